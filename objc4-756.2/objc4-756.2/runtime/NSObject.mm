@@ -323,8 +323,14 @@ storeWeak(id *location, objc_object *newObj)
     }
 
     // Clean up old value, if any.
-    if (haveOld) {
-        weak_unregister_no_lock(&oldTable->weak_table, oldObj, location);
+    // If the old value is deallocating and its weak pointers are being 
+    // cleared outside the lock, wait until this one has been cleared.
+    if (haveOld  &&  
+        !weak_unregister_no_lock(&oldTable->weak_table, oldObj, location)) 
+    {
+        SideTable::unlockTwo<haveOld, haveNew>(oldTable, newTable);
+        sched_yield();
+        goto retry;
     }
 
     // Assign new value, if any.
@@ -465,6 +471,28 @@ objc_loadWeakRetained(id *location)
     Class cls;
 
     SideTable *table;
+
+    if (fastpath(!DisableLockFreeWeakLoads)) {
+        // Fast case: retain without the side table lock.
+        // The load count keeps obj's memory from being freed: 
+        // weakly referenced objects clear their weak references and 
+        // then wait for the loads counted in their side table.
+        obj = *location;
+        if (!obj) return nil;
+        if (obj->isTaggedPointer()) return obj;
+
+        table = &SideTables()[obj];
+        weak_beginLockFreeLoad(&table->weak_table);
+        bool retained = 
+            obj == __c11_atomic_load((_Atomic(id) *)location, 
+                                     __ATOMIC_RELAXED)  &&  
+            ! obj->ISA()->hasCustomRR()  &&  
+            obj->rootTryRetainWithoutSideTable();
+        weak_endLockFreeLoad(&table->weak_table);
+        if (retained) return obj;
+        // Changed, deallocating, raw isa, custom RR, or retain count 
+        // overflow. Use the locked path.
+    }
     
  retry:
     // fixme std::atomic this load
@@ -597,6 +625,41 @@ objc_moveWeak(id *dst, id *src)
 BREAKPOINT_FUNCTION(void objc_autoreleaseNoPool(id obj));
 BREAKPOINT_FUNCTION(void objc_autoreleasePoolInvalid(const void *token));
 
+// Pages freed by any thread are kept here for reuse 
+// when OBJC_RESERVE_POOL_PAGES is set. 
+// The first page of each reserved page links to the next.
+spinlock_t PoolPageReserveLock;
+static void *PoolPageReserve;
+static size_t PoolPageReserveCount;
+static bool PoolPageReservePrefaulted;
+
+// Page allocation statistics for 
+// _objc_getAutoreleasePoolPageStatistics and OBJC_PRINT_POOL_HIGHWATER.
+static size_t PoolPagesFresh;
+static size_t PoolPagesReused;
+static size_t PoolPagesFromReserve;
+static size_t PoolPagesFreed;
+
+static inline void countPoolPages(size_t& counter)
+{
+    __c11_atomic_fetch_add((_Atomic(size_t) *)&counter, 1, 
+                           __ATOMIC_RELAXED);
+}
+
+// Return value statistics for _objc_getReturnValueStatistics. 
+// Recorded only when OBJC_DEBUG_RETURN_STATISTICS is set.
+static size_t ReturnsOptimized;
+static size_t ReturnsClaimed;
+static size_t ReturnsAutoreleased;
+
+static ALWAYS_INLINE void countReturns(size_t& counter)
+{
+    if (slowpath(DebugReturnStatistics)) {
+        __c11_atomic_fetch_add((_Atomic(size_t) *)&counter, 1, 
+                               __ATOMIC_RELAXED);
+    }
+}
+
 namespace {
 
 struct magic_t {
@@ -646,6 +709,13 @@ class AutoreleasePoolPage
     // never uses them.
 #   define EMPTY_POOL_PLACEHOLDER ((id*)1)
 
+    // CLAIMABLE_RETURN_PARKED is set in the same TLS word while 
+    // RETURN_CLAIMABLE_KEY holds a parked return value, so the pool 
+    // entry points check for one without reading another TLS slot. 
+    // Pages are SIZE-aligned and EMPTY_POOL_PLACEHOLDER is 1, 
+    // so this bit is otherwise always clear.
+#   define CLAIMABLE_RETURN_PARKED ((uintptr_t)2)
+
 #   define POOL_BOUNDARY nil
     static pthread_key_t const key = AUTORELEASE_POOL_KEY;
     static uint8_t const SCRIBBLE = 0xA3;  // 0xA3A3A3A3 after releasing
@@ -657,6 +727,19 @@ class AutoreleasePoolPage
 #endif
     static size_t const COUNT = SIZE / sizeof(id);
 
+    // releaseUntil() pops up to RELEASE_BATCH objects at a time, 
+    // and prefetches objects RELEASE_PREFETCH slots ahead.
+    static size_t const RELEASE_BATCH = 128;
+    static size_t const RELEASE_PREFETCH = 8;
+
+    // pop() keeps up to PAGE_CACHE_MAX empty pages past the hot page 
+    // for the thread's next burst of autoreleases.
+    // The reserve holds up to PAGE_RESERVE_MAX pages, 
+    // and its first use prefaults PAGE_RESERVE_PREFAULT pages.
+    static uint32_t const PAGE_CACHE_MAX = 8;
+    static size_t const PAGE_RESERVE_MAX = 64;
+    static size_t const PAGE_RESERVE_PREFAULT = 16;
+
     magic_t const magic;
     id *next;
     pthread_t const thread;
@@ -664,16 +747,66 @@ class AutoreleasePoolPage
     AutoreleasePoolPage *child;
     uint32_t const depth;
     uint32_t hiwat;
+    uint32_t deepest;  // deepest page used recently; valid in the cold page
 
     // SIZE-sizeof(*this) bytes of contents follow
 
     static void * operator new(size_t size) {
+        if (void *page = takeReservedPage()) return page;
+        countPoolPages(PoolPagesFresh);
         return malloc_zone_memalign(malloc_default_zone(), SIZE, SIZE);
     }
     static void operator delete(void * p) {
+        if (reservePage(p)) return;
+        countPoolPages(PoolPagesFreed);
         return free(p);
     }
 
+    static void *takeReservedPage()
+    {
+        if (!ReservePoolPages) return nil;
+        if (!PoolPageReservePrefaulted) prefaultReserve();
+
+        mutex_locker_t lock(PoolPageReserveLock);
+        void *page = PoolPageReserve;
+        if (page) {
+            PoolPageReserve = *(void **)page;
+            PoolPageReserveCount--;
+            countPoolPages(PoolPagesFromReserve);
+        }
+        return page;
+    }
+
+    static bool reservePage(void *page)
+    {
+        if (!ReservePoolPages) return false;
+
+        mutex_locker_t lock(PoolPageReserveLock);
+        if (PoolPageReserveCount >= PAGE_RESERVE_MAX) return false;
+        *(void **)page = PoolPageReserve;
+        PoolPageReserve = page;
+        PoolPageReserveCount++;
+        return true;
+    }
+
+    static __attribute__((noinline)) void prefaultReserve()
+    {
+        // Racy. At worst two threads both prefault 
+        // and the reserve limit turns away the excess.
+        PoolPageReservePrefaulted = true;
+        for (size_t i = 0; i < PAGE_RESERVE_PREFAULT; i++) {
+            void *page = malloc_zone_memalign(malloc_default_zone(), SIZE, SIZE);
+            if (!page) break;
+            bzero(page, SIZE);  // touch every vm page now, not later
+            countPoolPages(PoolPagesFresh);
+            if (!reservePage(page)) {
+                countPoolPages(PoolPagesFreed);
+                free(page);
+                break;
+            }
+        }
+    }
+
     inline void protect() {
 #if PROTECT_AUTORELEASEPOOL
         mprotect(this, SIZE, PROT_READ);
@@ -692,7 +825,7 @@ class AutoreleasePoolPage
         : magic(), next(begin()), thread(pthread_self()),
           parent(newParent), child(nil), 
           depth(parent ? 1+parent->depth : 0), 
-          hiwat(parent ? parent->hiwat : 0)
+          hiwat(parent ? parent->hiwat : 0), deepest(depth)
     { 
         if (parent) {
             parent->check();
@@ -785,11 +918,98 @@ class AutoreleasePoolPage
         releaseUntil(begin());
     }
 
+    // Release a run of count references to obj. 
+    // Runs of the same object become a single retain count update 
+    // when that cannot deallocate it.
+    static void releaseRun(id obj, size_t count) 
+    {
+        if (obj->isTaggedPointer()) return;
+        if (count > 1  &&  !obj->ISA()->hasCustomRR()  &&  
+            obj->rootTryReleaseWithoutDealloc(count)) 
+        {
+            return;
+        }
+        while (count--) objc_release(obj);
+    }
+
+    // Release objects popped from a page, last one first.
+    static void releaseBatch(id *batch, size_t count) 
+    {
+        size_t i = count;
+        while (i > 0) {
+            id obj = batch[--i];
+            if (i >= RELEASE_PREFETCH) {
+                // Start loading an upcoming object's isa.
+                // Prefetching nil or a tagged pointer is harmless.
+                __builtin_prefetch((void *)batch[i - RELEASE_PREFETCH]);
+            }
+            if (obj == POOL_BOUNDARY) continue;
+
+            size_t run = 1;
+            while (i > 0  &&  batch[i-1] == obj) {
+                i--;
+                run++;
+            }
+            releaseRun(obj, run);
+        }
+    }
+
     void releaseUntil(id *stop) 
     {
         // Not recursive: we don't want to blow out the stack 
         // if a thread accumulates a stupendous amount of garbage
         
+        do {
+            if (DisableBatchedPoolDrain) {
+                releaseOneByOneUntil(stop);
+            } else {
+                releaseBatchesUntil(stop);
+            }
+            // A -dealloc may have parked a return value meanwhile. 
+            // It belongs to this pool, not to the one that is hot next.
+        } while (flushClaimableReturn());
+
+        setHotPage(this);
+
+#if DEBUG
+        // we expect any children to be completely empty
+        for (AutoreleasePoolPage *page = child; page; page = page->child) {
+            assert(page->empty());
+        }
+#endif
+    }
+
+    void releaseBatchesUntil(id *stop) 
+    {
+        while (this->next != stop) {
+            // Restart from hotPage() after every batch, in case -release 
+            // autoreleased more objects. Objects below the batch stay 
+            // on the page, so nothing autoreleased meanwhile is lost.
+            AutoreleasePoolPage *page = hotPage();
+
+            while (page->empty()) {
+                page = page->parent;
+                setHotPage(page);
+            }
+
+            id *low = (page == this) ? stop : page->begin();
+            size_t count = MIN((size_t)(page->next - low), 
+                               (size_t)RELEASE_BATCH);
+            id batch[RELEASE_BATCH];
+
+            page->unprotect();
+            page->next -= count;
+            memcpy(batch, page->next, count * sizeof(id));
+            memset((void*)page->next, SCRIBBLE, count * sizeof(id));
+            page->protect();
+
+            releaseBatch(batch, count);
+        }
+    }
+
+    // The unbatched drain, for OBJC_DISABLE_BATCHED_POOL_DRAIN.
+    void releaseOneByOneUntil(id *stop) 
+    {
         while (this->next != stop) {
             // Restart from hotPage() every time, in case -release 
             // autoreleased more objects
@@ -810,15 +1030,6 @@ class AutoreleasePoolPage
                 objc_release(obj);
             }
         }
-
-        setHotPage(this);
-
-#if DEBUG
-        // we expect any children to be completely empty
-        for (AutoreleasePoolPage *page = child; page; page = page->child) {
-            assert(page->empty());
-        }
-#endif
     }
 
     void kill() 
@@ -843,13 +1054,18 @@ class AutoreleasePoolPage
 
     static void tls_dealloc(void *p) 
     {
-        if (p == (void*)EMPTY_POOL_PLACEHOLDER) {
+        uintptr_t pages = (uintptr_t)p & ~CLAIMABLE_RETURN_PARKED;
+        if (!pages  ||  pages == (uintptr_t)EMPTY_POOL_PLACEHOLDER) {
             // No objects or pool pages to clean up here.
+            // A parked return value is handled by claimable_dealloc.
             return;
         }
 
         // reinstate TLS value while we work
-        setHotPage((AutoreleasePoolPage *)p);
+        setPoolTLS((uintptr_t)p);
+
+        // include a parked return value in the final pop
+        flushClaimableReturn();
 
         if (AutoreleasePoolPage *page = coldPage()) {
             if (!page->empty()) pop(page->begin());  // pop all of the pools
@@ -861,7 +1077,7 @@ class AutoreleasePoolPage
         }
         
         // clear TLS value so TLS destruction doesn't loop
-        setHotPage(nil);
+        setPoolTLS(0);
     }
 
     static AutoreleasePoolPage *pageForPointer(const void *p) 
@@ -883,23 +1099,36 @@ class AutoreleasePoolPage
     }
 
 
+    // The raw TLS word: the hot page or EMPTY_POOL_PLACEHOLDER or nil, 
+    // plus CLAIMABLE_RETURN_PARKED.
+    static ALWAYS_INLINE uintptr_t poolTLS()
+    {
+        return (uintptr_t)tls_get_direct(key);
+    }
+
+    static ALWAYS_INLINE void setPoolTLS(uintptr_t tls)
+    {
+        tls_set_direct(key, (void *)tls);
+    }
+
     static inline bool haveEmptyPoolPlaceholder()
     {
-        id *tls = (id *)tls_get_direct(key);
+        id *tls = (id *)(poolTLS() & ~CLAIMABLE_RETURN_PARKED);
         return (tls == EMPTY_POOL_PLACEHOLDER);
     }
 
     static inline id* setEmptyPoolPlaceholder()
     {
-        assert(tls_get_direct(key) == nil);
-        tls_set_direct(key, (void *)EMPTY_POOL_PLACEHOLDER);
+        uintptr_t tls = poolTLS();
+        assert((tls & ~CLAIMABLE_RETURN_PARKED) == 0);
+        setPoolTLS((uintptr_t)EMPTY_POOL_PLACEHOLDER | tls);
         return EMPTY_POOL_PLACEHOLDER;
     }
 
     static inline AutoreleasePoolPage *hotPage() 
     {
         AutoreleasePoolPage *result = (AutoreleasePoolPage *)
-            tls_get_direct(key);
+            (poolTLS() & ~CLAIMABLE_RETURN_PARKED);
         if ((id *)result == EMPTY_POOL_PLACEHOLDER) return nil;
         if (result) result->fastcheck();
         return result;
@@ -908,7 +1137,7 @@ class AutoreleasePoolPage
     static inline void setHotPage(AutoreleasePoolPage *page) 
     {
         if (page) page->fastcheck();
-        tls_set_direct(key, (void *)page);
+        setPoolTLS((uintptr_t)page | (poolTLS() & CLAIMABLE_RETURN_PARKED));
     }
 
     static inline AutoreleasePoolPage *coldPage() 
@@ -924,6 +1153,31 @@ class AutoreleasePoolPage
     }
 
 
+#if SUPPORT_RETURN_AUTORELEASE
+    // Thread exit with a parked return value and no pool pages.
+    // Autoreleasing it reinstates the pool TLS, whose destructor 
+    // then releases it.
+    static void claimable_dealloc(void *p)
+    {
+        setPoolTLS(poolTLS() & ~CLAIMABLE_RETURN_PARKED);
+        countReturns(ReturnsAutoreleased);
+        autoreleaseFast((id)p);
+    }
+
+    static __attribute__((noinline))
+    bool flushParkedReturn(uintptr_t tls)
+    {
+        setPoolTLS(tls & ~CLAIMABLE_RETURN_PARKED);
+        id parked = getClaimableReturn();
+        // Nothing is parked if claimable_dealloc ran already.
+        if (!parked) return false;
+        setClaimableReturn(nil);
+        countReturns(ReturnsAutoreleased);
+        autoreleaseFast(parked);
+        return true;
+    }
+#endif
+
     static inline id *autoreleaseFast(id obj)
     {
         AutoreleasePoolPage *page = hotPage();
@@ -946,10 +1200,14 @@ class AutoreleasePoolPage
         assert(page->full()  ||  DebugPoolAllocation);
 
         do {
-            if (page->child) page = page->child;
+            if (page->child) {
+                page = page->child;
+                countPoolPages(PoolPagesReused);
+            }
             else page = new AutoreleasePoolPage(page);
         } while (page->full());
 
+        page->noteDepth();
         setHotPage(page);
         return page->add(obj);
     }
@@ -1012,10 +1270,48 @@ class AutoreleasePoolPage
     }
 
 public:
+    // Autorelease the return value parked for a claim by its caller, 
+    // if any. Called before anything that pushes, pops, or adds to 
+    // the pool, so the parked object lands in the pool that was hot 
+    // when it was returned. Returns true if anything was parked.
+    static ALWAYS_INLINE bool flushClaimableReturn()
+    {
+#if SUPPORT_RETURN_AUTORELEASE
+        uintptr_t tls = poolTLS();
+        if (slowpath(tls & CLAIMABLE_RETURN_PARKED)) {
+            return flushParkedReturn(tls);
+        }
+#endif
+        return false;
+    }
+
+#if SUPPORT_RETURN_AUTORELEASE
+    // Park obj at +1 for a claim by the caller, 
+    // autoreleasing whatever was parked before.
+    static ALWAYS_INLINE void parkReturn(id obj)
+    {
+        flushClaimableReturn();
+        setClaimableReturn(obj);
+        setPoolTLS(poolTLS() | CLAIMABLE_RETURN_PARKED);
+    }
+
+    // Take the parked return value if it is obj.
+    static ALWAYS_INLINE bool claimReturn(id obj)
+    {
+        uintptr_t tls = poolTLS();
+        if (fastpath(!(tls & CLAIMABLE_RETURN_PARKED))) return false;
+        if (getClaimableReturn() != obj) return false;
+        setClaimableReturn(nil);
+        setPoolTLS(tls & ~CLAIMABLE_RETURN_PARKED);
+        return true;
+    }
+#endif
+
     static inline id autorelease(id obj)
     {
         assert(obj);
         assert(!obj->isTaggedPointer());
+        flushClaimableReturn();
         id *dest __unused = autoreleaseFast(obj);
         assert(!dest  ||  dest == EMPTY_POOL_PLACEHOLDER  ||  *dest == obj);
         return obj;
@@ -1025,6 +1321,7 @@ public:
     static inline void *push() 
     {
         id *dest;
+        flushClaimableReturn();
         if (DebugPoolAllocation) {
             // Each autorelease pool starts on a new pool page.
             dest = autoreleaseNewPage(POOL_BOUNDARY);
@@ -1065,6 +1362,8 @@ public:
         AutoreleasePoolPage *page;
         id *stop;
 
+        flushClaimableReturn();
+
         if (token == (void*)EMPTY_POOL_PLACEHOLDER) {
             // Popping the top-level placeholder pool.
             if (hotPage()) {
@@ -1109,14 +1408,50 @@ public:
             setHotPage(nil);
         } 
         else if (page->child) {
-            // hysteresis: keep one empty child if page is more than half full
-            if (page->lessThanHalfFull()) {
-                page->child->kill();
-            }
-            else if (page->child->child) {
-                page->child->child->kill();
-            }
+            page->trimChildren();
+        }
+    }
+
+    // Record this page's depth in the cold page's recent deepest mark.
+    void noteDepth()
+    {
+        AutoreleasePoolPage *cold = this;
+        while (cold->parent) cold = cold->parent;
+        if (depth > cold->deepest) {
+            cold->unprotect();
+            cold->deepest = depth;
+            cold->protect();
+        }
+    }
+
+    // Free the empty children of this page, except for enough of them 
+    // to reach the recent deepest page again, up to PAGE_CACHE_MAX.
+    // If none are needed for that but this page is at least half full, 
+    // keep one child anyway so the next few autoreleases do not 
+    // allocate a page right away.
+    // The deepest mark halves whenever the outermost pool drains, 
+    // so pages used by one burst are freed after a few quieter cycles.
+    void trimChildren()
+    {
+        AutoreleasePoolPage *cold = this;
+        while (cold->parent) cold = cold->parent;
+
+        uint32_t mark = cold->deepest;
+        if (cold->empty()) {
+            cold->unprotect();
+            cold->deepest = mark / 2;
+            cold->protect();
+        }
+
+        uint32_t keep = mark > depth ? mark - depth : 0;
+        if (keep > PAGE_CACHE_MAX) keep = PAGE_CACHE_MAX;
+        if (keep == 0  &&  !lessThanHalfFull()) keep = 1;
+
+        AutoreleasePoolPage *last = this;
+        for (uint32_t i = 0; i < keep  &&  last->child; i++) {
+            last = last->child;
         }
+        if (last->child) last->child->kill();
     }
 
     static void init()
@@ -1124,6 +1459,11 @@ public:
         int r __unused = pthread_key_init_np(AutoreleasePoolPage::key, 
                                              AutoreleasePoolPage::tls_dealloc);
         assert(r == 0);
+#if SUPPORT_RETURN_AUTORELEASE
+        r = pthread_key_init_np(RETURN_CLAIMABLE_KEY, 
+                                AutoreleasePoolPage::claimable_dealloc);
+        assert(r == 0);
+#endif
     }
 
     void print() 
@@ -1170,6 +1510,71 @@ public:
         _objc_inform("##############");
     }
 
+    // Summarize the calling thread's pools for 
+    // _objc_copyAutoreleasePoolInfo(). Pages are only touched 
+    // by their own thread, so no lock is needed.
+    // A parked return value is reported but left parked.
+    static struct objc_autorelease_pool_class_count *
+    copyInfo(struct objc_autorelease_pool_info *info, unsigned int *outCount)
+    {
+        objc::DenseMap<Class, size_t> counts;
+        unsigned int pools = haveEmptyPoolPlaceholder() ? 1 : 0;
+        unsigned int pages = 0;
+        unsigned int keptPages = 0;
+        size_t entries = 0;
+
+        for (AutoreleasePoolPage *page = coldPage(); page; page = page->child) {
+            if (page->empty()) {
+                keptPages++;
+                continue;
+            }
+            pages++;
+            for (id *p = page->begin(); p < page->next; p++) {
+                if (*p == POOL_BOUNDARY) {
+                    pools++;
+                } else {
+                    entries++;
+                    counts[(*p)->getIsa()]++;
+                }
+            }
+        }
+
+        if (info) {
+            info->pools = pools;
+            info->pages = pages;
+            info->keptPages = keptPages;
+            info->entries = entries;
+            info->parkedReturns = 0;
+            if (poolTLS() & CLAIMABLE_RETURN_PARKED) info->parkedReturns = 1;
+
+            // Every page was counted fresh once when it was allocated. 
+            // Pages taken from the reserve are not new pages.
+            mutex_locker_t lock(PoolPageReserveLock);
+            info->allThreadsPages = 
+                PoolPagesFresh - PoolPagesFreed - PoolPageReserveCount;
+        }
+
+        struct objc_autorelease_pool_class_count *result = nil;
+        unsigned int count = 0;
+        if (counts.size() > 0) {
+            result = (struct objc_autorelease_pool_class_count *)
+                calloc(counts.size(), sizeof(*result));
+            for (auto& pair : counts) {
+                result[count].cls = pair.first;
+                result[count].count = pair.second;
+                count++;
+            }
+            std::stable_sort(result, result + count, 
+                             [](const struct objc_autorelease_pool_class_count& a, 
+                                const struct objc_autorelease_pool_class_count& b) {
+                return a.count > b.count;
+            });
+        }
+
+        if (outCount) *outCount = count;
+        return result;
+    }
+
     static void printHiwat()
     {
         // Check and propagate high water mark
@@ -1186,6 +1591,10 @@ public:
             _objc_inform("POOL HIGHWATER: new high water mark of %u "
                          "pending releases for thread %p:", 
                          mark, pthread_self());
+            _objc_inform("POOL HIGHWATER: pages allocated %zu, "
+                         "reused %zu, from reserve %zu, freed %zu", 
+                         PoolPagesFresh, PoolPagesReused, 
+                         PoolPagesFromReserve, PoolPagesFreed);
             
             void *stack[128];
             int count = backtrace(stack, sizeof(stack)/sizeof(stack[0]));
@@ -1198,12 +1607,34 @@ public:
     }
 
 #undef POOL_BOUNDARY
+#undef CLAIMABLE_RETURN_PARKED
 };
 
 // anonymous namespace
 };
 
 
+/***********************************************************************
+* weak_clearDetached
+* Finish clearing the weak pointers of a deallocating object 
+* after weak_clear_no_lock() and after the side table is unlocked.
+* Weak pointers detached into sweep are cleared without the lock.
+* Then wait for lock-free weak loads of objects in this side table.
+**********************************************************************/
+static void
+weak_clearDetached(SideTable& table, id referent, weak_sweep_t& sweep)
+{
+    if (sweep.referrers) {
+        weak_sweep(referent, &sweep);
+        table.lock();
+        weak_sweep_finish_no_lock(&table.weak_table, referent);
+        table.unlock();
+    }
+
+    weak_waitForLockFreeLoads(&table.weak_table);
+}
+
+
 /***********************************************************************
 * Slow paths for inline control
 **********************************************************************/
@@ -1234,14 +1665,18 @@ objc_object::clearDeallocating_slow()
     assert(isa.nonpointer  &&  (isa.weakly_referenced || isa.has_sidetable_rc));
 
     SideTable& table = SideTables()[this];
+    bool weaklyReferenced = isa.weakly_referenced;
+    weak_sweep_t sweep = { nil, 0 };
     table.lock();
-    if (isa.weakly_referenced) {
-        weak_clear_no_lock(&table.weak_table, (id)this);
+    if (weaklyReferenced) {
+        weak_clear_no_lock(&table.weak_table, (id)this, &sweep);
     }
     if (isa.has_sidetable_rc) {
         table.refcnts.erase(this);
     }
     table.unlock();
+
+    if (weaklyReferenced) weak_clearDetached(table, (id)this, sweep);
 }
 
 #endif
@@ -1411,12 +1846,233 @@ objc_object::sidetable_getExtraRC_nolock()
 #endif
 
 
+/***********************************************************************
+* Deferred side table releases
+* Objects whose retain count lives entirely in a side table take the 
+* side table's spinlock on every retain and release. For objects shared 
+* by many threads that lock is heavily contended. 
+* 
+* With OBJC_DEFER_SIDETABLE_RELEASES set, each thread keeps a small 
+* buffer of objects with large side table retain counts. A release of 
+* a buffered object is counted in the buffer instead of the side table, 
+* and a retain of a buffered object with deferred releases cancels one 
+* of them. Deferred releases are applied to the side table in one batch 
+* when the buffer needs the slot, when a slot's count gets large, when 
+* an autorelease pool is popped, when the thread asks for the object's 
+* retain count, and when the thread exits.
+* 
+* A deferred release is still counted in the side table, so an object 
+* is never deallocated while a release of it is deferred. The cost is 
+* that deallocation of an object whose last release was deferred is 
+* delayed until that release is applied.
+**********************************************************************/
+
+#define DEFERRED_RELEASE_SLOTS 8
+
+// Objects are buffered only if they have at least this many 
+// side table retains after a release.
+#define DEFERRED_RELEASE_MIN_RC 16
+
+// A slot is applied to the side table when it holds this many releases.
+#define DEFERRED_RELEASE_MAX_COUNT 1024
+
+struct deferred_release_buffer_t {
+    struct {
+        objc_object *obj;
+        size_t count;
+    } slots[DEFERRED_RELEASE_SLOTS];
+    unsigned nextVictim;
+};
+
+static deferred_release_buffer_t *
+deferredReleaseBuffer(bool create)
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(create);
+    if (!data) return nil;
+    if (!data->deferredReleases  &&  create) {
+        data->deferredReleases = (deferred_release_buffer_t *)
+            calloc(1, sizeof(deferred_release_buffer_t));
+    }
+    return data->deferredReleases;
+}
+
+static int
+deferredReleaseSlot(deferred_release_buffer_t *buffer, objc_object *obj)
+{
+    for (int i = 0; i < DEFERRED_RELEASE_SLOTS; i++) {
+        if (buffer->slots[i].obj == obj) return i;
+    }
+    return -1;
+}
+
+// Apply count deferred releases of obj to its side table.
+// All but the last cannot be the final release, because 
+// each deferred release is still counted in the side table.
+static void
+applyDeferredReleases(objc_object *obj, size_t count)
+{
+    assert(count > 0);
+
+    SideTable& table = SideTables()[obj];
+
+    bool do_dealloc = false;
+
+    table.lock();
+    size_t& refcnt = table.refcnts[obj];
+    if (! (refcnt & SIDE_TABLE_RC_PINNED)) {
+        assert((refcnt >> SIDE_TABLE_RC_SHIFT) >= count - 1);
+        refcnt -= (count - 1) << SIDE_TABLE_RC_SHIFT;
+        if (refcnt < SIDE_TABLE_DEALLOCATING) {
+            // SIDE_TABLE_WEAKLY_REFERENCED may be set. Don't change it.
+            do_dealloc = true;
+            refcnt |= SIDE_TABLE_DEALLOCATING;
+        } else {
+            refcnt -= SIDE_TABLE_RC_ONE;
+        }
+    }
+    table.unlock();
+
+    if (do_dealloc) {
+        ((void(*)(objc_object *, SEL))objc_msgSend)(obj, SEL_dealloc);
+    }
+}
+
+// Remove a slot from the buffer and apply its deferred releases.
+static void
+flushDeferredReleaseSlot(deferred_release_buffer_t *buffer, int i)
+{
+    objc_object *obj = buffer->slots[i].obj;
+    size_t count = buffer->slots[i].count;
+
+    // Empty the slot first. A deallocation below may release 
+    // other objects, or retain and release obj itself.
+    buffer->slots[i].obj = nil;
+    buffer->slots[i].count = 0;
+
+    if (count > 0) applyDeferredReleases(obj, count);
+}
+
+static void
+flushDeferredReleases(deferred_release_buffer_t *buffer)
+{
+    // Deallocations may defer more releases while we work.
+    bool again;
+    do {
+        again = false;
+        for (int i = 0; i < DEFERRED_RELEASE_SLOTS; i++) {
+            if (buffer->slots[i].count > 0) {
+                flushDeferredReleaseSlot(buffer, i);
+                again = true;
+            }
+        }
+    } while (again);
+}
+
+// Apply this thread's deferred releases of obj, if any.
+static void
+flushDeferredReleases(objc_object *obj)
+{
+    deferred_release_buffer_t *buffer = deferredReleaseBuffer(false);
+    if (!buffer) return;
+    int i = deferredReleaseSlot(buffer, obj);
+    if (i >= 0) flushDeferredReleaseSlot(buffer, i);
+}
+
+// Returns true if this release of obj was deferred.
+static bool
+deferRelease(objc_object *obj)
+{
+    deferred_release_buffer_t *buffer = deferredReleaseBuffer(false);
+    if (!buffer) return false;
+    int i = deferredReleaseSlot(buffer, obj);
+    if (i < 0) return false;
+
+    if (++buffer->slots[i].count == DEFERRED_RELEASE_MAX_COUNT) {
+        flushDeferredReleaseSlot(buffer, i);
+    }
+    return true;
+}
+
+// Returns true if this retain of obj cancelled a deferred release.
+static bool
+cancelDeferredRelease(objc_object *obj)
+{
+    deferred_release_buffer_t *buffer = deferredReleaseBuffer(false);
+    if (!buffer) return false;
+    int i = deferredReleaseSlot(buffer, obj);
+    if (i < 0  ||  buffer->slots[i].count == 0) return false;
+
+    buffer->slots[i].count--;
+    return true;
+}
+
+// Start deferring this thread's releases of obj.
+static void
+admitDeferredRelease(objc_object *obj)
+{
+    deferred_release_buffer_t *buffer = deferredReleaseBuffer(true);
+    if (!buffer) return;
+    if (deferredReleaseSlot(buffer, obj) >= 0) return;
+
+    // Use an empty slot, or a slot with no deferred releases, 
+    // or evict the slots in turn.
+    int victim = deferredReleaseSlot(buffer, nil);
+    for (int i = 0; victim < 0  &&  i < DEFERRED_RELEASE_SLOTS; i++) {
+        if (buffer->slots[i].count == 0) victim = i;
+    }
+    if (victim < 0) {
+        victim = buffer->nextVictim;
+        buffer->nextVictim = (victim + 1) % DEFERRED_RELEASE_SLOTS;
+        flushDeferredReleaseSlot(buffer, victim);
+        // The flush may have deallocated objects that refilled the slot.
+        if (buffer->slots[victim].obj) return;
+    }
+
+    buffer->slots[victim].obj = obj;
+    buffer->slots[victim].count = 0;
+}
+
+// Stop deferring this thread's releases of obj, which is deallocating.
+// Its slot has no deferred releases, or obj could not be deallocating.
+static void
+forgetDeferredRelease(objc_object *obj)
+{
+    deferred_release_buffer_t *buffer = deferredReleaseBuffer(false);
+    if (!buffer) return;
+    int i = deferredReleaseSlot(buffer, obj);
+    if (i < 0) return;
+
+    assert(buffer->slots[i].count == 0);
+    buffer->slots[i].obj = nil;
+}
+
+// Apply all of this thread's deferred releases.
+static void
+flushDeferredReleases(void)
+{
+    deferred_release_buffer_t *buffer = deferredReleaseBuffer(false);
+    if (buffer) flushDeferredReleases(buffer);
+}
+
+void
+_destroyDeferredReleaseBuffer(deferred_release_buffer_t *buffer)
+{
+    if (!buffer) return;
+    flushDeferredReleases(buffer);
+    free(buffer);
+}
+
+
 id
 objc_object::sidetable_retain()
 {
 #if SUPPORT_NONPOINTER_ISA
     assert(!isa.nonpointer);
 #endif
+    if (slowpath(DeferSideTableReleases)  &&  cancelDeferredRelease(this)) {
+        return (id)this;
+    }
+
     SideTable& table = SideTables()[this];
     
     table.lock();
@@ -1464,6 +2120,8 @@ objc_object::sidetable_tryRetain()
 uintptr_t
 objc_object::sidetable_retainCount()
 {
+    if (slowpath(DeferSideTableReleases)) flushDeferredReleases(this);
+
     SideTable& table = SideTables()[this];
 
     size_t refcnt_result = 1;
@@ -1540,9 +2198,13 @@ objc_object::sidetable_release(bool performDealloc)
 #if SUPPORT_NONPOINTER_ISA
     assert(!isa.nonpointer);
 #endif
+    bool deferring = slowpath(DeferSideTableReleases)  &&  performDealloc;
+    if (deferring  &&  deferRelease(this)) return 0;
+
     SideTable& table = SideTables()[this];
 
     bool do_dealloc = false;
+    bool admit = false;
 
     table.lock();
     RefcountMap::iterator it = table.refcnts.find(this);
@@ -1555,8 +2217,15 @@ objc_object::sidetable_release(bool performDealloc)
         it->second |= SIDE_TABLE_DEALLOCATING;
     } else if (! (it->second & SIDE_TABLE_RC_PINNED)) {
         it->second -= SIDE_TABLE_RC_ONE;
+        admit = deferring  &&  
+            !(it->second & SIDE_TABLE_DEALLOCATING)  &&  
+            (it->second >> SIDE_TABLE_RC_SHIFT) >= DEFERRED_RELEASE_MIN_RC;
     }
     table.unlock();
+    if (slowpath(admit)) admitDeferredRelease(this);
+    if (do_dealloc  &&  slowpath(DeferSideTableReleases)) {
+        forgetDeferredRelease(this);
+    }
     if (do_dealloc  &&  performDealloc) {
         ((void(*)(objc_object *, SEL))objc_msgSend)(this, SEL_dealloc);
     }
@@ -1572,15 +2241,20 @@ objc_object::sidetable_clearDeallocating()
     // clear any weak table items
     // clear extra retain count and deallocating bit
     // (fixme warn or abort if extra retain count == 0 ?)
+    bool weaklyReferenced = false;
+    weak_sweep_t sweep = { nil, 0 };
     table.lock();
     RefcountMap::iterator it = table.refcnts.find(this);
     if (it != table.refcnts.end()) {
         if (it->second & SIDE_TABLE_WEAKLY_REFERENCED) {
-            weak_clear_no_lock(&table.weak_table, (id)this);
+            weaklyReferenced = true;
+            weak_clear_no_lock(&table.weak_table, (id)this, &sweep);
         }
         table.refcnts.erase(it);
     }
     table.unlock();
+
+    if (weaklyReferenced) weak_clearDetached(table, (id)this, sweep);
 }
 
 
@@ -1729,7 +2403,10 @@ callAlloc(Class cls, bool checkNil, bool allocWithZone=false)
             //查看一下类是否有析构函数
             bool dtor = cls->hasCxxDtor();
             //分配内存，给obj对象
-            id obj = (id)calloc(1, cls->bits.fastInstanceSize());
+            size_t size = cls->bits.fastInstanceSize();
+            id obj = nil;
+            if (slowpath(AllocMagazines)) obj = (id)_objc_allocFromMagazine(size);
+            if (!obj) obj = (id)calloc(1, size);
             //如果分配失败，那么交给错误处理
             if (slowpath(!obj)) return callBadAllocHandler(cls);
             //初始化obj的isa
@@ -1831,6 +2508,7 @@ void
 objc_autoreleasePoolPop(void *ctxt)
 {
     AutoreleasePoolPage::pop(ctxt);
+    if (slowpath(DeferSideTableReleases)) flushDeferredReleases();
 }
 
 
@@ -1853,6 +2531,34 @@ _objc_autoreleasePoolPrint(void)
 }
 
 
+/***********************************************************************
+* _objc_copyAutoreleasePoolInfo
+* Returns the calling thread's pending autoreleased objects counted 
+* by class, most common class first, and fills info if it is not nil.
+* 
+* outCount may be nil. *outCount is the number of entries returned. 
+* If the returned array is not nil, it must be freed with free().
+**********************************************************************/
+struct objc_autorelease_pool_class_count *
+_objc_copyAutoreleasePoolInfo(struct objc_autorelease_pool_info *info, 
+                              unsigned int *outCount)
+{
+    return AutoreleasePoolPage::copyInfo(info, outCount);
+}
+
+void
+_objc_getAutoreleasePoolPageStatistics(struct objc_autorelease_pool_page_statistics *stats)
+{
+    stats->freshPages = PoolPagesFresh;
+    stats->reusedPages = PoolPagesReused;
+    stats->reservedPages = PoolPagesFromReserve;
+    stats->freedPages = PoolPagesFreed;
+
+    mutex_locker_t lock(PoolPageReserveLock);
+    stats->reserveCount = PoolPageReserveCount;
+}
+
+
 // Same as objc_release but suitable for tail-calling 
 // if you need the value back and don't want to push a frame before this point.
 __attribute__((noinline))
@@ -1873,11 +2579,48 @@ objc_retainAutoreleaseAndReturn(id obj)
 }
 
 
+// Park a value at +1 whose caller did not accept an optimized return, 
+// so the caller can still claim it. Returns false if obj must be 
+// autoreleased instead. See "Claimable returns" in objc-object.h.
+static ALWAYS_INLINE bool
+parkUnacceptedReturn(id obj)
+{
+#if SUPPORT_RETURN_AUTORELEASE
+    if (!DisableClaimableReturns  &&  obj  &&  !obj->isTaggedPointer()  &&  
+        !obj->ISA()->hasCustomRR()) 
+    {
+        AutoreleasePoolPage::parkReturn(obj);
+        return true;
+    }
+#endif
+    if (obj  &&  !obj->isTaggedPointer()) countReturns(ReturnsAutoreleased);
+    return false;
+}
+
+// Take the parked return value if it is obj. 
+// Returns true if the caller now owns the parked +1 reference.
+static ALWAYS_INLINE bool
+claimUnacceptedReturn(id obj)
+{
+#if SUPPORT_RETURN_AUTORELEASE
+    if (obj  &&  AutoreleasePoolPage::claimReturn(obj)) {
+        countReturns(ReturnsClaimed);
+        return true;
+    }
+#endif
+    return false;
+}
+
 // Prepare a value at +1 for return through a +0 autoreleasing convention.
 id 
 objc_autoreleaseReturnValue(id obj)
 {
-    if (prepareOptimizedReturn(ReturnAtPlus1)) return obj;
+    if (prepareOptimizedReturn(ReturnAtPlus1)) {
+        countReturns(ReturnsOptimized);
+        return obj;
+    }
+
+    if (parkUnacceptedReturn(obj)) return obj;
 
     return objc_autorelease(obj);
 }
@@ -1886,7 +2629,12 @@ objc_autoreleaseReturnValue(id obj)
 id 
 objc_retainAutoreleaseReturnValue(id obj)
 {
-    if (prepareOptimizedReturn(ReturnAtPlus0)) return obj;
+    if (prepareOptimizedReturn(ReturnAtPlus0)) {
+        countReturns(ReturnsOptimized);
+        return obj;
+    }
+
+    if (parkUnacceptedReturn(obj)) return objc_retain(obj);
 
     // not objc_autoreleaseReturnValue(objc_retain(obj)) 
     // because we don't need another optimization attempt
@@ -1899,6 +2647,8 @@ objc_retainAutoreleasedReturnValue(id obj)
 {
     if (acceptOptimizedReturn() == ReturnAtPlus1) return obj;
 
+    if (claimUnacceptedReturn(obj)) return obj;
+
     return objc_retain(obj);
 }
 
@@ -1906,11 +2656,23 @@ objc_retainAutoreleasedReturnValue(id obj)
 id
 objc_unsafeClaimAutoreleasedReturnValue(id obj)
 {
-    if (acceptOptimizedReturn() == ReturnAtPlus0) return obj;
+    if (acceptOptimizedReturn() == ReturnAtPlus0  &&  
+        !claimUnacceptedReturn(obj)) 
+    {
+        return obj;
+    }
 
     return objc_releaseAndReturn(obj);
 }
 
+void
+_objc_getReturnValueStatistics(struct objc_return_value_statistics *stats)
+{
+    stats->optimized = ReturnsOptimized;
+    stats->claimed = ReturnsClaimed;
+    stats->autoreleased = ReturnsAutoreleased;
+}
+
 id
 objc_retainAutorelease(id obj)
 {
@@ -324,7 +324,7 @@ static TrampolineBlockPageGroup *HeadPageGroup;
 #pragma mark Trampoline Management Functions
 static TrampolineBlockPageGroup *_allocateTrampolinesAndData()
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     vm_address_t dataAddress;
     
@@ -391,7 +391,7 @@ static TrampolineBlockPageGroup *_allocateTrampolinesAndData()
 static TrampolineBlockPageGroup *
 getOrAllocatePageGroupWithNextAvailable() 
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
     
     if (!HeadPageGroup)
         return _allocateTrampolinesAndData();
@@ -409,7 +409,7 @@ getOrAllocatePageGroupWithNextAvailable()
 static TrampolineBlockPageGroup *
 pageAndIndexContainingIMP(IMP anImp, uintptr_t *outIndex) 
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     // Authenticate as a function pointer, returning an un-signed address.
     uintptr_t trampAddress =
@@ -451,7 +451,7 @@ argumentModeForBlock(id block)
 IMP 
 _imp_implementationWithBlockNoCopy(id block)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     TrampolineBlockPageGroup *pageGroup = 
         getOrAllocatePageGroupWithNextAvailable();
@@ -496,7 +496,7 @@ IMP imp_implementationWithBlock(id block)
     // because it calls dlopen().
     Trampolines.Initialize();
     
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     return _imp_implementationWithBlockNoCopy(block);
 }
@@ -508,7 +508,7 @@ id imp_getBlock(IMP anImp) {
     
     if (!anImp) return nil;
     
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
     
     pageGroup = pageAndIndexContainingIMP(anImp, &index);
     
@@ -533,7 +533,7 @@ BOOL imp_removeBlock(IMP anImp) {
     id block;
     
     {
-        mutex_locker_t lock(runtimeLock);
+        rwlock_writer_t lock(runtimeLock);
     
         uintptr_t index;
         TrampolineBlockPageGroup *pageGroup =
@@ -10,7 +10,18 @@ extern IMP cache_getImp(Class cls, SEL sel);
 
 extern void cache_fill(Class cls, SEL sel, IMP imp, id receiver);
 
-extern void cache_erase_nolock(Class cls);
+extern uintptr_t cache_flushGeneration(void);
+
+extern bool cache_fill_unlessFlushed(Class cls, SEL sel, IMP imp, id receiver, 
+                                     uintptr_t generation);
+
+extern void cache_erase_nolock(Class cls, objc_cache_flush_cause cause);
+
+extern void cache_eraseSelectors_nolock(Class cls, const SEL *sels,
+                                        uint32_t count,
+                                        objc_cache_flush_cause cause);
+
+extern void cache_recordFlush(objc_cache_flush_cause cause);
 
 extern void cache_delete(Class cls);
 
@@ -71,6 +71,7 @@
  * flush_caches        (acquires lock)
  * cache_flush        (only called from cache_fill and flush_caches)
  * cache_collect_free (only called from cache_expand and cache_flush)
+ * cache_eraseSelectors_nolock (called from flushCaches; lock held)
  *
  * UNPROTECTED cache readers (NOT thread-safe; used for debug info only)
  * cache_print
@@ -84,6 +85,8 @@
 
 #include "objc-private.h"
 #include "objc-cache.h"
+#include "llvm-DenseMap.h"
+#include <algorithm>
 
 
 /* Initial cache bucket count. INIT_CACHE_SIZE must be a power of two. */
@@ -121,6 +124,62 @@ static void recordDeadCache(mask_t capacity)
     }
 }
 
+/***********************************************************************
+* Per-class cache statistics for OBJC_DEBUG_CACHE_STATISTICS
+* and objc_copyCacheStatistics(). 
+* Recorded by cache writers only, so objc_msgSend is unaffected. 
+* Cache hits are not counted; every fill is preceded by a miss.
+* Locking: cacheUpdateLock
+**********************************************************************/
+struct cache_stats_t {
+    size_t fills;
+    size_t expansions;
+    size_t flushes;
+    size_t probes;
+    mask_t maxProbe;
+    SEL maxProbeSel;
+    objc::DenseMap<SEL, size_t> fillsBySel;
+};
+
+// Allocated on first use to avoid a static constructor.
+static objc::DenseMap<Class, cache_stats_t> *cacheStats;
+
+static cache_stats_t& cacheStatsForClass(Class cls)
+{
+    cacheUpdateLock.assertLocked();
+    if (!cacheStats) cacheStats = new objc::DenseMap<Class, cache_stats_t>;
+    return (*cacheStats)[cls];
+}
+
+static void recordCacheFill(Class cls, SEL sel, mask_t probes)
+{
+    cache_stats_t& stats = cacheStatsForClass(cls);
+    stats.fills++;
+    stats.probes += probes;
+    if (probes > stats.maxProbe  ||  !stats.maxProbeSel) {
+        stats.maxProbe = probes;
+        stats.maxProbeSel = sel;
+    }
+    stats.fillsBySel[sel]++;
+}
+
+static void recordCacheExpansion(Class cls)
+{
+    cacheStatsForClass(cls).expansions++;
+}
+
+static void recordCacheFlush(Class cls)
+{
+    cacheStatsForClass(cls).flushes++;
+}
+
+static void forgetCacheStats(Class cls)
+{
+    cacheUpdateLock.assertLocked();
+    if (cacheStats) cacheStats->erase(cls);
+}
+
+
 /***********************************************************************
 * Pointers used by compiled class objects
 * These use asm to avoid conflicts with the compiler's internal declarations
@@ -242,6 +301,15 @@ ldp(uintptr_t& onep, uintptr_t& twop, const void *srcp)
 // Class points to cache. SEL is key. Cache buckets store SEL+IMP.
 // Caches are never built in the dyld shared cache.
 
+// Entries removed from a live cache keep their bucket, with this 
+// tombstone for a selector, so that a concurrent scan for a selector 
+// further along the same collision chain does not stop early. 
+// The tombstone is not 0 (an empty bucket), not 1 (the end marker), 
+// and never equal to a registered selector. Tombstones still count 
+// as occupied; they are dropped when the cache is reallocated.
+static const char cache_tombstone_name[] = "<removed cache entry>";
+#define CACHE_TOMBSTONE ((SEL)cache_tombstone_name)
+
 static inline mask_t cache_hash(SEL sel, mask_t mask) 
 {
     return (mask_t)(uintptr_t)sel & mask;
@@ -465,21 +533,71 @@ bool cache_t::canBeFreed()
 }
 
 
-void cache_t::reallocate(mask_t oldCapacity, mask_t newCapacity)
+// Copy the live entries of oldBuckets into newBuckets, rehashed for newMask.
+// newBuckets must be empty and not yet visible to objc_msgSend.
+// Returns the number of entries copied.
+static mask_t cache_migrate(bucket_t *oldBuckets, mask_t oldCapacity, 
+                            bucket_t *newBuckets, mask_t newMask)
+{
+    cacheUpdateLock.assertLocked();
+
+    mask_t count = 0;
+    for (mask_t i = 0; i < oldCapacity; i++) {
+        SEL sel = oldBuckets[i].sel();
+        if (sel == 0  ||  sel == CACHE_TOMBSTONE) continue;
+
+        mask_t j = cache_hash(sel, newMask);
+        while (newBuckets[j].sel() != 0) {
+            j = cache_next(j, newMask);
+        }
+        // NotAtomic is sufficient: setBucketsAndMask() orders 
+        // these stores before the new buckets are published.
+        newBuckets[j].set<NotAtomic>(sel, oldBuckets[i].imp());
+        count++;
+    }
+    return count;
+}
+
+
+// Replace this cache's buckets with newCapacity empty buckets.
+// If migrate is set and the cache grows, the old contents are 
+// copied into the new buckets so they need not be filled again.
+// A cache that is reallocated at the same size is migrated only 
+// if compact is set, to squeeze out tombstones.
+void cache_t::reallocate(mask_t oldCapacity, mask_t newCapacity, 
+                         bool migrate, bool compact)
 {
     bool freeOld = canBeFreed();
 
     bucket_t *oldBuckets = buckets();
     bucket_t *newBuckets = allocateBuckets(newCapacity);
 
-    // Cache's old contents are not propagated. 
-    // This is thought to save cache memory at the cost of extra cache fills.
-    // fixme re-measure this
-
     assert(newCapacity > 0);
     assert((uintptr_t)(mask_t)(newCapacity-1) == newCapacity-1);
 
-    setBucketsAndMask(newBuckets, newCapacity - 1);
+    // Old contents are propagated only when the cache really grows. 
+    // A cache that is reallocated at the same size was full; 
+    // keeping its contents would leave no room for the new entry, 
+    // unless enough of it was tombstones.
+    // The constant empty cache has no contents to propagate.
+    mask_t migrated = 0;
+    if (migrate  &&  freeOld  &&  
+        (newCapacity > oldCapacity  ||  compact)  &&  
+        !DisableCacheMigration) 
+    {
+        migrated = cache_migrate(oldBuckets, oldCapacity, 
+                                 newBuckets, newCapacity - 1);
+    }
+
+    setBucketsAndMask(newBuckets, newCapacity - 1);  // also clears occupied
+    _occupied = migrated;
+
+    if (PrintCaches  &&  migrated) {
+        _objc_inform("CACHES: migrated %u entries from %p to %p "
+                     "(capacity %u -> %u)", (unsigned)migrated, 
+                     oldBuckets, newBuckets, 
+                     (unsigned)oldCapacity, (unsigned)newCapacity);
+    }
     
     if (freeOld) {
         cache_collect_free(oldBuckets, oldCapacity);
@@ -535,6 +653,36 @@ bucket_t * cache_t::find(SEL s, id receiver)
 }
 
 
+// Returns the number of collisions skipped on the way 
+// from sel's home slot to bucket.
+static mask_t cache_probeCount(cache_t *cache, SEL sel, bucket_t *bucket)
+{
+    bucket_t *b = cache->buckets();
+    mask_t m = cache->mask();
+    mask_t i = cache_hash(sel, m);
+    mask_t count = 0;
+    while (&b[i] != bucket) {
+        i = cache_next(i, m);
+        count++;
+    }
+    return count;
+}
+
+
+// Returns the number of buckets holding tombstones.
+mask_t cache_t::tombstones()
+{
+    cacheUpdateLock.assertLocked();
+
+    bucket_t *b = buckets();
+    mask_t count = 0;
+    for (mask_t i = 0; i < capacity(); i++) {
+        if (b[i].sel() == CACHE_TOMBSTONE) count++;
+    }
+    return count;
+}
+
+
 void cache_t::expand()
 {
     cacheUpdateLock.assertLocked();
@@ -548,7 +696,18 @@ void cache_t::expand()
         newCapacity = oldCapacity;
     }
 
-    reallocate(oldCapacity, newCapacity);
+    reallocate(oldCapacity, newCapacity, true);
+}
+
+
+// Number of entries added to any method cache. 
+// Written with cacheUpdateLock held.
+static size_t cacheFillCount;
+
+size_t _objc_getCacheFillCount(void)
+{
+    return __c11_atomic_load((_Atomic(size_t) *)&cacheFillCount, 
+                             __ATOMIC_RELAXED);
 }
 
 
@@ -575,9 +734,15 @@ static void cache_fill_nolock(Class cls, SEL sel, IMP imp, id receiver)
     else if (newOccupied <= capacity / 4 * 3) {
         // Cache is less than 3/4 full. Use it as-is.
     }
+    else if (newOccupied - cache->tombstones() <= capacity / 2) {
+        // Cache is full mostly of tombstones left by selective flushes. 
+        // Rehash the live entries at the same size instead of growing.
+        cache->reallocate(capacity, capacity, true, true);
+    }
     else {
         // Cache is too full. Expand it.
         cache->expand();
+        if (DebugCacheStatistics) recordCacheExpansion(cls);
     }
 
     // Scan for the first unused slot and insert there.
@@ -586,6 +751,11 @@ static void cache_fill_nolock(Class cls, SEL sel, IMP imp, id receiver)
     bucket_t *bucket = cache->find(sel, receiver);
     if (bucket->sel() == 0) cache->incrementOccupied();
     bucket->set<Atomic>(sel, imp);
+
+    cacheFillCount++;
+    if (DebugCacheStatistics) {
+        recordCacheFill(cls, sel, cache_probeCount(cache, sel, bucket));
+    }
 }
 
 void cache_fill(Class cls, SEL sel, IMP imp, id receiver)
@@ -600,26 +770,147 @@ void cache_fill(Class cls, SEL sel, IMP imp, id receiver)
 }
 
 
+// Incremented by every cache flush. Written with cacheUpdateLock held.
+// Method lookups that run without runtimeLock read this before they 
+// search, and refuse to fill the cache if a flush happened since then, 
+// because the IMP they found may already be stale.
+static uintptr_t cacheFlushGeneration;
+
+uintptr_t cache_flushGeneration(void)
+{
+    return __c11_atomic_load((_Atomic(uintptr_t) *)&cacheFlushGeneration, 
+                             __ATOMIC_ACQUIRE);
+}
+
+// Like cache_fill(), but does nothing if any cache was flushed 
+// since cache_flushGeneration() returned generation.
+// Returns false if the cache was not filled for that reason.
+bool cache_fill_unlessFlushed(Class cls, SEL sel, IMP imp, id receiver, 
+                              uintptr_t generation)
+{
+#if !DEBUG_TASK_THREADS
+    mutex_locker_t lock(cacheUpdateLock);
+    if (cacheFlushGeneration != generation) return false;
+    cache_fill_nolock(cls, sel, imp, receiver);
+    return true;
+#else
+    _collecting_in_critical();
+    return false;
+#endif
+}
+
+
+// Cache flushes by cause. Written with cacheUpdateLock held.
+static objc_cache_flush_counts cacheFlushCounts[OBJC_CACHE_FLUSH_CAUSE_COUNT];
+
+// Count one flush request. A request may erase many caches.
+void cache_recordFlush(objc_cache_flush_cause cause)
+{
+    cacheUpdateLock.assertLocked();
+    cacheFlushCounts[cause].events++;
+}
+
+struct objc_cache_flush_counts 
+_objc_getCacheFlushCounts(objc_cache_flush_cause cause)
+{
+    objc_cache_flush_counts result = {0, 0};
+    if ((unsigned)cause >= OBJC_CACHE_FLUSH_CAUSE_COUNT) return result;
+
+    mutex_locker_t lock(cacheUpdateLock);
+    result = cacheFlushCounts[cause];
+    return result;
+}
+
+
+// Invalidate lock-free lookups in flight, even if the flushed 
+// cache is empty (a subclass may be about to fill).
+static void cache_bumpFlushGeneration(void)
+{
+    cacheUpdateLock.assertLocked();
+    __c11_atomic_store((_Atomic(uintptr_t) *)&cacheFlushGeneration, 
+                       cacheFlushGeneration + 1, __ATOMIC_RELEASE);
+}
+
+
 // Reset this entire cache to the uncached lookup by reallocating it.
 // This must not shrink the cache - that breaks the lock-free scheme.
-void cache_erase_nolock(Class cls)
+void cache_erase_nolock(Class cls, objc_cache_flush_cause cause)
 {
     cacheUpdateLock.assertLocked();
 
+    cache_bumpFlushGeneration();
+
     cache_t *cache = getCache(cls);
 
     mask_t capacity = cache->capacity();
     if (capacity > 0  &&  cache->occupied() > 0) {
+        cacheFlushCounts[cause].entriesRemoved += 
+            cache->occupied() - cache->tombstones();
+
         auto oldBuckets = cache->buckets();
         auto buckets = emptyBucketsForCapacity(capacity);
         cache->setBucketsAndMask(buckets, capacity - 1); // also clears occupied
 
         cache_collect_free(oldBuckets, capacity);
         cache_collect(false);
+
+        if (DebugCacheStatistics) recordCacheFlush(cls);
     }
 }
 
 
+// Remove only the given selectors from this cache, in place. 
+// Removed entries become tombstones so that objc_msgSend running 
+// concurrently still finds every other entry. 
+// sels must be sorted by address.
+void cache_eraseSelectors_nolock(Class cls, const SEL *sels, uint32_t count, 
+                                 objc_cache_flush_cause cause)
+{
+    cacheUpdateLock.assertLocked();
+
+    cache_bumpFlushGeneration();
+
+    cache_t *cache = getCache(cls);
+    if (cache->occupied() == 0) return;
+
+    bucket_t *b = cache->buckets();
+    mask_t m = cache->mask();
+    mask_t capacity = cache->capacity();
+    size_t removed = 0;
+
+    if (count < capacity) {
+        // Probe for each selector.
+        for (uint32_t s = 0; s < count; s++) {
+            mask_t begin = cache_hash(sels[s], m);
+            mask_t i = begin;
+            do {
+                SEL sel = b[i].sel();
+                if (sel == 0) break;
+                if (sel == sels[s]) {
+                    b[i].remove(CACHE_TOMBSTONE);
+                    removed++;
+                    break;
+                }
+            } while ((i = cache_next(i, m)) != begin);
+        }
+    } else {
+        // Scan every bucket.
+        for (mask_t i = 0; i < capacity; i++) {
+            SEL sel = b[i].sel();
+            if (sel == 0  ||  sel == CACHE_TOMBSTONE) continue;
+            if (std::binary_search(sels, sels + count, sel)) {
+                b[i].remove(CACHE_TOMBSTONE);
+                removed++;
+            }
+        }
+    }
+
+    cacheFlushCounts[cause].entriesRemoved += removed;
+
+    if (removed  &&  DebugCacheStatistics) recordCacheFlush(cls);
+}
+
+
 void cache_delete(Class cls)
 {
     mutex_locker_t lock(cacheUpdateLock);
@@ -627,6 +918,64 @@ void cache_delete(Class cls)
         if (PrintCaches) recordDeadCache(cls->cache.capacity());
         free(cls->cache.buckets());
     }
+    forgetCacheStats(cls);
+}
+
+
+/***********************************************************************
+* objc_copyCacheStatistics
+* Returns a snapshot of the statistics recorded for every class 
+* with OBJC_DEBUG_CACHE_STATISTICS set, busiest caches first.
+* 
+* outCount may be nil. *outCount is the number of entries returned. 
+* If the returned array is not nil, it must be freed with free().
+* Locking: acquires cacheUpdateLock
+**********************************************************************/
+struct objc_cache_statistics *
+objc_copyCacheStatistics(unsigned int *outCount)
+{
+    struct objc_cache_statistics *result = nil;
+    unsigned int count = 0;
+
+    {
+        mutex_locker_t lock(cacheUpdateLock);
+
+        if (cacheStats  &&  cacheStats->size() > 0) {
+            result = (struct objc_cache_statistics *)
+                calloc(cacheStats->size(), sizeof(*result));
+            for (auto& pair : *cacheStats) {
+                Class cls = pair.first;
+                cache_stats_t& stats = pair.second;
+                struct objc_cache_statistics& out = result[count++];
+
+                out.cls = cls;
+                out.capacity = cls->cache.capacity();
+                out.occupied = cls->cache.occupied();
+                out.fills = stats.fills;
+                out.expansions = stats.expansions;
+                out.flushes = stats.flushes;
+                out.probes = stats.probes;
+                out.maxProbe = stats.maxProbe;
+                out.maxProbeSelector = stats.maxProbeSel;
+                for (auto& selPair : stats.fillsBySel) {
+                    if (selPair.second > out.mostFilledSelectorFills) {
+                        out.mostFilledSelector = selPair.first;
+                        out.mostFilledSelectorFills = selPair.second;
+                    }
+                }
+            }
+        }
+    }
+
+    // Sort outside the lock.
+    std::stable_sort(result, result + count, 
+                     [](const struct objc_cache_statistics& a, 
+                        const struct objc_cache_statistics& b) {
+        return a.fills > b.fills;
+    });
+
+    if (outCount) *outCount = count;
+    return result;
 }
 
 
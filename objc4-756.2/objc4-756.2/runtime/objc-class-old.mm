@@ -2464,7 +2464,7 @@ void *objc_destructInstance(id obj)
         }
 
         if (isa->instancesHaveAssociatedObjects()) {
-            _object_remove_assocations(obj);
+            _object_remove_assocations(obj, true);
         }
 
         objc_clear_deallocating(obj);
@@ -2565,6 +2565,12 @@ unsigned class_createInstances(Class cls, size_t extraBytes,
     }
 }
 
+BOOL objc_setClassAllocationPolicy(Class cls, objc_allocation_policy policy)
+{
+    // Pooled instances are not supported here.
+    return cls  &&  policy == OBJC_ALLOCATION_POLICY_MALLOC;
+}
+
 id object_copy(id obj, size_t extraBytes) 
 {
     return (*_copy)(obj, extraBytes); 
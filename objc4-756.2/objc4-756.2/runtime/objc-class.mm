@@ -842,19 +842,552 @@ _objc_constructOrFree(id bytes, Class cls)
     assert(cls->hasCxxCtor());  // for performance, not correctness
 
     id obj = object_cxxConstructFromClass(bytes, cls);
-    if (!obj) free(bytes);
+    if (!obj) _objc_freeInstance(bytes);
 
     return obj;
 }
 
 
+/***********************************************************************
+* Allocation magazines.
+* With OBJC_ALLOC_MAGAZINES set, each thread keeps a few magazines, 
+* each holding malloc blocks of one size filled with one call to 
+* malloc_zone_batch_malloc(). class_createInstance() takes a block 
+* from the magazine for the instance size instead of calling calloc().
+* The blocks are ordinary malloc blocks, so the objects are freed 
+* as usual on any thread. Unused blocks are freed when a magazine is 
+* reassigned to another size and when the thread exits.
+* 
+* malloc_zone_batch_malloc() returns nothing for sizes it does not 
+* serve. Such sizes are remembered process-wide and are not tried 
+* again. Sizes above ALLOC_MAGAZINE_MAX_SIZE are never tried: they 
+* are beyond anything malloc batches.
+**********************************************************************/
+
+#define ALLOC_MAGAZINES 4
+#define ALLOC_MAGAZINE_BLOCKS 32
+#define ALLOC_MAGAZINE_MAX_SIZE 4096
+#define ALLOC_MAGAZINE_SIZE_CLASSES (ALLOC_MAGAZINE_MAX_SIZE / 16)
+
+// Bit n is set if batch malloc failed for size class n (up to 16*(n+1) 
+// bytes). Set without a lock; a lost update costs one more attempt.
+static uintptr_t UnbatchedSizes[ALLOC_MAGAZINE_SIZE_CLASSES / WORD_BITS];
+
+static inline bool allocSizeIsUnbatched(size_t size)
+{
+    size_t sc = (size - 1) / 16;
+    uintptr_t word = __c11_atomic_load
+        ((_Atomic(uintptr_t) *)&UnbatchedSizes[sc / WORD_BITS], 
+         __ATOMIC_RELAXED);
+    return word & ((uintptr_t)1 << (sc % WORD_BITS));
+}
+
+static void setAllocSizeUnbatched(size_t size)
+{
+    size_t sc = (size - 1) / 16;
+    __c11_atomic_fetch_or
+        ((_Atomic(uintptr_t) *)&UnbatchedSizes[sc / WORD_BITS], 
+         (uintptr_t)1 << (sc % WORD_BITS), __ATOMIC_RELAXED);
+}
+
+static unsigned allocBatch(size_t size, void **blocks)
+{
+    unsigned count = 
+        malloc_zone_batch_malloc(malloc_default_zone(), size, 
+                                 blocks, ALLOC_MAGAZINE_BLOCKS);
+    if (count == 0) setAllocSizeUnbatched(size);
+    return count;
+}
+
+struct alloc_magazines_t {
+    struct {
+        size_t size;
+        unsigned count;
+        void *blocks[ALLOC_MAGAZINE_BLOCKS];
+    } magazines[ALLOC_MAGAZINES];
+    unsigned nextVictim;
+};
+
+/***********************************************************************
+* _objc_allocFromMagazine
+* Returns a zero-filled block of size bytes from the calling thread's 
+* magazine for that size, or nil if the magazine could not be filled.
+**********************************************************************/
+void *
+_objc_allocFromMagazine(size_t size)
+{
+    if (size == 0  ||  size > ALLOC_MAGAZINE_MAX_SIZE  ||  
+        allocSizeIsUnbatched(size)) 
+    {
+        return nil;
+    }
+
+    _objc_pthread_data *data = _objc_fetch_pthread_data(true);
+    if (!data) return nil;
+    alloc_magazines_t *mags = data->allocMagazines;
+    if (!mags) {
+        mags = (alloc_magazines_t *)calloc(1, sizeof(*mags));
+        if (!mags) return nil;
+        data->allocMagazines = mags;
+    }
+
+    int i;
+    for (i = 0; i < ALLOC_MAGAZINES; i++) {
+        if (mags->magazines[i].size == size) break;
+    }
+    if (i == ALLOC_MAGAZINES) {
+        // No magazine for this size. Fill a new one first: 
+        // malloc_zone_batch_malloc() returns nothing for sizes 
+        // it does not serve, and then no magazine should be evicted.
+        void *blocks[ALLOC_MAGAZINE_BLOCKS];
+        unsigned count = allocBatch(size, blocks);
+        if (count == 0) return nil;
+
+        // Empty and reuse the next victim.
+        i = mags->nextVictim++ % ALLOC_MAGAZINES;
+        for (unsigned b = 0; b < mags->magazines[i].count; b++) {
+            free(mags->magazines[i].blocks[b]);
+        }
+        memcpy(mags->magazines[i].blocks, blocks, count * sizeof(void *));
+        mags->magazines[i].count = count;
+        mags->magazines[i].size = size;
+    }
+
+    auto& mag = mags->magazines[i];
+    if (mag.count == 0) {
+        mag.count = allocBatch(size, mag.blocks);
+        if (mag.count == 0) return nil;
+    }
+
+    void *block = mag.blocks[--mag.count];
+    bzero(block, size);
+    return block;
+}
+
+void
+_destroyAllocMagazines(alloc_magazines_t *mags)
+{
+    if (!mags) return;
+    for (int i = 0; i < ALLOC_MAGAZINES; i++) {
+        for (unsigned b = 0; b < mags->magazines[i].count; b++) {
+            free(mags->magazines[i].blocks[b]);
+        }
+    }
+    free(mags);
+}
+
+
+/***********************************************************************
+* Pooled instances.
+* objc_setClassAllocationPolicy(cls, OBJC_ALLOCATION_POLICY_POOLED) 
+* makes class_createInstance() take cls's instances from runtime-owned 
+* chunks instead of calloc(). Each chunk serves one 16-byte size class.
+* A freed instance goes on the freeing thread's free list for its size 
+* class and is zeroed when it is reused. A thread keeps at most 
+* POOL_CACHE_MAX free instances per size class; the excess moves to 
+* a process-wide depot that other threads refill from.
+* 
+* Inside objc_allocationArenaPush() and objc_allocationArenaPop(), 
+* pooled instances are instead carved from chunks owned by the arena. 
+* Freeing such an instance does not reuse its memory. The arena's 
+* chunks are released all at once, each as soon as the arena has been 
+* popped and every instance in that chunk has been freed.
+* 
+* All chunks come from one reserved range of address space, so the 
+* free path recognizes pooled memory with a range check. 
+* See _objc_freeInstance().
+* Locking: ObjectPoolLock protects the depot and the chunk allocator.
+**********************************************************************/
+
+#define POOL_CHUNK_SIZE (64*1024)
+#define POOL_SIZE_CLASSES (OBJECT_POOL_MAX_INSTANCE_SIZE / 16)
+#define POOL_CACHE_MAX 256
+
+spinlock_t ObjectPoolLock;
+uintptr_t ObjectPoolRegion;
+static uintptr_t ObjectPoolRegionNext;
+static void *ObjectPoolFreeChunks;
+
+// count is changed only with ObjectPoolLock held, but it is read 
+// without the lock to skip refills from an empty depot.
+static struct {
+    void *head;
+    size_t count;
+} ObjectPoolDepot[POOL_SIZE_CLASSES];
+
+static inline size_t
+poolDepotCount(unsigned sc)
+{
+    return __c11_atomic_load((_Atomic(size_t) *)&ObjectPoolDepot[sc].count, 
+                             __ATOMIC_RELAXED);
+}
+
+static inline void
+poolDepotSetCount(unsigned sc, size_t count)
+{
+    ObjectPoolLock.assertLocked();
+    __c11_atomic_store((_Atomic(size_t) *)&ObjectPoolDepot[sc].count, 
+                       count, __ATOMIC_RELAXED);
+}
+
+// The first bytes of every chunk. 
+// Instances start at POOL_CHUNK_HEADER_SIZE.
+struct pool_chunk_t {
+    pool_chunk_t *nextInArena;
+    uintptr_t refs;        // arena chunks: live instances, +1 until popped
+    uint32_t sizeClass;    // pool chunks: index into the size classes
+    bool isArena;
+};
+#define POOL_CHUNK_HEADER_SIZE 64
+static_assert(sizeof(pool_chunk_t) <= POOL_CHUNK_HEADER_SIZE, 
+              "pool chunk header is too big");
+
+struct pool_arena_t {
+    pool_arena_t *parent;
+    pool_chunk_t *chunks;  // newest first; the newest is being carved
+    char *next;
+    char *end;
+};
+
+struct object_pool_cache_t {
+    struct {
+        void *head;
+        unsigned count;
+        char *next;
+        char *end;
+    } sizes[POOL_SIZE_CLASSES];
+    pool_arena_t *arena;   // innermost open arena
+};
+
+static inline unsigned poolSizeClass(size_t size)
+{
+    return (unsigned)((size + 15) / 16 - 1);
+}
+
+static inline pool_chunk_t *poolChunkFor(void *p)
+{
+    return (pool_chunk_t *)((uintptr_t)p & ~(uintptr_t)(POOL_CHUNK_SIZE-1));
+}
+
+/***********************************************************************
+* _objc_reserveObjectPools
+* Reserves the address range for pooled instances, if not already done.
+* Called when a class is first given the pooled policy, so processes 
+* that never use pools reserve nothing.
+* Returns false if the range could not be reserved.
+* Locking: acquires ObjectPoolLock
+**********************************************************************/
+bool
+_objc_reserveObjectPools(void)
+{
+    mutex_locker_t lock(ObjectPoolLock);
+    if (ObjectPoolRegion) return true;
+
+    vm_address_t region = 0;
+    kern_return_t kr = 
+        vm_allocate(mach_task_self(), &region, 
+                    OBJECT_POOL_REGION_SIZE + POOL_CHUNK_SIZE, 
+                    VM_FLAGS_ANYWHERE | VM_MAKE_TAG(VM_MEMORY_FOUNDATION));
+    if (kr != KERN_SUCCESS) return false;
+
+    // Align the region to the chunk size.
+    // The free path reads the region without the lock. 
+    // See objectPoolRegion().
+    uintptr_t aligned = 
+        ((uintptr_t)region + POOL_CHUNK_SIZE-1) & ~(uintptr_t)(POOL_CHUNK_SIZE-1);
+    ObjectPoolRegionNext = aligned;
+    __c11_atomic_store((_Atomic(uintptr_t) *)&ObjectPoolRegion, aligned, 
+                       __ATOMIC_RELAXED);
+    return true;
+}
+
+static pool_chunk_t *
+poolChunkAlloc(void)
+{
+    mutex_locker_t lock(ObjectPoolLock);
+    pool_chunk_t *chunk = (pool_chunk_t *)ObjectPoolFreeChunks;
+    if (chunk) {
+        ObjectPoolFreeChunks = *(void **)chunk;
+    } else {
+        uintptr_t end = ObjectPoolRegion + OBJECT_POOL_REGION_SIZE;
+        if (ObjectPoolRegionNext >= end) return nil;
+        chunk = (pool_chunk_t *)ObjectPoolRegionNext;
+        ObjectPoolRegionNext += POOL_CHUNK_SIZE;
+    }
+    bzero(chunk, POOL_CHUNK_HEADER_SIZE);
+    return chunk;
+}
+
+static void
+poolChunkRelease(pool_chunk_t *chunk)
+{
+    // Give the pages back to the kernel but keep the address range.
+    madvise(chunk, POOL_CHUNK_SIZE, MADV_FREE);
+
+    mutex_locker_t lock(ObjectPoolLock);
+    *(void **)chunk = ObjectPoolFreeChunks;
+    ObjectPoolFreeChunks = chunk;
+}
+
+static void
+poolChunkRetain(pool_chunk_t *chunk)
+{
+    __c11_atomic_fetch_add((_Atomic(uintptr_t) *)&chunk->refs, 1, 
+                           __ATOMIC_RELAXED);
+}
+
+static void
+poolChunkUnretain(pool_chunk_t *chunk)
+{
+    if (__c11_atomic_fetch_sub((_Atomic(uintptr_t) *)&chunk->refs, 1, 
+                               __ATOMIC_ACQ_REL) == 1) 
+    {
+        poolChunkRelease(chunk);
+    }
+}
+
+static object_pool_cache_t *
+objectPoolCache(bool create)
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(create);
+    if (!data) return nil;
+    if (!data->objectPools  &&  create) {
+        data->objectPools = (object_pool_cache_t *)
+            calloc(1, sizeof(object_pool_cache_t));
+    }
+    return data->objectPools;
+}
+
+// Move up to count free instances of one size class 
+// from the depot to the cache.
+// Returns without taking ObjectPoolLock if the depot looks empty.
+static void
+poolRefillFromDepot(object_pool_cache_t *cache, unsigned sc, unsigned count)
+{
+    if (poolDepotCount(sc) == 0) return;
+
+    mutex_locker_t lock(ObjectPoolLock);
+    auto& depot = ObjectPoolDepot[sc];
+    auto& mine = cache->sizes[sc];
+    size_t depotCount = depot.count;
+    while (depot.head  &&  count--) {
+        void *p = depot.head;
+        depot.head = *(void **)p;
+        depotCount--;
+        *(void **)p = mine.head;
+        mine.head = p;
+        mine.count++;
+    }
+    poolDepotSetCount(sc, depotCount);
+}
+
+// Move up to count free instances of one size class 
+// from the cache to the depot.
+static void
+poolSpillToDepot(object_pool_cache_t *cache, unsigned sc, unsigned count)
+{
+    mutex_locker_t lock(ObjectPoolLock);
+    auto& depot = ObjectPoolDepot[sc];
+    auto& mine = cache->sizes[sc];
+    size_t depotCount = depot.count;
+    while (mine.head  &&  count--) {
+        void *p = mine.head;
+        mine.head = *(void **)p;
+        mine.count--;
+        *(void **)p = depot.head;
+        depot.head = p;
+        depotCount++;
+    }
+    poolDepotSetCount(sc, depotCount);
+}
+
+static void *
+arenaAlloc(pool_arena_t *arena, size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if ((size_t)(arena->end - arena->next) < size) {
+        pool_chunk_t *chunk = poolChunkAlloc();
+        if (!chunk) return nil;
+        chunk->isArena = true;
+        chunk->refs = 1;  // the arena's reference
+        chunk->nextInArena = arena->chunks;
+        arena->chunks = chunk;
+        arena->next = (char *)chunk + POOL_CHUNK_HEADER_SIZE;
+        arena->end = (char *)chunk + POOL_CHUNK_SIZE;
+    }
+    void *result = arena->next;
+    arena->next += size;
+    poolChunkRetain(arena->chunks);
+    return result;
+}
+
+/***********************************************************************
+* _objc_poolAlloc
+* Returns a zero-filled pooled block of size bytes, or nil.
+* size must be at most OBJECT_POOL_MAX_INSTANCE_SIZE.
+**********************************************************************/
+void *
+_objc_poolAlloc(size_t size)
+{
+    assert(size <= OBJECT_POOL_MAX_INSTANCE_SIZE);
+    object_pool_cache_t *cache = objectPoolCache(true);
+    if (!cache) return nil;
+
+    void *result;
+    if (cache->arena) {
+        result = arenaAlloc(cache->arena, size);
+        if (!result) return nil;
+    } 
+    else {
+        unsigned sc = poolSizeClass(size);
+        auto& mine = cache->sizes[sc];
+        if (!mine.head) poolRefillFromDepot(cache, sc, POOL_CACHE_MAX/2);
+        if (mine.head) {
+            result = mine.head;
+            mine.head = *(void **)result;
+            mine.count--;
+        }
+        else {
+            size_t slotSize = (sc + 1) * 16;
+            if ((size_t)(mine.end - mine.next) < slotSize) {
+                pool_chunk_t *chunk = poolChunkAlloc();
+                if (!chunk) return nil;
+                chunk->sizeClass = sc;
+                mine.next = (char *)chunk + POOL_CHUNK_HEADER_SIZE;
+                mine.end = (char *)chunk + POOL_CHUNK_SIZE;
+            }
+            result = mine.next;
+            mine.next += slotSize;
+        }
+    }
+
+    bzero(result, size);
+    return result;
+}
+
+/***********************************************************************
+* _objc_poolFree
+* Frees memory from _objc_poolAlloc(). Called by _objc_freeInstance().
+**********************************************************************/
+void
+_objc_poolFree(void *p)
+{
+    pool_chunk_t *chunk = poolChunkFor(p);
+    if (chunk->isArena) {
+        poolChunkUnretain(chunk);
+        return;
+    }
+
+    unsigned sc = chunk->sizeClass;
+    object_pool_cache_t *cache = objectPoolCache(true);
+    if (!cache) {
+        mutex_locker_t lock(ObjectPoolLock);
+        *(void **)p = ObjectPoolDepot[sc].head;
+        ObjectPoolDepot[sc].head = p;
+        poolDepotSetCount(sc, ObjectPoolDepot[sc].count + 1);
+        return;
+    }
+
+    auto& mine = cache->sizes[sc];
+    *(void **)p = mine.head;
+    mine.head = p;
+    if (++mine.count > POOL_CACHE_MAX) {
+        poolSpillToDepot(cache, sc, POOL_CACHE_MAX/2);
+    }
+}
+
+static void
+arenaRelease(pool_arena_t *arena)
+{
+    pool_chunk_t *chunk = arena->chunks;
+    while (chunk) {
+        // Read the link first. The chunk may be released below.
+        pool_chunk_t *next = chunk->nextInArena;
+        poolChunkUnretain(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+/***********************************************************************
+* objc_allocationArenaPush
+* Opens an arena on the calling thread. Pooled instances allocated 
+* on this thread until the matching objc_allocationArenaPop() 
+* are carved from the arena's chunks.
+**********************************************************************/
+void *
+objc_allocationArenaPush(void)
+{
+    object_pool_cache_t *cache = objectPoolCache(true);
+    if (!cache) _objc_fatal("could not allocate an allocation arena");
+    pool_arena_t *arena = (pool_arena_t *)calloc(1, sizeof(pool_arena_t));
+    if (!arena) _objc_fatal("could not allocate an allocation arena");
+    arena->parent = cache->arena;
+    cache->arena = arena;
+    return arena;
+}
+
+/***********************************************************************
+* objc_allocationArenaPop
+* Closes the calling thread's innermost arena. Its memory is released 
+* once every instance allocated from it has been freed. 
+* Instances that are still alive remain valid.
+**********************************************************************/
+void
+objc_allocationArenaPop(void *token)
+{
+    object_pool_cache_t *cache = objectPoolCache(false);
+    pool_arena_t *arena = (pool_arena_t *)token;
+    if (!cache  ||  !arena  ||  cache->arena != arena) {
+        _objc_fatal("Allocation arena %p popped out of order or on "
+                    "the wrong thread.", token);
+    }
+    cache->arena = arena->parent;
+    arenaRelease(arena);
+}
+
+void
+_destroyObjectPools(object_pool_cache_t *cache)
+{
+    if (!cache) return;
+
+    while (pool_arena_t *arena = cache->arena) {
+        cache->arena = arena->parent;
+        arenaRelease(arena);
+    }
+
+    for (unsigned sc = 0; sc < POOL_SIZE_CLASSES; sc++) {
+        // Hand the uncarved rest of the current chunk 
+        // and the free list to the depot.
+        auto& mine = cache->sizes[sc];
+        size_t slotSize = (sc + 1) * 16;
+        for ( ; (size_t)(mine.end - mine.next) >= slotSize; 
+              mine.next += slotSize) 
+        {
+            *(void **)mine.next = mine.head;
+            mine.head = mine.next;
+            mine.count++;
+        }
+        poolSpillToDepot(cache, sc, mine.count);
+    }
+
+    free(cache);
+}
+
+
 /***********************************************************************
 * _class_createInstancesFromZone
 * Batch-allocating version of _class_createInstanceFromZone.
 * Attempts to allocate num_requested objects, each with extraBytes.
 * Returns the number of allocated objects (possibly zero), with 
 * the allocated pointers in *results.
+* Every isa is written before any C++ constructor runs, and the 
+* constructors are looked up once for the whole batch.
 **********************************************************************/
+
+// Deeper hierarchies of C++ constructors use _objc_constructOrFree.
+#define BATCH_CXX_CTOR_DEPTH 16
+
 unsigned
 _class_createInstancesFromZone(Class cls, size_t extraBytes, void *zone, 
                                id *results, unsigned num_requested)
@@ -871,14 +1404,67 @@ _class_createInstancesFromZone(Class cls, size_t extraBytes, void *zone,
         bzero(results[i], size);
     }
 
+    // Nonpointer isa only for the default zone, as in class_createInstance.
+#if __OBJC2__
+    bool nonpointer = !zone  &&  cls->canAllocNonpointer();
+#else
+    bool nonpointer = false;
+#endif
+    bool dtor = cls->hasCxxDtor();
+    if (nonpointer) {
+        for (unsigned i = 0; i < num_allocated; i++) {
+            results[i]->initInstanceIsa(cls, dtor);
+        }
+    } else {
+        for (unsigned i = 0; i < num_allocated; i++) {
+            results[i]->initIsa(cls);
+        }
+    }
+
+    if (!cls->hasCxxCtor()) return num_allocated;
+
+    // Find the constructors object_cxxConstructFromClass would call, 
+    // most-derived class first.
+    Class classes[BATCH_CXX_CTOR_DEPTH];
+    id (*ctors[BATCH_CXX_CTOR_DEPTH])(id);
+    int depth = 0;
+    for (Class c = cls; c  &&  c->hasCxxCtor(); c = c->superclass) {
+        if (depth == BATCH_CXX_CTOR_DEPTH) {
+            depth = -1;
+            break;
+        }
+        classes[depth] = c;
+        ctors[depth] = (id(*)(id))
+            lookupMethodInClassAndLoadCache(c, SEL_cxx_construct);
+        depth++;
+    }
+
     // Construct each object, and delete any that fail construction.
 
     unsigned shift = 0;
-    bool ctor = cls->hasCxxCtor();
     for (unsigned i = 0; i < num_allocated; i++) {
         id obj = results[i];
-        obj->initIsa(cls);    // fixme allow nonpointer
-        if (ctor) obj = _objc_constructOrFree(obj, cls);
+        if (depth < 0) {
+            obj = _objc_constructOrFree(obj, cls);
+        } else {
+            // Base class constructors first.
+            for (int k = depth - 1; k >= 0; k--) {
+                if (ctors[k] == (id(*)(id))_objc_msgForward_impcache) continue;
+                if (PrintCxxCtors) {
+                    _objc_inform("CXX: calling C++ constructors for class %s", 
+                                 classes[k]->nameForLogging());
+                }
+                if (!(*ctors[k])(obj)) {
+                    // This class's ctor failed. 
+                    // Call superclasses's dtors to clean up.
+                    Class supercls = classes[k]->superclass;
+                    if (supercls) object_cxxDestructFromClass(obj, supercls);
+                    free(obj);
+                    obj = nil;
+                    break;
+                }
+            }
+        }
 
         if (obj) {
             results[i-shift] = obj;
@@ -4,6 +4,7 @@
 
 OPTION( PrintImages,              OBJC_PRINT_IMAGES,               "log image and library names as they are loaded")
 OPTION( PrintImageTimes,          OBJC_PRINT_IMAGE_TIMES,          "measure duration of image loading steps")
+OPTION( PrintStartupTrace,        OBJC_PRINT_STARTUP_TRACE,        "write the startup trace as JSON at exit, to the file named by OBJC_STARTUP_TRACE_FILE or to stderr; implies OBJC_RECORD_STARTUP_TRACE")
 OPTION( PrintLoading,             OBJC_PRINT_LOAD_METHODS,         "log calls to class and category +load methods")
 OPTION( PrintInitializing,        OBJC_PRINT_INITIALIZE_METHODS,   "log calls to class +initialize methods")
 OPTION( PrintResolving,           OBJC_PRINT_RESOLVED_METHODS,     "log methods created by +resolveClassMethod: and +resolveInstanceMethod:")
@@ -35,6 +36,8 @@ OPTION( DebugMissingPools,        OBJC_DEBUG_MISSING_POOLS,        "warn about a
 OPTION( DebugPoolAllocation,      OBJC_DEBUG_POOL_ALLOCATION,      "halt when autorelease pools are popped out of order, and allow heap debuggers to track autorelease pools")
 OPTION( DebugDuplicateClasses,    OBJC_DEBUG_DUPLICATE_CLASSES,    "halt when multiple classes with the same name are present")
 OPTION( DebugDontCrash,           OBJC_DEBUG_DONT_CRASH,           "halt the process by exiting instead of crashing")
+OPTION( DebugCacheStatistics,     OBJC_DEBUG_CACHE_STATISTICS,     "record per-class method cache statistics for objc_copyCacheStatistics()")
+OPTION( DebugReturnStatistics,    OBJC_DEBUG_RETURN_STATISTICS,    "count optimized, claimed, and autoreleased return values for _objc_getReturnValueStatistics()")
 
 OPTION( DisableVtables,           OBJC_DISABLE_VTABLES,            "disable vtable dispatch")
 OPTION( DisablePreopt,            OBJC_DISABLE_PREOPTIMIZATION,    "disable preoptimization courtesy of dyld shared cache")
@@ -42,3 +45,20 @@ OPTION( DisableTaggedPointers,    OBJC_DISABLE_TAGGED_POINTERS,    "disable tagg
 OPTION( DisableTaggedPointerObfuscation, OBJC_DISABLE_TAG_OBFUSCATION,    "disable obfuscation of tagged pointers")
 OPTION( DisableNonpointerIsa,     OBJC_DISABLE_NONPOINTER_ISA,     "disable non-pointer isa fields")
 OPTION( DisableInitializeForkSafety, OBJC_DISABLE_INITIALIZE_FORK_SAFETY, "disable safety checks for +initialize after fork")
+OPTION( DisableLockFreeLookup,    OBJC_DISABLE_LOCKFREE_LOOKUP,    "disable method lookup without runtimeLock for initialized classes")
+OPTION( DisableCacheMigration,    OBJC_DISABLE_CACHE_MIGRATION,    "disable copying of method cache contents when a cache grows")
+OPTION( DisableLockFreeWeakLoads, OBJC_DISABLE_LOCKFREE_WEAK_LOADS, "disable loading of weak references without the side table lock")
+OPTION( DisableLockFreeAssociations, OBJC_DISABLE_LOCKFREE_ASSOCIATIONS, "disable reading of associated objects without the associations lock")
+OPTION( DisableInlineAssociations, OBJC_DISABLE_INLINE_ASSOCIATIONS, "disable storing an object's first associations in its associations table entry")
+OPTION( DisableBatchedPoolDrain,  OBJC_DISABLE_BATCHED_POOL_DRAIN,  "disable releasing autorelease pool contents in batches")
+OPTION( DisableClaimableReturns,  OBJC_DISABLE_CLAIMABLE_RETURNS,  "disable keeping unoptimized autoreleased return values out of the pool until the caller claims them")
+OPTION( DisableParallelFixups,    OBJC_DISABLE_PARALLEL_FIXUPS,    "disable fixing up class, selector, and protocol references of many images on multiple threads")
+OPTION( DisableConformanceCache,  OBJC_DISABLE_CONFORMANCE_CACHE,  "disable memoizing class_conformsToProtocol() answers per class")
+OPTION( DisableSelectiveFlush,    OBJC_DISABLE_SELECTIVE_CACHE_FLUSH, "disable removing only the affected selectors from method caches when methods change")
+OPTION( DisableMethodIndex,       OBJC_DISABLE_METHOD_INDEX,       "disable merging the method lists of classes with many categories into one sorted index")
+OPTION( DisableMethodHash,        OBJC_DISABLE_METHOD_HASH,        "disable hash tables for looking up methods in big method lists")
+
+OPTION( DeferSideTableReleases,   OBJC_DEFER_SIDETABLE_RELEASES,   "buffer releases of heavily retained objects with side table retain counts and apply them in batches; may delay deallocation")
+OPTION( RecordStartupTrace,       OBJC_RECORD_STARTUP_TRACE,       "record per-image timings and counts of image loading and +load methods in memory")
+OPTION( ReservePoolPages,         OBJC_RESERVE_POOL_PAGES,         "keep a process-wide reserve of prefaulted autorelease pool pages")
+OPTION( AllocMagazines,           OBJC_ALLOC_MAGAZINES,            "allocate objects from per-thread magazines filled by batch malloc")
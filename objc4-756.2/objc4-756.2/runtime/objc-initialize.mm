@@ -51,9 +51,12 @@
  * and CLS_INITIALIZING: the transition to CLS_INITIALIZING must be 
  * an atomic test-and-set with respect to itself and the transition 
  * to CLS_INITIALIZED.
- * The global classInitWaitCond is used to block threads waiting for an 
- * initialization to complete. The classInitLock synchronizes
- * condition checking and the condition variable.
+ * The striped ClassInitWaitMonitors are used to block threads waiting 
+ * for an initialization to complete. Waiters for a class wait on that 
+ * class's stripe only, so finishing one class does not wake every 
+ * thread that is waiting for some other class. A waiter checks 
+ * CLS_INITIALIZED with its stripe held, and the stripe is notified 
+ * after CLS_INITIALIZED is set, so no wakeup is lost.
  **********************************************************************/
 
 /***********************************************************************
@@ -96,11 +99,13 @@
 #include "message.h"
 #include "objc-initialize.h"
 
-/* classInitLock protects CLS_INITIALIZED and CLS_INITIALIZING, and 
- * is signalled when any class is done initializing. 
- * Threads that are waiting for a class to finish initializing wait on this. */
+/* classInitLock protects CLS_INITIALIZED and CLS_INITIALIZING. */
 monitor_t classInitLock;
 
+/* ClassInitWaitMonitors[cls] is signalled when cls is done initializing. 
+ * Threads that are waiting for cls to finish initializing wait on it. */
+StripedMap<monitor_t> ClassInitWaitMonitors;
+
 
 /***********************************************************************
 * struct _objc_initializing_classes
@@ -286,7 +291,11 @@ static void _finishInitializing(Class cls, Class supercls)
 
     // mark this class as fully +initialized
     cls->setInitialized();
-    classInitLock.notifyAll();
+    {
+        monitor_t& waiters = ClassInitWaitMonitors[cls];
+        monitor_locker_t lock(waiters);
+        waiters.notifyAll();
+    }
     _setThisThreadIsNotInitializingClass(cls);
     
     // mark any subclasses that were merely waiting for this class
@@ -359,9 +368,10 @@ void waitForInitializeToComplete(Class cls)
                      "completes", pthread_self(), cls->nameForLogging());
     }
 
-    monitor_locker_t lock(classInitLock);
+    monitor_t& waiters = ClassInitWaitMonitors[cls];
+    monitor_locker_t lock(waiters);
     while (!cls->isInitialized()) {
-        classInitLock.wait();
+        waiters.wait();
     }
     asm("");
 }
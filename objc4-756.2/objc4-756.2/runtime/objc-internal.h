@@ -93,6 +93,53 @@ class_createInstances(Class _Nullable cls, size_t extraBytes,
     OBJC_AVAILABLE(10.7, 4.3, 9.0, 1.0, 2.0)
     OBJC_ARC_UNAVAILABLE;
 
+/**
+ * Where class_createInstance() and +alloc get a class's instances.
+ * 
+ * OBJC_ALLOCATION_POLICY_POOLED instances are taken from runtime-owned 
+ * memory that is recycled through per-thread free lists, or from the 
+ * calling thread's innermost allocation arena. Their memory does not 
+ * belong to malloc, so malloc_size() and malloc zone introspection 
+ * do not see them.
+ */
+typedef enum objc_allocation_policy {
+    OBJC_ALLOCATION_POLICY_MALLOC = 0,
+    OBJC_ALLOCATION_POLICY_POOLED = 1,
+} objc_allocation_policy;
+
+/**
+ * Sets the allocation policy for instances of a class. 
+ * Subclasses are not affected.
+ * 
+ * @return YES if the policy was set. NO if cls is nil or a metaclass, 
+ *  or if its instances are too big to be pooled.
+ */
+OBJC_EXPORT BOOL
+objc_setClassAllocationPolicy(Class _Nullable cls, 
+                              objc_allocation_policy policy)
+    OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 4.0);
+
+/**
+ * Opens an allocation arena on the calling thread. Until the matching 
+ * objc_allocationArenaPop(), pooled instances allocated on this thread 
+ * come from the arena. Arenas nest.
+ * 
+ * @return A token to pass to objc_allocationArenaPop().
+ */
+OBJC_EXPORT void * _Nonnull
+objc_allocationArenaPush(void)
+    OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 4.0);
+
+/**
+ * Closes the calling thread's innermost allocation arena. 
+ * The arena's memory is released together, once every instance 
+ * allocated from it has been deallocated. Instances still alive 
+ * when the arena is popped remain valid.
+ */
+OBJC_EXPORT void
+objc_allocationArenaPop(void * _Nonnull arena)
+    OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 4.0);
+
 // Get the isa pointer written into objects just before being freed.
 OBJC_EXPORT Class _Nonnull
 _objc_getFreedObjectClass(void)
@@ -208,6 +255,100 @@ objc_copyClassNamesForImageHeader(const struct mach_header * _Nonnull mh,
                                   unsigned int * _Nullable outCount)
     OBJC_AVAILABLE(10.14, 12.0, 12.0, 5.0, 3.0);
 
+/**
+ * Returns the number of entries added to method caches since launch.
+ * 
+ * @note For performance measurement only. Each increment is one 
+ *  message send that missed the cache and performed a full method lookup.
+ */
+OBJC_EXPORT size_t
+_objc_getCacheFillCount(void)
+    OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 4.0);
+
+/**
+ * Reasons for the runtime to discard method cache entries.
+ */
+typedef enum objc_cache_flush_cause {
+    OBJC_CACHE_FLUSH_CATEGORY = 0,        // category methods were attached
+    OBJC_CACHE_FLUSH_ADD_METHOD,          // class_addMethod() and friends
+    OBJC_CACHE_FLUSH_SET_IMPLEMENTATION,  // method_setImplementation(),
+                                          // class_replaceMethod()
+    OBJC_CACHE_FLUSH_EXCHANGE,            // method_exchangeImplementations()
+    OBJC_CACHE_FLUSH_SUPERCLASS,          // class_setSuperclass()
+    OBJC_CACHE_FLUSH_EXPLICIT,            // _objc_flush_caches()
+    OBJC_CACHE_FLUSH_CAUSE_COUNT
+} objc_cache_flush_cause;
+
+/**
+ * Method cache flushes with one cause since launch.
+ */
+struct objc_cache_flush_counts {
+    size_t events;          // flushes requested
+    size_t entriesRemoved;  // cache entries those flushes discarded
+};
+
+/**
+ * Returns the number of method cache flushes with the given cause
+ * since launch, and the number of cache entries they discarded.
+ *
+ * @note For performance measurement only. Every discarded entry
+ *  that is used again costs one cache fill.
+ */
+OBJC_EXPORT struct objc_cache_flush_counts
+_objc_getCacheFlushCounts(objc_cache_flush_cause cause)
+    OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 4.0);
+
+/**
+ * Method cache statistics for one class. 
+ * Recorded only when OBJC_DEBUG_CACHE_STATISTICS is set.
+ * 
+ * Cache hits are not counted. Each fill follows a cache miss, 
+ * so a class with many fills relative to its selectors is refilling 
+ * entries that were dropped by flushes.
+ */
+struct objc_cache_statistics {
+    Class _Nonnull cls;
+    uint32_t capacity;      // current number of buckets
+    uint32_t occupied;      // current number of entries
+    size_t fills;           // entries added to the cache
+    size_t expansions;      // times the cache grew
+    size_t flushes;         // times a non-empty cache was emptied
+    size_t probes;          // total collisions skipped while filling
+    uint32_t maxProbe;      // longest collision chain seen while filling
+    SEL _Nullable maxProbeSelector;        // selector that saw maxProbe
+    SEL _Nullable mostFilledSelector;      // selector filled most often
+    size_t mostFilledSelectorFills;
+};
+
+/**
+ * Returns the method cache statistics recorded for each class, 
+ * sorted by decreasing fills.
+ * 
+ * @param outCount On return, the number of entries in the returned array.
+ * 
+ * @return An array of statistics which must be freed with free(), 
+ *  or nil if OBJC_DEBUG_CACHE_STATISTICS is not set or nothing was recorded.
+ */
+OBJC_EXPORT struct objc_cache_statistics * _Nullable
+objc_copyCacheStatistics(unsigned int * _Nullable outCount)
+    OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 4.0);
+
+/**
+ * Returns the startup trace recorded under OBJC_RECORD_STARTUP_TRACE 
+ * as a JSON object: for each image, the duration in nanoseconds and 
+ * the work count of each image loading phase; and each +load method 
+ * called, with its start time and duration.
+ * 
+ * Images are identified by path and load order index, not by address. 
+ * The process ID is reported once, in the "trace" record.
+ * 
+ * @return A string which must be freed with free(), 
+ *  or nil if the trace is not being recorded.
+ */
+OBJC_EXPORT char * _Nullable
+_objc_copyStartupTraceJSON(void)
+    OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 4.0);
+
 // Tagged pointer objects.
 
 #if __LP64__
@@ -687,6 +828,24 @@ OBJC_EXPORT id _Nullable
 objc_unsafeClaimAutoreleasedReturnValue(id _Nullable obj)
     OBJC_AVAILABLE(10.11, 9.0, 9.0, 1.0, 2.0);
 
+/**
+ * Counts of values returned through a +0 autoreleasing convention. 
+ * Recorded only when OBJC_DEBUG_RETURN_STATISTICS is set.
+ * 
+ * A return is optimized when the callee recognized its caller, 
+ * claimed when the caller took the value back from the per-thread 
+ * claimable slot, and autoreleased when it went to the pool.
+ */
+struct objc_return_value_statistics {
+    size_t optimized;
+    size_t claimed;
+    size_t autoreleased;
+};
+
+OBJC_EXPORT void
+_objc_getReturnValueStatistics(struct objc_return_value_statistics * _Nonnull stats)
+    OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 4.0);
+
 OBJC_EXPORT void
 objc_storeStrong(id _Nullable * _Nonnull location, id _Nullable obj)
     OBJC_AVAILABLE(10.7, 5.0, 9.0, 1.0, 2.0);
@@ -739,6 +898,69 @@ OBJC_EXPORT void
 _objc_autoreleasePoolPrint(void)
     OBJC_AVAILABLE(10.7, 5.0, 9.0, 1.0, 2.0);
 
+/**
+ * Process-wide autorelease pool page allocation counts.
+ * 
+ * A page is reused when a thread steps into an empty page it kept 
+ * from an earlier pool. Reserved pages are taken from the process-wide 
+ * reserve enabled by OBJC_RESERVE_POOL_PAGES.
+ */
+struct objc_autorelease_pool_page_statistics {
+    size_t freshPages;      // pages allocated from malloc
+    size_t reusedPages;     // times a thread reused one of its kept pages
+    size_t reservedPages;   // pages taken from the reserve
+    size_t freedPages;      // pages returned to malloc
+    size_t reserveCount;    // pages currently in the reserve
+};
+
+OBJC_EXPORT void
+_objc_getAutoreleasePoolPageStatistics(struct objc_autorelease_pool_page_statistics * _Nonnull stats)
+    OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 4.0);
+
+/**
+ * A summary of the calling thread's autorelease pools.
+ * 
+ * Pools are counted by their boundaries, so a pool pushed 
+ * inside an empty pool is not counted until it is used.
+ * Every page is counted in either pages or keptPages.
+ * A return value parked for its caller to claim is not in the pool 
+ * yet; it is counted in parkedReturns, not in entries.
+ */
+struct objc_autorelease_pool_info {
+    unsigned int pools;     // pools pushed and not yet popped
+    unsigned int pages;     // pages holding pending objects or pools
+    unsigned int keptPages; // empty pages kept for reuse, the cold page too
+    size_t entries;         // objects waiting to be released
+    size_t allThreadsPages; // pool pages in use by every thread
+    unsigned int parkedReturns; // 0 or 1 return values waiting for a claim
+};
+
+/**
+ * The number of pending autoreleased objects of one class.
+ */
+struct objc_autorelease_pool_class_count {
+    Class _Nonnull cls;
+    size_t count;
+};
+
+/**
+ * Summarizes the calling thread's autorelease pools and counts 
+ * their pending objects by class.
+ * 
+ * Other threads' pools are not examined. Only their total page count 
+ * is reported, in info->allThreadsPages.
+ * 
+ * @param info If not nil, filled with the summary.
+ * @param outCount On return, the number of entries in the returned array.
+ * 
+ * @return An array of counts sorted by decreasing count, which must 
+ *  be freed with free(), or nil if no objects are pending.
+ */
+OBJC_EXPORT struct objc_autorelease_pool_class_count * _Nullable
+_objc_copyAutoreleasePoolInfo(struct objc_autorelease_pool_info * _Nullable info,
+                              unsigned int * _Nullable outCount)
+    OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 4.0);
+
 OBJC_EXPORT BOOL
 objc_should_deallocate(id _Nonnull object)
     OBJC_AVAILABLE(10.7, 5.0, 9.0, 1.0, 2.0);
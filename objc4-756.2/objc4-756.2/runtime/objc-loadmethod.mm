@@ -201,7 +201,12 @@ static void call_class_loads(void)
         if (PrintLoading) {
             _objc_inform("LOAD: +[%s load]\n", cls->nameForLogging());
         }
+        uint64_t start = RecordStartupTrace ? nanoseconds() : 0;
         (*load_method)(cls, SEL_load);
+        if (RecordStartupTrace) {
+            _objc_traceLoadMethod(_headerForClass(cls), cls, nil, 
+                                  start, nanoseconds() - start);
+        }
     }
     
     // Destroy the detached list.
@@ -248,7 +253,13 @@ static bool call_category_loads(void)
                              cls->nameForLogging(), 
                              _category_getName(cat));
             }
+            uint64_t start = RecordStartupTrace ? nanoseconds() : 0;
             (*load_method)(cls, SEL_load);
+            if (RecordStartupTrace) {
+                _objc_traceLoadMethod(_headerForCategory(cat), cls, 
+                                      _category_getName(cat), 
+                                      start, nanoseconds() - start);
+            }
             cats[i].cat = nil;
         }
     }
@@ -48,6 +48,31 @@ static constexpr inline void lockdebug_mutex_assert_locked(mutex_tt<false> *lock
 static constexpr inline void lockdebug_mutex_assert_unlocked(mutex_tt<false> *lock) { }
 
 
+extern void lockdebug_remember_rwlock(rwlock_tt<true> *lock);
+extern void lockdebug_rwlock_read(rwlock_tt<true> *lock);
+extern void lockdebug_rwlock_try_read_success(rwlock_tt<true> *lock);
+extern void lockdebug_rwlock_unlock_read(rwlock_tt<true> *lock);
+extern void lockdebug_rwlock_write(rwlock_tt<true> *lock);
+extern void lockdebug_rwlock_try_write_success(rwlock_tt<true> *lock);
+extern void lockdebug_rwlock_unlock_write(rwlock_tt<true> *lock);
+extern void lockdebug_rwlock_assert_reading(rwlock_tt<true> *lock);
+extern void lockdebug_rwlock_assert_writing(rwlock_tt<true> *lock);
+extern void lockdebug_rwlock_assert_locked(rwlock_tt<true> *lock);
+extern void lockdebug_rwlock_assert_unlocked(rwlock_tt<true> *lock);
+
+static constexpr inline void lockdebug_remember_rwlock(rwlock_tt<false> *lock) { }
+static constexpr inline void lockdebug_rwlock_read(rwlock_tt<false> *lock) { }
+static constexpr inline void lockdebug_rwlock_try_read_success(rwlock_tt<false> *lock) { }
+static constexpr inline void lockdebug_rwlock_unlock_read(rwlock_tt<false> *lock) { }
+static constexpr inline void lockdebug_rwlock_write(rwlock_tt<false> *lock) { }
+static constexpr inline void lockdebug_rwlock_try_write_success(rwlock_tt<false> *lock) { }
+static constexpr inline void lockdebug_rwlock_unlock_write(rwlock_tt<false> *lock) { }
+static constexpr inline void lockdebug_rwlock_assert_reading(rwlock_tt<false> *lock) { }
+static constexpr inline void lockdebug_rwlock_assert_writing(rwlock_tt<false> *lock) { }
+static constexpr inline void lockdebug_rwlock_assert_locked(rwlock_tt<false> *lock) { }
+static constexpr inline void lockdebug_rwlock_assert_unlocked(rwlock_tt<false> *lock) { }
+
+
 extern void lockdebug_remember_monitor(monitor_tt<true> *lock);
 extern void lockdebug_monitor_enter(monitor_tt<true> *lock);
 extern void lockdebug_monitor_leave(monitor_tt<true> *lock);
@@ -306,6 +306,13 @@ lockdebug_remember_monitor(monitor_t *lock)
     setLock(AllLocks(), lock, MONITOR);
 }
 
+void
+lockdebug_remember_rwlock(rwlock_t *lock)
+{
+    // fork() acquires rwlocks for writing.
+    setLock(AllLocks(), lock, WRLOCK);
+}
+
 void
 lockdebug_assert_all_locks_locked()
 {
@@ -434,6 +441,127 @@ lockdebug_recursive_mutex_assert_unlocked(recursive_mutex_t *lock)
 }
 
 
+/***********************************************************************
+* Reader/writer lock checking
+**********************************************************************/
+
+void 
+lockdebug_rwlock_read(rwlock_t *lock)
+{
+    auto& locks = ownedLocks();
+
+    if (hasLock(locks, lock, RDLOCK)) {
+        // Recursive read is bad: it deadlocks against a waiting writer.
+        _objc_fatal("recursive rwlock read");
+    }
+    if (hasLock(locks, lock, WRLOCK)) {
+        _objc_fatal("deadlock: read after write for rwlock");
+    }
+    setLock(locks, lock, RDLOCK);
+}
+
+// try-read success is the only case with lockdebug effects.
+// try-read when already reading is OK (won't deadlock)
+// try-read when already writing is OK (will fail)
+// try-read failure does nothing.
+void 
+lockdebug_rwlock_try_read_success(rwlock_t *lock)
+{
+    auto& locks = ownedLocks();
+    setLock(locks, lock, RDLOCK);
+}
+
+void 
+lockdebug_rwlock_unlock_read(rwlock_t *lock)
+{
+    auto& locks = ownedLocks();
+
+    if (!hasLock(locks, lock, RDLOCK)) {
+        _objc_fatal("un-reading unowned rwlock");
+    }
+    clearLock(locks, lock, RDLOCK);
+}
+
+
+void 
+lockdebug_rwlock_write(rwlock_t *lock)
+{
+    auto& locks = ownedLocks();
+
+    if (hasLock(locks, lock, RDLOCK)) {
+        // Lock promotion not allowed (may deadlock)
+        _objc_fatal("deadlock: write after read for rwlock");
+    }
+    if (hasLock(locks, lock, WRLOCK)) {
+        _objc_fatal("recursive rwlock write");
+    }
+    setLock(locks, lock, WRLOCK);
+}
+
+// try-write success is the only case with lockdebug effects.
+// try-write when already reading is OK (will fail)
+// try-write when already writing is OK (will fail)
+// try-write failure does nothing.
+void 
+lockdebug_rwlock_try_write_success(rwlock_t *lock)
+{
+    auto& locks = ownedLocks();
+    setLock(locks, lock, WRLOCK);
+}
+
+void 
+lockdebug_rwlock_unlock_write(rwlock_t *lock)
+{
+    auto& locks = ownedLocks();
+
+    if (!hasLock(locks, lock, WRLOCK)) {
+        _objc_fatal("un-writing unowned rwlock");
+    }
+    clearLock(locks, lock, WRLOCK);
+}
+
+
+void 
+lockdebug_rwlock_assert_reading(rwlock_t *lock)
+{
+    auto& locks = ownedLocks();
+
+    if (!hasLock(locks, lock, RDLOCK)) {
+        _objc_fatal("rwlock incorrectly not reading");
+    }
+}
+
+void 
+lockdebug_rwlock_assert_writing(rwlock_t *lock)
+{
+    auto& locks = ownedLocks();
+
+    if (!hasLock(locks, lock, WRLOCK)) {
+        _objc_fatal("rwlock incorrectly not writing");
+    }
+}
+
+void 
+lockdebug_rwlock_assert_locked(rwlock_t *lock)
+{
+    auto& locks = ownedLocks();
+
+    if (!hasLock(locks, lock, RDLOCK)  &&  !hasLock(locks, lock, WRLOCK)) {
+        _objc_fatal("rwlock incorrectly neither reading nor writing");
+    }
+}
+
+void 
+lockdebug_rwlock_assert_unlocked(rwlock_t *lock)
+{
+    auto& locks = ownedLocks();
+
+    if (hasLock(locks, lock, RDLOCK)  ||  hasLock(locks, lock, WRLOCK)) {
+        _objc_fatal("rwlock incorrectly not unlocked");
+    }
+}
+
+
 /***********************************************************************
 * Monitor checking
 **********************************************************************/
@@ -32,7 +32,9 @@
 // fork() safety requires careful tracking of all locks used in the runtime.
 // Thou shalt not declare any locks outside this file.
 
-extern mutex_t runtimeLock;
+extern rwlock_t runtimeLock;
+extern StripedMap<mutex_t> ClassMethodLocks;
 extern mutex_t DemangleCacheLock;
+extern monitor_t FixupPoolMonitor;
 
 #endif
@@ -36,16 +36,21 @@
 // and is enforced by lockdebug.
 
 extern monitor_t classInitLock;
+extern StripedMap<monitor_t> ClassInitWaitMonitors;
 extern mutex_t selLock;
 extern mutex_t cacheUpdateLock;
 extern recursive_mutex_t loadMethodLock;
 extern mutex_t crashlog_lock;
 extern spinlock_t objcMsgLogLock;
 extern mutex_t AltHandlerDebugLock;
-extern mutex_t AssociationsManagerLock;
+extern mutex_t epochLock;
+extern spinlock_t PoolPageReserveLock;
+extern spinlock_t ObjectPoolLock;
+extern mutex_t StartupTraceLock;
 extern StripedMap<spinlock_t> PropertyLocks;
 extern StripedMap<spinlock_t> StructLocks;
 extern StripedMap<spinlock_t> CppObjectLocks;
+extern StripedMap<spinlock_t> AssociationsLocks;
 
 // SideTable lock is buried awkwardly. Call a function to manipulate it.
 extern void SideTableLockAll();
@@ -429,7 +429,7 @@ objc_object::rootDealloc()
                  !isa.has_sidetable_rc))
     {
         assert(!sidetable_present());
-        free(this);
+        _objc_freeInstance(this);
     } 
     else {
         object_dispose((id)this);
@@ -472,6 +472,64 @@ objc_object::rootTryRetain()
     return rootRetain(true, false) ? true : false;
 }
 
+// Like rootTryRetain(), for callers that do not hold the side table lock.
+// Returns false without retaining if the object is deallocating, 
+// has a raw isa, or needs its retain count moved to the side table. 
+// The caller must then retry with rootTryRetain() under the lock.
+ALWAYS_INLINE bool 
+objc_object::rootTryRetainWithoutSideTable()
+{
+    assert(!isTaggedPointer());
+
+    isa_t oldisa;
+    isa_t newisa;
+
+    do {
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (slowpath(!newisa.nonpointer  ||  newisa.deallocating)) {
+            ClearExclusive(&isa.bits);
+            return false;
+        }
+        uintptr_t carry;
+        newisa.bits = addc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc++
+        if (slowpath(carry)) {
+            ClearExclusive(&isa.bits);
+            return false;
+        }
+    } while (slowpath(!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits)));
+
+    return true;
+}
+
+// Releases count references in one update of the inline retain count.
+// Returns false without releasing anything if the object has a raw isa, 
+// is deallocating, or would need the side table or deallocation.
+// The caller must then release one reference at a time.
+ALWAYS_INLINE bool 
+objc_object::rootTryReleaseWithoutDealloc(uintptr_t count)
+{
+    assert(!isTaggedPointer());
+
+    isa_t oldisa;
+    isa_t newisa;
+
+    do {
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (slowpath(!newisa.nonpointer  ||  newisa.deallocating  ||  
+                     newisa.extra_rc < count)) 
+        {
+            ClearExclusive(&isa.bits);
+            return false;
+        }
+        newisa.bits -= count * RC_ONE;  // extra_rc -= count
+    } while (slowpath(!StoreReleaseExclusive(&isa.bits, 
+                                             oldisa.bits, newisa.bits)));
+
+    return true;
+}
+
 ALWAYS_INLINE id 
 objc_object::rootRetain(bool tryRetain, bool handleOverflow)
 {
@@ -970,6 +1028,22 @@ objc_object::rootTryRetain()
 }
 
 
+// All retain counts live in the side table.
+inline bool 
+objc_object::rootTryRetainWithoutSideTable()
+{
+    return false;
+}
+
+
+// All retain counts live in the side table.
+inline bool 
+objc_object::rootTryReleaseWithoutDealloc(uintptr_t count __unused)
+{
+    return false;
+}
+
+
 inline uintptr_t 
 objc_object::rootRetainCount()
 {
@@ -1040,6 +1114,22 @@ objc_object::rootRetainCount()
   Tagged pointer objects do participate in the optimized return scheme, 
   because it saves message sends. They are not entered in the autorelease 
   pool in the unoptimized case.
+
+  Claimable returns:
+  When objc_autoreleaseReturnValue or objc_retainAutoreleaseReturnValue 
+  does not recognize its caller, the result is parked at +1 in a 
+  thread-local slot instead of being autoreleased. If the caller then 
+  calls objc_retainAutoreleasedReturnValue or 
+  objc_unsafeClaimAutoreleasedReturnValue with the same object, it 
+  takes the parked reference and the pool is never involved. Anything 
+  that pushes, pops, or adds to the autorelease pool first autoreleases 
+  the parked object, so an unclaimed result lands in the same pool 
+  it would have without parking. A pool pop also autoreleases anything 
+  parked while it drains, before it finishes, so the pop releases it. 
+  A bit in the autorelease pool's TLS word says whether anything is 
+  parked, so those checks cost no extra TLS read. Objects with custom 
+  retain/release are never parked. OBJC_DISABLE_CLAIMABLE_RETURNS 
+  turns this off.
 **********************************************************************/
 
 # if __x86_64__
@@ -1167,6 +1257,21 @@ setReturnDisposition(ReturnDisposition disposition)
 }
 
 
+// The unoptimized return value parked for a claim by the caller, or nil.
+static ALWAYS_INLINE id 
+getClaimableReturn()
+{
+    return (id)tls_get_direct(RETURN_CLAIMABLE_KEY);
+}
+
+
+static ALWAYS_INLINE void 
+setClaimableReturn(id obj)
+{
+    tls_set_direct(RETURN_CLAIMABLE_KEY, (void*)obj);
+}
+
+
 // Try to prepare for optimized return with the given disposition (+0 or +1).
 // Returns true if the optimized path is successful.
 // Otherwise the return value must be retained and/or autoreleased as usual.
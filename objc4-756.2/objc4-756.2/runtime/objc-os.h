@@ -275,6 +275,7 @@ extern void _objc_fatal_with_reason(uint64_t reason, uint64_t flags,
 #   define AUTORELEASE_POOL_KEY  ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY3)
 # if SUPPORT_RETURN_AUTORELEASE
 #   define RETURN_DISPOSITION_KEY ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY4)
+#   define RETURN_CLAIMABLE_KEY   ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY5)
 # endif
 #else
 #   define SUPPORT_DIRECT_THREAD_KEYS 0
@@ -340,6 +341,7 @@ static bool is_valid_direct_key(tls_key_t k) {
             || k == AUTORELEASE_POOL_KEY
 #   if SUPPORT_RETURN_AUTORELEASE
             || k == RETURN_DISPOSITION_KEY
+            || k == RETURN_CLAIMABLE_KEY
 #   endif
                );
 }
@@ -386,6 +388,7 @@ static inline mach_port_t mach_thread_self_direct()
 template <bool Debug> class mutex_tt;
 template <bool Debug> class monitor_tt;
 template <bool Debug> class recursive_mutex_tt;
+template <bool Debug> class rwlock_tt;
 
 #if DEBUG
 #   define LOCKDEBUG 1
@@ -397,6 +400,7 @@ using spinlock_t = mutex_tt<LOCKDEBUG>;
 using mutex_t = mutex_tt<LOCKDEBUG>;
 using monitor_t = monitor_tt<LOCKDEBUG>;
 using recursive_mutex_t = recursive_mutex_tt<LOCKDEBUG>;
+using rwlock_t = rwlock_tt<LOCKDEBUG>;
 
 // Use fork_unsafe_lock to get a lock that isn't 
 // acquired and released around fork().
@@ -510,6 +514,15 @@ class recursive_mutex_tt : nocopy_t {
         os_unfair_recursive_lock_lock(&mLock);
     }
 
+    bool tryLock()
+    {
+        if (os_unfair_recursive_lock_trylock(&mLock)) {
+            lockdebug_recursive_mutex_lock(this);
+            return true;
+        }
+        return false;
+    }
+
     void unlock()
     {
         lockdebug_recursive_mutex_unlock(this);
@@ -584,6 +597,10 @@ class monitor_tt {
         if (err) _objc_fatal("pthread_cond_wait failed (%d)", err);
     }
 
+    // For StripedMap<monitor_t>::lockAll() and unlockAll().
+    void lock() { enter(); }
+    void unlock() { leave(); }
+
     void notify() 
     {
         int err = pthread_cond_signal(&cond);
@@ -618,6 +635,126 @@ class monitor_tt {
 };
 
 
+// Reader/writer lock. Any number of readers or one writer.
+// Neither reading nor writing is recursive, and a reader 
+// may not upgrade to writing.
+template <bool Debug>
+class rwlock_tt : nocopy_t {
+    pthread_rwlock_t mLock;
+
+  public:
+    constexpr rwlock_tt() : mLock(PTHREAD_RWLOCK_INITIALIZER) {
+        lockdebug_remember_rwlock(this);
+    }
+
+    constexpr rwlock_tt(const fork_unsafe_lock_t unsafe)
+        : mLock(PTHREAD_RWLOCK_INITIALIZER)
+    { }
+
+    void read() 
+    {
+        lockdebug_rwlock_read(this);
+
+        int err = pthread_rwlock_rdlock(&mLock);
+        if (err) _objc_fatal("pthread_rwlock_rdlock failed (%d)", err);
+    }
+
+    void unlockRead()
+    {
+        lockdebug_rwlock_unlock_read(this);
+
+        int err = pthread_rwlock_unlock(&mLock);
+        if (err) _objc_fatal("pthread_rwlock_unlock failed (%d)", err);
+    }
+
+    bool tryRead()
+    {
+        int err = pthread_rwlock_tryrdlock(&mLock);
+        if (err == 0) {
+            lockdebug_rwlock_try_read_success(this);
+            return true;
+        } else if (err == EBUSY) {
+            return false;
+        } else {
+            _objc_fatal("pthread_rwlock_tryrdlock failed (%d)", err);
+        }
+    }
+
+    void write()
+    {
+        lockdebug_rwlock_write(this);
+
+        int err = pthread_rwlock_wrlock(&mLock);
+        if (err) _objc_fatal("pthread_rwlock_wrlock failed (%d)", err);
+    }
+
+    void unlockWrite()
+    {
+        lockdebug_rwlock_unlock_write(this);
+
+        int err = pthread_rwlock_unlock(&mLock);
+        if (err) _objc_fatal("pthread_rwlock_unlock failed (%d)", err);
+    }
+
+    bool tryWrite()
+    {
+        int err = pthread_rwlock_trywrlock(&mLock);
+        if (err == 0) {
+            lockdebug_rwlock_try_write_success(this);
+            return true;
+        } else if (err == EBUSY) {
+            return false;
+        } else {
+            _objc_fatal("pthread_rwlock_trywrlock failed (%d)", err);
+        }
+    }
+
+    void forceReset()
+    {
+        lockdebug_rwlock_unlock_write(this);
+
+        bzero(&mLock, sizeof(mLock));
+        mLock = pthread_rwlock_t PTHREAD_RWLOCK_INITIALIZER;
+    }
+
+    void assertReading() {
+        lockdebug_rwlock_assert_reading(this);
+    }
+
+    void assertWriting() {
+        lockdebug_rwlock_assert_writing(this);
+    }
+
+    // Reading or writing.
+    void assertLocked() {
+        lockdebug_rwlock_assert_locked(this);
+    }
+
+    void assertUnlocked() {
+        lockdebug_rwlock_assert_unlocked(this);
+    }
+
+    // Scoped read and unlockRead
+    class reader : nocopy_t {
+        rwlock_tt& lock;
+    public:
+        reader(rwlock_tt& newLock) : lock(newLock) { lock.read(); }
+        ~reader() { lock.unlockRead(); }
+    };
+
+    // Scoped write and unlockWrite
+    class writer : nocopy_t {
+        rwlock_tt& lock;
+    public:
+        writer(rwlock_tt& newLock) : lock(newLock) { lock.write(); }
+        ~writer() { lock.unlockWrite(); }
+    };
+};
+
+using rwlock_reader_t = rwlock_tt<LOCKDEBUG>::reader;
+using rwlock_writer_t = rwlock_tt<LOCKDEBUG>::writer;
+
+
 // semaphore_create formatted for INIT_ONCE use
 static inline semaphore_t create_semaphore(void)
 {
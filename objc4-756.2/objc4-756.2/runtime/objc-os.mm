@@ -287,11 +287,17 @@ map_images_nolock(unsigned mhCount, const char * const mhPaths[],
             //遍历头信息
             const headerType *mhdr = (const headerType *)mhdrs[i];
             //给原始的头信息添加其他必要信息,将mach_header转换成header_info
+            uint64_t start = RecordStartupTrace ? nanoseconds() : 0;
             auto hi = addHeader(mhdr, mhPaths[i], totalClasses, unoptimizedTotalClasses);
             if (!hi) {
                 // no objc data in this entry
                 continue;
             }
+            if (RecordStartupTrace) {
+                _objc_traceStartupImage(mhdr, mhPaths[i]);
+                _objc_traceStartupPhase(mhdr, STARTUP_MAP_IMAGE, 
+                                        nanoseconds() - start, 0);
+            }
             //如果该头信息是可执行文件类型，则给方法个数添加相应值
             if (mhdr->filetype == MH_EXECUTE) {
                 // Size some data structures based on main executable's size
@@ -453,11 +459,32 @@ static void defineLockOrder()
     lockdebug_lock_precedes_lock(&cacheUpdateLock, &crashlog_lock);
     lockdebug_lock_precedes_lock(&objcMsgLogLock, &crashlog_lock);
     lockdebug_lock_precedes_lock(&AltHandlerDebugLock, &crashlog_lock);
-    lockdebug_lock_precedes_lock(&AssociationsManagerLock, &crashlog_lock);
+    AssociationsLocks.precedeLock(&crashlog_lock);
     SideTableLocksPrecedeLock(&crashlog_lock);
     PropertyLocks.precedeLock(&crashlog_lock);
     StructLocks.precedeLock(&crashlog_lock);
     CppObjectLocks.precedeLock(&crashlog_lock);
+    lockdebug_lock_precedes_lock(&epochLock, &crashlog_lock);
+    lockdebug_lock_precedes_lock(&PoolPageReserveLock, &crashlog_lock);
+    lockdebug_lock_precedes_lock(&ObjectPoolLock, &crashlog_lock);
+    lockdebug_lock_precedes_lock(&StartupTraceLock, &crashlog_lock);
+    lockdebug_lock_precedes_lock(&FixupPoolMonitor, &crashlog_lock);
+
+    // epochLock is a leaf lock. Memory may be retired 
+    // for lock-free readers while holding any other lock.
+    lockdebug_lock_precedes_lock(&loadMethodLock, &epochLock);
+    lockdebug_lock_precedes_lock(&classInitLock, &epochLock);
+    lockdebug_lock_precedes_lock(&runtimeLock, &epochLock);
+    lockdebug_lock_precedes_lock(&DemangleCacheLock, &epochLock);
+    lockdebug_lock_precedes_lock(&selLock, &epochLock);
+    lockdebug_lock_precedes_lock(&cacheUpdateLock, &epochLock);
+    lockdebug_lock_precedes_lock(&objcMsgLogLock, &epochLock);
+    lockdebug_lock_precedes_lock(&AltHandlerDebugLock, &epochLock);
+    AssociationsLocks.precedeLock(&epochLock);
+    SideTableLocksPrecedeLock(&epochLock);
+    PropertyLocks.precedeLock(&epochLock);
+    StructLocks.precedeLock(&epochLock);
+    CppObjectLocks.precedeLock(&epochLock);
 
     // loadMethodLock precedes everything
     // because it is held while +load methods run
@@ -469,20 +496,20 @@ static void defineLockOrder()
     lockdebug_lock_precedes_lock(&loadMethodLock, &cacheUpdateLock);
     lockdebug_lock_precedes_lock(&loadMethodLock, &objcMsgLogLock);
     lockdebug_lock_precedes_lock(&loadMethodLock, &AltHandlerDebugLock);
-    lockdebug_lock_precedes_lock(&loadMethodLock, &AssociationsManagerLock);
+    AssociationsLocks.succeedLock(&loadMethodLock);
     SideTableLocksSucceedLock(&loadMethodLock);
     PropertyLocks.succeedLock(&loadMethodLock);
     StructLocks.succeedLock(&loadMethodLock);
     CppObjectLocks.succeedLock(&loadMethodLock);
 
-    // PropertyLocks and CppObjectLocks and AssociationManagerLock 
+    // PropertyLocks and CppObjectLocks and AssociationsLocks 
     // precede everything because they are held while objc_retain() 
     // or C++ copy are called.
     // (StructLocks do not precede everything because it calls memmove only.)
     auto PropertyAndCppObjectAndAssocLocksPrecedeLock = [&](const void *lock) {
         PropertyLocks.precedeLock(lock);
         CppObjectLocks.precedeLock(lock);
-        lockdebug_lock_precedes_lock(&AssociationsManagerLock, lock);
+        AssociationsLocks.precedeLock(lock);
     };
     PropertyAndCppObjectAndAssocLocksPrecedeLock(&runtimeLock);
     PropertyAndCppObjectAndAssocLocksPrecedeLock(&DemangleCacheLock);
@@ -492,13 +519,17 @@ static void defineLockOrder()
     PropertyAndCppObjectAndAssocLocksPrecedeLock(&cacheUpdateLock);
     PropertyAndCppObjectAndAssocLocksPrecedeLock(&objcMsgLogLock);
     PropertyAndCppObjectAndAssocLocksPrecedeLock(&AltHandlerDebugLock);
+    PropertyAndCppObjectAndAssocLocksPrecedeLock(&ObjectPoolLock);
 
     SideTableLocksSucceedLocks(PropertyLocks);
     SideTableLocksSucceedLocks(CppObjectLocks);
-    SideTableLocksSucceedLock(&AssociationsManagerLock);
+    SideTableLocksSucceedLocks(AssociationsLocks);
 
-    PropertyLocks.precedeLock(&AssociationsManagerLock);
-    CppObjectLocks.precedeLock(&AssociationsManagerLock);
+    const void *assocLock;
+    for (int i = 0; (assocLock = AssociationsLocks.getLock(i)); i++) {
+        PropertyLocks.precedeLock(assocLock);
+        CppObjectLocks.precedeLock(assocLock);
+    }
     
     lockdebug_lock_precedes_lock(&classInitLock, &runtimeLock);
 
@@ -510,13 +541,42 @@ static void defineLockOrder()
     lockdebug_lock_precedes_lock(&runtimeLock, &selLock);
     lockdebug_lock_precedes_lock(&runtimeLock, &cacheUpdateLock);
     lockdebug_lock_precedes_lock(&runtimeLock, &DemangleCacheLock);
+    // Instances may be freed and pool policies set inside runtimeLock.
+    lockdebug_lock_precedes_lock(&runtimeLock, &ObjectPoolLock);
+    lockdebug_lock_precedes_lock(&loadMethodLock, &ObjectPoolLock);
+    lockdebug_lock_precedes_lock(&classInitLock, &ObjectPoolLock);
+    SideTableLocksPrecedeLock(&ObjectPoolLock);
+    // The startup trace is recorded while images are mapped and 
+    // +load methods run.
+    lockdebug_lock_precedes_lock(&runtimeLock, &StartupTraceLock);
+    lockdebug_lock_precedes_lock(&selLock, &StartupTraceLock);
+    lockdebug_lock_precedes_lock(&loadMethodLock, &StartupTraceLock);
+    // Image fixups are handed to worker threads inside 
+    // runtimeLock and selLock.
+    lockdebug_lock_precedes_lock(&runtimeLock, &FixupPoolMonitor);
+    lockdebug_lock_precedes_lock(&selLock, &FixupPoolMonitor);
+
+    // ClassMethodLocks are taken inside a read-locked runtimeLock 
+    // and are held while method lists are fixed up and caches flushed.
+    ClassMethodLocks.succeedLock(&runtimeLock);
+    ClassMethodLocks.precedeLock(&selLock);
+    ClassMethodLocks.precedeLock(&cacheUpdateLock);
+    ClassMethodLocks.precedeLock(&DemangleCacheLock);
+    ClassMethodLocks.precedeLock(&epochLock);
+
+    // ClassInitWaitMonitors are notified inside classInitLock.
+    ClassInitWaitMonitors.succeedLock(&classInitLock);
+    ClassInitWaitMonitors.precedeLock(&crashlog_lock);
 
 
     // Striped locks use address order internally.
     SideTableDefineLockOrder();
+    ClassMethodLocks.defineLockOrder();
+    ClassInitWaitMonitors.defineLockOrder();
     PropertyLocks.defineLockOrder();
     StructLocks.defineLockOrder();
     CppObjectLocks.defineLockOrder();
+    AssociationsLocks.defineLockOrder();
 }
 // LOCKDEBUG
 #endif
@@ -533,10 +593,12 @@ void _objc_atfork_prepare()
     loadMethodLock.lock();
     PropertyLocks.lockAll();
     CppObjectLocks.lockAll();
-    AssociationsManagerLock.lock();
+    AssociationsLocks.lockAll();
     SideTableLockAll();
     classInitLock.enter();
-    runtimeLock.lock();
+    ClassInitWaitMonitors.lockAll();
+    runtimeLock.write();
+    ClassMethodLocks.lockAll();
     DemangleCacheLock.lock();
 
     selLock.lock();
@@ -544,6 +606,11 @@ void _objc_atfork_prepare()
     objcMsgLogLock.lock();
     AltHandlerDebugLock.lock();
     StructLocks.lockAll();
+    PoolPageReserveLock.lock();
+    ObjectPoolLock.lock();
+    StartupTraceLock.lock();
+    FixupPoolMonitor.enter();
+    epochLock.lock();
     crashlog_lock.lock();
 
     lockdebug_assert_all_locks_locked();
@@ -557,17 +624,24 @@ void _objc_atfork_parent()
     CppObjectLocks.unlockAll();
     StructLocks.unlockAll();
     PropertyLocks.unlockAll();
-    AssociationsManagerLock.unlock();
+    AssociationsLocks.unlockAll();
     AltHandlerDebugLock.unlock();
     objcMsgLogLock.unlock();
     crashlog_lock.unlock();
+    epochLock.unlock();
+    PoolPageReserveLock.unlock();
+    ObjectPoolLock.unlock();
+    StartupTraceLock.unlock();
+    FixupPoolMonitor.leave();
     loadMethodLock.unlock();
     cacheUpdateLock.unlock();
     selLock.unlock();
     SideTableUnlockAll();
     DemangleCacheLock.unlock();
-    runtimeLock.unlock();
+    ClassMethodLocks.unlockAll();
+    runtimeLock.unlockWrite();
 
+    ClassInitWaitMonitors.unlockAll();
     classInitLock.leave();
 
     lockdebug_assert_no_locks_locked();
@@ -585,17 +659,26 @@ void _objc_atfork_child()
     CppObjectLocks.forceResetAll();
     StructLocks.forceResetAll();
     PropertyLocks.forceResetAll();
-    AssociationsManagerLock.forceReset();
+    AssociationsLocks.forceResetAll();
     AltHandlerDebugLock.forceReset();
     objcMsgLogLock.forceReset();
     crashlog_lock.forceReset();
+    epochLock.forceReset();
+    epoch_atfork_child();
+    PoolPageReserveLock.forceReset();
+    ObjectPoolLock.forceReset();
+    StartupTraceLock.forceReset();
+    FixupPoolMonitor.forceReset();
+    fixup_pool_atfork_child();
     loadMethodLock.forceReset();
     cacheUpdateLock.forceReset();
     selLock.forceReset();
     SideTableForceResetAll();
     DemangleCacheLock.forceReset();
+    ClassMethodLocks.forceResetAll();
     runtimeLock.forceReset();
 
+    ClassInitWaitMonitors.forceResetAll();
     classInitLock.forceReset();
 
     lockdebug_assert_no_locks_locked();
@@ -666,6 +749,16 @@ const header_info *_headerForClass(Class cls)
 }
 
 
+/***********************************************************************
+* _headerForCategory
+* Return the image header containing this category, or NULL.
+**********************************************************************/
+const header_info *_headerForCategory(Category cat)
+{
+    return _headerForAddress(cat);
+}
+
+
 /**********************************************************************
 * secure_open
 * Securely open a file from a world-writable directory (like /tmp)
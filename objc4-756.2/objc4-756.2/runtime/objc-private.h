@@ -155,6 +155,8 @@ public:
     bool rootRelease();
     id rootAutorelease();
     bool rootTryRetain();
+    bool rootTryRetainWithoutSideTable();
+    bool rootTryReleaseWithoutDealloc(uintptr_t count);
     bool rootReleaseShouldDealloc();
     uintptr_t rootRetainCount();
 
@@ -241,6 +243,29 @@ typedef struct property_t *objc_property_t;
 
 #include "objc-ptrauth.h"
 
+// Epoch-based reclamation for lock-free readers.
+// Readers bracket unlocked accesses with epoch_reader_t.
+// Writers unlink shared memory and pass it to epoch_retire()
+// instead of freeing it. See objc-runtime.mm for details.
+struct epoch_record_t;
+extern epoch_record_t *epoch_enter(void);
+extern void epoch_leave(epoch_record_t *record);
+extern void epoch_retire(void *ptr);
+extern void epoch_collect(void);
+extern void epoch_synchronize(void);
+extern void epoch_atfork_child(void);
+extern void fixup_pool_atfork_child(void);
+extern void _destroyEpochRecord(struct epoch_record_t *record);
+
+// Scoped epoch_enter() and epoch_leave().
+class epoch_reader_t : nocopy_t {
+    epoch_record_t *record;
+ public:
+    epoch_reader_t() : record(epoch_enter()) { }
+    ~epoch_reader_t() { epoch_leave(record); }
+};
+
+
 #include "objc-runtime-new.h"
 
 
@@ -416,6 +441,7 @@ static inline bool sectnameStartsWith(const char *sectname, const char *prefix){
 /* selectors */
 extern void sel_init(size_t selrefCount);
 extern SEL sel_registerNameNoLock(const char *str, bool copy);
+extern SEL sel_lookupNameNoLock(const char *str);
 
 extern SEL SEL_load;
 extern SEL SEL_initialize;
@@ -556,6 +582,10 @@ typedef struct {
     const char **classNameLookups;  // for objc_getClass() hooks
     unsigned classNameLookupsAllocated;
     unsigned classNameLookupsUsed;
+    struct epoch_record_t *epochRecord;  // for lock-free readers
+    struct deferred_release_buffer_t *deferredReleases;  // for OBJC_DEFER_SIDETABLE_RELEASES
+    struct alloc_magazines_t *allocMagazines;  // for OBJC_ALLOC_MAGAZINES
+    struct object_pool_cache_t *objectPools;  // for pooled instances
 
     // If you add new fields here, don't forget to update 
     // _objc_pthread_destroyspecific()
@@ -577,6 +607,9 @@ extern char *encoding_copyArgumentType(const char *t, unsigned int index);
 // sync.h
 extern void _destroySyncCache(struct SyncCache *cache);
 
+// NSObject.mm
+extern void _destroyDeferredReleaseBuffer(struct deferred_release_buffer_t *buffer);
+
 // arr
 extern void arr_init(void);
 extern id objc_autoreleaseReturnValue(id obj);
@@ -621,12 +654,61 @@ extern void _read_images(header_info **hList, uint32_t hCount, int totalClasses,
 extern void _unload_image(header_info *hi);
 
 extern const header_info *_headerForClass(Class cls);
+extern const header_info *_headerForCategory(Category cat);
 
 extern Class _class_remap(Class cls);
 extern Ivar _class_getVariable(Class cls, const char *name);
 
 extern unsigned _class_createInstancesFromZone(Class cls, size_t extraBytes, void *zone, id *results, unsigned num_requested);
 extern id _objc_constructOrFree(id bytes, Class cls);
+extern void *_objc_allocFromMagazine(size_t size);
+extern void _destroyAllocMagazines(struct alloc_magazines_t *mags);
+
+// Pooled instances. See objc_setClassAllocationPolicy().
+#if __LP64__
+#   define OBJECT_POOL_REGION_SIZE (1UL << 30)
+#else
+#   define OBJECT_POOL_REGION_SIZE (64UL << 20)
+#endif
+#define OBJECT_POOL_MAX_INSTANCE_SIZE 1024
+// ObjectPoolRegion is 0 until the first class is given the pooled 
+// policy, and then never changes. It needs no ordering: a thread 
+// freeing a pooled instance already saw the region through whatever 
+// gave it the instance, and a thread that still sees 0 has no 
+// pooled instances to free.
+extern uintptr_t ObjectPoolRegion;
+extern bool _objc_reserveObjectPools(void);
+extern void *_objc_poolAlloc(size_t size);
+extern void _objc_poolFree(void *p);
+extern void _destroyObjectPools(struct object_pool_cache_t *cache);
+
+static ALWAYS_INLINE uintptr_t 
+objectPoolRegion(void)
+{
+    return __c11_atomic_load((_Atomic(uintptr_t) *)&ObjectPoolRegion, 
+                             __ATOMIC_RELAXED);
+}
+
+static ALWAYS_INLINE bool 
+objectPoolsInUse(void)
+{
+    return objectPoolRegion() != 0;
+}
+
+// Free the memory of an instance that was allocated 
+// by calloc() or by _objc_poolAlloc().
+static ALWAYS_INLINE void 
+_objc_freeInstance(void *obj)
+{
+    uintptr_t region = objectPoolRegion();
+    if (slowpath(region)  &&  
+        (uintptr_t)obj - region < OBJECT_POOL_REGION_SIZE) 
+    {
+        _objc_poolFree(obj);
+    } else {
+        free(obj);
+    }
+}
 
 extern const char *_category_getName(Category cat);
 extern const char *_category_getClassName(Category cat);
@@ -740,6 +822,55 @@ class TimeLogger {
     }
 };
 
+
+// Startup trace, recorded when OBJC_RECORD_STARTUP_TRACE is set.
+// Each phase has one count: classes read, protocols read, refs fixed up, 
+// classes realized, categories attached, or +load methods called.
+enum startup_phase_t {
+    STARTUP_MAP_IMAGE,
+    STARTUP_DISCOVER_CLASSES,
+    STARTUP_DISCOVER_PROTOCOLS,
+    STARTUP_REMAP_CLASS_REFS,
+    STARTUP_UNIQUE_SELECTORS,
+    STARTUP_FIXUP_PROTOCOL_REFS,
+    STARTUP_REALIZE_CLASSES,
+    STARTUP_ATTACH_CATEGORIES,
+    STARTUP_PREPARE_LOAD,
+    STARTUP_CALL_LOAD,
+    STARTUP_PHASE_COUNT
+};
+
+extern void _objc_traceStartupImage(const headerType *mhdr, const char *path);
+extern void _objc_traceStartupPhase(const headerType *mhdr, 
+                                    startup_phase_t phase, 
+                                    uint64_t nanos, size_t count);
+extern void _objc_traceLoadMethod(const header_info *hi, Class cls, 
+                                  const char *categoryName, 
+                                  uint64_t start, uint64_t nanos);
+
+// Times one phase for one image and records it in the startup trace.
+class StartupPhaseTimer {
+    const headerType *mMhdr;
+    startup_phase_t mPhase;
+    uint64_t mStart;
+ public:
+    size_t count;
+
+    StartupPhaseTimer(const header_info *hi, startup_phase_t phase)
+     : mMhdr(RecordStartupTrace ? hi->mhdr() : nil)
+     , mPhase(phase)
+     , mStart(mMhdr ? nanoseconds() : 0)
+     , count(0)
+    { }
+
+    ~StartupPhaseTimer() {
+        if (mMhdr) {
+            _objc_traceStartupPhase(mMhdr, mPhase, 
+                                    nanoseconds() - mStart, count);
+        }
+    }
+};
+
 enum { CacheLineSize = 64 };
 
 // StripedMap<T> is a map of void* -> T, sized appropriately 
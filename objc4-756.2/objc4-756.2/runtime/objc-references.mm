@@ -27,183 +27,300 @@
 
 #include "objc-private.h"
 #include <objc/message.h>
-#include <map>
-
-#if _LIBCPP_VERSION
-#   include <unordered_map>
-#else
-#   include <tr1/unordered_map>
-    using namespace tr1;
-#endif
 
 
 // wrap all the murky C++ details in a namespace to get them out of the way.
 
 namespace objc_references_support {
-    struct DisguisedPointerEqual {
-        bool operator()(uintptr_t p1, uintptr_t p2) const {
-            return p1 == p2;
-        }
+    typedef uintptr_t disguised_ptr_t;
+    inline disguised_ptr_t DISGUISE(const void *value) { return ~uintptr_t(value); }
+    inline id UNDISGUISE(disguised_ptr_t dptr) { return id(~dptr); }
+
+    // Disguised values of ~0 and ~1 are neither objects nor sensible keys.
+    enum : disguised_ptr_t {
+        EMPTY_KEY     = 0,
+        TOMBSTONE_KEY = 1
     };
-    
-    struct DisguisedPointerHash {
-        uintptr_t operator()(uintptr_t k) const {
-            // borrowed from CFSet.c
-#if __LP64__
-            uintptr_t a = 0x4368726973746F70ULL;
-            uintptr_t b = 0x686572204B616E65ULL;
-#else
-            uintptr_t a = 0x4B616E65UL;
-            uintptr_t b = 0x4B616E65UL; 
-#endif
-            uintptr_t c = 1;
-            a += k;
-#if __LP64__
-            a -= b; a -= c; a ^= (c >> 43);
-            b -= c; b -= a; b ^= (a << 9);
-            c -= a; c -= b; c ^= (b >> 8);
-            a -= b; a -= c; a ^= (c >> 38);
-            b -= c; b -= a; b ^= (a << 23);
-            c -= a; c -= b; c ^= (b >> 5);
-            a -= b; a -= c; a ^= (c >> 35);
-            b -= c; b -= a; b ^= (a << 49);
-            c -= a; c -= b; c ^= (b >> 11);
-            a -= b; a -= c; a ^= (c >> 12);
-            b -= c; b -= a; b ^= (a << 18);
-            c -= a; c -= b; c ^= (b >> 22);
-#else
-            a -= b; a -= c; a ^= (c >> 13);
-            b -= c; b -= a; b ^= (a << 8);
-            c -= a; c -= b; c ^= (b >> 13);
-            a -= b; a -= c; a ^= (c >> 12);
-            b -= c; b -= a; b ^= (a << 16);
-            c -= a; c -= b; c ^= (b >> 5);
-            a -= b; a -= c; a ^= (c >> 3);
-            b -= c; b -= a; b ^= (a << 10);
-            c -= a; c -= b; c ^= (b >> 15);
-#endif
-            return c;
-        }
+
+    struct ObjcAssociation {
+        disguised_ptr_t key;
+        uintptr_t policy;
+        id value;
     };
-    
-    struct ObjectPointerLess {
-        bool operator()(const void *p1, const void *p2) const {
-            return p1 < p2;
+
+    // FlatTable is an open-addressed hash table with linear probing, 
+    // keyed by a disguised pointer stored in each Bucket's `key`.
+    // The first InlineCount buckets live inside the table itself 
+    // so small tables need no separate allocation.
+    // Zero-filled memory is a valid empty table.
+    //
+    // Writers hold the stripe lock. Readers may instead use tryRead() 
+    // inside an epoch_reader_t. Writers increment `seq` before and after 
+    // every change, so it is odd while a change is in progress, and 
+    // tryRead() discards any copy made while `seq` moved. Bucket arrays 
+    // replaced by growth are freed with epoch_retire().
+    template <typename Bucket, uint32_t InlineCount>
+    class FlatTable {
+        struct Array {
+            uint32_t capacity;  // power of two
+            Bucket first;
+
+            Bucket& at(uint32_t i) { return (&first)[i]; }
+
+            static size_t byteSize(uint32_t capacity) {
+                return offsetof(Array, first) + capacity * sizeof(Bucket);
+            }
+        };
+
+        struct InlineArray {
+            uint32_t capacity;
+            Bucket buckets[InlineCount];
+        };
+
+        uintptr_t seq;
+        Array *array;        // nil until the first insertion
+        uint32_t occupied;   // live and tombstone buckets
+        uint32_t count;      // live buckets
+        InlineArray inlineArray;
+
+        bool isInline(Array *a) const {
+            return a == (const Array *)&inlineArray;
         }
-    };
-    
-    struct ObjcPointerHash {
-        uintptr_t operator()(void *p) const {
-            return DisguisedPointerHash()(uintptr_t(p));
+
+        // Inline storage may be filled completely. 
+        // Larger tables keep a quarter of their buckets empty.
+        static uint32_t limit(uint32_t capacity) {
+            return capacity == InlineCount ? capacity : capacity / 4 * 3;
         }
-    };
 
-    // STL allocator that uses the runtime's internal allocator.
-    
-    template <typename T> struct ObjcAllocator {
-        typedef T                 value_type;
-        typedef value_type*       pointer;
-        typedef const value_type *const_pointer;
-        typedef value_type&       reference;
-        typedef const value_type& const_reference;
-        typedef size_t            size_type;
-        typedef ptrdiff_t         difference_type;
-
-        template <typename U> struct rebind { typedef ObjcAllocator<U> other; };
-
-        template <typename U> ObjcAllocator(const ObjcAllocator<U>&) {}
-        ObjcAllocator() {}
-        ObjcAllocator(const ObjcAllocator&) {}
-        ~ObjcAllocator() {}
-
-        pointer address(reference x) const { return &x; }
-        const_pointer address(const_reference x) const { 
-            return x;
+        void beginWrite() {
+            __c11_atomic_store((_Atomic(uintptr_t) *)&seq, seq + 1, 
+                               __ATOMIC_RELAXED);
+            __c11_atomic_thread_fence(__ATOMIC_RELEASE);
         }
 
-        pointer allocate(size_type n, const_pointer = 0) {
-            return static_cast<pointer>(::malloc(n * sizeof(T)));
+        void endWrite() {
+            __c11_atomic_store((_Atomic(uintptr_t) *)&seq, seq + 1, 
+                               __ATOMIC_RELEASE);
         }
 
-        void deallocate(pointer p, size_type) { ::free(p); }
+        // Returns the first empty or tombstone bucket for key.
+        // The key must not be present and the array must have room.
+        static Bucket *findSlot(Array *a, disguised_ptr_t key) {
+            uint32_t mask = a->capacity - 1;
+            uint32_t i = ptr_hash(key) & mask;
+            while (a->at(i).key != EMPTY_KEY  &&  
+                   a->at(i).key != TOMBSTONE_KEY) 
+            {
+                i = (i+1) & mask;
+            }
+            return &a->at(i);
+        }
 
-        size_type max_size() const { 
-            return static_cast<size_type>(-1) / sizeof(T);
+        void grow() {
+            Array *oldArray = array;
+            uint32_t newCapacity = oldArray ? oldArray->capacity : InlineCount;
+            while (count + 1 > limit(newCapacity)) newCapacity *= 2;
+
+            Array *newArray;
+            if (newCapacity == InlineCount) {
+                // Rebuild the inline storage in place to drop tombstones.
+                // Lock-free readers fail validation because we are 
+                // inside a write. The capacity word stays intact so 
+                // their probes stay in bounds.
+                Bucket saved[InlineCount];
+                uint32_t savedCount = 0;
+                if (oldArray) {
+                    for (uint32_t i = 0; i < oldArray->capacity; i++) {
+                        Bucket& b = oldArray->at(i);
+                        if (b.key != EMPTY_KEY  &&  b.key != TOMBSTONE_KEY) {
+                            saved[savedCount++] = b;
+                        }
+                    }
+                }
+                bzero(inlineArray.buckets, sizeof(inlineArray.buckets));
+                inlineArray.capacity = InlineCount;
+                newArray = (Array *)&inlineArray;
+                for (uint32_t i = 0; i < savedCount; i++) {
+                    *findSlot(newArray, saved[i].key) = saved[i];
+                }
+            } else {
+                newArray = (Array *)calloc(1, Array::byteSize(newCapacity));
+                newArray->capacity = newCapacity;
+                for (uint32_t i = 0; i < oldArray->capacity; i++) {
+                    Bucket& b = oldArray->at(i);
+                    if (b.key != EMPTY_KEY  &&  b.key != TOMBSTONE_KEY) {
+                        *findSlot(newArray, b.key) = b;
+                    }
+                }
+            }
+
+            occupied = count;
+            __c11_atomic_store((_Atomic(uintptr_t) *)&array, 
+                               (uintptr_t)newArray, __ATOMIC_RELEASE);
+            if (oldArray  &&  oldArray != newArray  &&  !isInline(oldArray)) {
+                epoch_retire(oldArray);
+            }
         }
 
-        void construct(pointer p, const value_type& x) { 
-            new(p) value_type(x); 
+    public:
+        uint32_t size() const { return count; }
+
+        // Locking: stripe lock must be held
+        Bucket *find(disguised_ptr_t key) {
+            Array *a = array;
+            if (!a) return nil;
+            uint32_t capacity = a->capacity;
+            uint32_t i = ptr_hash(key) & (capacity - 1);
+            for (uint32_t n = 0; n < capacity; n++) {
+                Bucket& b = a->at(i);
+                if (b.key == key) return &b;
+                if (b.key == EMPTY_KEY) return nil;
+                i = (i+1) & (capacity - 1);
+            }
+            return nil;
         }
 
-        void destroy(pointer p) { p->~value_type(); }
+        // Copies the bucket for key into result and sets found.
+        // Returns false if a writer interfered, in which case the 
+        // caller must take the stripe lock instead.
+        // Locking: none; caller must be inside an epoch_reader_t
+        bool tryRead(disguised_ptr_t key, Bucket& result, bool& found) {
+            uintptr_t start = 
+                __c11_atomic_load((_Atomic(uintptr_t) *)&seq, __ATOMIC_ACQUIRE);
+            if (start & 1) return false;
+
+            found = false;
+            Array *a = (Array *)
+                __c11_atomic_load((_Atomic(uintptr_t) *)&array, __ATOMIC_ACQUIRE);
+            if (a) {
+                // Read the capacity once. Every probe stays within it 
+                // even if the contents are changing underneath us.
+                uint32_t capacity = a->capacity;
+                uint32_t i = ptr_hash(key) & (capacity - 1);
+                for (uint32_t n = 0; n < capacity; n++) {
+                    Bucket& b = a->at(i);
+                    disguised_ptr_t k = b.key;
+                    if (k == key) {
+                        result = b;
+                        found = true;
+                        break;
+                    }
+                    if (k == EMPTY_KEY) break;
+                    i = (i+1) & (capacity - 1);
+                }
+            }
 
-        void operator=(const ObjcAllocator&);
+            __c11_atomic_thread_fence(__ATOMIC_ACQUIRE);
+            return start == 
+                __c11_atomic_load((_Atomic(uintptr_t) *)&seq, __ATOMIC_RELAXED);
+        }
 
-    };
+        // Inserts entry, or replaces the bucket with the same key.
+        // Returns true and copies the replaced bucket into *old 
+        // if there was one.
+        // Locking: stripe lock must be held
+        bool set(const Bucket& entry, Bucket *old) {
+            beginWrite();
+            Bucket *b = find(entry.key);
+            bool replaced = (b != nil);
+            if (replaced) {
+                *old = *b;
+            } else {
+                if (!array  ||  occupied + 1 > limit(array->capacity)) grow();
+                b = findSlot(array, entry.key);
+                if (b->key == EMPTY_KEY) occupied++;
+                count++;
+            }
+            *b = entry;
+            endWrite();
+            return replaced;
+        }
 
-    template<> struct ObjcAllocator<void> {
-        typedef void        value_type;
-        typedef void*       pointer;
-        typedef const void *const_pointer;
-        template <typename U> struct rebind { typedef ObjcAllocator<U> other; };
-    };
-  
-    typedef uintptr_t disguised_ptr_t;
-    inline disguised_ptr_t DISGUISE(id value) { return ~uintptr_t(value); }
-    inline id UNDISGUISE(disguised_ptr_t dptr) { return id(~dptr); }
-  
-    class ObjcAssociation {
-        uintptr_t _policy;
-        id _value;
-    public:
-        ObjcAssociation(uintptr_t policy, id value) : _policy(policy), _value(value) {}
-        ObjcAssociation() : _policy(0), _value(nil) {}
+        // Removes the bucket for key and copies it into *old.
+        // Returns false if there was no such bucket.
+        // Locking: stripe lock must be held
+        bool erase(disguised_ptr_t key, Bucket *old) {
+            Bucket *b = find(key);
+            if (!b) return false;
+            beginWrite();
+            *old = *b;
+            bzero(b, sizeof(*b));
+            b->key = TOMBSTONE_KEY;
+            count--;
+            endWrite();
+            return true;
+        }
 
-        uintptr_t policy() const { return _policy; }
-        id value() const { return _value; }
-        
-        bool hasValue() { return _value != nil; }
-    };
+        // Make every later tryRead() fail. 
+        // Used on a table that has been unlinked but may still be 
+        // visible to lock-free readers.
+        void invalidate() {
+            beginWrite();
+        }
 
+        template <typename Fn>
+        void forEach(const Fn& fn) {
+            Array *a = array;
+            if (!a) return;
+            for (uint32_t i = 0; i < a->capacity; i++) {
+                Bucket& b = a->at(i);
+                if (b.key != EMPTY_KEY  &&  b.key != TOMBSTONE_KEY) fn(b);
+            }
+        }
 
-    typedef ObjcAllocator<std::pair<void * const, ObjcAssociation> > ObjectAssociationMapAllocator;
-    class ObjectAssociationMap : public std::map<void *, ObjcAssociation, ObjectPointerLess, ObjectAssociationMapAllocator> {
-    public:
-        void *operator new(size_t n) { return ::malloc(n); }
-        void operator delete(void *ptr) { ::free(ptr); }
+        // Free a calloc'ed table that is no longer reachable.
+        // If lock-free readers may still see it, the memory is retired 
+        // instead of freed immediately.
+        void destroy(bool retire) {
+            Array *a = array;
+            if (a  &&  !isInline(a)) {
+                if (retire) epoch_retire(a);
+                else free(a);
+            }
+            if (retire) epoch_retire(this);
+            else free(this);
+        }
     };
-    typedef ObjcAllocator<std::pair<const disguised_ptr_t, ObjectAssociationMap*> > AssociationsHashMapAllocator;
-    class AssociationsHashMap : public unordered_map<disguised_ptr_t, ObjectAssociationMap *, DisguisedPointerHash, DisguisedPointerEqual, AssociationsHashMapAllocator> {
-    public:
-        void *operator new(size_t n) { return ::malloc(n); }
-        void operator delete(void *ptr) { ::free(ptr); }
+
+    // key -> ObjcAssociation, for objects with more associations 
+    // than fit in their AssociationsTableEntry.
+    // A map is made only for the third association, when the entry's 
+    // INLINE_ASSOCIATIONS slots overflow. Four inline buckets hold 
+    // the third and fourth without a separate bucket array.
+    typedef FlatTable<ObjcAssociation, 4> ObjectAssociationMap;
+
+    enum { INLINE_ASSOCIATIONS = 2 };
+
+    // An object's first associations live in `slots`. When one more 
+    // is added than the slots can hold, all of them move to `refs`.
+    // Empty slots have key EMPTY_KEY.
+    struct AssociationsTableEntry {
+        disguised_ptr_t key;
+        ObjectAssociationMap *refs;
+        ObjcAssociation slots[INLINE_ASSOCIATIONS];
+
+        ObjcAssociation *findSlot(disguised_ptr_t assocKey) {
+            for (auto& slot : slots) {
+                if (slot.key == assocKey) return &slot;
+            }
+            return nil;
+        }
     };
 
+    // disguised object -> AssociationsTableEntry, one per stripe.
+    typedef FlatTable<AssociationsTableEntry, 4> AssociationsTable;
 }
 
 using namespace objc_references_support;
 
-// class AssociationsManager manages a lock / hash table singleton pair.
-// Allocating an instance acquires the lock, and calling its assocations()
-// method lazily allocates the hash table.
-
-spinlock_t AssociationsManagerLock;
-
-class AssociationsManager {
-    // associative references: object pointer -> PtrPtrHashMap.
-    static AssociationsHashMap *_map;
-public:
-    AssociationsManager()   { AssociationsManagerLock.lock(); }
-    ~AssociationsManager()  { AssociationsManagerLock.unlock(); }
-    
-    AssociationsHashMap &associations() {
-        if (_map == NULL)
-            _map = new AssociationsHashMap();
-        return *_map;
-    }
-};
+// Associations are striped by object address. 
+// AssociationsLocks[object] guards AssociationsTables[object] 
+// and every ObjectAssociationMap reachable from it.
+// Both are zero-initialized, so no static initializer is needed.
 
-AssociationsHashMap *AssociationsManager::_map = NULL;
+StripedMap<spinlock_t> AssociationsLocks;
+static StripedMap<AssociationsTable> AssociationsTables;
 
 // expanded policy bits.
 
@@ -217,20 +334,49 @@ enum {
 }; 
 
 id _object_get_associative_reference(id object, void *key) {
+    AssociationsTable &associations = AssociationsTables[object];
+    disguised_ptr_t disguised_object = DISGUISE(object);
+    disguised_ptr_t disguised_key = DISGUISE(key);
+
+    // Try without the lock first. Values whose getter retains 
+    // still need the lock, because a concurrent setter may be 
+    // about to release them.
+    if (!DisableLockFreeAssociations) {
+        epoch_reader_t reader;
+        AssociationsTableEntry i;
+        ObjcAssociation j;
+        bool found;
+        if (associations.tryRead(disguised_object, i, found)) {
+            if (!found) return nil;
+            bool valid = true;
+            if (i.refs) {
+                valid = i.refs->tryRead(disguised_key, j, found);
+            } else if (ObjcAssociation *slot = i.findSlot(disguised_key)) {
+                j = *slot;
+            } else {
+                found = false;
+            }
+            if (valid) {
+                if (!found) return nil;
+                if (!(j.policy & OBJC_ASSOCIATION_GETTER_RETAIN)) {
+                    return j.value;
+                }
+            }
+        }
+    }
+
     id value = nil;
     uintptr_t policy = OBJC_ASSOCIATION_ASSIGN;
     {
-        AssociationsManager manager;
-        AssociationsHashMap &associations(manager.associations());
-        disguised_ptr_t disguised_object = DISGUISE(object);
-        AssociationsHashMap::iterator i = associations.find(disguised_object);
-        if (i != associations.end()) {
-            ObjectAssociationMap *refs = i->second;
-            ObjectAssociationMap::iterator j = refs->find(key);
-            if (j != refs->end()) {
-                ObjcAssociation &entry = j->second;
-                value = entry.value();
-                policy = entry.policy();
+        mutex_locker_t lock(AssociationsLocks[object]);
+        AssociationsTableEntry *i = associations.find(disguised_object);
+        if (i) {
+            ObjcAssociation *j = i->refs 
+                ? i->refs->find(disguised_key) 
+                : i->findSlot(disguised_key);
+            if (j) {
+                value = j->value;
+                policy = j->policy;
                 if (policy & OBJC_ASSOCIATION_GETTER_RETAIN) {
                     objc_retain(value);
                 }
@@ -260,11 +406,27 @@ static void releaseValue(id value, uintptr_t policy) {
 }
 
 struct ReleaseValue {
-    void operator() (ObjcAssociation &association) {
-        releaseValue(association.value(), association.policy());
+    void operator() (ObjcAssociation &association) const {
+        releaseValue(association.value, association.policy);
     }
 };
 
+// Move an entry's inline associations plus one more into a new map.
+static ObjectAssociationMap *
+spillAssociations(AssociationsTableEntry& entry, 
+                  const ObjcAssociation& association)
+{
+    ObjectAssociationMap *refs = (ObjectAssociationMap *)
+        calloc(1, sizeof(ObjectAssociationMap));
+    ObjcAssociation unused;
+    for (auto& slot : entry.slots) {
+        if (slot.key != EMPTY_KEY) refs->set(slot, &unused);
+    }
+    refs->set(association, &unused);
+    bzero(entry.slots, sizeof(entry.slots));
+    return refs;
+}
+
 void _object_set_associative_reference(id object, void *key, id value, uintptr_t policy) {
     // This code used to work when nil was passed for object and key. Some code
     // probably relies on that to not crash. Check and handle it explicitly.
@@ -276,78 +438,94 @@ void _object_set_associative_reference(id object, void *key, id value, uintptr_t
     if (object->getIsa()->forbidsAssociatedObjects())
         _objc_fatal("objc_setAssociatedObject called on instance (%p) of class %s which does not allow associated objects", object, object_getClassName(object));
     /*
-     AssociationsManager
-        AssociationsHashMap
+     AssociationsTables[object]
+        AssociationsTable
                     |
-            DISGUISE(object)  ObjectAssociationMap
-                                            |
-                                  key  ObjcAssociation
-    关联对象原理：由AssociatesManager管理的一个AssociationsHashMap存放着所有的(object,ObjectAssociationMap)对，在ObjectAssociationMap中存放着(key,ObjcAssociation(policy,value))对。
+            DISGUISE(object)  AssociationsTableEntry
+                                 |                  |
+                               slots[2]    or    ObjectAssociationMap
+                                                        |
+                                      DISGUISE(key)  ObjcAssociation
+    关联对象原理：按对象地址分片的AssociationsTable存放着(object,AssociationsTableEntry)对。前两个关联直接存放在AssociationsTableEntry的slots中，更多时全部移到ObjectAssociationMap，其中存放着(key,ObjcAssociation(policy,value))对。
      */
     // retain the new value (if any) outside the lock.
-    ObjcAssociation old_association(0, nil);
+    ObjcAssociation old_association = {};
     id new_value = value ? acquireValue(value, policy) : nil;
     {
-        AssociationsManager manager;
-        AssociationsHashMap &associations(manager.associations());
+        mutex_locker_t lock(AssociationsLocks[object]);
+        AssociationsTable &associations = AssociationsTables[object];
         disguised_ptr_t disguised_object = DISGUISE(object);
-        if (new_value) {
-            // break any existing association.
-            AssociationsHashMap::iterator i = associations.find(disguised_object);
-            if (i != associations.end()) {
-                // secondary table exists
-                ObjectAssociationMap *refs = i->second;
-                ObjectAssociationMap::iterator j = refs->find(key);
-                if (j != refs->end()) {
-                    old_association = j->second;
-                    j->second = ObjcAssociation(policy, new_value);
-                } else {
-                    (*refs)[key] = ObjcAssociation(policy, new_value);
-                }
+        disguised_ptr_t disguised_key = DISGUISE(key);
+        ObjcAssociation association = { disguised_key, policy, new_value };
+        AssociationsTableEntry *i = associations.find(disguised_object);
+        if (i  &&  i->refs) {
+            // secondary table exists.
+            if (new_value) {
+                i->refs->set(association, &old_association);
+            } else {
+                // setting the association to nil breaks the association.
+                i->refs->erase(disguised_key, &old_association);
+            }
+        } else if (i  ||  new_value) {
+            // Edit a copy of the entry and store it back whole, 
+            // so lock-free getters never see a half-written slot.
+            AssociationsTableEntry entry;
+            if (i) {
+                entry = *i;
             } else {
                 // create the new association (first time).
-                ObjectAssociationMap *refs = new ObjectAssociationMap;
-                associations[disguised_object] = refs;
-                (*refs)[key] = ObjcAssociation(policy, new_value);
-                object->setHasAssociatedObjects();
+                bzero(&entry, sizeof(entry));
+                entry.key = disguised_object;
             }
-        } else {
-            // setting the association to nil breaks the association.
-            AssociationsHashMap::iterator i = associations.find(disguised_object);
-            if (i !=  associations.end()) {
-                ObjectAssociationMap *refs = i->second;
-                ObjectAssociationMap::iterator j = refs->find(key);
-                if (j != refs->end()) {
-                    old_association = j->second;
-                    refs->erase(j);
+
+            ObjcAssociation *slot = entry.findSlot(disguised_key);
+            if (slot) old_association = *slot;
+
+            if (new_value) {
+                if (!slot  &&  !DisableInlineAssociations) {
+                    slot = entry.findSlot(EMPTY_KEY);
                 }
+                if (slot) *slot = association;
+                else entry.refs = spillAssociations(entry, association);
+            } else if (slot) {
+                // setting the association to nil breaks the association.
+                bzero(slot, sizeof(*slot));
+            }
+
+            if (new_value  ||  slot) {
+                AssociationsTableEntry unused;
+                associations.set(entry, &unused);
+                if (!i) object->setHasAssociatedObjects();
             }
         }
     }
     // release the old value (outside of the lock).
-    if (old_association.hasValue()) ReleaseValue()(old_association);
+    if (old_association.value) ReleaseValue()(old_association);
 }
 
-void _object_remove_assocations(id object) {
-    vector< ObjcAssociation,ObjcAllocator<ObjcAssociation> > elements;
+void _object_remove_assocations(id object, bool deallocating) {
+    AssociationsTableEntry i;
     {
-        AssociationsManager manager;
-        AssociationsHashMap &associations(manager.associations());
+        mutex_locker_t lock(AssociationsLocks[object]);
+        AssociationsTable &associations = AssociationsTables[object];
         if (associations.size() == 0) return;
+        if (!associations.erase(DISGUISE(object), &i)) return;
 
-        disguised_ptr_t disguised_object = DISGUISE(object);
-        AssociationsHashMap::iterator i = associations.find(disguised_object);
-        if (i != associations.end()) {
-            // copy all of the associations that need to be removed.
-            ObjectAssociationMap *refs = i->second;
-            for (ObjectAssociationMap::iterator j = refs->begin(), end = refs->end(); j != end; ++j) {
-                elements.push_back(j->second);
-            }
-            // remove the secondary table.
-            delete refs;
-            associations.erase(i);
-        }
+        // Lock-free getters that already found refs 
+        // must retry under the lock and find nothing.
+        if (i.refs) i.refs->invalidate();
     }
+
     // the calls to releaseValue() happen outside of the lock.
-    for_each(elements.begin(), elements.end(), ReleaseValue());
+    // Nothing else can reach these associations now.
+    for (auto& slot : i.slots) {
+        if (slot.key != EMPTY_KEY) ReleaseValue()(slot);
+    }
+    if (!i.refs) return;
+    i.refs->forEach(ReleaseValue());
+
+    // Nobody may legitimately read the associations of a deallocating 
+    // object, so its storage is freed right away. Otherwise a lock-free 
+    // getter on another thread may still be looking at it.
+    i.refs->destroy(!deallocating);
 }
@@ -76,6 +76,11 @@ public:
 
     template <Atomicity>
     void set(SEL newSel, IMP newImp);
+
+    // Replace sel with a tombstone that matches no selector.
+    // imp is left alone: objc_msgSend sees either the old sel and imp
+    // or the tombstone, never the old sel with some other imp.
+    void remove(SEL tombstone) { _sel = tombstone; }
 };
 
 //方法缓存
@@ -106,7 +111,9 @@ public:
     static struct bucket_t * endMarker(struct bucket_t *b, uint32_t cap);
 
     void expand();
-    void reallocate(mask_t oldCapacity, mask_t newCapacity);
+    void reallocate(mask_t oldCapacity, mask_t newCapacity, 
+                    bool migrate = false, bool compact = false);
+    mask_t tombstones();
     struct bucket_t * find(SEL sel, id receiver);//缓存查询
 
     static void bad_cache(id receiver, SEL sel, Class isa) __attribute__((noreturn));
@@ -473,8 +480,8 @@ struct locstamped_category_list_t {
 #define RW_CONSTRUCTING       (1<<26)
 // class allocated and registered
 #define RW_CONSTRUCTED        (1<<25)
-// available for use; was RW_FINALIZE_ON_MAIN_THREAD
-// #define RW_24 (1<<24)
+// class instances come from pooled memory; was RW_FINALIZE_ON_MAIN_THREAD
+#define RW_POOLED_INSTANCES   (1<<24)
 // class +load has been called
 #define RW_LOADED             (1<<23)
 #if !SUPPORT_NONPOINTER_ISA
@@ -728,6 +735,12 @@ class list_array_tt {
         arrayAndFlag = (uintptr_t)array | 1;
     }
 
+    // Store a fully-initialized list or array for lock-free readers.
+    void publish(uintptr_t bits) {
+        __c11_atomic_store((_Atomic(uintptr_t) *)&arrayAndFlag, 
+                           bits, __ATOMIC_RELEASE);
+    }
+
  public:
 
     uint32_t count() {
@@ -779,35 +792,60 @@ class list_array_tt {
         }
     }
 
+    // Lock-free readers use this instead of beginLists()/endLists().
+    // The list pointer is read exactly once. A single list is copied 
+    // into storage so a concurrent attachLists() can't move it.
+    // Call only inside an epoch read-side section.
+    List** beginListsUnlocked(List** &end, List* &storage) const {
+        uintptr_t bits = 
+            __c11_atomic_load((_Atomic(uintptr_t) *)&arrayAndFlag, 
+                              __ATOMIC_ACQUIRE);
+        if (bits & 1) {
+            array_t *a = (array_t *)(bits & ~1);
+            end = a->lists + a->count;
+            return a->lists;
+        }
+        storage = (List *)bits;
+        end = storage ? &storage + 1 : &storage;
+        return &storage;
+    }
+
     void attachLists(List* const * addedLists, uint32_t addedCount) {
         if (addedCount == 0) return;
-        //
+
+        // Lock-free readers may be walking the current array.
+        // Build the new array completely, then publish it with a 
+        // single release store. The old array is retired, not freed.
         if (hasArray()) {
             //首先给类的数据（方法，属性，协议）列表扩容，再将类的数据放到最后，将addedLists（也就是分类数据）移到前面位置：可以解释的了，分类的方法调用先与分类的方法（指的是相同方法名的方法）
             // many lists -> many lists
-            uint32_t oldCount = array()->count;
+            array_t *oldArray = array();
+            uint32_t oldCount = oldArray->count;
             uint32_t newCount = oldCount + addedCount;
-            setArray((array_t *)realloc(array(), array_t::byteSize(newCount)));
-            array()->count = newCount;
-            memmove(array()->lists + addedCount, array()->lists, 
-                    oldCount * sizeof(array()->lists[0]));
-            memcpy(array()->lists, addedLists, 
-                   addedCount * sizeof(array()->lists[0]));
+            array_t *newArray = (array_t *)malloc(array_t::byteSize(newCount));
+            newArray->count = newCount;
+            memcpy(newArray->lists + addedCount, oldArray->lists, 
+                   oldCount * sizeof(oldArray->lists[0]));
+            memcpy(newArray->lists, addedLists, 
+                   addedCount * sizeof(newArray->lists[0]));
+            publish((uintptr_t)newArray | 1);
+            epoch_retire(oldArray);
         }
         else if (!list  &&  addedCount == 1) {
             // 0 lists -> 1 list
-            list = addedLists[0];
+            publish((uintptr_t)addedLists[0]);
         } 
         else {
             // 1 list -> many lists
             List* oldList = list;
             uint32_t oldCount = oldList ? 1 : 0;
             uint32_t newCount = oldCount + addedCount;
-            setArray((array_t *)malloc(array_t::byteSize(newCount)));
-            array()->count = newCount;
-            if (oldList) array()->lists[addedCount] = oldList;
-            memcpy(array()->lists, addedLists, 
-                   addedCount * sizeof(array()->lists[0]));
+            array_t *newArray = (array_t *)malloc(array_t::byteSize(newCount));
+            newArray->count = newCount;
+            if (oldList) newArray->lists[addedCount] = oldList;
+            memcpy(newArray->lists, addedLists, 
+                   addedCount * sizeof(newArray->lists[0]));
+            publish((uintptr_t)newArray | 1);
         }
     }
 
@@ -906,6 +944,25 @@ struct class_rw_t {
     uint32_t index;
 #endif
 
+    // Built by object_copy() on first use. See copyPlanForClass().
+    struct copy_plan_t *copyPlan;
+
+    // Built by class_conformsToProtocol() on first use. 
+    // See conformanceCacheForClass().
+    struct conformance_cache_t *conformanceCache;
+
+    // Built by method lookups for classes with many method lists. 
+    // See methodIndexForClass().
+    struct method_index_t *methodIndex;
+
+    // Counts changes to methods. Odd while attachMethodLists() 
+    // is changing them. See methodIndexForClass().
+    uintptr_t methodsGeneration;
+
+    // Hash tables for big method lists, built by method lookups. 
+    // See methodHashForList().
+    struct method_hash_t *methodHashes;
+
     void setFlags(uint32_t set) 
     {
         OSAtomicOr32Barrier(set, &flags);
@@ -913,7 +970,8 @@ struct class_rw_t {
 
     void clearFlags(uint32_t clear) 
     {
-        OSAtomicXor32Barrier(clear, &flags);
+        // Not Xor: concurrent clears of the same bit must not set it again.
+        OSAtomicAnd32Barrier(~clear, &flags);
     }
 
     // set and clear must not overlap
@@ -1387,6 +1445,11 @@ struct objc_class : objc_object {
         return (data()->flags & RW_FORBIDS_ASSOCIATED_OBJECTS);
     }
 
+    // Set by objc_setClassAllocationPolicy(). Not inherited.
+    bool hasPooledInstances() {
+        return data()->flags & RW_POOLED_INSTANCES;
+    }
+
 #if SUPPORT_NONPOINTER_ISA
     // Tracked in non-pointer isas; not tracked otherwise
 #else
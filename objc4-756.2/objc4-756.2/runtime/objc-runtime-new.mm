@@ -51,13 +51,19 @@ static bool methodListImplementsRR(const method_list_t *mlist);
 static bool methodListImplementsAWZ(const method_list_t *mlist);
 static void updateCustomRR_AWZ(Class cls, method_t *meth);
 static method_t *search_method_list(const method_list_t *mlist, SEL sel);
-static void flushCaches(Class cls);
+static void flushCaches(Class cls, objc_cache_flush_cause cause);
+static void attachMethodLists(Class cls, method_list_t * const *lists, 
+                              uint32_t count);
+static void flushCachesForSelectors(Class cls, SEL *sels, uint32_t count, 
+                                    objc_cache_flush_cause cause);
 static void initializeTaggedPointerObfuscator(void);
 #if SUPPORT_FIXUP
 static void fixupMessageRef(message_ref_t *msg);
 #endif
-static Class realizeClassMaybeSwiftAndUnlock(Class cls, mutex_t& lock);
+static Class realizeClassMaybeSwiftAndUnlock(Class cls, rwlock_t& lock);
 static Class readClass(Class cls, bool headerIsBundle, bool headerIsPreoptimized);
+static void protocolsChanged(void);
+static void dropConformanceCache(Class cls);
 
 static bool MetaclassNSObjectAWZSwizzled;
 static bool ClassNSObjectRRSwizzled;
@@ -66,11 +72,22 @@ static bool ClassNSObjectRRSwizzled;
 /***********************************************************************
 * Lock management
 **********************************************************************/
-mutex_t runtimeLock;
+// runtimeLock is write-locked by anything that realizes classes, 
+// attaches categories, or changes class and protocol tables.
+// Read-only introspection of realized classes only read-locks it.
+rwlock_t runtimeLock;
 mutex_t selLock;
 mutex_t cacheUpdateLock;
 recursive_mutex_t loadMethodLock;
 
+// ClassMethodLocks serialize changes to and copies of one class's 
+// method lists when runtimeLock is only read-locked 
+// (class_addMethod and friends, class_copyMethodList).
+// Anything with runtimeLock write-locked may change method lists 
+// without them, because no reader of runtimeLock can be running.
+// Unlocked readers of method lists use epoch_reader_t instead.
+StripedMap<mutex_t> ClassMethodLocks;
+
 void lock_init(void)
 {
 }
@@ -356,7 +373,7 @@ void *object_getIndexedIvars(id obj)
 **********************************************************************/
 static class_ro_t *make_ro_writeable(class_rw_t *rw)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     if (rw->flags & RW_COPIED_RO) {
         // already writeable, do nothing
@@ -381,8 +398,11 @@ static NXMapTable *unattachedCategories(void)
 
     if (category_map) return category_map;
 
+    // Read-locked callers may get here concurrently.
     // fixme initial map size
-    category_map = NXCreateMapTable(NXPtrValueMapPrototype, 16);
+    INIT_ONCE_PTR(category_map, 
+                  NXCreateMapTable(NXPtrValueMapPrototype, 16), 
+                  NXFreeMapTable(v));
 
     return category_map;
 }
@@ -495,7 +515,7 @@ static bool isKnownClass(Class cls) {
 * Locking: runtimeLock must be held by the caller.
 **********************************************************************/
 static void addClassTableEntry(Class cls, bool addMeta = true) {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     // This class is allowed to be a known class via the shared cache or via
     // data segments, but it is not allowed to be in the dynamic table already.
@@ -529,7 +549,7 @@ static void checkIsKnownClass(Class cls)
 static void addUnattachedCategoryForClass(category_t *cat, Class cls, 
                                           header_info *catHeader)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     // DO NOT use cat->cls! cls may be cat->cls->isa instead
     NXMapTable *cats = unattachedCategories();
@@ -555,7 +575,7 @@ static void addUnattachedCategoryForClass(category_t *cat, Class cls,
 **********************************************************************/
 static void removeUnattachedCategoryForClass(category_t *cat, Class cls)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     // DO NOT use cat->cls! cls may be cat->cls->isa instead
     NXMapTable *cats = unattachedCategories();
@@ -599,7 +619,7 @@ unattachedCategoriesForClass(Class cls, bool realizing)
 **********************************************************************/
 static void removeAllUnattachedCategoriesForClass(Class cls)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     void *list = NXMapRemove(unattachedCategories(), cls);
     if (list) free(list);
@@ -764,63 +784,99 @@ prepareMethodLists(Class cls, method_list_t **addedLists, int addedCount,
 // Attach method lists and properties and protocols from categories to a class.
 // Assumes the categories in cats are all loaded and sorted by load order, 
 // oldest categories first.
+// The lists are gathered on the stack in batches of ATTACH_BUFSIZ. 
+// Each buffer is filled from the end, so the newest category of a batch 
+// comes first, and each batch is attached in front of the older ones.
 static void 
 attachCategories(Class cls, category_list *cats, bool flush_caches)
 {
+    runtimeLock.assertWriting();
+
     if (!cats) return;
     if (PrintReplacedMethods) printReplacements(cls, cats);
 
     bool isMeta = cls->isMetaClass();
 
-    // fixme rearrange to remove these intermediate allocations
-    //这里需要注意的是添加的方式，首先创建二维数组，用于存放分类的方法列表，属性列表，协议列表
-    method_list_t **mlists = (method_list_t **)
-        malloc(cats->count * sizeof(*mlists));
-    property_list_t **proplists = (property_list_t **)
-        malloc(cats->count * sizeof(*proplists));
-    protocol_list_t **protolists = (protocol_list_t **)
-        malloc(cats->count * sizeof(*protolists));
-
-    // Count backwards through cats to get newest categories first
-    int mcount = 0;
-    int propcount = 0;
-    int protocount = 0;
-    int i = cats->count;
+    constexpr uint32_t ATTACH_BUFSIZ = 64;
+    method_list_t   *mlists[ATTACH_BUFSIZ];
+    property_list_t *proplists[ATTACH_BUFSIZ];
+    protocol_list_t *protolists[ATTACH_BUFSIZ];
+
+    // Selectors to flush from the caches. If there are more than 
+    // fit here, the caches are flushed completely instead.
+    constexpr uint32_t FLUSH_BUFSIZ = 256;
+    SEL flushSels[FLUSH_BUFSIZ];
+    uint32_t flushCount = 0;
+    bool flushAll = false;
+
+    uint32_t mcount = 0;
+    uint32_t propcount = 0;
+    uint32_t protocount = 0;
     bool fromBundle = NO;
-    //操作顺序，递减存放，先参加编译的分类数据会被排到数组后面，后编译的分类数据会被放到前面
-    while (i--) {
+    bool addedProtocols = NO;
+    auto rw = cls->data();
+
+    auto attachMethodBatch = [&]{
+        method_list_t **batch = mlists + ATTACH_BUFSIZ - mcount;
+        prepareMethodLists(cls, batch, mcount, NO, fromBundle);
+        attachMethodLists(cls, batch, mcount);
+        if (flush_caches) {
+            for (uint32_t i = 0; i < mcount; i++) {
+                for (auto& meth : *batch[i]) {
+                    if (flushCount == FLUSH_BUFSIZ) flushAll = true;
+                    else flushSels[flushCount++] = meth.name;
+                }
+            }
+        }
+        mcount = 0;
+        fromBundle = NO;
+    };
+
+    for (uint32_t i = 0; i < cats->count; i++) {
         auto& entry = cats->list[i];
 
         method_list_t *mlist = entry.cat->methodsForMeta(isMeta);
         if (mlist) {
-            mlists[mcount++] = mlist;
+            if (mcount == ATTACH_BUFSIZ) attachMethodBatch();
+            mlists[ATTACH_BUFSIZ - ++mcount] = mlist;
             fromBundle |= entry.hi->isBundle();
         }
 
         property_list_t *proplist = 
             entry.cat->propertiesForMeta(isMeta, entry.hi);
         if (proplist) {
-            proplists[propcount++] = proplist;
+            if (propcount == ATTACH_BUFSIZ) {
+                rw->properties.attachLists(proplists, propcount);
+                propcount = 0;
+            }
+            proplists[ATTACH_BUFSIZ - ++propcount] = proplist;
         }
 
         protocol_list_t *protolist = entry.cat->protocols;
         if (protolist) {
-            protolists[protocount++] = protolist;
+            if (protocount == ATTACH_BUFSIZ) {
+                rw->protocols.attachLists(protolists, protocount);
+                protocount = 0;
+            }
+            protolists[ATTACH_BUFSIZ - ++protocount] = protolist;
+            addedProtocols = YES;
         }
     }
-    //rw获取到的是类对象中bits，这个bits数据中存放了是class_rw_t,包含有类的方法列表，协议列表，属性列表，以及class_ro_t这个包含了类编译时的大部分信息（instanceSize,ivars,只读的方法列表，属性列表，协议列表等）
-    auto rw = cls->data();
-    //下面只说明方法的合并操作
-    prepareMethodLists(cls, mlists, mcount, NO, fromBundle);
-    rw->methods.attachLists(mlists, mcount);
-    free(mlists);
-    if (flush_caches  &&  mcount > 0) flushCaches(cls);
 
-    rw->properties.attachLists(proplists, propcount);
-    free(proplists);
+    if (mcount > 0) attachMethodBatch();
+    rw->properties.attachLists(proplists + ATTACH_BUFSIZ - propcount, 
+                               propcount);
+    rw->protocols.attachLists(protolists + ATTACH_BUFSIZ - protocount, 
+                              protocount);
 
-    rw->protocols.attachLists(protolists, protocount);
-    free(protolists);
+    if (flushAll) {
+        flushCaches(cls, OBJC_CACHE_FLUSH_CATEGORY);
+    } else if (flushCount > 0) {
+        // Only the categories' selectors can dispatch differently now.
+        flushCachesForSelectors(cls, flushSels, flushCount, 
+                                OBJC_CACHE_FLUSH_CATEGORY);
+    }
+    if (addedProtocols) dropConformanceCache(cls);
 }
 
 
@@ -832,7 +888,7 @@ attachCategories(Class cls, category_list *cats, bool flush_caches)
 **********************************************************************/
 static void methodizeClass(Class cls)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     bool isMeta = cls->isMetaClass();
     auto rw = cls->data();
@@ -848,7 +904,7 @@ static void methodizeClass(Class cls)
     method_list_t *list = ro->baseMethods();
     if (list) {
         prepareMethodLists(cls, &list, 1, YES, isBundleClass(cls));
-        rw->methods.attachLists(&list, 1);
+        attachMethodLists(cls, &list, 1);
     }
 
     property_list_t *proplist = ro->baseProperties;
@@ -909,7 +965,7 @@ static void remethodizeClass(Class cls)
     category_list *cats;
     bool isMeta;
 
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     isMeta = cls->isMetaClass();
 
@@ -964,7 +1020,7 @@ static NXMapTable *nonMetaClasses(void)
 **********************************************************************/
 static void addNonMetaClass(Class cls)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
     void *old;
     old = NXMapInsert(nonMetaClasses(), cls->ISA(), cls);
 
@@ -976,7 +1032,7 @@ static void addNonMetaClass(Class cls)
 
 static void removeNonMetaClass(Class cls)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
     NXMapRemove(nonMetaClasses(), cls->ISA());
 }
 
@@ -1153,7 +1209,7 @@ static Class getClassExceptSomeSwift(const char *name)
 **********************************************************************/
 static void addNamedClass(Class cls, const char *name, Class replacing = nil)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
     Class old;
     if ((old = getClassExceptSomeSwift(name))  &&  old != replacing) {
         inform_duplicate(name, old, cls);
@@ -1179,7 +1235,7 @@ static void addNamedClass(Class cls, const char *name, Class replacing = nil)
 **********************************************************************/
 static void removeNamedClass(Class cls, const char *name)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
     assert(!(cls->data()->flags & RO_META));
     if (cls == NXMapGet(gdb_objc_realized_classes, name)) {
         NXMapRemove(gdb_objc_realized_classes, name);
@@ -1223,8 +1279,9 @@ static NXMapTable *futureNamedClasses()
     if (future_named_class_map) return future_named_class_map;
 
     // future_named_class_map is big enough for CF's classes and a few others
-    future_named_class_map = 
-        NXCreateMapTable(NXStrValueMapPrototype, 32);
+    INIT_ONCE_PTR(future_named_class_map, 
+                  NXCreateMapTable(NXStrValueMapPrototype, 32), 
+                  NXFreeMapTable(v));
 
     return future_named_class_map;
 }
@@ -1244,7 +1301,7 @@ static void addFutureNamedClass(const char *name, Class cls)
 {
     void *old;
 
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     if (PrintFuture) {
         _objc_inform("FUTURE: reserving %p for %s", (void*)cls, name);
@@ -1271,7 +1328,7 @@ static void addFutureNamedClass(const char *name, Class cls)
 **********************************************************************/
 static Class popFutureNamedClass(const char *name)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     Class cls = nil;
 
@@ -1338,7 +1395,7 @@ static bool noClassesRemapped(void)
 **********************************************************************/
 static void addRemappedClass(Class oldcls, Class newcls)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     if (PrintFuture) {
         _objc_inform("FUTURE: using %p instead of %p for %s", 
@@ -1381,7 +1438,7 @@ static Class remapClass(classref_t cls)
 
 Class _class_remap(Class cls)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
     return remapClass(cls);
 }
 
@@ -1527,13 +1584,13 @@ static Class getMaybeUnrealizedNonMetaClass(Class metacls, id inst)
 *   On exit the lock is re-acquired or dropped as requested by leaveLocked.
 **********************************************************************/
 static Class initializeAndMaybeRelock(Class cls, id inst,
-                                      mutex_t& lock, bool leaveLocked)
+                                      rwlock_t& lock, bool leaveLocked)
 {
-    lock.assertLocked();
+    lock.assertWriting();
     assert(cls->isRealized());
 
     if (cls->isInitialized()) {
-        if (!leaveLocked) lock.unlock();
+        if (!leaveLocked) lock.unlockWrite();
         return cls;
     }
 
@@ -1546,7 +1603,7 @@ static Class initializeAndMaybeRelock(Class cls, id inst,
         // nonmeta is cls, which was already realized
         // OR nonmeta is distinct, but is already realized
         // - nothing else to do
-        lock.unlock();
+        lock.unlockWrite();
     } else {
         nonmeta = realizeClassMaybeSwiftAndUnlock(nonmeta, lock);
         // runtimeLock is now unlocked
@@ -1560,19 +1617,19 @@ static Class initializeAndMaybeRelock(Class cls, id inst,
     //去调用initialize
     initializeNonMetaClass(nonmeta);
 
-    if (leaveLocked) runtimeLock.lock();
+    if (leaveLocked) runtimeLock.write();
     return cls;
 }
 
 // Locking: acquires runtimeLock
 Class class_initialize(Class cls, id obj)
 {
-    runtimeLock.lock();
+    runtimeLock.write();
     return initializeAndMaybeRelock(cls, obj, runtimeLock, false);
 }
 
 // Locking: caller must hold runtimeLock; this may drop and re-acquire it
-static Class initializeAndLeaveLocked(Class cls, id obj, mutex_t& lock)
+static Class initializeAndLeaveLocked(Class cls, id obj, rwlock_t& lock)
 {
     return initializeAndMaybeRelock(cls, obj, lock, true);
 }
@@ -1592,7 +1649,7 @@ Class firstRealizedClass()
 
 static void addRootClass(Class cls)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     assert(cls->isRealized());
     cls->data()->nextSiblingClass = _firstRealizedClass;
@@ -1601,7 +1658,7 @@ static void addRootClass(Class cls)
 
 static void removeRootClass(Class cls)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     Class *classp;
     for (classp = &_firstRealizedClass; 
@@ -1620,7 +1677,7 @@ static void removeRootClass(Class cls)
 **********************************************************************/
 static void addSubclass(Class supercls, Class subcls)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     if (supercls  &&  subcls) {
         assert(supercls->isRealized());
@@ -1660,7 +1717,7 @@ static void addSubclass(Class supercls, Class subcls)
 **********************************************************************/
 static void removeSubclass(Class supercls, Class subcls)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
     assert(supercls->isRealized());
     assert(subcls->isRealized());
     assert(subcls->superclass == supercls);
@@ -1700,17 +1757,15 @@ static NXMapTable *protocols(void)
 * Looks up a protocol by name. Demangled Swift names are recognized.
 * Locking: runtimeLock must be read- or write-locked by the caller.
 **********************************************************************/
-static Protocol *getProtocol(const char *name)
+static Protocol *getProtocolInMap(NXMapTable *map, const char *name)
 {
-    runtimeLock.assertLocked();
-
     // Try name as-is.
-    Protocol *result = (Protocol *)NXMapGet(protocols(), name);
+    Protocol *result = (Protocol *)NXMapGet(map, name);
     if (result) return result;
 
     // Try Swift-mangled equivalent of the given name.
     if (char *swName = copySwiftV1MangledName(name, true/*isProtocol*/)) {
-        result = (Protocol *)NXMapGet(protocols(), swName);
+        result = (Protocol *)NXMapGet(map, swName);
         free(swName);
         return result;
     }
@@ -1718,6 +1773,13 @@ static Protocol *getProtocol(const char *name)
     return nil;
 }
 
+static Protocol *getProtocol(const char *name)
+{
+    runtimeLock.assertLocked();
+
+    return getProtocolInMap(protocols(), name);
+}
+
 
 /***********************************************************************
 * remapProtocol
@@ -1761,7 +1823,7 @@ static void remapProtocolRef(protocol_t **protoref)
 **********************************************************************/
 static void moveIvars(class_ro_t *ro, uint32_t superSize)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     uint32_t diff;
 
@@ -1914,7 +1976,7 @@ static void reconcileInstanceVariables(Class cls, Class supercls, const class_ro
 **********************************************************************/
 static Class realizeClassWithoutSwift(Class cls)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     const class_ro_t *ro;
     class_rw_t *rw;
@@ -2074,7 +2136,7 @@ Class _objc_realizeClassFromSwift(Class cls, void *previously)
                         "but libobjc does not support that.", previously);
         } else {
             // #1 and #2: realization in place, or new class
-            mutex_locker_t lock(runtimeLock);
+            rwlock_writer_t lock(runtimeLock);
 
             if (!previously) {
                 // #2: new class
@@ -2123,12 +2185,12 @@ static Class realizeSwiftClass(Class cls)
     // if we add support for ObjC sublasses of Swift classes.
 
 #if DEBUG
-    runtimeLock.lock();
+    runtimeLock.read();
     assert(remapClass(cls) == cls);
     assert(cls->isSwiftStable_ButAllowLegacyForNow());
     assert(!cls->isMetaClassMaybeUnrealized());
     assert(cls->superclass);
-    runtimeLock.unlock();
+    runtimeLock.unlockRead();
 #endif
 
     // Look for a Swift metadata initialization function
@@ -2159,7 +2221,7 @@ static Class realizeSwiftClass(Class cls)
     else {
         // No Swift-side initialization callback.
         // Perform our own realization directly.
-        mutex_locker_t lock(runtimeLock);
+        rwlock_writer_t lock(runtimeLock);
         return realizeClassWithoutSwift(cls);
     }
 }
@@ -2177,35 +2239,35 @@ static Class realizeSwiftClass(Class cls)
 * This complication avoids repeated lock transitions in some cases.
 **********************************************************************/
 static Class
-realizeClassMaybeSwiftMaybeRelock(Class cls, mutex_t& lock, bool leaveLocked)
+realizeClassMaybeSwiftMaybeRelock(Class cls, rwlock_t& lock, bool leaveLocked)
 {
-    lock.assertLocked();
+    lock.assertWriting();
 
     if (!cls->isSwiftStable_ButAllowLegacyForNow()) {
         // Non-Swift class. Realize it now with the lock still held.
         // fixme wrong in the future for objc subclasses of swift classes
         realizeClassWithoutSwift(cls);
-        if (!leaveLocked) lock.unlock();
+        if (!leaveLocked) lock.unlockWrite();
     } else {
         // Swift class. We need to drop locks and call the Swift
         // runtime to initialize it.
-        lock.unlock();
+        lock.unlockWrite();
         cls = realizeSwiftClass(cls);
         assert(cls->isRealized());    // callback must have provoked realization
-        if (leaveLocked) lock.lock();
+        if (leaveLocked) lock.write();
     }
 
     return cls;
 }
 
 static Class
-realizeClassMaybeSwiftAndUnlock(Class cls, mutex_t& lock)
+realizeClassMaybeSwiftAndUnlock(Class cls, rwlock_t& lock)
 {
     return realizeClassMaybeSwiftMaybeRelock(cls, lock, false);
 }
 
 static Class
-realizeClassMaybeSwiftAndLeaveLocked(Class cls, mutex_t& lock)
+realizeClassMaybeSwiftAndLeaveLocked(Class cls, rwlock_t& lock)
 {
     return realizeClassMaybeSwiftMaybeRelock(cls, lock, true);
 }
@@ -2243,7 +2305,7 @@ missingWeakSuperclass(Class cls)
 **********************************************************************/
 static void realizeAllClassesInImage(header_info *hi)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     size_t count, i;
     classref_t *classlist;
@@ -2275,7 +2337,7 @@ static void realizeAllClassesInImage(header_info *hi)
 **********************************************************************/
 static void realizeAllClasses(void)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     header_info *hi;
     for (hi = FirstHeader; hi; hi = hi->getNext()) {
@@ -2293,7 +2355,7 @@ static void realizeAllClasses(void)
 **********************************************************************/
 Class _objc_allocateFutureClass(const char *name)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     Class cls;
     NXMapTable *map = futureNamedClasses();
@@ -2353,20 +2415,60 @@ BOOL _class_isFutureClass(Class cls)
 * and subclasses thereof. Nil flushes all classes.)
 * Locking: acquires runtimeLock
 **********************************************************************/
-static void flushCaches(Class cls)
+static void flushCaches(Class cls, objc_cache_flush_cause cause)
+{
+    runtimeLock.assertLocked();
+
+    mutex_locker_t lock(cacheUpdateLock);
+
+    cache_recordFlush(cause);
+
+    if (cls) {
+        foreach_realized_class_and_subclass(cls, ^(Class c){
+            cache_erase_nolock(c, cause);
+        });
+    }
+    else {
+        foreach_realized_class_and_metaclass(^(Class c){
+            cache_erase_nolock(c, cause);
+        });
+    }
+}
+
+
+/***********************************************************************
+* flushCachesForSelectors
+* Removes sels from the caches of cls and its subclasses, 
+* or of all classes if cls is nil. Other cache entries are kept.
+* Use this when only the methods for sels changed. 
+* sels is sorted in place.
+* Locking: runtimeLock must be held by the caller
+**********************************************************************/
+static void flushCachesForSelectors(Class cls, SEL *sels, uint32_t count, 
+                                    objc_cache_flush_cause cause)
 {
     runtimeLock.assertLocked();
 
+    if (DisableSelectiveFlush) {
+        flushCaches(cls, cause);
+        return;
+    }
+
+    std::sort(sels, sels + count);
+    count = (uint32_t)(std::unique(sels, sels + count) - sels);
+
     mutex_locker_t lock(cacheUpdateLock);
 
+    cache_recordFlush(cause);
+
     if (cls) {
         foreach_realized_class_and_subclass(cls, ^(Class c){
-            cache_erase_nolock(c);
+            cache_eraseSelectors_nolock(c, sels, count, cause);
         });
     }
     else {
         foreach_realized_class_and_metaclass(^(Class c){
-            cache_erase_nolock(c);
+            cache_eraseSelectors_nolock(c, sels, count, cause);
         });
     }
 }
@@ -2375,10 +2477,10 @@ static void flushCaches(Class cls)
 void _objc_flush_caches(Class cls)
 {
     {
-        mutex_locker_t lock(runtimeLock);
-        flushCaches(cls);
+        rwlock_writer_t lock(runtimeLock);
+        flushCaches(cls, OBJC_CACHE_FLUSH_EXPLICIT);
         if (cls  &&  cls->superclass  &&  cls != cls->getIsa()) {
-            flushCaches(cls->getIsa());
+            flushCaches(cls->getIsa(), OBJC_CACHE_FLUSH_EXPLICIT);
         } else {
             // cls is a root class or root metaclass. Its metaclass is itself
             // or a subclass so the metaclass caches were already flushed.
@@ -2404,7 +2506,7 @@ void
 map_images(unsigned count, const char * const paths[],
            const struct mach_header * const mhdrs[])
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
     //关键，将传入的mhdrs数组转换成header_info数组输出
     return map_images_nolock(count, paths, mhdrs);
 }
@@ -2429,9 +2531,15 @@ load_images(const char *path __unused, const struct mach_header *mh)
 
     // Discover load methods
     {
-        mutex_locker_t lock2(runtimeLock);
+        rwlock_writer_t lock2(runtimeLock);
+        uint64_t start = RecordStartupTrace ? nanoseconds() : 0;
         //加载有load方法的类，父类，分类：加载顺序为父类》本类》分类
         prepare_load_methods((const headerType *)mh);
+        if (RecordStartupTrace) {
+            _objc_traceStartupPhase((const headerType *)mh, 
+                                    STARTUP_PREPARE_LOAD, 
+                                    nanoseconds() - start, 0);
+        }
     }
     //调用load方法，runtime中call_load_methods里是通过load方法的地址直接调用的load方法，而不是通过消息机制来调用的。
     // Call +load methods (without runtimeLock - re-entrant)
@@ -2449,7 +2557,7 @@ void
 unmap_image(const char *path __unused, const struct mach_header *mh)
 {
     recursive_mutex_locker_t lock(loadMethodLock);
-    mutex_locker_t lock2(runtimeLock);
+    rwlock_writer_t lock2(runtimeLock);
     unmap_image_nolock(mh);
 }
 
@@ -2624,6 +2732,7 @@ readProtocol(protocol_t *newproto, Class protocol_class,
     auto insertFn = headerIsBundle ? NXMapKeyCopyingInsert : NXMapInsert;
 
     protocol_t *oldproto = (protocol_t *)getProtocol(newproto->mangledName);
+    if (!oldproto) protocolsChanged();
 
     if (oldproto) {
         // Some other definition already won.
@@ -2700,6 +2809,370 @@ readProtocol(protocol_t *newproto, Class protocol_class,
     }
 }
 
+/***********************************************************************
+* Parallel image fixups
+* Class ref remapping, selector ref uniquing, and @protocol ref fixup 
+* each touch only one image's refs plus lookups in tables that nobody 
+* inserts into meanwhile. After launch, _read_images runs them for 
+* many images at once on a small pool of worker threads, holding 
+* runtimeLock, selLock, and dyld's lock on the workers' behalf. 
+* 
+* The workers must take no runtime or dyld locks: they call only 
+* fixupImage(), which takes no locks, allocates nothing, and writes 
+* only its own preallocated image_fixups_t. Selectors that are not 
+* registered yet, timings, and startup trace records are handled 
+* afterwards on the calling thread.
+* 
+* The pool uses plain pthreads rather than libdispatch, which itself 
+* uses libobjc. During _objc_init and launch the fixups run serially 
+* on the calling thread, and no worker threads exist.
+**********************************************************************/
+#define PARALLEL_FIXUP_MIN_REFS 16384
+
+enum { FIXUP_CLASSREFS, FIXUP_SELREFS, FIXUP_PROTOREFS, FIXUP_PHASES };
+
+static const char * const fixupPhaseNames[FIXUP_PHASES] = {
+    "remap classes", 
+    "fix up selector references", 
+    "fix up @protocol references", 
+};
+
+static const startup_phase_t fixupStartupPhases[FIXUP_PHASES] = {
+    STARTUP_REMAP_CLASS_REFS, 
+    STARTUP_UNIQUE_SELECTORS, 
+    STARTUP_FIXUP_PROTOCOL_REFS, 
+};
+
+struct image_fixups_t {
+    header_info *hi;
+    uint32_t *selMisses;     // indexes of selrefs that are not registered
+    uint32_t selMissCount;
+    uint64_t nanos[FIXUP_PHASES];
+    size_t refs[FIXUP_PHASES];
+    size_t changed[FIXUP_PHASES];  // refs actually rewritten
+};
+
+struct parallel_fixups_t {
+    image_fixups_t *images;
+    NXMapTable *remappedClasses;  // nil if no class is remapped
+    NXMapTable *protocols;
+    bool timed;
+};
+
+static void fixupImage(parallel_fixups_t *work, image_fixups_t *image)
+{
+    header_info *hi = image->hi;
+    size_t count, changed;
+    uint64_t start = work->timed ? nanoseconds() : 0;
+
+    auto phaseDone = [&](int phase) {
+        image->refs[phase] = count;
+        image->changed[phase] = changed;
+        if (work->timed) {
+            uint64_t end = nanoseconds();
+            image->nanos[phase] = end - start;
+            start = end;
+        }
+    };
+
+    // Class refs and super refs are remapped for message dispatching.
+    count = changed = 0;
+    if (NXMapTable *map = work->remappedClasses) {
+        for (int superrefs = 0; superrefs < 2; superrefs++) {
+            size_t refCount;
+            Class *classrefs = superrefs 
+                ? _getObjc2SuperRefs(hi, &refCount) 
+                : _getObjc2ClassRefs(hi, &refCount);
+            // fixme why doesn't test future1 catch the absence of super refs?
+            for (size_t i = 0; i < refCount; i++) {
+                Class newcls;
+                if (classrefs[i]  &&  
+                    NXMapMember(map, classrefs[i], (void**)&newcls) != 
+                    NX_MAPNOTAKEY) 
+                {
+                    classrefs[i] = newcls;
+                    changed++;
+                }
+            }
+            count += refCount;
+        }
+    }
+    phaseDone(FIXUP_CLASSREFS);
+
+    // Selector refs that are already registered are fixed up here. 
+    // The rest are left for the caller to insert.
+    count = changed = 0;
+    if (!hi->isPreoptimized()) {
+        SEL *sels = _getObjc2SelectorRefs(hi, &count);
+        for (size_t i = 0; i < count; i++) {
+            SEL sel = sel_lookupNameNoLock(sel_cname(sels[i]));
+            if (!sel) {
+                image->selMisses[image->selMissCount++] = (uint32_t)i;
+            } else if (sels[i] != sel) {
+                sels[i] = sel;
+                changed++;
+            }
+        }
+    }
+    phaseDone(FIXUP_SELREFS);
+
+    // Preoptimized images may have the right 
+    // answer already but we don't know for sure.
+    count = changed = 0;
+    protocol_t **protorefs = _getObjc2ProtocolRefs(hi, &count);
+    for (size_t i = 0; i < count; i++) {
+        protocol_t *proto = protorefs[i];
+        protocol_t *newproto = (protocol_t *)
+            getProtocolInMap(work->protocols, proto->mangledName);
+        if (newproto  &&  newproto != proto) {
+            protorefs[i] = newproto;
+            changed++;
+        }
+    }
+    phaseDone(FIXUP_PROTOREFS);
+}
+
+
+// The current job. Protected by FixupPoolMonitor.
+monitor_t FixupPoolMonitor;
+static parallel_fixups_t *FixupPoolWork;  // nil if no job
+static uint32_t FixupPoolCount;           // images in the job
+static uint32_t FixupPoolNext;            // next image to fix up
+static uint32_t FixupPoolDone;            // images fixed up
+static unsigned FixupPoolThreads;         // workers started
+
+#define FIXUP_POOL_MAX_THREADS 7
+
+// Fix up images of the current job until none are left.
+// Locking: FixupPoolMonitor must be held. It is dropped while 
+// each image is fixed up.
+static void fixupPoolRunImages_locked(void)
+{
+    FixupPoolMonitor.assertLocked();
+
+    while (FixupPoolWork  &&  FixupPoolNext < FixupPoolCount) {
+        parallel_fixups_t *work = FixupPoolWork;
+        uint32_t index = FixupPoolNext++;
+
+        FixupPoolMonitor.leave();
+        fixupImage(work, &work->images[index]);
+        FixupPoolMonitor.enter();
+
+        if (++FixupPoolDone == FixupPoolCount) FixupPoolMonitor.notifyAll();
+    }
+}
+
+static void *fixupPoolWorker(void *arg __unused)
+{
+    FixupPoolMonitor.enter();
+    while (true) {
+        fixupPoolRunImages_locked();
+        FixupPoolMonitor.wait();
+    }
+}
+
+
+/***********************************************************************
+* fixupPoolStart_locked
+* Starts the worker threads for parallel image fixups, if they are 
+* not running yet. Returns the number of workers.
+* Locking: FixupPoolMonitor must be held.
+**********************************************************************/
+static unsigned fixupPoolStart_locked(void)
+{
+    FixupPoolMonitor.assertLocked();
+
+    if (FixupPoolThreads) return FixupPoolThreads;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned want = (unsigned)MIN(MAX(cpus, 1) - 1, FIXUP_POOL_MAX_THREADS);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (unsigned i = 0; i < want; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, &fixupPoolWorker, nil) != 0) break;
+        FixupPoolThreads++;
+    }
+    pthread_attr_destroy(&attr);
+
+    return FixupPoolThreads;
+}
+
+
+/***********************************************************************
+* fixupImagesInPool
+* Fixes up every image of work on the worker threads and on the 
+* calling thread. Returns false without doing anything if there 
+* are no worker threads.
+* Locking: runtimeLock write-locked and selLock locked by the caller.
+**********************************************************************/
+static bool fixupImagesInPool(parallel_fixups_t *work, uint32_t count)
+{
+    runtimeLock.assertWriting();
+    selLock.assertLocked();
+
+    monitor_locker_t lock(FixupPoolMonitor);
+    if (fixupPoolStart_locked() == 0) return false;
+
+    FixupPoolWork = work;
+    FixupPoolCount = count;
+    FixupPoolNext = 0;
+    FixupPoolDone = 0;
+    FixupPoolMonitor.notifyAll();
+
+    fixupPoolRunImages_locked();
+    while (FixupPoolDone < FixupPoolCount) FixupPoolMonitor.wait();
+
+    FixupPoolWork = nil;
+    return true;
+}
+
+
+/***********************************************************************
+* fixup_pool_atfork_child
+* The pool's worker threads do not survive fork(). 
+* Start new ones if the child needs them.
+**********************************************************************/
+void fixup_pool_atfork_child(void)
+{
+    FixupPoolWork = nil;
+    FixupPoolThreads = 0;
+}
+
+
+/***********************************************************************
+* fixupImageRefs
+* Remaps class refs, uniques selector refs, and remaps @protocol refs 
+* of every image in hList, in parallel when there is enough work 
+* to be worth it and the process has finished launching.
+* Locking: runtimeLock write-locked by the caller. 
+*   Acquires selLock and FixupPoolMonitor.
+**********************************************************************/
+static size_t UnfixedSelectors;
+static void fixupImageRefs(header_info **hList, uint32_t hCount, 
+                           bool launching, TimeLogger& ts)
+{
+    runtimeLock.assertWriting();
+
+    parallel_fixups_t work;
+    bzero(&work, sizeof(work));
+    work.images = (image_fixups_t *)calloc(hCount, sizeof(image_fixups_t));
+    work.protocols = protocols();
+    work.remappedClasses = noClassesRemapped() ? nil : remappedClasses(NO);
+    work.timed = PrintImageTimes  ||  RecordStartupTrace;
+
+    // Count the refs, and make room for every selref to be a miss 
+    // so the workers need not allocate.
+    size_t totalRefs = 0;
+    size_t totalSelRefs = 0;
+    for (uint32_t i = 0; i < hCount; i++) {
+        header_info *hi = hList[i];
+        size_t count;
+        work.images[i].hi = hi;
+        if (!hi->isPreoptimized()) {
+            _getObjc2SelectorRefs(hi, &count);
+            totalSelRefs += count;
+            totalRefs += count;
+        }
+        _getObjc2ProtocolRefs(hi, &count);
+        totalRefs += count;
+        if (work.remappedClasses) {
+            _getObjc2ClassRefs(hi, &count);
+            totalRefs += count;
+        }
+    }
+    uint32_t *selMisses = (uint32_t *)
+        malloc(totalSelRefs * sizeof(uint32_t));
+    size_t offset = 0;
+    for (uint32_t i = 0; i < hCount; i++) {
+        header_info *hi = hList[i];
+        if (hi->isPreoptimized()) continue;
+        size_t count;
+        _getObjc2SelectorRefs(hi, &count);
+        work.images[i].selMisses = selMisses + offset;
+        offset += count;
+    }
+
+    bool parallel = !launching  &&  !DisableParallelFixups  &&  
+        hCount > 1  &&  totalRefs >= PARALLEL_FIXUP_MIN_REFS;
+
+    mutex_locker_t lock(selLock);
+
+    if (parallel) {
+        parallel = fixupImagesInPool(&work, hCount);
+    }
+    if (!parallel) {
+        for (uint32_t i = 0; i < hCount; i++) {
+            fixupImage(&work, &work.images[i]);
+        }
+    }
+
+    // Gather the workers' results.
+    uint64_t nanos[FIXUP_PHASES] = {};
+    size_t refs[FIXUP_PHASES] = {};
+    size_t changed[FIXUP_PHASES] = {};
+    for (uint32_t i = 0; i < hCount; i++) {
+        image_fixups_t& image = work.images[i];
+        for (int phase = 0; phase < FIXUP_PHASES; phase++) {
+            nanos[phase] += image.nanos[phase];
+            refs[phase] += image.refs[phase];
+            changed[phase] += image.changed[phase];
+            if (RecordStartupTrace) {
+                _objc_traceStartupPhase(image.hi->mhdr(), 
+                                        fixupStartupPhases[phase], 
+                                        image.nanos[phase], 
+                                        image.refs[phase]);
+            }
+        }
+    }
+
+    // Register the selectors no image had registered yet.
+    uint64_t start = work.timed ? nanoseconds() : 0;
+    size_t inserted = 0;
+    for (uint32_t i = 0; i < hCount; i++) {
+        image_fixups_t& image = work.images[i];
+        if (!image.selMissCount) continue;
+
+        StartupPhaseTimer timer(image.hi, STARTUP_UNIQUE_SELECTORS);
+        bool isBundle = image.hi->isBundle();
+        size_t count;
+        SEL *sels = _getObjc2SelectorRefs(image.hi, &count);
+        for (uint32_t m = 0; m < image.selMissCount; m++) {
+            SEL *ref = &sels[image.selMisses[m]];
+            SEL sel = sel_registerNameNoLock(sel_cname(*ref), isBundle);
+            if (*ref != sel) {
+                *ref = sel;
+                changed[FIXUP_SELREFS]++;
+            }
+        }
+        inserted += image.selMissCount;
+    }
+    UnfixedSelectors += refs[FIXUP_SELREFS];
+    UnfixedProtocolReferences += changed[FIXUP_PROTOREFS];
+    free(selMisses);
+    free(work.images);
+
+    // Timings are also measured for the startup trace, 
+    // but are printed only if asked for.
+    if (PrintImageTimes) {
+        for (int phase = 0; phase < FIXUP_PHASES; phase++) {
+            _objc_inform("IMAGE TIMES:   %s: %.2f ms on all threads, "
+                         "%zu refs, %zu changed", fixupPhaseNames[phase], 
+                         nanos[phase] / 1000000.0, 
+                         refs[phase], changed[phase]);
+        }
+        _objc_inform("IMAGE TIMES:   register new selectors: %.2f ms, "
+                     "%zu selectors", 
+                     (nanoseconds() - start) / 1000000.0, inserted);
+        _objc_inform("IMAGE TIMES:   %u images %s", 
+                     hCount, parallel ? "in parallel" : "serially");
+    }
+    ts.log("IMAGE TIMES: fix up class, selector, and @protocol references");
+}
+
+
 /***********************************************************************
 * _read_images
 * Perform initial processing of the headers in the linked 
@@ -2720,7 +3193,10 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
     static bool doneOnce;
     TimeLogger ts(PrintImageTimes);
 
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
+
+    // The first call maps the images loaded at launch.
+    bool launching = !doneOnce;
 
 #define EACH_HEADER \
     hIndex = 0;         \
@@ -2807,12 +3283,14 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
     // Discover classes. Fix up unresolved future classes. Mark bundle classes.
 
     for (EACH_HEADER) {
+        StartupPhaseTimer timer(hi, STARTUP_DISCOVER_CLASSES);
         classref_t *classlist = _getObjc2ClassList(hi, &count);
         
         if (! mustReadClasses(hi)) {
             // Image is sufficiently optimized that we need not call readClass()
             continue;
         }
+        timer.count = count;
 
         bool headerIsBundle = hi->isBundle();
         bool headerIsPreoptimized = hi->isPreoptimized();
@@ -2835,65 +3313,9 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
 
     ts.log("IMAGE TIMES: discover classes");
 
-    // Fix up remapped classes
-    // Class list and nonlazy class list remain unremapped.
-    // Class refs and super refs are remapped for message dispatching.
-    
-    if (!noClassesRemapped()) {
-        for (EACH_HEADER) {
-            Class *classrefs = _getObjc2ClassRefs(hi, &count);
-            for (i = 0; i < count; i++) {
-                remapClassRef(&classrefs[i]);
-            }
-            // fixme why doesn't test future1 catch the absence of this?
-            classrefs = _getObjc2SuperRefs(hi, &count);
-            for (i = 0; i < count; i++) {
-                remapClassRef(&classrefs[i]);
-            }
-        }
-    }
-
-    ts.log("IMAGE TIMES: remap classes");
-
-    // Fix up @selector references
-    static size_t UnfixedSelectors;
-    {
-        mutex_locker_t lock(selLock);
-        for (EACH_HEADER) {
-            if (hi->isPreoptimized()) continue;
-            
-            bool isBundle = hi->isBundle();
-            SEL *sels = _getObjc2SelectorRefs(hi, &count);
-            UnfixedSelectors += count;
-            for (i = 0; i < count; i++) {
-                const char *name = sel_cname(sels[i]);
-                sels[i] = sel_registerNameNoLock(name, isBundle);
-            }
-        }
-    }
-
-    ts.log("IMAGE TIMES: fix up selector references");
-
-#if SUPPORT_FIXUP
-    // Fix up old objc_msgSend_fixup call sites
-    for (EACH_HEADER) {
-        message_ref_t *refs = _getObjc2MessageRefs(hi, &count);
-        if (count == 0) continue;
-
-        if (PrintVtables) {
-            _objc_inform("VTABLES: repairing %zu unsupported vtable dispatch "
-                         "call sites in %s", count, hi->fname());
-        }
-        for (i = 0; i < count; i++) {
-            fixupMessageRef(refs+i);
-        }
-    }
-
-    ts.log("IMAGE TIMES: fix up objc_msgSend_fixup");
-#endif
-
-    // Discover protocols. Fix up protocol refs.
+    // Discover protocols.
     for (EACH_HEADER) {
+        StartupPhaseTimer timer(hi, STARTUP_DISCOVER_PROTOCOLS);
         extern objc_class OBJC_CLASS_$_Protocol;
         Class cls = (Class)&OBJC_CLASS_$_Protocol;
         assert(cls);
@@ -2906,29 +3328,42 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
             readProtocol(protolist[i], cls, protocol_map, 
                          isPreoptimized, isBundle);
         }
+        timer.count = count;
     }
 
     ts.log("IMAGE TIMES: discover protocols");
 
-    // Fix up @protocol references
-    // Preoptimized images may have the right 
-    // answer already but we don't know for sure.
+    // Fix up class refs, @selector references, and @protocol references.
+    // Class list and nonlazy class list remain unremapped.
+    fixupImageRefs(hList, hCount, launching, ts);
+
+#if SUPPORT_FIXUP
+    // Fix up old objc_msgSend_fixup call sites
     for (EACH_HEADER) {
-        protocol_t **protolist = _getObjc2ProtocolRefs(hi, &count);
+        message_ref_t *refs = _getObjc2MessageRefs(hi, &count);
+        if (count == 0) continue;
+
+        if (PrintVtables) {
+            _objc_inform("VTABLES: repairing %zu unsupported vtable dispatch "
+                         "call sites in %s", count, hi->fname());
+        }
         for (i = 0; i < count; i++) {
-            remapProtocolRef(&protolist[i]);
+            fixupMessageRef(refs+i);
         }
     }
 
-    ts.log("IMAGE TIMES: fix up @protocol references");
+    ts.log("IMAGE TIMES: fix up objc_msgSend_fixup");
+#endif
 
     // Realize non-lazy classes (for +load methods and static instances)
     for (EACH_HEADER) {
+        StartupPhaseTimer timer(hi, STARTUP_REALIZE_CLASSES);
         classref_t *classlist = 
             _getObjc2NonlazyClassList(hi, &count);
         for (i = 0; i < count; i++) {
             Class cls = remapClass(classlist[i]);
             if (!cls) continue;
+            timer.count++;
 
             // hack for class __ARCLite__, which didn't get this above
 #if TARGET_OS_SIMULATOR
@@ -2981,6 +3416,7 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
     //搜索分类
     // Discover categories. 
     for (EACH_HEADER) {
+        StartupPhaseTimer timer(hi, STARTUP_ATTACH_CATEGORIES);
         //获取分类列表，并将分类列表中的数据加在所对应的类数据中，数据包括方法列表，属性列表，协议列表，事实上分类中的协议列表，属性列表都是空的，所以真正加进去的就是方法列表
         category_t **catlist = 
             _getObjc2CategoryList(hi, &count);
@@ -3002,6 +3438,8 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
                 continue;
             }
 
+            timer.count++;
+
             // Process this category. 
             // First, register the category with its target class. 
             // Then, rebuild the class's method lists (etc) if 
@@ -3149,7 +3587,7 @@ void prepare_load_methods(const headerType *mhdr)
 {
     size_t count, i;
 
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
     //先获取所有拥有 load 方法的类，
     classref_t *classlist = 
         _getObjc2NonlazyClassList(mhdr, &count);
@@ -3184,7 +3622,7 @@ void _unload_image(header_info *hi)
     size_t count, i;
 
     loadMethodLock.assertLocked();
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     // Unload unattached categories and categories waiting for +load.
 
@@ -3323,7 +3761,9 @@ _method_setImplementation(Class cls, method_t *m, IMP imp)
     // RR/AWZ updates are slow if cls is nil (i.e. unknown)
     // fixme build list of classes whose Methods are known externally?
 
-    flushCaches(cls);
+    SEL sel = m->name;
+    flushCachesForSelectors(cls, &sel, 1, 
+                            OBJC_CACHE_FLUSH_SET_IMPLEMENTATION);
 
     updateCustomRR_AWZ(cls, m);
 
@@ -3335,7 +3775,7 @@ method_setImplementation(Method m, IMP imp)
 {
     // Don't know the class - will be slow if RR/AWZ are affected
     // fixme build list of classes whose Methods are known externally?
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
     return _method_setImplementation(Nil, m, imp);
 }
 
@@ -3344,7 +3784,7 @@ void method_exchangeImplementations(Method m1, Method m2)
 {
     if (!m1  ||  !m2) return;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     IMP m1_imp = m1->imp;
     m1->imp = m2->imp;
@@ -3355,7 +3795,8 @@ void method_exchangeImplementations(Method m1, Method m2)
     // Cache updates are slow because class is unknown
     // fixme build list of classes whose Methods are known externally?
 
-    flushCaches(nil);
+    SEL sels[2] = { m1->name, m2->name };
+    flushCachesForSelectors(nil, sels, 2, OBJC_CACHE_FLUSH_EXCHANGE);
 
     updateCustomRR_AWZ(nil, m1);
     updateCustomRR_AWZ(nil, m2);
@@ -3420,7 +3861,7 @@ objc_property_attribute_t *property_copyAttributeList(objc_property_t prop,
         return nil;
     }
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
     return copyPropertyAttributeList(prop->attributes,outCount);
 }
 
@@ -3428,7 +3869,7 @@ char * property_copyAttributeValue(objc_property_t prop, const char *name)
 {
     if (!prop  ||  !name  ||  *name == '\0') return nil;
     
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
     return copyPropertyAttributeValue(prop->attributes, name);
 }
 
@@ -3539,7 +3980,7 @@ fixupProtocolMethodList(protocol_t *proto, method_list_t *mlist,
 static void 
 fixupProtocol(protocol_t *proto)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     if (proto->protocols) {
         for (uintptr_t i = 0; i < proto->protocols->count; i++) {
@@ -3570,7 +4011,7 @@ fixupProtocolIfNeeded(protocol_t *proto)
     assert(proto);
 
     if (!proto->isFixedUp()) {
-        mutex_locker_t lock(runtimeLock);
+        rwlock_writer_t lock(runtimeLock);
         fixupProtocol(proto);
     }
 }
@@ -3646,7 +4087,7 @@ protocol_getMethod(protocol_t *proto, SEL sel, bool isRequiredMethod, bool isIns
     if (!proto) return nil;
     fixupProtocolIfNeeded(proto);
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
     return protocol_getMethod_nolock(proto, sel, isRequiredMethod, 
                                      isInstanceMethod, recursive);
 }
@@ -3707,7 +4148,7 @@ _protocol_getMethodTypeEncoding(Protocol *proto_gen, SEL sel,
     if (!proto) return nil;
     fixupProtocolIfNeeded(proto);
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
     return protocol_getMethodTypeEncoding_nolock(proto, sel, 
                                                  isRequiredMethod, 
                                                  isInstanceMethod);
@@ -3809,7 +4250,7 @@ protocol_conformsToProtocol_nolock(protocol_t *self, protocol_t *other)
 **********************************************************************/
 BOOL protocol_conformsToProtocol(Protocol *self, Protocol *other)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
     return protocol_conformsToProtocol_nolock(newprotocol(self), 
                                               newprotocol(other));
 }
@@ -3853,7 +4294,7 @@ protocol_copyMethodDescriptionList(Protocol *p,
 
     fixupProtocolIfNeeded(proto);
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
 
     method_list_t *mlist = 
         getProtocolMethodList(proto, isRequiredMethod, isInstanceMethod);
@@ -3919,7 +4360,7 @@ objc_property_t protocol_getProperty(Protocol *p, const char *name,
 {
     if (!p  ||  !name) return nil;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
     return (objc_property_t)
         protocol_getProperty_nolock(newprotocol(p), name, 
                                     isRequiredProperty, isInstanceProperty);
@@ -3966,7 +4407,7 @@ protocol_copyPropertyList2(Protocol *proto, unsigned int *outCount,
         return nil;
     }
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
 
     property_list_t *plist = isInstanceProperty
         ? newprotocol(proto)->instanceProperties
@@ -4000,7 +4441,7 @@ protocol_copyProtocolList(Protocol *p, unsigned int *outCount)
         return nil;
     }
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
 
     if (proto->protocols) {
         count = (unsigned int)proto->protocols->count;
@@ -4030,7 +4471,7 @@ protocol_copyProtocolList(Protocol *p, unsigned int *outCount)
 Protocol *
 objc_allocateProtocol(const char *name)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     if (getProtocol(name)) {
         return nil;
@@ -4061,7 +4502,7 @@ void objc_registerProtocol(Protocol *proto_gen)
 {
     protocol_t *proto = newprotocol(proto_gen);
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     extern objc_class OBJC_CLASS_$___IncompleteProtocol;
     Class oldcls = (Class)&OBJC_CLASS_$___IncompleteProtocol;
@@ -4084,6 +4525,7 @@ void objc_registerProtocol(Protocol *proto_gen)
     proto->changeIsa(cls);
 
     NXMapKeyCopyingInsert(protocols(), proto->mangledName, proto);
+    protocolsChanged();
 }
 
 
@@ -4106,7 +4548,7 @@ protocol_addProtocol(Protocol *proto_gen, Protocol *addition_gen)
     if (!proto_gen) return;
     if (!addition_gen) return;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     if (proto->ISA() != cls) {
         _objc_inform("protocol_addProtocol: modified protocol '%s' is not "
@@ -4132,6 +4574,7 @@ protocol_addProtocol(Protocol *proto_gen, Protocol *addition_gen)
 
     protolist->list[protolist->count++] = (protocol_ref_t)addition;
     proto->protocols = protolist;
+    protocolsChanged();
 }
 
 
@@ -4169,7 +4612,7 @@ protocol_addMethodDescription(Protocol *proto_gen, SEL name, const char *types,
 
     if (!proto_gen) return;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     if (proto->ISA() != cls) {
         _objc_inform("protocol_addMethodDescription: protocol '%s' is not "
@@ -4227,7 +4670,7 @@ protocol_addProperty(Protocol *proto_gen, const char *name,
     if (!proto) return;
     if (!name) return;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     if (proto->ISA() != cls) {
         _objc_inform("protocol_addProperty: protocol '%s' is not "
@@ -4259,7 +4702,7 @@ protocol_addProperty(Protocol *proto_gen, const char *name,
 int 
 objc_getClassList(Class *buffer, int bufferLen) 
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     realizeAllClasses();
 
@@ -4294,7 +4737,7 @@ objc_getClassList(Class *buffer, int bufferLen)
 Class *
 objc_copyClassList(unsigned int *outCount)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     realizeAllClasses();
 
@@ -4329,7 +4772,7 @@ objc_copyClassList(unsigned int *outCount)
 Protocol * __unsafe_unretained * 
 objc_copyProtocolList(unsigned int *outCount) 
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
 
     NXMapTable *protocol_map = protocols();
 
@@ -4366,7 +4809,7 @@ objc_copyProtocolList(unsigned int *outCount)
 **********************************************************************/
 Protocol *objc_getProtocol(const char *name)
 {
-    mutex_locker_t lock(runtimeLock); 
+    rwlock_reader_t lock(runtimeLock); 
     return getProtocol(name);
 }
 
@@ -4374,7 +4817,7 @@ Protocol *objc_getProtocol(const char *name)
 /***********************************************************************
 * class_copyMethodList
 * fixme
-* Locking: read-locks runtimeLock
+* Locking: read-locks runtimeLock and acquires cls's ClassMethodLocks
 **********************************************************************/
 Method *
 class_copyMethodList(Class cls, unsigned int *outCount)
@@ -4387,7 +4830,8 @@ class_copyMethodList(Class cls, unsigned int *outCount)
         return nil;
     }
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
+    mutex_locker_t methodLock(ClassMethodLocks[cls]);
     
     assert(cls->isRealized());
 
@@ -4425,7 +4869,7 @@ class_copyIvarList(Class cls, unsigned int *outCount)
         return nil;
     }
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
 
     assert(cls->isRealized());
     
@@ -4459,7 +4903,7 @@ class_copyPropertyList(Class cls, unsigned int *outCount)
         return nil;
     }
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
 
     checkIsKnownClass(cls);
     assert(cls->isRealized());
@@ -4551,7 +4995,7 @@ _category_getClassName(Category cat)
 Class 
 _category_getClass(Category cat)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
     Class result = remapClass(cat->cls);
     assert(result->isRealized());  // ok for call_category_loads' usage
     return result;
@@ -4615,7 +5059,7 @@ class_copyProtocolList(Class cls, unsigned int *outCount)
         return nil;
     }
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
 
     checkIsKnownClass(cls);
 
@@ -4646,7 +5090,7 @@ class_copyProtocolList(Class cls, unsigned int *outCount)
 **********************************************************************/
 const char **objc_copyImageNames(unsigned int *outCount)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
     
 
 
@@ -4731,7 +5175,7 @@ objc_copyClassNamesForImage(const char *image, unsigned int *outCount)
         return nil;
     }
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
 
     // Find the image.
     header_info *hi;
@@ -4767,7 +5211,7 @@ objc_copyClassNamesForImageHeader(const struct mach_header *mh, unsigned int *ou
         return nil;
     }
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
 
     // Find the image.
     header_info *hi;
@@ -5004,25 +5448,341 @@ static method_t *search_method_list(const method_list_t *mlist, SEL sel)
     return nil;
 }
 
-static method_t *
-getMethodNoSuper_nolock(Class cls, SEL sel)
-{
-    runtimeLock.assertLocked();
-
-    assert(cls->isRealized());
-    // fixme nil cls? 
-    // fixme nil sel?
+/***********************************************************************
+* Merged method index
+* A class with many method lists, usually from many categories, gets 
+* one array of its methods sorted by selector, so that a lookup is 
+* one binary search instead of one per list. Only the first method 
+* for each selector in list order is kept, so category overrides 
+* still win. The entries point into the method lists themselves, 
+* so Method pointers and method_setImplementation() are unaffected.
+* 
+* attachMethodLists() makes class_rw_t::methodsGeneration odd, drops 
+* the index, publishes the new method lists, and makes the generation 
+* even again. The index records the even generation it was built at, 
+* and lookups ignore it unless that is still the class's generation. 
+* Comparing generations instead of method list array pointers keeps 
+* a freed and reallocated array from validating a stale index.
+**********************************************************************/
+#define METHOD_INDEX_MIN_LISTS 4
 
-    for (auto mlists = cls->data()->methods.beginLists(), 
-              end = cls->data()->methods.endLists(); 
-         mlists != end;
-         ++mlists)
-    {
-        method_t *m = search_method_list(*mlists, sel);
-        if (m) return m;
-    }
+struct method_index_t {
+    uintptr_t generation;
+    uint32_t count;
+    method_t *methods[0];
+};
 
-    return nil;
+static method_index_t *loadMethodIndex(Class cls)
+{
+    return (method_index_t *)
+        __c11_atomic_load((_Atomic(uintptr_t) *)&cls->data()->methodIndex, 
+                          __ATOMIC_ACQUIRE);
+}
+
+static uintptr_t loadMethodsGeneration(Class cls)
+{
+    return __c11_atomic_load((_Atomic(uintptr_t) *)
+                             &cls->data()->methodsGeneration, 
+                             __ATOMIC_ACQUIRE);
+}
+
+// The release stores that publish the index and the method lists 
+// keep this change visible before them.
+static void bumpMethodsGeneration(Class cls)
+{
+    __c11_atomic_fetch_add((_Atomic(uintptr_t) *)
+                           &cls->data()->methodsGeneration, 1, 
+                           __ATOMIC_RELEASE);
+}
+
+static method_t *findMethodInIndex(const method_index_t *index, SEL sel)
+{
+    uint32_t lo = 0;
+    uint32_t hi = index->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        method_t *m = index->methods[mid];
+        if (m->name == sel) return m;
+        if ((uintptr_t)m->name < (uintptr_t)sel) lo = mid + 1;
+        else hi = mid;
+    }
+    return nil;
+}
+
+static method_index_t *
+buildMethodIndex(method_list_t **lists, method_list_t **end, 
+                 uintptr_t generation)
+{
+    uint32_t total = 0;
+    for (auto mlists = lists; mlists != end; ++mlists) {
+        total += (*mlists)->count;
+    }
+
+    method_index_t *index = (method_index_t *)
+        malloc(sizeof(method_index_t) + total * sizeof(method_t *));
+    index->generation = generation;
+
+    uint32_t count = 0;
+    for (auto mlists = lists; mlists != end; ++mlists) {
+        for (auto& meth : **mlists) index->methods[count++] = &meth;
+    }
+
+    // Stable sort keeps equal selectors in list order. 
+    // The first of each run is the one that lookups must find.
+    std::stable_sort(index->methods, index->methods + count, 
+                     [](method_t *a, method_t *b) {
+        return (uintptr_t)a->name < (uintptr_t)b->name;
+    });
+    auto last = std::unique(index->methods, index->methods + count, 
+                            [](method_t *a, method_t *b) {
+        return a->name == b->name;
+    });
+    index->count = (uint32_t)(last - index->methods);
+    return index;
+}
+
+
+/***********************************************************************
+* methodIndexForClass
+* Builds cls's merged method index if cls has enough method lists 
+* and the index is missing or stale.
+* Locking: runtimeLock must be read- or write-locked by the caller, 
+*   and the caller must be inside an epoch read-side section.
+**********************************************************************/
+static void methodIndexForClass(Class cls)
+{
+    runtimeLock.assertLocked();
+
+    if (DisableMethodIndex) return;
+
+    // Don't build from lists that are being changed.
+    uintptr_t generation = loadMethodsGeneration(cls);
+    if (generation & 1) return;
+
+    method_index_t *old = loadMethodIndex(cls);
+    if (old  &&  old->generation == generation) return;
+
+    method_list_t *storage;
+    method_list_t **end;
+    method_list_t **lists = 
+        cls->data()->methods.beginListsUnlocked(end, storage);
+    if (end - lists < METHOD_INDEX_MIN_LISTS) return;
+
+    method_index_t *index = buildMethodIndex(lists, end, generation);
+
+    // The lists may have changed while the index was built. 
+    // Installing the index anyway would be harmless because its 
+    // generation no longer matches, but it would be wasted.
+    if (loadMethodsGeneration(cls) != generation) {
+        free(index);
+        return;
+    }
+
+    // Other threads holding the read lock may be building one too.
+    if (!__c11_atomic_compare_exchange_strong
+        ((_Atomic(uintptr_t) *)&cls->data()->methodIndex, 
+         (uintptr_t *)&old, (uintptr_t)index, 
+         __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+    {
+        free(index);
+        return;
+    }
+    if (old) epoch_retire(old);
+}
+
+
+/***********************************************************************
+* attachMethodLists
+* Adds method lists to cls in front of its existing ones, 
+* and drops cls's merged method index before the new lists are visible.
+* Locking: runtimeLock must be held by the caller. If it is only 
+*   read-locked then the caller must also hold cls's ClassMethodLocks.
+**********************************************************************/
+static void attachMethodLists(Class cls, method_list_t * const *lists, 
+                              uint32_t count)
+{
+    runtimeLock.assertLocked();
+
+    bumpMethodsGeneration(cls);
+    method_index_t *index = (method_index_t *)
+        __c11_atomic_exchange((_Atomic(uintptr_t) *)&cls->data()->methodIndex, 
+                              0, __ATOMIC_ACQ_REL);
+
+    cls->data()->methods.attachLists(lists, count);
+
+    bumpMethodsGeneration(cls);
+    if (index) epoch_retire(index);
+}
+
+
+/***********************************************************************
+* Method list hash tables
+* A method list with at least METHOD_HASH_MIN_COUNT methods gets an 
+* open-addressed hash table from selector to method index, so that 
+* a lookup is one or two probes instead of a binary search, and 
+* lists that are unsorted or have an unusual entsize are not searched 
+* linearly. Each 32-bit slot holds the method's index + 1 in its low 
+* half and a tag of the selector's hash in its high half, so probes 
+* stay within the table's cache lines until a tag matches.
+* Tables are kept on a list in the class_rw_t of the class that owns 
+* the method list. Method lists never change once attached, so the 
+* tables are never invalidated; they are freed with the class.
+**********************************************************************/
+#define METHOD_HASH_MIN_COUNT 128
+#define METHOD_HASH_MAX_COUNT 0xfffe
+
+struct method_hash_t {
+    method_hash_t *next;
+    const method_list_t *list;
+    uint32_t mask;
+    uint32_t slots[0];
+};
+
+static method_t *findMethodInHash(const method_hash_t *hash, SEL sel)
+{
+    uint32_t h = ptr_hash((uintptr_t)sel);
+    uint32_t tag = h & 0xffff0000;
+    uint32_t i = h & hash->mask;
+    while (uint32_t slot = hash->slots[i]) {
+        if ((slot & 0xffff0000) == tag) {
+            method_t& meth = hash->list->get((slot & 0xffff) - 1);
+            if (meth.name == sel) return &meth;
+        }
+        i = (i + 1) & hash->mask;
+    }
+    return nil;
+}
+
+static method_hash_t *buildMethodHash(const method_list_t *mlist)
+{
+    uint32_t capacity = 16;
+    while (capacity < mlist->count * 2) capacity *= 2;
+
+    method_hash_t *hash = (method_hash_t *)
+        calloc(sizeof(method_hash_t) + capacity * sizeof(uint32_t), 1);
+    hash->list = mlist;
+    hash->mask = capacity - 1;
+
+    // A lookup must find the first method with a selector, 
+    // like the list searches do.
+    for (uint32_t m = 0; m < mlist->count; m++) {
+        SEL sel = mlist->get(m).name;
+        if (findMethodInHash(hash, sel)) continue;
+
+        uint32_t h = ptr_hash((uintptr_t)sel);
+        uint32_t i = h & hash->mask;
+        while (hash->slots[i]) i = (i + 1) & hash->mask;
+        hash->slots[i] = (h & 0xffff0000) | (m + 1);
+    }
+
+    return hash;
+}
+
+
+/***********************************************************************
+* methodHashForList
+* Returns the hash table for mlist, one of cls's method lists, or nil 
+* if mlist is too small or too big to get one. If build is set and 
+* the table does not exist yet, it is built.
+* Locking: runtimeLock must be read- or write-locked by the caller 
+*   if build is set. Otherwise none.
+**********************************************************************/
+static method_hash_t *
+methodHashForList(Class cls, const method_list_t *mlist, bool build)
+{
+    if (DisableMethodHash) return nil;
+    if (mlist->count < METHOD_HASH_MIN_COUNT) return nil;
+    if (mlist->count > METHOD_HASH_MAX_COUNT) return nil;
+
+    auto head = (_Atomic(uintptr_t) *)&cls->data()->methodHashes;
+    method_hash_t *first = (method_hash_t *)
+        __c11_atomic_load(head, __ATOMIC_ACQUIRE);
+    for (method_hash_t *h = first; h; h = h->next) {
+        if (h->list == mlist) return h;
+    }
+    if (!build) return nil;
+
+    runtimeLock.assertLocked();
+
+    method_hash_t *hash = buildMethodHash(mlist);
+
+    // Other threads holding the read lock may be adding tables too.
+    method_hash_t *seen = nil;
+    do {
+        for (method_hash_t *h = first; h != seen; h = h->next) {
+            if (h->list == mlist) {
+                free(hash);
+                return h;
+            }
+        }
+        seen = first;
+        hash->next = first;
+    } while (!__c11_atomic_compare_exchange_weak
+             (head, (uintptr_t *)&first, (uintptr_t)hash, 
+              __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+    return hash;
+}
+
+
+/***********************************************************************
+* getMethodNoSuper_lockfree
+* Like getMethodNoSuper_nolock, for callers that do not hold runtimeLock.
+* If buildHashes is set, missing method list hash tables are built; 
+* the caller must then hold runtimeLock as well.
+* Locking: caller must be inside an epoch read-side section
+**********************************************************************/
+static method_t *
+getMethodNoSuper_lockfree(Class cls, SEL sel, bool buildHashes = false)
+{
+    assert(cls->isRealized());
+
+    uintptr_t generation = loadMethodsGeneration(cls);
+    method_index_t *index = loadMethodIndex(cls);
+    if (index  &&  index->generation == generation) {
+        return findMethodInIndex(index, sel);
+    }
+
+    method_list_t *storage;
+    method_list_t **end;
+    method_list_t **lists = 
+        cls->data()->methods.beginListsUnlocked(end, storage);
+
+    for (auto mlists = lists; mlists != end; ++mlists) {
+        method_t *m;
+        if (method_hash_t *hash = 
+            methodHashForList(cls, *mlists, buildHashes)) 
+        {
+            m = findMethodInHash(hash, sel);
+        } else {
+            m = search_method_list(*mlists, sel);
+        }
+        if (m) return m;
+    }
+
+    return nil;
+}
+
+
+/***********************************************************************
+* getMethodNoSuper_nolock
+* Locking: runtimeLock must be read- or write-locked by the caller
+**********************************************************************/
+static method_t *
+getMethodNoSuper_nolock(Class cls, SEL sel)
+{
+    runtimeLock.assertLocked();
+
+    assert(cls->isRealized());
+    // fixme nil cls? 
+    // fixme nil sel?
+
+    // With runtimeLock only read-locked, class_addMethod may replace 
+    // the method list array while we search it. Method lists themselves 
+    // are never freed while the class is alive, so the result stays valid.
+    epoch_reader_t reader;
+    methodIndexForClass(cls);
+    return getMethodNoSuper_lockfree(cls, sel, true);
 }
 
 
@@ -5058,7 +5818,7 @@ getMethod_nolock(Class cls, SEL sel)
 **********************************************************************/
 static Method _class_getMethod(Class cls, SEL sel)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
     return getMethod_nolock(cls, sel);
 }
 
@@ -5110,7 +5870,7 @@ static void resolveClassMethod(Class cls, SEL sel, id inst)
 
     Class nonmeta;
     {
-        mutex_locker_t lock(runtimeLock);
+        rwlock_writer_t lock(runtimeLock);
         nonmeta = getMaybeUnrealizedNonMetaClass(cls, inst);
         // +initialize path should have realized nonmeta already
         if (!nonmeta->isRealized()) {
@@ -5254,6 +6014,69 @@ IMP _class_lookupMethodAndLoadCache3(id obj, SEL sel, Class cls)
 }
 
 
+/***********************************************************************
+* lookUpImpLockFree.
+* Method search for an initialized class without acquiring runtimeLock.
+* Searches cls and its superclasses and fills cls's cache on success.
+* Returns nil if the method was not found or the search was abandoned. 
+* The caller must then do a locked lookup, which is also responsible 
+* for method resolvers and forwarding.
+*
+* Method lists are published with copy-on-write and old list arrays are 
+* retired through epoch_retire(), so the lists seen here stay valid 
+* until the read-side section ends. A concurrent change that flushes 
+* caches while the search is running prevents the cache fill, so a 
+* stale IMP is never cached. It may still be returned to this caller, 
+* which is the same as if the lookup had finished before the change.
+*
+* Like the optimistic cache lookup, this does not call checkIsKnownClass.
+* Locking: none. runtimeLock must not be held.
+**********************************************************************/
+enum { LockFreeLookupMaxDepth = 256 };
+
+static IMP lookUpImpLockFree(Class cls, SEL sel, id inst)
+{
+#if SUPPORT_MESSAGE_LOGGING
+    // Message logging may veto caching. Leave that to the locked path.
+    if (objcMsgLogEnabled) return nil;
+#endif
+
+    // Read the flush generation before reading any method data.
+    uintptr_t generation = cache_flushGeneration();
+
+    epoch_reader_t reader;
+
+    unsigned depth = 0;
+    for (Class curClass = cls;
+         curClass != nil;
+         curClass = curClass->superclass)
+    {
+        // Long or cyclic superclass chains are diagnosed by the locked path.
+        if (++depth > LockFreeLookupMaxDepth) return nil;
+
+        IMP imp = nil;
+        if (curClass != cls) {
+            // Superclass cache.
+            imp = cache_getImp(curClass, sel);
+            if (imp == (IMP)_objc_msgForward_impcache) {
+                // Resolver for cls must run first. Use the locked path.
+                return nil;
+            }
+        }
+        if (!imp) {
+            method_t *meth = getMethodNoSuper_lockfree(curClass, sel);
+            if (meth) imp = meth->imp;
+        }
+        if (imp) {
+            cache_fill_unlessFlushed(cls, sel, imp, inst, generation);
+            return imp;
+        }
+    }
+
+    return nil;
+}
+
+
 /***********************************************************************
 * lookUpImpOrForward.
 * The standard IMP lookup. 
@@ -5280,6 +6103,16 @@ IMP lookUpImpOrForward(Class cls, SEL sel, id inst,
         if (imp) return imp;
     }
 
+    // Lock-free method search. Only for initialized classes: 
+    // realization and +initialize need runtimeLock anyway, and an 
+    // initialized class's superclasses are all realized too.
+    if (!DisableLockFreeLookup  &&  
+        cls->isRealized()  &&  cls->isInitialized())
+    {
+        imp = lookUpImpLockFree(cls, sel, inst);
+        if (imp) return imp;
+    }
+
     // runtimeLock is held during isRealized and isInitialized checking
     // to prevent races against concurrent realization.
 
@@ -5289,7 +6122,7 @@ IMP lookUpImpOrForward(Class cls, SEL sel, id inst,
     // the cache was re-filled with the old value after the cache flush on
     // behalf of the category.
 
-    runtimeLock.lock();
+    runtimeLock.write();
     checkIsKnownClass(cls);
 
     if (!cls->isRealized()) {
@@ -5368,9 +6201,9 @@ IMP lookUpImpOrForward(Class cls, SEL sel, id inst,
     // No implementation found. Try method resolver once.
 
     if (resolver  &&  !triedResolver) {
-        runtimeLock.unlock();
+        runtimeLock.unlockWrite();
         resolveMethod(cls, sel, inst);
-        runtimeLock.lock();
+        runtimeLock.write();
         // Don't cache the result; we don't hold the lock so it may have 
         // changed already. Re-do the search from scratch instead.
         triedResolver = YES;
@@ -5384,7 +6217,7 @@ IMP lookUpImpOrForward(Class cls, SEL sel, id inst,
     cache_fill(cls, sel, imp, inst);
 
  done:
-    runtimeLock.unlock();
+    runtimeLock.unlockWrite();
 
     return imp;
 }
@@ -5424,7 +6257,7 @@ IMP lookupMethodInClassAndLoadCache(Class cls, SEL sel)
 
     // Cache miss. Search method list.
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     meth = getMethodNoSuper_nolock(cls, sel);
 
@@ -5449,7 +6282,7 @@ objc_property_t class_getProperty(Class cls, const char *name)
 {
     if (!cls  ||  !name) return nil;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
 
     checkIsKnownClass(cls);
     
@@ -5500,7 +6333,7 @@ objc_class::setInitialized()
     cls = (Class)this;
     metacls = cls->ISA();
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     // Scan metaclass for custom AWZ.
     // Scan metaclass for custom RR.
@@ -5788,7 +6621,7 @@ void objc_class::chooseClassArrayIndex()
 {
 #if SUPPORT_INDEXED_ISA
     Class cls = (Class)this;
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     if (objc_indexed_classes_count >= ISA_INDEX_COUNT) {
         // No more indexes available.
@@ -5936,7 +6769,7 @@ class_setIvarLayout(Class cls, const uint8_t *layout)
 {
     if (!cls) return;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
     
     checkIsKnownClass(cls);
 
@@ -5970,7 +6803,7 @@ class_setWeakIvarLayout(Class cls, const uint8_t *layout)
 {
     if (!cls) return;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
     
     checkIsKnownClass(cls);
 
@@ -6023,7 +6856,7 @@ static ivar_t *getIvar(Class cls, const char *name)
 **********************************************************************/
 Class _class_getClassForIvar(Class cls, Ivar ivar)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
 
     for ( ; cls; cls = cls->superclass) {
         if (auto ivars = cls->data()->ro->ivars) {
@@ -6045,7 +6878,7 @@ Class _class_getClassForIvar(Class cls, Ivar ivar)
 Ivar 
 _class_getVariable(Class cls, const char *name)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
 
     for ( ; cls; cls = cls->superclass) {
         ivar_t *ivar = getIvar(cls, name);
@@ -6058,9 +6891,188 @@ _class_getVariable(Class cls, const char *name)
 }
 
 
+/***********************************************************************
+* Protocol conformance cache.
+* class_conformsToProtocol() memoizes its answers per class in a small 
+* open-addressed table. Each slot holds a protocol pointer with the 
+* answer in its low bit. A new table starts with the transitive closure 
+* of the class's protocols, remapped to their live protocol_t, all 
+* answering YES. Any other protocol pointer asked about (a NO answer, 
+* or a stale copy of a protocol) is added after the locked answer is 
+* computed, while the table has room. Slots are claimed with 
+* compare-and-swap and never change afterwards, so readers need no lock.
+*
+* A class's table is dropped when its protocol list changes. Every table 
+* goes stale when a protocol is registered, because that can change 
+* what remapProtocol() returns. Dropped tables are freed by epoch_retire().
+**********************************************************************/
+struct conformance_cache_t {
+    uintptr_t generation;
+    uint32_t mask;
+    uint32_t occupied;
+    uintptr_t slots[0];
+};
+
+// Incremented when the protocol table changes. 
+// Written with runtimeLock write-locked.
+static uintptr_t ProtocolGeneration;
+
+static void protocolsChanged(void)
+{
+    runtimeLock.assertWriting();
+    __c11_atomic_fetch_add((_Atomic(uintptr_t) *)&ProtocolGeneration, 1, 
+                           __ATOMIC_RELEASE);
+}
+
+static uintptr_t protocolGeneration(void)
+{
+    return __c11_atomic_load((_Atomic(uintptr_t) *)&ProtocolGeneration, 
+                             __ATOMIC_ACQUIRE);
+}
+
+static conformance_cache_t *loadConformanceCache(Class cls)
+{
+    return (conformance_cache_t *)
+        __c11_atomic_load((_Atomic(uintptr_t) *)&cls->data()->conformanceCache, 
+                          __ATOMIC_ACQUIRE);
+}
+
+// Returns 1 or 0 if cache knows the answer for proto, -1 otherwise.
+static int conformanceCacheFind(conformance_cache_t *cache, protocol_t *proto)
+{
+    uintptr_t key = (uintptr_t)proto;
+    uint32_t mask = cache->mask;
+    uint32_t index = ptr_hash(key) & mask;
+    for (uint32_t probes = 0; probes <= mask; probes++) {
+        uintptr_t slot = __c11_atomic_load((_Atomic(uintptr_t) *)
+                                           &cache->slots[index], 
+                                           __ATOMIC_RELAXED);
+        if (slot == 0) return -1;
+        if ((slot & ~(uintptr_t)1) == key) return (int)(slot & 1);
+        index = (index + 1) & mask;
+    }
+    return -1;
+}
+
+// Adds proto's answer unless the table is too full or already has it.
+static void conformanceCacheAdd(conformance_cache_t *cache, 
+                                protocol_t *proto, bool conforms)
+{
+    uintptr_t key = (uintptr_t)proto;
+    uint32_t mask = cache->mask;
+    if (cache->occupied >= (mask + 1) * 3 / 4) return;
+
+    uint32_t index = ptr_hash(key) & mask;
+    for (uint32_t probes = 0; probes <= mask; probes++) {
+        uintptr_t slot = 0;
+        if (__c11_atomic_compare_exchange_strong
+            ((_Atomic(uintptr_t) *)&cache->slots[index], &slot, 
+             key | (uintptr_t)conforms, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            __c11_atomic_fetch_add((_Atomic(uint32_t) *)&cache->occupied, 
+                                   1, __ATOMIC_RELAXED);
+            return;
+        }
+        if ((slot & ~(uintptr_t)1) == key) return;
+        index = (index + 1) & mask;
+    }
+}
+
+// Adds proto and everything it incorporates to the closure array.
+static void addConformances(protocol_t *proto, 
+                            protocol_t **& closure, size_t& count, size_t& max)
+{
+    runtimeLock.assertLocked();
+
+    for (size_t i = 0; i < count; i++) {
+        if (closure[i] == proto) return;
+    }
+    if (count == max) {
+        max = max ? max*2 : 16;
+        closure = (protocol_t **)realloc(closure, max * sizeof(protocol_t *));
+    }
+    closure[count++] = proto;
+
+    if (proto->protocols) {
+        for (uintptr_t i = 0; i < proto->protocols->count; i++) {
+            addConformances(remapProtocol(proto->protocols->list[i]), 
+                            closure, count, max);
+        }
+    }
+}
+
+
+/***********************************************************************
+* conformanceCacheForClass
+* Returns cls's conformance table, building it if it is missing or stale.
+* Returns nil if OBJC_DISABLE_CONFORMANCE_CACHE is set.
+* Locking: runtimeLock must be read- or write-locked by the caller.
+**********************************************************************/
+static conformance_cache_t *conformanceCacheForClass(Class cls)
+{
+    runtimeLock.assertLocked();
+
+    if (DisableConformanceCache) return nil;
+
+    uintptr_t generation = protocolGeneration();
+    conformance_cache_t *old = loadConformanceCache(cls);
+    if (old  &&  old->generation == generation) return old;
+
+    protocol_t **closure = nil;
+    size_t count = 0, max = 0;
+    for (const auto& proto_ref : cls->data()->protocols) {
+        addConformances(remapProtocol(proto_ref), closure, count, max);
+    }
+
+    uint32_t capacity = 16;
+    while (capacity < count * 4) capacity *= 2;
+    conformance_cache_t *cache = (conformance_cache_t *)
+        calloc(sizeof(conformance_cache_t) + capacity*sizeof(uintptr_t), 1);
+    cache->generation = generation;
+    cache->mask = capacity - 1;
+    for (size_t i = 0; i < count; i++) {
+        conformanceCacheAdd(cache, closure[i], YES);
+    }
+    free(closure);
+
+    // Other threads holding the read lock may be building one too.
+    if (!__c11_atomic_compare_exchange_strong
+        ((_Atomic(uintptr_t) *)&cls->data()->conformanceCache, 
+         (uintptr_t *)&old, (uintptr_t)cache, 
+         __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+    {
+        free(cache);
+        return old;
+    }
+    if (old) epoch_retire(old);
+    return cache;
+}
+
+
+/***********************************************************************
+* dropConformanceCache
+* Called when cls's protocol list changes.
+* Locking: runtimeLock must be write-locked by the caller.
+**********************************************************************/
+static void dropConformanceCache(Class cls)
+{
+    runtimeLock.assertWriting();
+
+    conformance_cache_t *cache = cls->data()->conformanceCache;
+    if (!cache) return;
+    __c11_atomic_store((_Atomic(uintptr_t) *)&cls->data()->conformanceCache, 
+                       0, __ATOMIC_RELEASE);
+    epoch_retire(cache);
+}
+
+
 /***********************************************************************
 * class_conformsToProtocol
-* fixme
+* Returns YES if cls itself adopts proto or a protocol that 
+* incorporates it. Superclasses are not searched.
+* Answers already in the conformance cache are returned without locking.
+* Like the optimistic cache lookup, that path does not call 
+* checkIsKnownClass.
 * Locking: read-locks runtimeLock
 **********************************************************************/
 BOOL class_conformsToProtocol(Class cls, Protocol *proto_gen)
@@ -6070,27 +7082,43 @@ BOOL class_conformsToProtocol(Class cls, Protocol *proto_gen)
     if (!cls) return NO;
     if (!proto_gen) return NO;
 
-    mutex_locker_t lock(runtimeLock);
+    if (cls->isRealized()) {
+        epoch_reader_t reader;
+        conformance_cache_t *cache = loadConformanceCache(cls);
+        if (cache  &&  cache->generation == protocolGeneration()) {
+            int found = conformanceCacheFind(cache, proto);
+            if (found >= 0) return found;
+        }
+    }
+
+    rwlock_reader_t lock(runtimeLock);
 
     checkIsKnownClass(cls);
     
     assert(cls->isRealized());
     
+    bool result = NO;
     for (const auto& proto_ref : cls->data()->protocols) {
         protocol_t *p = remapProtocol(proto_ref);
         if (p == proto || protocol_conformsToProtocol_nolock(p, proto)) {
-            return YES;
+            result = YES;
+            break;
         }
     }
 
-    return NO;
+    if (conformance_cache_t *cache = conformanceCacheForClass(cls)) {
+        conformanceCacheAdd(cache, proto, result);
+    }
+
+    return result;
 }
 
 
 /**********************************************************************
 * addMethod
 * fixme
-* Locking: runtimeLock must be held by the caller
+* Locking: runtimeLock must be held by the caller. If it is only 
+*   read-locked then the caller must also hold cls's ClassMethodLocks.
 **********************************************************************/
 static IMP 
 addMethod(Class cls, SEL name, IMP imp, const char *types, bool replace)
@@ -6124,8 +7152,8 @@ addMethod(Class cls, SEL name, IMP imp, const char *types, bool replace)
         newlist->first.imp = imp;
 
         prepareMethodLists(cls, &newlist, 1, NO, NO);
-        cls->data()->methods.attachLists(&newlist, 1);
-        flushCaches(cls);
+        attachMethodLists(cls, &newlist, 1);
+        flushCachesForSelectors(cls, &name, 1, OBJC_CACHE_FLUSH_ADD_METHOD);
 
         result = nil;
     }
@@ -6139,7 +7167,8 @@ addMethod(Class cls, SEL name, IMP imp, const char *types, bool replace)
 * Returns the selectors which could not be added, when replace == NO and a
 * method already exists. The returned selectors are NULL terminated and must be
 * freed by the caller. They are NULL if no failures occurred.
-* Locking: runtimeLock must be held by the caller
+* Locking: runtimeLock must be held by the caller. If it is only 
+*   read-locked then the caller must also hold cls's ClassMethodLocks.
 **********************************************************************/
 static SEL *
 addMethods(Class cls, const SEL *names, const IMP *imps, const char **types,
@@ -6198,8 +7227,15 @@ addMethods(Class cls, const SEL *names, const IMP *imps, const char **types,
         std::stable_sort(newlist->begin(), newlist->end(), sorter);
         
         prepareMethodLists(cls, &newlist, 1, NO, NO);
-        cls->data()->methods.attachLists(&newlist, 1);
-        flushCaches(cls);
+        attachMethodLists(cls, &newlist, 1);
+
+        SEL *sels = (SEL *)malloc(newlist->count * sizeof(SEL));
+        for (uint32_t i = 0; i < newlist->count; i++) {
+            sels[i] = newlist->get(i).name;
+        }
+        flushCachesForSelectors(cls, sels, newlist->count, 
+                                OBJC_CACHE_FLUSH_ADD_METHOD);
+        free(sels);
     } else {
         // Attaching the method list to the class consumes it. If we don't
         // do that, we have to free the memory ourselves.
@@ -6217,7 +7253,8 @@ class_addMethod(Class cls, SEL name, IMP imp, const char *types)
 {
     if (!cls) return NO;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
+    mutex_locker_t methodLock(ClassMethodLocks[cls]);
     return ! addMethod(cls, name, imp, types ?: "", NO);
 }
 
@@ -6227,7 +7264,8 @@ class_replaceMethod(Class cls, SEL name, IMP imp, const char *types)
 {
     if (!cls) return nil;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
+    mutex_locker_t methodLock(ClassMethodLocks[cls]);
     return addMethod(cls, name, imp, types ?: "", YES);
 }
 
@@ -6242,7 +7280,8 @@ class_addMethodsBulk(Class cls, const SEL *names, const IMP *imps,
         return (SEL *)memdup(names, count * sizeof(*names));
     }
     
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
+    mutex_locker_t methodLock(ClassMethodLocks[cls]);
     return addMethods(cls, names, imps, types, count, NO, outFailedCount);
 }
 
@@ -6252,7 +7291,8 @@ class_replaceMethodsBulk(Class cls, const SEL *names, const IMP *imps,
 {
     if (!cls) return;
     
-    mutex_locker_t lock(runtimeLock);
+    rwlock_reader_t lock(runtimeLock);
+    mutex_locker_t methodLock(ClassMethodLocks[cls]);
     addMethods(cls, names, imps, types, count, YES, nil);
 }
 
@@ -6271,7 +7311,7 @@ class_addIvar(Class cls, const char *name, size_t size,
     if (!type) type = "";
     if (name  &&  0 == strcmp(name, "")) name = nil;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     checkIsKnownClass(cls);
     assert(cls->isRealized());
@@ -6347,7 +7387,7 @@ BOOL class_addProtocol(Class cls, Protocol *protocol_gen)
     if (!cls) return NO;
     if (class_conformsToProtocol(cls, protocol_gen)) return NO;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     assert(cls->isRealized());
     
@@ -6358,6 +7398,7 @@ BOOL class_addProtocol(Class cls, Protocol *protocol_gen)
     protolist->list[0] = (protocol_ref_t)protocol;
 
     cls->data()->protocols.attachLists(&protolist, 1);
+    dropConformanceCache(cls);
 
     // fixme metaclass?
 
@@ -6385,13 +7426,13 @@ _class_addProperty(Class cls, const char *name,
     } 
     else if (prop) {
         // replace existing
-        mutex_locker_t lock(runtimeLock);
+        rwlock_writer_t lock(runtimeLock);
         try_free(prop->attributes);
         prop->attributes = copyPropertyAttributeString(attrs, count);
         return YES;
     }
     else {
-        mutex_locker_t lock(runtimeLock);
+        rwlock_writer_t lock(runtimeLock);
         
         assert(cls->isRealized());
         
@@ -6452,14 +7493,14 @@ look_up_class(const char *name,
     Class result;
     bool unrealized;
     {
-        runtimeLock.lock();
+        runtimeLock.write();
         result = getClassExceptSomeSwift(name);
         unrealized = result  &&  !result->isRealized();
         if (unrealized) {
             result = realizeClassMaybeSwiftAndUnlock(result, runtimeLock);
             // runtimeLock is now unlocked
         } else {
-            runtimeLock.unlock();
+            runtimeLock.unlockWrite();
         }
     }
 
@@ -6519,7 +7560,7 @@ objc_duplicateClass(Class original, const char *name,
 {
     Class duplicate;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     checkIsKnownClass(original);
 
@@ -6586,7 +7627,7 @@ static const uint8_t UnsetLayout = 0;
 
 static void objc_initializeClassPair_internal(Class superclass, const char *name, Class cls, Class meta)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     class_ro_t *cls_ro_w, *meta_ro_w;
     
@@ -6689,7 +7730,7 @@ Class objc_initializeClassPair(Class superclass, const char *name, Class cls, Cl
     // Fail if the class name is in use.
     if (look_up_class(name, NO, NO)) return nil;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     // Fail if the class name is in use.
     // Fail if the superclass isn't kosher.
@@ -6718,7 +7759,7 @@ Class objc_allocateClassPair(Class superclass, const char *name,
     // Fail if the class name is in use.
     if (look_up_class(name, NO, NO)) return nil;
 
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     // Fail if the class name is in use.
     // Fail if the superclass isn't kosher.
@@ -6746,7 +7787,7 @@ Class objc_allocateClassPair(Class superclass, const char *name,
 **********************************************************************/
 void objc_registerClassPair(Class cls)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     checkIsKnownClass(cls);
 
@@ -6788,7 +7829,7 @@ void objc_registerClassPair(Class cls)
 **********************************************************************/
 Class objc_readClassPair(Class bits, const struct objc_image_info *info)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     // No info bits are significant yet.
     (void)info;
@@ -6827,7 +7868,7 @@ Class objc_readClassPair(Class bits, const struct objc_image_info *info)
 **********************************************************************/
 static void detach_class(Class cls, bool isMeta)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     // categories not yet attached to this class
     removeAllUnattachedCategoriesForClass(cls);
@@ -6858,7 +7899,7 @@ static void detach_class(Class cls, bool isMeta)
 **********************************************************************/
 static void free_class(Class cls)
 {
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     if (! cls->isRealized()) return;
 
@@ -6892,6 +7933,13 @@ static void free_class(Class cls)
     
     try_free(ro->ivarLayout);
     try_free(ro->weakIvarLayout);
+    free(rw->copyPlan);
+    free(rw->conformanceCache);
+    free(rw->methodIndex);
+    for (method_hash_t *h = rw->methodHashes, *next; h; h = next) {
+        next = h->next;
+        free(h);
+    }
     try_free(ro->name);
     try_free(ro);
     try_free(rw);
@@ -6901,7 +7949,7 @@ static void free_class(Class cls)
 
 void objc_disposeClassPair(Class cls)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
 
     checkIsKnownClass(cls);
 
@@ -7005,7 +8053,16 @@ _class_createInstanceFromZone(Class cls, size_t extraBytes, void *zone,
 
     id obj;
     if (!zone  &&  fast) {
-        obj = (id)calloc(1, size);
+        obj = nil;
+        if (slowpath(objectPoolsInUse())  &&  extraBytes == 0  &&  
+            cls->hasPooledInstances()) 
+        {
+            obj = (id)_objc_poolAlloc(size);
+        }
+        else if (slowpath(AllocMagazines)) {
+            obj = (id)_objc_allocFromMagazine(size);
+        }
+        if (!obj) obj = (id)calloc(1, size);
         if (!obj) return nil;
         obj->initInstanceIsa(cls, hasCxxDtor);
     } 
@@ -7039,12 +8096,10 @@ class_createInstance(Class cls, size_t extraBytes)
 
 /***********************************************************************
 * class_createInstances
-* fixme
+* Allocates up to num_requested instances with one batch malloc.
+* See _class_createInstancesFromZone.
 * Locking: none
 **********************************************************************/
-#if SUPPORT_NONPOINTER_ISA
-#warning fixme optimize class_createInstances
-#endif
 unsigned 
 class_createInstances(Class cls, size_t extraBytes, 
                       id *results, unsigned num_requested)
@@ -7053,9 +8108,166 @@ class_createInstances(Class cls, size_t extraBytes,
                                           results, num_requested);
 }
 
+
+/***********************************************************************
+* objc_setClassAllocationPolicy
+* Chooses where class_createInstance() and +alloc get cls's instances.
+* The policy applies to cls only, not to its subclasses. 
+* Instances allocated under one policy may be freed under another.
+* Returns NO if the policy cannot be used for cls.
+* Locking: acquires runtimeLock and ObjectPoolLock
+**********************************************************************/
+BOOL
+objc_setClassAllocationPolicy(Class cls, objc_allocation_policy policy)
+{
+    if (!cls) return NO;
+
+    rwlock_writer_t lock(runtimeLock);
+
+    checkIsKnownClass(cls);
+    if (cls->isMetaClass()) return NO;
+    realizeClassMaybeSwiftAndLeaveLocked(cls, runtimeLock);
+
+    switch (policy) {
+    case OBJC_ALLOCATION_POLICY_MALLOC:
+        cls->clearInfo(RW_POOLED_INSTANCES);
+        return YES;
+
+    case OBJC_ALLOCATION_POLICY_POOLED:
+        if (cls->instanceSize(0) > OBJECT_POOL_MAX_INSTANCE_SIZE) return NO;
+        if (!_objc_reserveObjectPools()) return NO;
+        cls->setInfo(RW_POOLED_INSTANCES);
+        return YES;
+    }
+
+    return NO;
+}
+
+/***********************************************************************
+* copy_plan_t
+* What object_copy() does to an instance of one class, precomputed from 
+* the strong and weak ivar layouts of the class and its superclasses.
+*   ranges  (offset, length) byte ranges to memcpy. Excludes the isa 
+*           and every weak ivar. Covers alignedInstanceSize() bytes.
+*   strong  byte offsets of strong ivars to retain after the memcpy
+*   weak    byte offsets of weak ivars to objc_copyWeak()
+* Offsets are stored in one array: ranges first (two entries each), 
+* then strong, then weak.
+**********************************************************************/
+struct copy_plan_t {
+    uint32_t size;
+    uint32_t rangeCount;
+    uint32_t strongCount;
+    uint32_t weakCount;
+    uint32_t offsets[0];
+
+    const uint32_t *ranges() const { return offsets; }
+    const uint32_t *strong() const { return ranges() + rangeCount*2; }
+    const uint32_t *weak() const { return strong() + strongCount; }
+};
+
+enum : uint8_t { COPY_PLAIN = 0, COPY_STRONG, COPY_WEAK };
+
+static void 
+markLayout(uint8_t *kinds, size_t words, 
+           size_t firstWord, const uint8_t *layout, uint8_t kind)
+{
+    if (!layout) return;
+
+    size_t word = firstWord;
+    unsigned char byte;
+    while ((byte = *layout++)) {
+        word += (byte >> 4);
+        for (unsigned count = (byte & 0x0F); count > 0; count--, word++) {
+            if (word < words) kinds[word] = kind;
+        }
+    }
+}
+
+static copy_plan_t *buildCopyPlan(Class cls)
+{
+    size_t size = cls->alignedInstanceSize();
+    size_t words = size / sizeof(id);
+
+    uint8_t stackKinds[64];
+    uint8_t *kinds = words <= sizeof(stackKinds) 
+        ? stackKinds : (uint8_t *)malloc(words);
+    bzero(kinds, words);
+
+    for (Class c = cls; c; c = c->superclass) {
+        if (!c->hasAutomaticIvars()) continue;
+        // Use alignedInstanceStart() because unaligned bytes at the start
+        // of this class's ivars are not represented in the layout bitmap.
+        size_t first = c->alignedInstanceStart() / sizeof(id);
+        markLayout(kinds, words, first, class_getIvarLayout(c), COPY_STRONG);
+        markLayout(kinds, words, first, class_getWeakIvarLayout(c), COPY_WEAK);
+    }
+
+    // Word 0 is the isa, which the allocation already set.
+    uint32_t rangeCount = 0, strongCount = 0, weakCount = 0;
+    bool inRange = false;
+    for (size_t i = 1; i < words; i++) {
+        if (kinds[i] == COPY_WEAK) { weakCount++; inRange = false; continue; }
+        if (kinds[i] == COPY_STRONG) strongCount++;
+        if (!inRange) rangeCount++;
+        inRange = true;
+    }
+
+    size_t count = rangeCount*2 + strongCount + weakCount;
+    copy_plan_t *plan = (copy_plan_t *)
+        malloc(sizeof(copy_plan_t) + count * sizeof(uint32_t));
+    plan->size = (uint32_t)size;
+    plan->rangeCount = rangeCount;
+    plan->strongCount = strongCount;
+    plan->weakCount = weakCount;
+
+    uint32_t *range = plan->offsets;
+    uint32_t *strong = range + rangeCount*2;
+    uint32_t *weak = strong + strongCount;
+    inRange = false;
+    for (size_t i = 1; i < words; i++) {
+        uint32_t offset = (uint32_t)(i * sizeof(id));
+        if (kinds[i] == COPY_WEAK) { *weak++ = offset; inRange = false; continue; }
+        if (kinds[i] == COPY_STRONG) *strong++ = offset;
+        if (!inRange) { range[0] = offset; range[1] = 0; range += 2; }
+        range[-1] += sizeof(id);
+        inRange = true;
+    }
+
+    if (kinds != stackKinds) free(kinds);
+    return plan;
+}
+
+
+/***********************************************************************
+* copyPlanForClass
+* Returns cls's copy plan, building and caching it on first use.
+* Returns nil for classes still under construction, whose ivar 
+* layouts may yet change; the caller copies those the slow way.
+* Locking: none. Racing builders are harmless; one plan wins.
+**********************************************************************/
+static const copy_plan_t *copyPlanForClass(Class cls)
+{
+    class_rw_t *rw = cls->data();
+    copy_plan_t *plan = rw->copyPlan;
+    if (fastpath(plan)) return plan;
+
+    if (rw->flags & RW_CONSTRUCTING) return nil;
+
+    plan = buildCopyPlan(cls);
+    if (!OSAtomicCompareAndSwapPtrBarrier(nil, plan, (void **)&rw->copyPlan)) {
+        free(plan);
+        plan = rw->copyPlan;
+    }
+    return plan;
+}
+
+
 /***********************************************************************
 * object_copyFromZone
-* fixme
+* Copies the instance's bytes by following its class's copy plan.
+* C++ ivars are copied bytewise: the compiler emits no copy constructor 
+* entry point the runtime could call (#4619414).
 * Locking: none
 **********************************************************************/
 static id 
@@ -7064,20 +8276,44 @@ _object_copyFromZone(id oldObj, size_t extraBytes, void *zone)
     if (!oldObj) return nil;
     if (oldObj->isTaggedPointer()) return oldObj;
 
-    // fixme this doesn't handle C++ ivars correctly (#4619414)
-
     Class cls = oldObj->ISA();
     size_t size;
     id obj = _class_createInstanceFromZone(cls, extraBytes, zone, false, &size);
     if (!obj) return nil;
 
-    // Copy everything except the isa, which was already set above.
-    uint8_t *copyDst = (uint8_t *)obj + sizeof(Class);
-    uint8_t *copySrc = (uint8_t *)oldObj + sizeof(Class);
-    size_t copySize = size - sizeof(Class);
-    memmove(copyDst, copySrc, copySize);
+    const copy_plan_t *plan = copyPlanForClass(cls);
+    if (slowpath(!plan)) {
+        // Copy everything except the isa, which was already set above.
+        uint8_t *copyDst = (uint8_t *)obj + sizeof(Class);
+        uint8_t *copySrc = (uint8_t *)oldObj + sizeof(Class);
+        size_t copySize = size - sizeof(Class);
+        memmove(copyDst, copySrc, copySize);
 
-    fixupCopiedIvars(obj, oldObj);
+        fixupCopiedIvars(obj, oldObj);
+        return obj;
+    }
+
+    uint8_t *dst = (uint8_t *)obj;
+    uint8_t *src = (uint8_t *)oldObj;
+    const uint32_t *range = plan->ranges();
+    for (uint32_t i = 0; i < plan->rangeCount; i++, range += 2) {
+        memcpy(dst + range[0], src + range[0], range[1]);
+    }
+    if (size > plan->size) {
+        // Extra bytes, and the padding up to the minimum allocation size.
+        memcpy(dst + plan->size, src + plan->size, size - plan->size);
+    }
+
+    const uint32_t *strong = plan->strong();
+    for (uint32_t i = 0; i < plan->strongCount; i++) {
+        id value = *(id *)(dst + strong[i]);
+        if (value) objc_retain(value);
+    }
+
+    const uint32_t *weak = plan->weak();
+    for (uint32_t i = 0; i < plan->weakCount; i++) {
+        objc_copyWeak((id *)(dst + weak[i]), (id *)(src + weak[i]));
+    }
 
     return obj;
 }
@@ -7139,7 +8375,7 @@ void *objc_destructInstance(id obj)
 
         // This order is important.
         if (cxx) object_cxxDestruct(obj);
-        if (assoc) _object_remove_assocations(obj);
+        if (assoc) _object_remove_assocations(obj, true);
         obj->clearDeallocating();
     }
 
@@ -7158,7 +8394,7 @@ object_dispose(id obj)
     if (!obj) return nil;
 
     objc_destructInstance(obj);    
-    free(obj);
+    _objc_freeInstance(obj);
 
     return nil;
 }
@@ -7472,7 +8708,7 @@ static Class setSuperclass(Class cls, Class newSuper)
 {
     Class oldSuper;
 
-    runtimeLock.assertLocked();
+    runtimeLock.assertWriting();
 
     assert(cls->isRealized());
     assert(newSuper->isRealized());
@@ -7487,8 +8723,8 @@ static Class setSuperclass(Class cls, Class newSuper)
     addSubclass(newSuper->ISA(), cls->ISA());
 
     // Flush subclass's method caches.
-    flushCaches(cls);
-    flushCaches(cls->ISA());
+    flushCaches(cls, OBJC_CACHE_FLUSH_SUPERCLASS);
+    flushCaches(cls->ISA(), OBJC_CACHE_FLUSH_SUPERCLASS);
     
     return oldSuper;
 }
@@ -7496,7 +8732,7 @@ static Class setSuperclass(Class cls, Class newSuper)
 
 Class class_setSuperclass(Class cls, Class newSuper)
 {
-    mutex_locker_t lock(runtimeLock);
+    rwlock_writer_t lock(runtimeLock);
     return setSuperclass(cls, newSuper);
 }
 
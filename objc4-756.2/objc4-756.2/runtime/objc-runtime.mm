@@ -36,6 +36,7 @@
 #include "objc-private.h"
 #include "objc-loadmethod.h"
 #include "message.h"
+#include "llvm-DenseMap.h"
 
 /***********************************************************************
 * Exports.
@@ -273,6 +274,8 @@ void removeHeader(header_info *hi)
 }
 
 
+static void startup_trace_init(void);
+
 /***********************************************************************
 * environ_init
 * Read environment variables that affect the runtime.
@@ -345,6 +348,8 @@ void environ_init(void)
         }
     }
 
+    startup_trace_init();
+
     // Print OBJC_HELP and OBJC_PRINT_OPTIONS output.
     if (PrintHelp  ||  PrintOptions) {
         if (PrintHelp) {
@@ -429,6 +434,9 @@ void _objc_pthread_destroyspecific(void *arg)
 {
     _objc_pthread_data *data = (_objc_pthread_data *)arg;
     if (data != NULL) {
+        // Apply deferred releases first. 
+        // The deallocations they cause may run arbitrary code.
+        _destroyDeferredReleaseBuffer(data->deferredReleases);
         _destroyInitializingClassList(data->initializingClasses);
         _destroySyncCache(data->syncCache);
         _destroyAltHandlerList(data->handlerList);
@@ -438,6 +446,9 @@ void _objc_pthread_destroyspecific(void *arg)
             }
         }
         free(data->classNameLookups);
+        _destroyEpochRecord(data->epochRecord);
+        _destroyAllocMagazines(data->allocMagazines);
+        _destroyObjectPools(data->objectPools);
 
         // add further cleanup here...
 
@@ -446,6 +457,551 @@ void _objc_pthread_destroyspecific(void *arg)
 }
 
 
+/***********************************************************************
+* Epoch-based reclamation.
+* Some runtime data is read without locks (for example, method lists 
+* searched by lock-free method lookup). A writer that replaces such data 
+* may not free the old copy while a lock-free reader might still be 
+* using it. Instead the writer unlinks the old copy and retires it with 
+* epoch_retire(). Retired memory is freed by epoch_collect() after every 
+* reader that could have seen it has left its read-side section.
+*
+* Readers enter a read-side section with epoch_enter() and leave it with 
+* epoch_leave(); use epoch_reader_t for scoped sections. Sections nest. 
+* Readers take no locks and must not block inside a section.
+*
+* Each thread gets one epoch_record_t on first use. Records are never 
+* freed. A record is recycled for another thread after its thread exits.
+*
+* Locking: epoch_retire() and epoch_collect() acquire epochLock.
+*   epochLock is a leaf lock; any other runtime lock may be held.
+**********************************************************************/
+mutex_t epochLock;
+
+struct epoch_record_t {
+    // Global epoch when the owning thread entered its outermost section, 
+    // or 0 if it is not in a section. Written only by the owning thread.
+    std::atomic<uintptr_t> epoch;
+    // Section nesting depth. Used only by the owning thread.
+    uintptr_t depth;
+    std::atomic<bool> inUse;
+    epoch_record_t *next;
+
+    // Pad to a cache line so readers don't share lines with each other.
+    char pad[CacheLineSize - 2*sizeof(uintptr_t) - sizeof(bool) - sizeof(void*)];
+};
+static_assert(sizeof(epoch_record_t) == CacheLineSize, 
+              "epoch_record_t should fill one cache line");
+
+// Starts at 1 because a record epoch of 0 means "not reading".
+static std::atomic<uintptr_t> GlobalEpoch{1};
+static std::atomic<epoch_record_t *> EpochRecords{nil};
+
+struct epoch_garbage_t {
+    void *ptr;
+    uintptr_t epoch;
+};
+
+// Retired memory not yet freed. Protected by epochLock.
+static epoch_garbage_t *epoch_garbage = nil;
+static size_t epoch_garbage_count = 0;
+static size_t epoch_garbage_max = 0;
+
+// Try to free retired memory after this many retirements.
+enum { EPOCH_COLLECT_THRESHOLD = 64 };
+
+
+static epoch_record_t *epoch_acquireRecord(void)
+{
+    // Reuse a record abandoned by an exited thread.
+    for (epoch_record_t *rec = EpochRecords.load(std::memory_order_acquire);
+         rec != nil;
+         rec = rec->next)
+    {
+        bool expected = false;
+        if (!rec->inUse.load(std::memory_order_relaxed)  &&  
+            rec->inUse.compare_exchange_strong(expected, true, 
+                                               std::memory_order_acquire))
+        {
+            return rec;
+        }
+    }
+
+    // No record available. Make a new one and push it on the list.
+    epoch_record_t *rec = (epoch_record_t *)calloc(1, sizeof(*rec));
+    rec->inUse.store(true, std::memory_order_relaxed);
+    epoch_record_t *head = EpochRecords.load(std::memory_order_relaxed);
+    do {
+        rec->next = head;
+    } while (!EpochRecords.compare_exchange_weak(head, rec, 
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed));
+    return rec;
+}
+
+
+void _destroyEpochRecord(epoch_record_t *rec)
+{
+    if (!rec) return;
+
+    if (rec->depth != 0) {
+        _objc_fatal("thread exited inside an epoch read-side section");
+    }
+    rec->epoch.store(0, std::memory_order_release);
+    rec->inUse.store(false, std::memory_order_release);
+}
+
+
+epoch_record_t *epoch_enter(void)
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(true);
+    epoch_record_t *rec = data->epochRecord;
+    if (slowpath(!rec)) {
+        rec = data->epochRecord = epoch_acquireRecord();
+    }
+
+    if (rec->depth++ == 0) {
+        // Publish our epoch before reading any shared data.
+        // Pairs with the fence in epoch_collect() and epoch_synchronize():
+        // either the writer sees our epoch, or we see its unlinking store.
+        rec->epoch.store(GlobalEpoch.load(std::memory_order_acquire), 
+                         std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    return rec;
+}
+
+
+void epoch_leave(epoch_record_t *rec)
+{
+    assert(rec->depth > 0);
+    if (--rec->depth == 0) {
+        rec->epoch.store(0, std::memory_order_release);
+    }
+}
+
+
+// Returns the oldest epoch of any reader currently in a section, 
+// or UINTPTR_MAX if there are no readers.
+static uintptr_t epoch_oldestReader(void)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    uintptr_t oldest = UINTPTR_MAX;
+    for (epoch_record_t *rec = EpochRecords.load(std::memory_order_acquire);
+         rec != nil;
+         rec = rec->next)
+    {
+        uintptr_t e = rec->epoch.load(std::memory_order_acquire);
+        if (e  &&  e < oldest) oldest = e;
+    }
+    return oldest;
+}
+
+
+static void epoch_collect_nolock(void)
+{
+    epochLock.assertLocked();
+
+    if (epoch_garbage_count == 0) return;
+
+    // Memory retired at epoch E may be in use by readers that entered 
+    // at epoch E or earlier. Everything older than the oldest reader 
+    // is unreachable.
+    uintptr_t oldest = epoch_oldestReader();
+
+    size_t kept = 0;
+    for (size_t i = 0; i < epoch_garbage_count; i++) {
+        epoch_garbage_t g = epoch_garbage[i];
+        if (g.epoch < oldest) {
+            free(g.ptr);
+        } else {
+            epoch_garbage[kept++] = g;
+        }
+    }
+    epoch_garbage_count = kept;
+}
+
+
+/***********************************************************************
+* epoch_retire
+* Free ptr after all current lock-free readers have finished.
+* The caller must already have made ptr unreachable to new readers.
+* Locking: acquires epochLock
+**********************************************************************/
+void epoch_retire(void *ptr)
+{
+    if (!ptr) return;
+
+    mutex_locker_t lock(epochLock);
+
+    if (epoch_garbage_count == epoch_garbage_max) {
+        epoch_garbage_max = epoch_garbage_max ? epoch_garbage_max*2 : 32;
+        epoch_garbage = (epoch_garbage_t *)
+            realloc(epoch_garbage, epoch_garbage_max * sizeof(epoch_garbage_t));
+    }
+
+    uintptr_t e = GlobalEpoch.fetch_add(1, std::memory_order_seq_cst);
+    epoch_garbage[epoch_garbage_count++] = epoch_garbage_t{ptr, e};
+
+    if (epoch_garbage_count % EPOCH_COLLECT_THRESHOLD == 0) {
+        epoch_collect_nolock();
+    }
+}
+
+
+/***********************************************************************
+* epoch_collect
+* Free whatever retired memory is no longer visible to any reader.
+* Locking: acquires epochLock
+**********************************************************************/
+void epoch_collect(void)
+{
+    mutex_locker_t lock(epochLock);
+    epoch_collect_nolock();
+}
+
+
+/***********************************************************************
+* epoch_synchronize
+* Wait until every reader that was in a read-side section when this 
+* function was called has left it. 
+* Must not be called from inside a read-side section.
+* Locking: none
+**********************************************************************/
+void epoch_synchronize(void)
+{
+    // Waiting for our own section would never finish.
+    _objc_pthread_data *data = _objc_fetch_pthread_data(false);
+    if (data  &&  data->epochRecord  &&  data->epochRecord->depth != 0) {
+        _objc_fatal("epoch_synchronize() called inside "
+                    "an epoch read-side section");
+    }
+
+    uintptr_t e = GlobalEpoch.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    for (epoch_record_t *rec = EpochRecords.load(std::memory_order_acquire);
+         rec != nil;
+         rec = rec->next)
+    {
+        uintptr_t re;
+        while ((re = rec->epoch.load(std::memory_order_acquire))  &&  re <= e)
+        {
+            sched_yield();
+        }
+    }
+}
+
+
+/***********************************************************************
+* epoch_atfork_child
+* Other threads do not survive fork(). Abandon their records so 
+* they do not block reclamation in the child forever.
+**********************************************************************/
+void epoch_atfork_child(void)
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(false);
+    epoch_record_t *mine = data ? data->epochRecord : nil;
+
+    for (epoch_record_t *rec = EpochRecords.load(std::memory_order_relaxed);
+         rec != nil;
+         rec = rec->next)
+    {
+        if (rec == mine) continue;
+        rec->depth = 0;
+        rec->epoch.store(0, std::memory_order_relaxed);
+        rec->inUse.store(false, std::memory_order_relaxed);
+    }
+}
+
+
+/***********************************************************************
+* Startup trace.
+* When OBJC_RECORD_STARTUP_TRACE is set, map_images, _read_images, and 
+* load_images record how long each phase took for each image and how 
+* much work it did, and every +load method call is timed. The trace 
+* is kept in memory and is returned as JSON by 
+* _objc_copyStartupTraceJSON(). OBJC_PRINT_STARTUP_TRACE also writes 
+* it out at exit.
+*
+* Locking: StartupTraceLock is a leaf lock; recording may happen 
+*   with any other runtime lock held.
+**********************************************************************/
+mutex_t StartupTraceLock;
+
+static const char * const startupPhaseNames[STARTUP_PHASE_COUNT] = {
+    "map_image", 
+    "discover_classes", 
+    "discover_protocols", 
+    "remap_class_refs", 
+    "unique_selectors", 
+    "fixup_protocol_refs", 
+    "realize_classes", 
+    "attach_categories", 
+    "prepare_load", 
+    "call_load", 
+};
+
+static const char * const startupCountNames[STARTUP_PHASE_COUNT] = {
+    nil, 
+    "classes_read", 
+    "protocols_read", 
+    "class_refs", 
+    "selector_refs", 
+    "protocol_refs", 
+    "classes_realized", 
+    "categories_attached", 
+    nil, 
+    "load_methods_called", 
+};
+
+struct startup_image_t {
+    const headerType *mhdr;
+    char *path;
+    uint64_t mapped;
+    uint64_t nanos[STARTUP_PHASE_COUNT];
+    size_t counts[STARTUP_PHASE_COUNT];
+};
+
+struct startup_load_t {
+    const headerType *mhdr;
+    char *className;
+    char *categoryName;
+    uint64_t start;
+    uint64_t nanos;
+};
+
+// All protected by StartupTraceLock.
+static uint64_t StartupTraceOrigin;
+static startup_image_t *StartupImages;
+static size_t StartupImageCount;
+static size_t StartupImageMax;
+static objc::DenseMap<const headerType *, size_t> StartupImageIndexes;
+static startup_load_t *StartupLoads;
+static size_t StartupLoadCount;
+static size_t StartupLoadMax;
+
+template <typename T>
+static T *growArray(T *array, size_t count, size_t& max)
+{
+    if (count < max) return array;
+    max = max ? max*2 : 64;
+    return (T *)realloc(array, max * sizeof(T));
+}
+
+static startup_image_t *startupImage(const headerType *mhdr)
+{
+    StartupTraceLock.assertLocked();
+
+    auto it = StartupImageIndexes.find(mhdr);
+    if (it != StartupImageIndexes.end()) return &StartupImages[it->second];
+
+    StartupImages = growArray(StartupImages, StartupImageCount, 
+                              StartupImageMax);
+    size_t index = StartupImageCount++;
+    startup_image_t *image = &StartupImages[index];
+    bzero(image, sizeof(*image));
+    image->mhdr = mhdr;
+    StartupImageIndexes[mhdr] = index;
+    return image;
+}
+
+
+/***********************************************************************
+* _objc_traceStartupImage
+* Record that mhdr was mapped from path.
+**********************************************************************/
+void _objc_traceStartupImage(const headerType *mhdr, const char *path)
+{
+    uint64_t now = nanoseconds();
+    mutex_locker_t lock(StartupTraceLock);
+
+    startup_image_t *image = startupImage(mhdr);
+    if (!image->path) {
+        image->path = strdup(path ?: "");
+        image->mapped = now;
+    }
+}
+
+
+/***********************************************************************
+* _objc_traceStartupPhase
+* Add the duration and count of one phase to mhdr's record.
+**********************************************************************/
+void _objc_traceStartupPhase(const headerType *mhdr, startup_phase_t phase, 
+                             uint64_t nanos, size_t count)
+{
+    mutex_locker_t lock(StartupTraceLock);
+
+    startup_image_t *image = startupImage(mhdr);
+    image->nanos[phase] += nanos;
+    image->counts[phase] += count;
+}
+
+
+/***********************************************************************
+* _objc_traceLoadMethod
+* Record one +load call. hi is the image that contains the class or 
+* category, or nil if it is unknown.
+**********************************************************************/
+void _objc_traceLoadMethod(const header_info *hi, Class cls, 
+                           const char *categoryName, 
+                           uint64_t start, uint64_t nanos)
+{
+    const headerType *mhdr = hi ? hi->mhdr() : nil;
+    char *className = strdup(cls->nameForLogging());
+    char *catName = categoryName ? strdup(categoryName) : nil;
+
+    mutex_locker_t lock(StartupTraceLock);
+
+    StartupLoads = growArray(StartupLoads, StartupLoadCount, StartupLoadMax);
+    StartupLoads[StartupLoadCount++] = 
+        startup_load_t{mhdr, className, catName, start, nanos};
+
+    if (mhdr) {
+        startup_image_t *image = startupImage(mhdr);
+        image->nanos[STARTUP_CALL_LOAD] += nanos;
+        image->counts[STARTUP_CALL_LOAD]++;
+    }
+}
+
+
+// Growable string for JSON output.
+struct startup_json_t {
+    char *buf = nil;
+    size_t len = 0;
+    size_t max = 0;
+
+    __attribute__((format(printf, 2, 3)))
+    void append(const char *fmt, ...) {
+        va_list ap;
+        while (true) {
+            va_start(ap, fmt);
+            int n = vsnprintf(buf + len, max - len, fmt, ap);
+            va_end(ap);
+            if (n < 0) return;
+            if (len + n < max) { len += n; return; }
+            max = (len + n + 1) * 2;
+            buf = (char *)realloc(buf, max);
+        }
+    }
+
+    void appendString(const char *str) {
+        if (!str) { append("null"); return; }
+        append("\"");
+        for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+            if (*c == '"'  ||  *c == '\\') append("\\%c", *c);
+            else if (*c < 0x20) append("\\u%04x", *c);
+            else append("%c", *c);
+        }
+        append("\"");
+    }
+};
+
+
+/***********************************************************************
+* _objc_copyStartupTraceJSON
+* Returns the startup trace as a JSON object. The caller must free() it.
+* Times are integer nanoseconds. Timestamps are relative to the 
+* runtime's initialization. Images are identified by path and by their 
+* index in load order, never by address, so traces of different 
+* launches can be compared. The process ID appears once, in "trace".
+**********************************************************************/
+char *_objc_copyStartupTraceJSON(void)
+{
+    if (!RecordStartupTrace) return nil;
+
+    mutex_locker_t lock(StartupTraceLock);
+
+    startup_json_t json;
+    json.append("{\n  \"trace\": {\"pid\": %d},\n  \"images\": [", getpid());
+    for (size_t i = 0; i < StartupImageCount; i++) {
+        startup_image_t& image = StartupImages[i];
+        json.append("%s\n    {\"path\": ", i ? "," : "");
+        json.appendString(image.path);
+        json.append(", \"index\": %zu, \"mapped_ns\": %llu, "
+                    "\"phases\": {", i, 
+                    image.mapped ? image.mapped - StartupTraceOrigin : 0ULL);
+        bool first = true;
+        for (int p = 0; p < STARTUP_PHASE_COUNT; p++) {
+            if (!image.nanos[p]  &&  !image.counts[p]) continue;
+            json.append("%s\n      \"%s\": {\"ns\": %llu", first ? "" : ",", 
+                        startupPhaseNames[p], image.nanos[p]);
+            if (startupCountNames[p]) {
+                json.append(", \"%s\": %zu", 
+                            startupCountNames[p], image.counts[p]);
+            }
+            json.append("}");
+            first = false;
+        }
+        json.append("}}");
+    }
+
+    json.append("\n  ],\n  \"load_methods\": [");
+    for (size_t i = 0; i < StartupLoadCount; i++) {
+        startup_load_t& load = StartupLoads[i];
+        json.append("%s\n    {\"class\": ", i ? "," : "");
+        json.appendString(load.className);
+        json.append(", \"category\": ");
+        json.appendString(load.categoryName);
+        json.append(", \"image\": ");
+        auto it = StartupImageIndexes.find(load.mhdr);
+        json.appendString(it != StartupImageIndexes.end() 
+                          ? StartupImages[it->second].path : nil);
+        json.append(", \"start_ns\": %llu, \"ns\": %llu}", 
+                    load.start - StartupTraceOrigin, load.nanos);
+    }
+    json.append("\n  ]\n}\n");
+
+    return json.buf;
+}
+
+
+static void printStartupTrace(void)
+{
+    char *json = _objc_copyStartupTraceJSON();
+    if (!json) return;
+
+    int fd = STDERR_FILENO;
+    const char *path = getenv("OBJC_STARTUP_TRACE_FILE");
+    if (path  &&  path[0]) {
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            _objc_inform("STARTUP TRACE: could not open %s (%s)", 
+                         path, strerror(errno));
+            fd = STDERR_FILENO;
+        }
+    }
+
+    size_t len = strlen(json);
+    for (size_t done = 0; done < len; ) {
+        ssize_t n = write(fd, json + done, len - done);
+        if (n < 0  &&  errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    if (fd != STDERR_FILENO) close(fd);
+    free(json);
+}
+
+
+/***********************************************************************
+* startup_trace_init
+* Start the trace clock. Arrange to print the trace at exit if requested.
+* Called by environ_init().
+**********************************************************************/
+static void startup_trace_init(void)
+{
+    if (PrintStartupTrace) RecordStartupTrace = true;
+    if (!RecordStartupTrace) return;
+
+    StartupTraceOrigin = nanoseconds();
+    if (PrintStartupTrace) atexit(&printStartupTrace);
+}
+
+
 void tls_init(void)
 {
 #if SUPPORT_DIRECT_THREAD_KEYS
@@ -578,7 +1134,7 @@ void objc_setAssociatedObject(id object, const void *key, id value, objc_Associa
 void objc_removeAssociatedObjects(id object) 
 {
     if (object && object->hasAssociatedObjects()) {
-        _object_remove_assocations(object);
+        _object_remove_assocations(object, false);
     }
 }
 
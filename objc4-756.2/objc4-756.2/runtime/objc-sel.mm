@@ -31,22 +31,256 @@ static const objc_selopt_t *builtins = NULL;
 #endif
 
 
-static size_t SelrefCount = 0;
-//被注册的selector会被放到一个静态变量namedSelectors
-static NXMapTable *namedSelectors;
-
 static SEL search_builtins(const char *key);
 
 
+/***********************************************************************
+* Selector table.
+* Selectors registered at runtime (everything not in the shared cache's 
+* builtins) live in an open-addressed, linearly probed table of name 
+* pointers. Each slot also records the name's hash, so most probes that 
+* do not match are rejected without touching the string.
+*
+* Lookups take no locks. Inserts take no locks either: a new name is 
+* claimed by compare-and-swap on an empty slot. Two threads inserting 
+* the same name probe the same sequence of slots, so they meet at the 
+* same empty slot and the loser adopts the winner's selector.
+*
+* Growing the table takes selLock. The grower freezes every empty slot 
+* of the old table, copies its names to a table twice as large, and then 
+* publishes the new table. An inserter that runs into a frozen slot 
+* waits for selLock and retries in the new table. Readers of the old 
+* table still see every name it held. Old tables are never freed, 
+* because lock-free readers may still be using them; since tables 
+* double, they add up to less than the live table.
+*
+* Names that must be copied are copied into an append-only arena. 
+* Selectors are never unregistered, so the arena is never freed.
+**********************************************************************/
+#define SEL_SLOT_FROZEN ((const char *)(uintptr_t)1)
+#define SEL_TABLE_MIN_CAPACITY 1024
+#define SEL_ARENA_CHUNK_SIZE (64*1024)
+
+struct selector_slot_t {
+    std::atomic<const char *> name;
+    // 0 until the inserter has stored it. Readers treat 0 as "compare".
+    std::atomic<uint32_t> hash;
+};
+
+struct selector_table_t {
+    uint32_t mask;
+    std::atomic<uint32_t> count;
+    selector_slot_t slots[0];
+
+    uint32_t capacity() const { return mask + 1; }
+};
+
+struct selector_arena_t {
+    std::atomic<size_t> used;
+    size_t size;
+    char bytes[0];
+};
+
+static std::atomic<selector_table_t *> SelectorTable{nil};
+static std::atomic<selector_arena_t *> SelectorArena{nil};
+
+static uint32_t sel_hash(const char *name)
+{
+    // Mix _objc_strhash() so the low bits used for the slot index 
+    // depend on every character.
+    uint32_t h = _objc_strhash(name);
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h ?: 1;  // 0 means "hash not stored yet"
+}
+
+static selector_table_t *sel_allocTable(uint32_t capacity)
+{
+    size_t size = sizeof(selector_table_t) + capacity*sizeof(selector_slot_t);
+    selector_table_t *table = (selector_table_t *)calloc(size, 1);
+    table->mask = capacity - 1;
+    return table;
+}
+
+// Returns the current table, creating it if sel_init() has not run yet.
+static selector_table_t *sel_getTable(void)
+{
+    selector_table_t *table = SelectorTable.load(std::memory_order_acquire);
+    if (fastpath(table)) return table;
+
+    selector_table_t *newTable = sel_allocTable(SEL_TABLE_MIN_CAPACITY);
+    if (SelectorTable.compare_exchange_strong(table, newTable, 
+                                              std::memory_order_acq_rel)) 
+    {
+        return newTable;
+    }
+    free(newTable);
+    return table;
+}
+
+// Find name in table. Returns nil if it is not there.
+static SEL sel_findInTable(selector_table_t *table, 
+                           const char *name, uint32_t hash)
+{
+    uint32_t mask = table->mask;
+    uint32_t index = hash & mask;
+    for (uint32_t probes = 0; probes <= mask; probes++) {
+        selector_slot_t& slot = table->slots[index];
+        const char *slotName = slot.name.load(std::memory_order_acquire);
+        if (!slotName  ||  slotName == SEL_SLOT_FROZEN) return nil;
+
+        uint32_t slotHash = slot.hash.load(std::memory_order_relaxed);
+        if ((slotHash == 0  ||  slotHash == hash)  &&  
+            0 == strcmp(slotName, name)) 
+        {
+            return (SEL)slotName;
+        }
+        index = (index + 1) & mask;
+    }
+    return nil;
+}
+
+// Copy name into the selector arena.
+static const char *sel_copyName(const char *name)
+{
+    size_t size = strlen(name) + 1;
+    if (_dyld_is_memory_immutable(name, size)) return name;
+
+    while (true) {
+        selector_arena_t *arena = 
+            SelectorArena.load(std::memory_order_acquire);
+        if (arena) {
+            size_t offset = 
+                arena->used.fetch_add(size, std::memory_order_relaxed);
+            if (offset + size <= arena->size) {
+                char *copy = arena->bytes + offset;
+                memcpy(copy, name, size);
+                return copy;
+            }
+        }
+
+        // Arena is full. Install a new one unless another thread did.
+        size_t chunk = MAX(size, SEL_ARENA_CHUNK_SIZE - sizeof(selector_arena_t));
+        selector_arena_t *newArena = (selector_arena_t *)
+            malloc(sizeof(selector_arena_t) + chunk);
+        newArena->used.store(0, std::memory_order_relaxed);
+        newArena->size = chunk;
+        if (!SelectorArena.compare_exchange_strong(arena, newArena, 
+                                                   std::memory_order_release))
+        {
+            free(newArena);
+        }
+    }
+}
+
+// Replace table with a table twice its size.
+// Does nothing if another thread already replaced it.
+static void sel_growTable(selector_table_t *table)
+{
+    selLock.assertLocked();
+
+    if (SelectorTable.load(std::memory_order_acquire) != table) return;
+
+    selector_table_t *newTable = sel_allocTable(table->capacity() * 2);
+    uint32_t newMask = newTable->mask;
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < table->capacity(); i++) {
+        selector_slot_t& slot = table->slots[i];
+        const char *name = nil;
+        // Freeze empty slots. A failed freeze means an insert won the slot.
+        if (slot.name.compare_exchange_strong(name, SEL_SLOT_FROZEN, 
+                                              std::memory_order_acq_rel)) 
+        {
+            continue;
+        }
+
+        uint32_t hash = slot.hash.load(std::memory_order_relaxed);
+        if (!hash) hash = sel_hash(name);
+        uint32_t index = hash & newMask;
+        while (newTable->slots[index].name.load(std::memory_order_relaxed)) {
+            index = (index + 1) & newMask;
+        }
+        newTable->slots[index].hash.store(hash, std::memory_order_relaxed);
+        newTable->slots[index].name.store(name, std::memory_order_relaxed);
+        count++;
+    }
+
+    newTable->count.store(count, std::memory_order_relaxed);
+    SelectorTable.store(newTable, std::memory_order_release);
+}
+
+// Look up name, inserting it if it is not there.
+// The caller holds selLock if and only if locked is true.
+static SEL sel_findOrInsert(const char *name, uint32_t hash, 
+                            bool copy, bool locked)
+{
+    const char *newName = nil;
+
+    while (true) {
+        selector_table_t *table = sel_getTable();
+
+        // Keep the load factor at or below 3/4.
+        if ((table->count.load(std::memory_order_relaxed) + 1) * 4 > 
+            table->capacity() * 3) 
+        {
+            conditional_mutex_locker_t lock(selLock, !locked);
+            sel_growTable(table);
+            continue;
+        }
+
+        uint32_t mask = table->mask;
+        uint32_t index = hash & mask;
+        bool frozen = false;
+        for (uint32_t probes = 0; probes <= mask; probes++) {
+            selector_slot_t& slot = table->slots[index];
+            const char *slotName = slot.name.load(std::memory_order_acquire);
+
+            if (!slotName) {
+                if (!newName) newName = copy ? sel_copyName(name) : name;
+                if (slot.name.compare_exchange_strong
+                    (slotName, newName, std::memory_order_acq_rel)) 
+                {
+                    slot.hash.store(hash, std::memory_order_relaxed);
+                    table->count.fetch_add(1, std::memory_order_relaxed);
+                    return (SEL)newName;
+                }
+                // Lost the slot. slotName is now the winner's name.
+            }
+
+            if (slotName == SEL_SLOT_FROZEN) {
+                frozen = true;
+                break;
+            }
+
+            uint32_t slotHash = slot.hash.load(std::memory_order_relaxed);
+            if ((slotHash == 0  ||  slotHash == hash)  &&  
+                0 == strcmp(slotName, name)) 
+            {
+                // Any copy we made stays unused in the arena.
+                return (SEL)slotName;
+            }
+            index = (index + 1) & mask;
+        }
+
+        // The table is being replaced (frozen), or inserts that raced 
+        // with the load factor check filled it. Either way, make sure 
+        // a bigger table exists and try again.
+        conditional_mutex_locker_t lock(selLock, !locked);
+        if (!frozen) sel_growTable(table);
+    }
+}
+
+
 /***********************************************************************
 * sel_init
 * Initialize selector tables and register selectors used internally.
 **********************************************************************/
 void sel_init(size_t selrefCount)
 {
-    // save this value for later
-    SelrefCount = selrefCount;
-
 #if SUPPORT_PREOPT
     builtins = preoptimizedSelectors();
 
@@ -62,6 +296,17 @@ void sel_init(size_t selrefCount)
         }
 #endif
 
+    // Size the table for the main executable's selector refs.
+    uint32_t capacity = SEL_TABLE_MIN_CAPACITY;
+    while (capacity * 3 < selrefCount * 4) capacity *= 2;
+    selector_table_t *table = sel_allocTable(capacity);
+    selector_table_t *expected = nil;
+    if (!SelectorTable.compare_exchange_strong(expected, table, 
+                                               std::memory_order_release)) 
+    {
+        free(table);
+    }
+
     // Register selectors used by libobjc
     //#表示：对应变量字符串化
     //##表示：把宏参数名与宏定义代码序列中的标识符连接在一起，形成一个新的标识符
@@ -96,13 +341,6 @@ void sel_init(size_t selrefCount)
 }
 
 
-static SEL sel_alloc(const char *name, bool copy)
-{
-    selLock.assertLocked();
-    return (SEL)(copy ? strdupIfMutable(name) : name);    
-}
-
-
 const char *sel_getName(SEL sel) 
 {
     if (!sel) return "<null selector>";
@@ -118,11 +356,9 @@ BOOL sel_isMapped(SEL sel)
 
     if (sel == search_builtins(name)) return YES;
 
-    mutex_locker_t lock(selLock);
-    if (namedSelectors) {
-        return (sel == (SEL)NXMapGet(namedSelectors, name));
-    }
-    return false;
+    selector_table_t *table = SelectorTable.load(std::memory_order_acquire);
+    if (!table) return NO;
+    return sel == sel_findInTable(table, name, sel_hash(name));
 }
 
 
@@ -135,6 +371,8 @@ static SEL search_builtins(const char *name)
 }
 
 //selector添加到MapTable中
+// shouldLock is false if the caller holds selLock. 
+// The table itself needs selLock only to grow.
 static SEL __sel_registerName(const char *name, bool shouldLock, bool copy) 
 {
     SEL result = 0;
@@ -146,26 +384,13 @@ static SEL __sel_registerName(const char *name, bool shouldLock, bool copy)
 
     result = search_builtins(name);
     if (result) return result;
-    
-    conditional_mutex_locker_t lock(selLock, shouldLock);
-    if (namedSelectors) {
-        result = (SEL)NXMapGet(namedSelectors, name);
-    }
+
+    uint32_t hash = sel_hash(name);
+    result = sel_findInTable(sel_getTable(), name, hash);
     if (result) return result;
 
     // No match. Insert.
-
-    if (!namedSelectors) {
-        namedSelectors = NXCreateMapTable(NXStrValueMapPrototype, 
-                                          (unsigned)SelrefCount);
-    }
-    if (!result) {
-        result = sel_alloc(name, copy);
-        // fixme choose a better container (hash not map for starters)
-        NXMapInsert(namedSelectors, sel_getName(result), result);
-    }
-
-    return result;
+    return sel_findOrInsert(name, hash, copy, !shouldLock);
 }
 
 
@@ -177,6 +402,17 @@ SEL sel_registerNameNoLock(const char *name, bool copy) {
     return __sel_registerName(name, 0, copy);  // NO lock, maybe copy
 }
 
+// Look up an already-registered selector without inserting it.
+// No lock assertions: _read_images' fixup workers call this while 
+// the thread that spawned them holds selLock on their behalf.
+SEL sel_lookupNameNoLock(const char *name) {
+    SEL result = search_builtins(name);
+    if (result) return result;
+    selector_table_t *table = SelectorTable.load(std::memory_order_acquire);
+    if (!table) return nil;
+    return sel_findInTable(table, name, sel_hash(name));
+}
+
 
 // 2001/1/24
 // the majority of uses of this function (which used to return NULL if not found)
@@ -26,14 +26,15 @@
 
 //
 // Allocate a lock only when needed.  Since few locks are needed at any point
-// in time, keep them on a single list.
+// in time, keep them in small per-stripe hash tables and reuse 
+// locks that no thread is using.
 //
 
 
 typedef struct alignas(CacheLineSize) SyncData {
-    struct SyncData* nextData;
     DisguisedPtr<objc_object> object;
     int32_t threadCount;  // number of THREADS using this block
+    uint32_t spinLimit;   // tryLock attempts before parking; adapts to contention
     recursive_mutex_t mutex;
 } SyncData;
 
@@ -56,18 +57,35 @@ typedef struct SyncCache {
   SYNC_COUNT_DIRECT_KEY == SyncCacheItem.lockCount
  */
 
+// Open-addressed table of SyncData, keyed by object with linear probing.
+// Buckets are never emptied: a SyncData whose threadCount is zero 
+// may be reassigned to any object whose probe sequence reaches it. 
+// When the table fills up it is rebuilt with only the SyncData 
+// still in use, and the rest are freed. Memory therefore tracks 
+// the peak number of objects locked at once, not the number of 
+// distinct objects ever locked.
 struct SyncList {
-    SyncData *data;
+    SyncData **buckets;
+    uint32_t mask;      // capacity - 1; buckets is nil while mask is 0
+    uint32_t occupied;
     spinlock_t lock;
 
-    constexpr SyncList() : data(nil), lock(fork_unsafe_lock) { }
+    constexpr SyncList() 
+        : buckets(nil), mask(0), occupied(0), lock(fork_unsafe_lock) { }
 };
 
-// Use multiple parallel lists to decrease contention among unrelated objects.
+// Use multiple parallel tables to decrease contention among unrelated objects.
 #define LOCK_FOR_OBJ(obj) sDataLists[obj].lock
-#define LIST_FOR_OBJ(obj) sDataLists[obj].data
+#define LIST_FOR_OBJ(obj) sDataLists[obj]
 static StripedMap<SyncList> sDataLists;
 
+#define SYNC_LIST_MIN_CAPACITY 8
+
+// Adaptive spinning before parking on a contended SyncData mutex.
+#define SYNC_SPIN_MIN      4
+#define SYNC_SPIN_INITIAL  64
+#define SYNC_SPIN_MAX      2048
+
 
 enum usage { ACQUIRE, RELEASE, CHECK };
 
@@ -107,10 +125,111 @@ void _destroySyncCache(struct SyncCache *cache)
 }
 
 
+static ALWAYS_INLINE void sync_pause(void)
+{
+#if __x86_64__  ||  __i386__
+    __builtin_ia32_pause();
+#elif __arm64__  ||  __arm__
+    __builtin_arm_yield();
+#endif
+}
+
+
+// Insert data into the first empty bucket on its probe sequence.
+// Locking: list.lock must be held
+static void sync_insert(SyncList& list, SyncData *data)
+{
+    uint32_t i = ptr_hash((uintptr_t)(objc_object *)data->object) & list.mask;
+    while (list.buckets[i]) i = (i+1) & list.mask;
+    list.buckets[i] = data;
+    list.occupied++;
+}
+
+
+// Rebuild the table with room for one more SyncData. 
+// SyncData that no thread is using are freed. Their mutexes are 
+// unlocked, because objc_sync_exit unlocks before dropping threadCount.
+// Locking: list.lock must be held
+static void sync_rebuild(SyncList& list)
+{
+    SyncData **oldBuckets = list.buckets;
+    uint32_t oldCapacity = oldBuckets ? list.mask + 1 : 0;
+
+    uint32_t inUse = 0;
+    for (uint32_t i = 0; i < oldCapacity; i++) {
+        SyncData *p = oldBuckets[i];
+        if (p  &&  p->threadCount > 0) inUse++;
+    }
+
+    uint32_t newCapacity = SYNC_LIST_MIN_CAPACITY;
+    while ((inUse + 1) * 4 > newCapacity * 3) newCapacity *= 2;
+
+    list.buckets = (SyncData **)calloc(newCapacity, sizeof(SyncData *));
+    list.mask = newCapacity - 1;
+    list.occupied = 0;
+
+    for (uint32_t i = 0; i < oldCapacity; i++) {
+        SyncData *p = oldBuckets[i];
+        if (!p) continue;
+        if (p->threadCount > 0) sync_insert(list, p);
+        else free(p);
+    }
+    free(oldBuckets);
+}
+
+
+// Find the SyncData for object and add this thread to its threadCount, 
+// reusing or allocating one if the object has none.
+// Locking: list.lock must be held
+static SyncData *sync_claim(SyncList& list, id object)
+{
+    SyncData *firstUnused = nil;
+
+    if (list.buckets) {
+        uint32_t i = ptr_hash((uintptr_t)object) & list.mask;
+        SyncData *p;
+        while ((p = list.buckets[i])) {
+            if (p->object == object) {
+                // atomic because may collide with concurrent RELEASE
+                OSAtomicIncrement32Barrier(&p->threadCount);
+                return p;
+            }
+            if (!firstUnused  &&  p->threadCount == 0) firstUnused = p;
+            i = (i+1) & list.mask;
+        }
+    }
+
+    // no SyncData currently associated with object.
+    // An unused one on object's probe sequence can take over its bucket.
+    if (firstUnused) {
+        firstUnused->object = (objc_object *)object;
+        firstUnused->threadCount = 1;
+        return firstUnused;
+    }
+
+    if (!list.buckets  ||  (list.occupied + 1) * 4 > (list.mask + 1) * 3) {
+        sync_rebuild(list);
+    }
+
+    // Allocate a new SyncData and add it to the table.
+    // XXX allocating memory with a global lock held is bad practice,
+    // might be worth releasing the lock, allocating, and searching again.
+    // But SyncData are reused, so we won't be stuck in allocation very often.
+    SyncData *result;
+    posix_memalign((void **)&result, alignof(SyncData), sizeof(SyncData));
+    result->object = (objc_object *)object;
+    result->threadCount = 1;
+    result->spinLimit = SYNC_SPIN_INITIAL;
+    new (&result->mutex) recursive_mutex_t(fork_unsafe_lock);
+    sync_insert(list, result);
+    return result;
+}
+
+
 static SyncData* id2data(id object, enum usage why)
 {
     spinlock_t *lockp = &LOCK_FOR_OBJ(object);
-    SyncData **listp = &LIST_FOR_OBJ(object);
+    SyncList *listp = &LIST_FOR_OBJ(object);
     SyncData* result = NULL;
 
 #if SUPPORT_DIRECT_THREAD_KEYS
@@ -193,83 +312,60 @@ static SyncData* id2data(id object, enum usage why)
     }
 
     // Thread cache didn't find anything.
-    // Walk in-use list looking for matching object
+    // All RELEASE and CHECK and recursive ACQUIRE are 
+    // handled by the per-thread caches above.
+    if (why != ACQUIRE) {
+        // Probably some thread is incorrectly exiting 
+        // while the object is held by another thread.
+        return nil;
+    }
+
+    // Look in the object's stripe table.
     // Spinlock prevents multiple threads from creating multiple 
     // locks for the same new object.
-    // We could keep the nodes in some hash table if we find that there are
-    // more than 20 or so distinct locks active, but we don't do that now.
-    
     lockp->lock();
+    result = sync_claim(*listp, object);
+    lockp->unlock();
+
+    if (result->object != object) _objc_fatal("id2data is buggy");
 
+#if SUPPORT_DIRECT_THREAD_KEYS
+    if (!fastCacheOccupied) {
+        // Save in fast thread cache
+        tls_set_direct(SYNC_DATA_DIRECT_KEY, result);
+        tls_set_direct(SYNC_COUNT_DIRECT_KEY, (void*)1);
+    } else 
+#endif
     {
-        SyncData* p;
-        SyncData* firstUnused = NULL;
-        for (p = *listp; p != NULL; p = p->nextData) {
-            if ( p->object == object ) {
-                result = p;
-                // atomic because may collide with concurrent RELEASE
-                OSAtomicIncrement32Barrier(&result->threadCount);
-                goto done;
-            }
-            if ( (firstUnused == NULL) && (p->threadCount == 0) )
-                firstUnused = p;
-        }
-    
-        // no SyncData currently associated with object
-        if ( (why == RELEASE) || (why == CHECK) )
-            goto done;
-    
-        // an unused one was found, use it
-        if ( firstUnused != NULL ) {
-            result = firstUnused;
-            result->object = (objc_object *)object;
-            result->threadCount = 1;
-            goto done;
-        }
+        // Save in thread cache
+        if (!cache) cache = fetch_cache(YES);
+        cache->list[cache->used].data = result;
+        cache->list[cache->used].lockCount = 1;
+        cache->used++;
     }
 
-    // Allocate a new SyncData and add to list.
-    // XXX allocating memory with a global lock held is bad practice,
-    // might be worth releasing the lock, allocating, and searching again.
-    // But since we never free these guys we won't be stuck in allocation very often.
-    posix_memalign((void **)&result, alignof(SyncData), sizeof(SyncData));
-    result->object = (objc_object *)object;
-    result->threadCount = 1;
-    new (&result->mutex) recursive_mutex_t(fork_unsafe_lock);
-    result->nextData = *listp;
-    *listp = result;
-    
- done:
-    lockp->unlock();
-    if (result) {
-        // Only new ACQUIRE should get here.
-        // All RELEASE and CHECK and recursive ACQUIRE are 
-        // handled by the per-thread caches above.
-        if (why == RELEASE) {
-            // Probably some thread is incorrectly exiting 
-            // while the object is held by another thread.
-            return nil;
-        }
-        if (why != ACQUIRE) _objc_fatal("id2data is buggy");
-        if (result->object != object) _objc_fatal("id2data is buggy");
+    return result;
+}
 
-#if SUPPORT_DIRECT_THREAD_KEYS
-        if (!fastCacheOccupied) {
-            // Save in fast thread cache
-            tls_set_direct(SYNC_DATA_DIRECT_KEY, result);
-            tls_set_direct(SYNC_COUNT_DIRECT_KEY, (void*)1);
-        } else 
-#endif
-        {
-            // Save in thread cache
-            if (!cache) cache = fetch_cache(YES);
-            cache->list[cache->used].data = result;
-            cache->list[cache->used].lockCount = 1;
-            cache->used++;
+
+// Lock data's mutex, spinning first in case the owner leaves soon.
+// The spin limit grows when spinning succeeds and shrinks when 
+// we park anyway, so long critical sections stop wasting CPU.
+static void sync_lock(SyncData *data)
+{
+    if (data->mutex.tryLock()) return;
+
+    uint32_t limit = data->spinLimit;
+    for (uint32_t i = 0; i < limit; i++) {
+        sync_pause();
+        if (data->mutex.tryLock()) {
+            if (limit < SYNC_SPIN_MAX) data->spinLimit = limit * 2;
+            return;
         }
     }
+    if (limit > SYNC_SPIN_MIN) data->spinLimit = limit / 2;
 
-    return result;
+    data->mutex.lock();
 }
 
 
@@ -288,7 +384,7 @@ int objc_sync_enter(id obj)
     if (obj) {
         SyncData* data = id2data(obj, ACQUIRE);
         assert(data);
-        data->mutex.lock();
+        sync_lock(data);
     } else {
         // @synchronized(nil) does nothing
         if (DebugNilSync) {
@@ -308,13 +404,17 @@ int objc_sync_exit(id obj)
     int result = OBJC_SYNC_SUCCESS;
     
     if (obj) {
-        SyncData* data = id2data(obj, RELEASE); 
+        // Unlock before RELEASE drops threadCount. Once threadCount 
+        // is zero the SyncData may be reused or freed by another thread.
+        SyncData* data = id2data(obj, CHECK); 
         if (!data) {
             result = OBJC_SYNC_NOT_OWNING_THREAD_ERROR;
         } else {
             bool okay = data->mutex.tryUnlock();
             if (!okay) {
                 result = OBJC_SYNC_NOT_OWNING_THREAD_ERROR;
+            } else {
+                id2data(obj, RELEASE);
             }
         }
     } else {
@@ -97,6 +97,12 @@ struct weak_entry_t {
         return (out_of_line_ness == REFERRERS_OUT_OF_LINE);
     }
 
+    // Referrers were detached by weak_clear_no_lock() 
+    // and are being cleared by weak_sweep().
+    bool sweeping() {
+        return out_of_line()  &&  referrers == nil;
+    }
+
     weak_entry_t& operator=(const weak_entry_t& other) {
         memcpy(this, &other, sizeof(other));
         return *this;
@@ -121,14 +127,25 @@ struct weak_table_t {
     size_t    num_entries;
     uintptr_t mask;
     uintptr_t max_hash_displacement;
+    // Number of objc_loadWeakRetained() calls using objects 
+    // in this table without the lock. Accessed atomically.
+    uintptr_t lockfree_loads;
 };
 
 /// Adds an (object, weak pointer) pair to the weak table.
 id weak_register_no_lock(weak_table_t *weak_table, id referent, 
                          id *referrer, bool crashIfDeallocating);
 
+/// Weak pointers detached from the weak table by weak_clear_no_lock().
+struct weak_sweep_t {
+    weak_referrer_t *referrers;
+    size_t count;
+};
+
 /// Removes an (object, weak pointer) pair from the weak table.
-void weak_unregister_no_lock(weak_table_t *weak_table, id referent, id *referrer);
+/// Returns false and does nothing if the object's weak pointers are 
+/// being cleared by weak_sweep(). The caller must drop the lock and retry.
+bool weak_unregister_no_lock(weak_table_t *weak_table, id referent, id *referrer);
 
 #if DEBUG
 /// Returns true if an object is weakly referenced somewhere.
@@ -136,7 +153,26 @@ bool weak_is_registered_no_lock(weak_table_t *weak_table, id referent);
 #endif
 
 /// Called on object destruction. Sets all remaining weak pointers to nil.
-void weak_clear_no_lock(weak_table_t *weak_table, id referent);
+/// Many weak pointers are instead detached into sweep. Then the caller 
+/// must drop the lock, call weak_sweep(), and call 
+/// weak_sweep_finish_no_lock() with the lock held again.
+void weak_clear_no_lock(weak_table_t *weak_table, id referent, 
+                        weak_sweep_t *sweep);
+
+/// Sets weak pointers detached by weak_clear_no_lock() to nil. 
+/// Called without the lock.
+void weak_sweep(id referent, weak_sweep_t *sweep);
+
+/// Removes the weak table entry of an object after weak_sweep().
+void weak_sweep_finish_no_lock(weak_table_t *weak_table, id referent);
+
+/// Brackets a weak load that uses an object without the lock.
+void weak_beginLockFreeLoad(weak_table_t *weak_table);
+void weak_endLockFreeLoad(weak_table_t *weak_table);
+
+/// Called on object destruction after the weak pointers are cleared, without the lock.
+/// Waits for weak loads that may have read the object without the lock.
+void weak_waitForLockFreeLoads(weak_table_t *weak_table);
 
 __END_DECLS
 
@@ -344,7 +344,7 @@ weak_entry_for_referent(weak_table_t *weak_table, objc_object *referent)
  * @param referent The object.
  * @param referrer The weak reference.
  */
-void
+bool
 weak_unregister_no_lock(weak_table_t *weak_table, id referent_id, 
                         id *referrer_id)
 {
@@ -353,9 +353,12 @@ weak_unregister_no_lock(weak_table_t *weak_table, id referent_id,
 
     weak_entry_t *entry;
 
-    if (!referent) return;
+    if (!referent) return true;
 
     if ((entry = weak_entry_for_referent(weak_table, referent))) {
+        // weak_sweep() may still write to referrer.
+        if (entry->sweeping()) return false;
+
         remove_referrer(entry, referrer);
         bool empty = true;
         if (entry->out_of_line()  &&  entry->num_refs != 0) {
@@ -377,6 +380,8 @@ weak_unregister_no_lock(weak_table_t *weak_table, id referent_id,
 
     // Do not set *referrer = nil. objc_storeWeak() requires that the 
     // value not change.
+
+    return true;
 }
 
 /** 
@@ -427,6 +432,8 @@ weak_register_no_lock(weak_table_t *weak_table, id referent_id,
     // now remember it and where it is being stored
     weak_entry_t *entry;
     if ((entry = weak_entry_for_referent(weak_table, referent))) {
+        // The referent is deallocating, whatever -allowsWeakReference said.
+        if (entry->sweeping()) return nil;
         append_referrer(entry, referrer);
     } 
     else {
@@ -451,18 +458,65 @@ weak_is_registered_no_lock(weak_table_t *weak_table, id referent_id)
 #endif
 
 
+// Objects with at least this many weak pointers have them 
+// cleared by weak_sweep() instead of under the lock.
+#define WEAK_SWEEP_MIN_REFS 32
+
+// How far ahead weak_clear_referrers() prefetches weak pointers.
+#define WEAK_CLEAR_PREFETCH 8
+
+static void 
+weak_clear_referrers(objc_object *referent, 
+                     weak_referrer_t *referrers, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (i + WEAK_CLEAR_PREFETCH < count) {
+            objc_object **ahead = referrers[i + WEAK_CLEAR_PREFETCH];
+            if (ahead) __builtin_prefetch(ahead, 1);
+        }
+
+        objc_object **referrer = referrers[i];
+        if (referrer) {
+            if (*referrer == referent) {
+                *referrer = nil;
+            }
+            else if (*referrer) {
+                _objc_inform("__weak variable at %p holds %p instead of %p. "
+                             "This is probably incorrect use of "
+                             "objc_storeWeak() and objc_loadWeak(). "
+                             "Break on objc_weak_error to debug.\n", 
+                             referrer, (void*)*referrer, (void*)referent);
+                objc_weak_error();
+            }
+        }
+    }
+}
+
+
 /** 
  * Called by dealloc; nils out all weak pointers that point to the 
  * provided object so that they can no longer be used.
  * 
+ * An object with many weak pointers would hold the lock for a long time. 
+ * Its referrer set is instead detached into sweep, and its entry stays 
+ * in the table marked as sweeping until weak_sweep_finish_no_lock(). 
+ * While the entry is sweeping, objc_storeWeak() may not change any of 
+ * the detached weak pointers: weak_unregister_no_lock() refuses, so 
+ * the caller waits for the sweep to finish.
+ * 
  * @param weak_table 
  * @param referent The object being deallocated. 
+ * @param sweep Set to the detached weak pointers, if any.
  */
 void 
-weak_clear_no_lock(weak_table_t *weak_table, id referent_id) 
+weak_clear_no_lock(weak_table_t *weak_table, id referent_id, 
+                   weak_sweep_t *sweep) 
 {
     objc_object *referent = (objc_object *)referent_id;
 
+    sweep->referrers = nil;
+    sweep->count = 0;
+
     weak_entry_t *entry = weak_entry_for_referent(weak_table, referent);
     if (entry == nil) {
         /// XXX shouldn't happen, but does with mismatched CF/objc
@@ -477,29 +531,120 @@ weak_clear_no_lock(weak_table_t *weak_table, id referent_id)
     if (entry->out_of_line()) {
         referrers = entry->referrers;
         count = TABLE_SIZE(entry);
+
+        if (entry->num_refs >= WEAK_SWEEP_MIN_REFS) {
+            // Detach the referrers and leave a sweeping entry behind.
+            sweep->referrers = referrers;
+            sweep->count = count;
+            entry->referrers = nil;
+            entry->num_refs = 0;
+            entry->mask = 0;
+            entry->max_hash_displacement = 0;
+            return;
+        }
     } 
     else {
         referrers = entry->inline_referrers;
         count = WEAK_INLINE_COUNT;
     }
     
-    for (size_t i = 0; i < count; ++i) {
-        objc_object **referrer = referrers[i];
-        if (referrer) {
-            if (*referrer == referent) {
-                *referrer = nil;
-            }
-            else if (*referrer) {
-                _objc_inform("__weak variable at %p holds %p instead of %p. "
-                             "This is probably incorrect use of "
-                             "objc_storeWeak() and objc_loadWeak(). "
-                             "Break on objc_weak_error to debug.\n", 
-                             referrer, (void*)*referrer, (void*)referent);
-                objc_weak_error();
-            }
-        }
-    }
+    weak_clear_referrers(referent, referrers, count);
     
     weak_entry_remove(weak_table, entry);
 }
 
+
+/** 
+ * Called by dealloc without the lock, after weak_clear_no_lock() 
+ * detached the object's weak pointers. Sets them to nil.
+ * 
+ * Concurrent objc_loadWeakRetained() may still read the object from 
+ * a weak pointer that is not cleared yet. It returns nil just as 
+ * it would for a cleared one, because the object is deallocating.
+ * 
+ * @param referent The object being deallocated. 
+ * @param sweep The weak pointers detached by weak_clear_no_lock().
+ */
+void 
+weak_sweep(id referent_id, weak_sweep_t *sweep)
+{
+    objc_object *referent = (objc_object *)referent_id;
+
+    weak_clear_referrers(referent, sweep->referrers, sweep->count);
+    free(sweep->referrers);
+    sweep->referrers = nil;
+    sweep->count = 0;
+}
+
+
+/** 
+ * Called by dealloc after weak_sweep(). Removes the object's 
+ * sweeping entry, which lets waiting objc_storeWeak() calls proceed.
+ * 
+ * @param weak_table 
+ * @param referent The object being deallocated. 
+ */
+void 
+weak_sweep_finish_no_lock(weak_table_t *weak_table, id referent_id)
+{
+    objc_object *referent = (objc_object *)referent_id;
+
+    weak_entry_t *entry = weak_entry_for_referent(weak_table, referent);
+    assert(entry  &&  entry->sweeping());
+    weak_entry_remove(weak_table, entry);
+}
+
+
+/** 
+ * Brackets a load in objc_loadWeakRetained() that reads and retains 
+ * an object without the side table lock. weak_table is the table 
+ * of the object read from the weak pointer. The caller must read 
+ * the weak pointer again after weak_beginLockFreeLoad() and use 
+ * the object only if it has not changed.
+ * 
+ * @param weak_table The global weak table of the object.
+ */
+void 
+weak_beginLockFreeLoad(weak_table_t *weak_table)
+{
+    // Pairs with the fence in weak_waitForLockFreeLoads(): either 
+    // the deallocating thread sees our count, or we see its cleared 
+    // weak pointer when we read it again.
+    __c11_atomic_fetch_add((_Atomic(uintptr_t) *)&weak_table->lockfree_loads, 
+                           1, __ATOMIC_SEQ_CST);
+}
+
+void 
+weak_endLockFreeLoad(weak_table_t *weak_table)
+{
+    __c11_atomic_fetch_sub((_Atomic(uintptr_t) *)&weak_table->lockfree_loads, 
+                           1, __ATOMIC_RELEASE);
+}
+
+
+/** 
+ * Called on object destruction after weak_clear_no_lock() or 
+ * weak_sweep() has set the object's weak pointers to nil, and 
+ * after the side table lock is released.
+ * 
+ * objc_loadWeakRetained() may read and retain an object without 
+ * the side table lock. Such a load may have read a weak pointer 
+ * before it was cleared. The object must not be freed until that 
+ * load has finished. Only loads of objects in the same table are 
+ * waited for, and they never block while counted, so usually 
+ * there is nothing to wait for.
+ * 
+ * @param weak_table The global weak table of the deallocating object.
+ */
+void 
+weak_waitForLockFreeLoads(weak_table_t *weak_table)
+{
+    if (DisableLockFreeWeakLoads) return;
+
+    __c11_atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (__c11_atomic_load((_Atomic(uintptr_t) *)&weak_table->lockfree_loads,
+                             __ATOMIC_ACQUIRE) != 0)
+    {
+        sched_yield();
+    }
+}
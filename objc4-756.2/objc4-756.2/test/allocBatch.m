@@ -0,0 +1,122 @@
+// TEST_CONFIG MEM=mrc
+
+// class_createInstances returns zero-filled instances that support 
+// ordinary retain/release, weak references, and deallocation. 
+// +alloc of several classes with different instance sizes, 
+// interleaved and on several threads, returns zero-filled instances.
+// Then compare the cost of +alloc and class_createInstances.
+// Test allocMagazines also uses this file, 
+// with OBJC_ALLOC_MAGAZINES set.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/objc-internal.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
+
+static int deallocs;
+
+@interface Small : NSObject {
+  @public
+    long a;
+}
+@end
+@implementation Small
+-(void)dealloc {
+    __sync_fetch_and_add(&deallocs, 1);
+    [super dealloc];
+}
+@end
+
+@interface Large : Small {
+  @public
+    long b[30];
+}
+@end
+@implementation Large @end
+
+#define BATCH 100
+
+static void checkZeroed(Small *obj, Class cls)
+{
+    testassert([obj class] == cls);
+    testassert(obj->a == 0);
+    if (cls == [Large class]) {
+        for (int i = 0; i < 30; i++) testassert(((Large *)obj)->b[i] == 0);
+    }
+}
+
+static void *allocLoop(void *arg __unused)
+{
+    for (int round = 0; round < 100; round++) {
+        Small *objs[BATCH];
+        for (int i = 0; i < BATCH; i++) {
+            Class cls = (i % 3) ? [Small class] : [Large class];
+            objs[i] = [cls alloc];
+            checkZeroed(objs[i], cls);
+            objs[i]->a = -1;
+        }
+        for (int i = 0; i < BATCH; i++) [objs[i] release];
+    }
+    return NULL;
+}
+
+int main()
+{
+    // Batch allocation.
+    id objs[BATCH];
+    deallocs = 0;
+    unsigned count = class_createInstances([Large class], 0, objs, BATCH);
+    testassert(count > 0  &&  count <= BATCH);
+    for (unsigned i = 0; i < count; i++) {
+        checkZeroed(objs[i], [Large class]);
+        [objs[i] retain];
+        testassert([objs[i] retainCount] == 2);
+        [objs[i] release];
+    }
+    id weak = nil;
+    objc_storeWeak(&weak, objs[0]);
+    for (unsigned i = 0; i < count; i++) [objs[i] release];
+    testassert(deallocs == (int)count);
+    testassert(objc_loadWeak(&weak) == nil);
+
+    // Interleaved sizes on several threads.
+    deallocs = 0;
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) {
+        pthread_create(&threads[t], NULL, &allocLoop, NULL);
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    testassert(deallocs == 4 * 100 * BATCH);
+
+    // Allocation cost.
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    uint64_t allocTime = 0;
+    uint64_t batchTime = 0;
+    unsigned batched = 0;
+    for (int round = 0; round < 1000; round++) {
+        uint64_t start = mach_absolute_time();
+        for (int i = 0; i < BATCH; i++) objs[i] = [Small alloc];
+        allocTime += mach_absolute_time() - start;
+        for (int i = 0; i < BATCH; i++) [objs[i] release];
+
+        start = mach_absolute_time();
+        count = class_createInstances([Small class], 0, objs, BATCH);
+        batchTime += mach_absolute_time() - start;
+        batched += count;
+        for (unsigned i = 0; i < count; i++) [objs[i] release];
+    }
+    testprintf("+alloc: %llu ns/object\n", 
+               (unsigned long long)(allocTime * tb.numer / tb.denom 
+                                    / (1000 * BATCH)));
+    if (batched) {
+        testprintf("class_createInstances: %llu ns/object\n", 
+                   (unsigned long long)(batchTime * tb.numer / tb.denom 
+                                        / batched));
+    }
+
+    succeed(__FILE__);
+}
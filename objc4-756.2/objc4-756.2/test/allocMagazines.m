@@ -0,0 +1,12 @@
+// Run test allocBatch with per-thread allocation magazines.
+
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_ALLOC_MAGAZINES=YES
+
+/*
+TEST_RUN_OUTPUT
+OK: allocBatch.m
+END
+*/
+
+#include "allocBatch.m"
@@ -0,0 +1,120 @@
+// TEST_CONFIG MEM=mrc
+
+// Pooled allocation policy and allocation arenas.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/objc-internal.h>
+#include <pthread.h>
+
+static int deallocs;
+
+@interface Pooled : NSObject {
+  @public
+    long a, b, c;
+}
+@end
+@implementation Pooled
+-(void)dealloc {
+    deallocs++;
+    [super dealloc];
+}
+@end
+
+@interface PooledSub : Pooled @end
+@implementation PooledSub @end
+
+@interface Plain : NSObject {
+  @public
+    long a, b, c;
+}
+@end
+@implementation Plain @end
+
+#define COUNT 10000
+#define ROUNDS 20
+
+static void *freeOnThread(void *arg)
+{
+    Pooled **objs = (Pooled **)arg;
+    for (int i = 0; i < COUNT; i++) {
+        [objs[i] release];
+    }
+    return NULL;
+}
+
+static uint64_t churn(Class cls)
+{
+    static id objs[COUNT];
+    uint64_t start = mach_absolute_time();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < COUNT; i++) objs[i] = [cls new];
+        for (int i = 0; i < COUNT; i++) [objs[i] release];
+    }
+    return mach_absolute_time() - start;
+}
+
+int main()
+{
+    testassert(!objc_setClassAllocationPolicy(nil, OBJC_ALLOCATION_POLICY_POOLED));
+    testassert(!objc_setClassAllocationPolicy(object_getClass([Pooled class]),
+                                              OBJC_ALLOCATION_POLICY_POOLED));
+    testassert(objc_setClassAllocationPolicy([Pooled class],
+                                             OBJC_ALLOCATION_POLICY_POOLED));
+
+    // Reused memory is zeroed.
+    Pooled *obj = [Pooled new];
+    obj->a = obj->b = obj->c = -1;
+    [obj release];
+    for (int i = 0; i < 100; i++) {
+        obj = [Pooled new];
+        testassert(obj->a == 0  &&  obj->b == 0  &&  obj->c == 0);
+        testassert([obj class] == [Pooled class]);
+        obj->a = obj->b = obj->c = -1;
+        [obj release];
+    }
+
+    // Subclasses keep the default policy but still work.
+    PooledSub *sub = [PooledSub new];
+    testassert(sub->a == 0);
+    [sub release];
+
+    // Instances may be freed on a thread other than the allocating one.
+    static Pooled *objs[COUNT];
+    deallocs = 0;
+    for (int i = 0; i < COUNT; i++) objs[i] = [Pooled new];
+    pthread_t th;
+    pthread_create(&th, NULL, &freeOnThread, objs);
+    pthread_join(th, NULL);
+    testassert(deallocs == COUNT);
+
+    // Instances that outlive their arena stay valid until released.
+    void *outer = objc_allocationArenaPush();
+    Pooled *survivor = [Pooled new];
+    void *inner = objc_allocationArenaPush();
+    for (int i = 0; i < COUNT; i++) objs[i] = [Pooled new];
+    for (int i = 0; i < COUNT; i++) [objs[i] release];
+    objc_allocationArenaPop(inner);
+    survivor->a = 42;
+    objc_allocationArenaPop(outer);
+    testassert(survivor->a == 42);
+    testassert([survivor retainCount] == 1);
+    [survivor release];
+
+    // Setting the policy back to malloc stops pooling new instances.
+    testassert(objc_setClassAllocationPolicy([Pooled class],
+                                             OBJC_ALLOCATION_POLICY_MALLOC));
+    obj = [Pooled new];
+    testassert(malloc_size(obj) > 0);
+    [obj release];
+
+    testassert(objc_setClassAllocationPolicy([Plain class],
+                                             OBJC_ALLOCATION_POLICY_POOLED));
+    uint64_t pooled = churn([Plain class]);
+    testassert(objc_setClassAllocationPolicy([Plain class],
+                                             OBJC_ALLOCATION_POLICY_MALLOC));
+    uint64_t malloced = churn([Plain class]);
+    testprintf("pooled %llu, malloc %llu\n", pooled, malloced);
+
+    succeed(__FILE__);
+}
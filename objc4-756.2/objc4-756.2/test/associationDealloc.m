@@ -0,0 +1,122 @@
+// TEST_CONFIG MEM=mrc
+
+// Deallocation of short-lived objects with a few associations.
+// Objects with one or two associations keep them in their 
+// associations table entry; a third moves them to a separate map.
+// Every association must survive that move, and every value must 
+// be released exactly once when its object is deallocated.
+// Test associationDeallocSpilled also uses this file, 
+// with OBJC_DISABLE_INLINE_ASSOCIATIONS set.
+// Run both and compare the printed dealloc throughput.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <mach/mach_time.h>
+
+#if defined(__arm__)
+#define THREADS 4
+#define COUNT 1024*4
+#else
+#define THREADS 16
+#define COUNT 1024*16
+#endif
+#define MAXKEYS 3
+
+static atomic_int ValueDealloc;
+
+@interface Value : TestRoot @end
+@implementation Value
+-(void)dealloc {
+    atomic_fetch_add(&ValueDealloc, 1);
+    [super dealloc];
+}
+@end
+
+static char keys[MAXKEYS];
+static id value;
+
+static void *churn(void *arg)
+{
+    int count = (int)(intptr_t)arg;
+    for (int n = 0; n < COUNT; n++) {
+        id obj = [TestRoot new];
+        for (int k = 0; k < count; k++) {
+            objc_setAssociatedObject(obj, &keys[k], value, 
+                                     OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        }
+        [obj release];
+    }
+    return NULL;
+}
+
+static uint64_t elapsedMicroseconds(uint64_t start)
+{
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    return (mach_absolute_time() - start) * tb.numer / tb.denom / 1000;
+}
+
+int main()
+{
+    // Associations survive filling the inline slots, 
+    // moving to a map, and removal in any order.
+    id obj = [TestRoot new];
+    id values[MAXKEYS];
+    for (int k = 0; k < MAXKEYS; k++) {
+        values[k] = [Value new];
+        objc_setAssociatedObject(obj, &keys[k], values[k], 
+                                 OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        [values[k] release];
+        for (int j = 0; j <= k; j++) {
+            testassert(objc_getAssociatedObject(obj, &keys[j]) == values[j]);
+        }
+    }
+    objc_setAssociatedObject(obj, &keys[0], nil, OBJC_ASSOCIATION_ASSIGN);
+    testassert(ValueDealloc == 1);
+    testassert(objc_getAssociatedObject(obj, &keys[0]) == nil);
+    testassert(objc_getAssociatedObject(obj, &keys[1]) == values[1]);
+    testassert(objc_getAssociatedObject(obj, &keys[2]) == values[2]);
+    [obj release];
+    testassert(ValueDealloc == MAXKEYS);
+
+    obj = [TestRoot new];
+    values[0] = [Value new];
+    objc_setAssociatedObject(obj, &keys[0], values[0], 
+                             OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    [values[0] release];
+    objc_setAssociatedObject(obj, &keys[0], nil, OBJC_ASSOCIATION_ASSIGN);
+    testassert(ValueDealloc == MAXKEYS + 1);
+    testassert(objc_getAssociatedObject(obj, &keys[0]) == nil);
+    [obj release];
+
+    // Dealloc throughput with 1, 2, and 3 associations per object.
+    value = [Value new];
+    for (int count = 1; count <= MAXKEYS; count++) {
+        uint64_t start = mach_absolute_time();
+        churn((void *)(intptr_t)count);
+        testprintf("1 thread x %d objects with %d associations: %llu us\n", 
+                   COUNT, count, 
+                   (unsigned long long)elapsedMicroseconds(start));
+
+        start = mach_absolute_time();
+        pthread_t threads[THREADS];
+        for (int t = 0; t < THREADS; t++) {
+            pthread_create(&threads[t], NULL, &churn, (void *)(intptr_t)count);
+        }
+        for (int t = 0; t < THREADS; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        testprintf("%d threads x %d objects with %d associations: %llu us\n", 
+                   THREADS, COUNT, count, 
+                   (unsigned long long)elapsedMicroseconds(start));
+    }
+
+    testassert(ValueDealloc == MAXKEYS + 1);
+    [value release];
+    testassert(ValueDealloc == MAXKEYS + 2);
+
+    succeed(__FILE__);
+}
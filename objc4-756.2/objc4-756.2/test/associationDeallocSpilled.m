@@ -0,0 +1,12 @@
+// Run test associationDealloc with every object's associations in a separate map.
+
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DISABLE_INLINE_ASSOCIATIONS=YES
+
+/*
+TEST_RUN_OUTPUT
+OK: associationDealloc.m
+END
+*/
+
+#include "associationDealloc.m"
@@ -0,0 +1,181 @@
+// TEST_CONFIG MEM=mrc
+
+// Associated object get/set/remove from many threads.
+// Readers get associations of shared objects while writers replace 
+// them; every get must return nil or one of the installed values. 
+// Each thread also churns private objects through set, get, 
+// objc_removeAssociatedObjects, and dealloc, and every value 
+// released along the way must be deallocated exactly once.
+// Test associationStormLocked also uses this file, 
+// with OBJC_DISABLE_LOCKFREE_ASSOCIATIONS set.
+// Run both and compare the printed times against earlier runtimes.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <mach/mach_time.h>
+
+#if defined(__arm__)
+#define THREADS 4
+#define GETS 1024*16
+#define CHURN 1024
+#else
+#define THREADS 16
+#define GETS 1024*64
+#define CHURN 1024*4
+#endif
+#define SHARED 64
+#define KEYS 4
+#define VALUES 8
+
+static atomic_int ValueDealloc;
+
+@interface Value : TestRoot @end
+@implementation Value
+-(void)dealloc {
+    atomic_fetch_add(&ValueDealloc, 1);
+    [super dealloc];
+}
+@end
+
+static char keys[KEYS];
+static id shared[SHARED];
+static id values[VALUES];
+static atomic_int done;
+
+static bool isInstalledValue(id value)
+{
+    if (!value) return true;
+    for (int v = 0; v < VALUES; v++) {
+        if (value == values[v]) return true;
+    }
+    return false;
+}
+
+static void *getter(void *arg __unused)
+{
+    @autoreleasepool {
+        for (int n = 0; n < GETS; n++) {
+            id obj = shared[n % SHARED];
+            id value = objc_getAssociatedObject(obj, &keys[n % KEYS]);
+            testassert(isInstalledValue(value));
+        }
+    }
+    return NULL;
+}
+
+static void *setter(void *arg __unused)
+{
+    // Alternate non-atomic and atomic policies so both 
+    // the unlocked and the locked getter paths run.
+    unsigned n = 0;
+    while (!atomic_load(&done)) {
+        id obj = shared[n % SHARED];
+        const void *key = &keys[(n / SHARED) % KEYS];
+        id value = (n % 5 == 0) ? nil : values[n % VALUES];
+        objc_setAssociatedObject(obj, key, value, (n & 1) 
+                                 ? OBJC_ASSOCIATION_RETAIN 
+                                 : OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        n++;
+    }
+    return NULL;
+}
+
+static void *churner(void *arg __unused)
+{
+    for (int n = 0; n < CHURN; n++) {
+        id obj = [TestRoot new];
+        int count = 1 + n % (KEYS + 1);
+        for (int k = 0; k < count; k++) {
+            id value = [Value new];
+            objc_setAssociatedObject(obj, &keys[k % KEYS], value, 
+                                     OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+            [value release];
+        }
+        for (int k = 0; k < count  &&  k < KEYS; k++) {
+            testassert(objc_getAssociatedObject(obj, &keys[k]) != nil);
+        }
+        if (n & 1) {
+            objc_removeAssociatedObjects(obj);
+            testassert(objc_getAssociatedObject(obj, &keys[0]) == nil);
+        }
+        [obj release];
+    }
+    return NULL;
+}
+
+static uint64_t elapsedMicroseconds(uint64_t start)
+{
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    return (mach_absolute_time() - start) * tb.numer / tb.denom / 1000;
+}
+
+int main()
+{
+    for (int i = 0; i < SHARED; i++) {
+        shared[i] = [TestRoot new];
+    }
+    for (int v = 0; v < VALUES; v++) {
+        values[v] = [Value new];
+    }
+
+    // Uncontended gets.
+    for (int i = 0; i < SHARED; i++) {
+        objc_setAssociatedObject(shared[i], &keys[0], values[i % VALUES], 
+                                 OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    }
+    uint64_t start = mach_absolute_time();
+    getter(NULL);
+    testprintf("1 thread x %d gets: %llu us\n", GETS, 
+               (unsigned long long)elapsedMicroseconds(start));
+
+    // Gets racing with sets.
+    pthread_t set;
+    pthread_create(&set, NULL, &setter, NULL);
+    start = mach_absolute_time();
+    pthread_t threads[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &getter, NULL);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    testprintf("%d threads x %d gets with a concurrent setter: %llu us\n", 
+               THREADS, GETS, (unsigned long long)elapsedMicroseconds(start));
+    atomic_store(&done, 1);
+    pthread_join(set, NULL);
+
+    // Set, get, remove, and dealloc of private objects.
+    int deallocsBefore = atomic_load(&ValueDealloc);
+    int expected = 0;
+    for (int n = 0; n < CHURN; n++) expected += 1 + n % (KEYS + 1);
+    start = mach_absolute_time();
+    for (int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &churner, NULL);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    testprintf("%d threads x %d set/get/remove cycles: %llu us\n", 
+               THREADS, CHURN, (unsigned long long)elapsedMicroseconds(start));
+    testassert(atomic_load(&ValueDealloc) - deallocsBefore == THREADS * expected);
+
+    // The shared values are still retained by the shared objects.
+    for (int i = 0; i < SHARED; i++) {
+        objc_removeAssociatedObjects(shared[i]);
+        for (int k = 0; k < KEYS; k++) {
+            testassert(objc_getAssociatedObject(shared[i], &keys[k]) == nil);
+        }
+        [shared[i] release];
+    }
+    testassert(atomic_load(&ValueDealloc) == THREADS * expected);
+    for (int v = 0; v < VALUES; v++) {
+        [values[v] release];
+    }
+    testassert(atomic_load(&ValueDealloc) == THREADS * expected + VALUES);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,12 @@
+// Run test associationStorm with every get under the associations lock.
+
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DISABLE_LOCKFREE_ASSOCIATIONS=YES
+
+/*
+TEST_RUN_OUTPUT
+OK: associationStorm.m
+END
+*/
+
+#include "associationStorm.m"
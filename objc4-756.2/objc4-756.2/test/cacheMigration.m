@@ -0,0 +1,82 @@
+// TEST_CONFIG
+
+// Method cache contents survive cache growth.
+// A fresh class receives messages with many different selectors, 
+// growing its method cache several times. Each selector should be 
+// filled into the cache only once, and every cached entry must 
+// still dispatch to the right implementation after the cache grows.
+// Test cacheMigrationDisabled also uses this file, to compare fills 
+// and warm-up time against caches that drop their contents.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <objc/message.h>
+#include <objc/objc-internal.h>
+#include <mach/mach_time.h>
+
+#define SELS 200
+#define ROUNDS 16
+
+@interface Warm : TestRoot @end
+@implementation Warm @end
+
+static SEL sels[SELS];
+
+static IMP impReturning(long value)
+{
+    return imp_implementationWithBlock(^(id self __unused) { return value; });
+}
+
+// Send every selector ROUNDS times, in order.
+// Returns elapsed time in nanoseconds.
+static uint64_t warmUp(id obj)
+{
+    uint64_t start = mach_absolute_time();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < SELS; i++) {
+            long value = ((long(*)(id, SEL))objc_msgSend)(obj, sels[i]);
+            testassert(value == i);
+        }
+    }
+    uint64_t elapsed = mach_absolute_time() - start;
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    return elapsed * tb.numer / tb.denom;
+}
+
+int main()
+{
+    for (int i = 0; i < SELS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "warm%d", i);
+        sels[i] = sel_registerName(name);
+        testassert(class_addMethod([Warm class], sels[i], impReturning(i), "l@:"));
+    }
+
+    id obj = [Warm new];
+
+    // Pass 0 grows the cache from its initial size.
+    // Pass 1 refills it after a flush, which does not shrink it.
+    for (int pass = 0; pass < 2; pass++) {
+        _objc_flush_caches([Warm class]);
+
+        size_t fills = _objc_getCacheFillCount();
+        uint64_t ns = warmUp(obj);
+        fills = _objc_getCacheFillCount() - fills;
+
+        testprintf("pass %d: %zu cache fills, %llu ns for %d sends\n", 
+                   pass, fills, (unsigned long long)ns, SELS*ROUNDS);
+
+#if MIGRATION_DISABLED
+        // Entries dropped by each cache growth are filled again.
+        if (pass == 0) testassert(fills > SELS);
+        else testassert(fills == SELS);
+#else
+        testassert(fills == SELS);
+#endif
+    }
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,13 @@
+// Run test cacheMigration with method cache migration disabled.
+
+// TEST_CONFIG
+// TEST_ENV OBJC_DISABLE_CACHE_MIGRATION=YES
+// TEST_CFLAGS -DMIGRATION_DISABLED=1
+
+/*
+TEST_RUN_OUTPUT
+OK: cacheMigration.m
+END
+*/
+
+#include "cacheMigration.m"
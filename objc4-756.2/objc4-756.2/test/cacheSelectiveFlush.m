@@ -0,0 +1,186 @@
+// TEST_CONFIG
+
+// Adding or changing methods removes only the affected selectors
+// from method caches. Other cached entries keep dispatching without
+// being filled again, and changed entries dispatch to the new IMP.
+// Test cacheSelectiveFlushDisabled also uses this file, to compare
+// refills against flushes that erase whole caches.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <objc/message.h>
+#include <objc/objc-internal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define SELS 64
+
+@interface Base : TestRoot @end
+@implementation Base @end
+
+@interface Sub : Base @end
+@implementation Sub @end
+
+static SEL sels[SELS];
+static long expected[SELS];
+
+static IMP impReturning(long value)
+{
+    return imp_implementationWithBlock(^(id self __unused) { return value; });
+}
+
+static long send(id obj, int i)
+{
+    return ((long(*)(id, SEL))objc_msgSend)(obj, sels[i]);
+}
+
+// Send every selector to every object, checking the results.
+// Returns the number of cache fills that took.
+static size_t sendAll(id base, id sub)
+{
+    size_t fills = _objc_getCacheFillCount();
+    for (int i = 0; i < SELS; i++) {
+        testassert(send(base, i) == expected[i]);
+        testassert(send(sub, i) == expected[i]);
+    }
+    return _objc_getCacheFillCount() - fills;
+}
+
+static struct objc_cache_flush_counts counts(objc_cache_flush_cause cause)
+{
+    return _objc_getCacheFlushCounts(cause);
+}
+
+static atomic_bool done;
+
+static void *sender(void *arg)
+{
+    id obj = (id)arg;
+    while (!atomic_load(&done)) {
+        for (int i = 0; i < SELS; i++) {
+            long value = send(obj, i);
+            testassert(value == i  ||  value == -i);
+        }
+    }
+    return NULL;
+}
+
+int main()
+{
+    for (int i = 0; i < SELS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "flush%d", i);
+        sels[i] = sel_registerName(name);
+        expected[i] = i;
+        testassert(class_addMethod([Base class], sels[i],
+                                   impReturning(i), "l@:"));
+    }
+
+    id base = [Base new];
+    id sub = [Sub new];
+
+    testassert(sendAll(base, sub) == 2*SELS);
+    testassert(sendAll(base, sub) == 0);
+
+    // Unrelated new method: nothing cached needs to change.
+    struct objc_cache_flush_counts before = counts(OBJC_CACHE_FLUSH_ADD_METHOD);
+    testassert(class_addMethod([Base class], @selector(unrelated),
+                               impReturning(-1), "l@:"));
+    struct objc_cache_flush_counts after = counts(OBJC_CACHE_FLUSH_ADD_METHOD);
+    testassert(after.events == before.events + 1);
+    size_t fills = sendAll(base, sub);
+    testprintf("unrelated method: %zu refills, %zu entries removed\n",
+               fills, after.entriesRemoved - before.entriesRemoved);
+#if SELECTIVE_FLUSH_DISABLED
+    testassert(fills == 2*SELS);
+#else
+    testassert(fills == 0);
+    testassert(after.entriesRemoved == before.entriesRemoved);
+#endif
+
+    // Changed implementation: its entries in Base and Sub are refilled.
+    before = counts(OBJC_CACHE_FLUSH_SET_IMPLEMENTATION);
+    method_setImplementation(class_getInstanceMethod([Base class], sels[5]),
+                             impReturning(500));
+    expected[5] = 500;
+    after = counts(OBJC_CACHE_FLUSH_SET_IMPLEMENTATION);
+    testassert(after.events == before.events + 1);
+    fills = sendAll(base, sub);
+    testprintf("changed implementation: %zu refills\n", fills);
+#if SELECTIVE_FLUSH_DISABLED
+    testassert(fills >= 2*SELS);
+#else
+    testassert(fills == 2);
+    testassert(after.entriesRemoved == before.entriesRemoved + 2);
+#endif
+
+    // Exchanged implementations.
+    before = counts(OBJC_CACHE_FLUSH_EXCHANGE);
+    method_exchangeImplementations(class_getInstanceMethod([Base class], sels[1]),
+                                   class_getInstanceMethod([Base class], sels[2]));
+    expected[1] = 2;
+    expected[2] = 1;
+    after = counts(OBJC_CACHE_FLUSH_EXCHANGE);
+    testassert(after.events == before.events + 1);
+    fills = sendAll(base, sub);
+#if SELECTIVE_FLUSH_DISABLED
+    testassert(fills >= 2*SELS);
+#else
+    testassert(fills == 4);
+#endif
+
+    // Override in the subclass: only Sub's entry changes.
+    testassert(class_addMethod([Sub class], sels[3], impReturning(3), "l@:"));
+    fills = sendAll(base, sub);
+#if SELECTIVE_FLUSH_DISABLED
+    testassert(fills == SELS);
+#else
+    testassert(fills == 1);
+#endif
+
+    // Explicit flushes still erase everything.
+    before = counts(OBJC_CACHE_FLUSH_EXPLICIT);
+    _objc_flush_caches([Base class]);
+    after = counts(OBJC_CACHE_FLUSH_EXPLICIT);
+    testassert(after.events > before.events);
+    testassert(after.entriesRemoved >= before.entriesRemoved + 2*SELS);
+    testassert(sendAll(base, sub) == 2*SELS);
+
+    // Repeated removals leave tombstones behind.
+    // The cache must keep working as they accumulate.
+    for (int r = 0; r < 20*SELS; r++) {
+        int i = r % SELS;
+        expected[i] = (r / SELS) % 2 ? i : i + 1000;
+        method_setImplementation(class_getInstanceMethod([Base class], sels[i]),
+                                 impReturning(expected[i]));
+        if (i == 3) {
+            method_setImplementation(class_getInstanceMethod([Sub class], sels[3]),
+                                     impReturning(expected[i]));
+        }
+        sendAll(base, sub);
+    }
+
+    // Concurrent senders see either implementation, never garbage.
+    Class racer = objc_allocateClassPair([TestRoot class], "Racer", 0);
+    objc_registerClassPair(racer);
+    for (int i = 0; i < SELS; i++) {
+        testassert(class_addMethod(racer, sels[i], impReturning(i), "l@:"));
+    }
+    id racerObj = [racer new];
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) {
+        pthread_create(&threads[t], NULL, &sender, racerObj);
+    }
+    for (int r = 0; r < 2000; r++) {
+        int i = r % SELS;
+        method_setImplementation(class_getInstanceMethod(racer, sels[i]),
+                                 impReturning((r / SELS) % 2 ? i : -i));
+    }
+    atomic_store(&done, true);
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,13 @@
+// Run test cacheSelectiveFlush with whole-cache flushes.
+
+// TEST_CONFIG
+// TEST_ENV OBJC_DISABLE_SELECTIVE_CACHE_FLUSH=YES
+// TEST_CFLAGS -DSELECTIVE_FLUSH_DISABLED=1
+
+/*
+TEST_RUN_OUTPUT
+OK: cacheSelectiveFlush.m
+END
+*/
+
+#include "cacheSelectiveFlush.m"
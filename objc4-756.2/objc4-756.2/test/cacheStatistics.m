@@ -0,0 +1,102 @@
+// TEST_CONFIG
+// TEST_ENV OBJC_DEBUG_CACHE_STATISTICS=YES
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <objc/message.h>
+#include <objc/objc-internal.h>
+
+#define SELS 32
+#define ROUNDS 8
+
+@interface Thrash : TestRoot @end
+@implementation Thrash @end
+
+@interface Quiet : TestRoot @end
+@implementation Quiet 
+-(int)quiet { return 1; }
+@end
+
+static SEL sels[SELS];
+
+static int fn(id self __unused, SEL _cmd __unused) { return 0; }
+
+static void sendAll(id obj)
+{
+    for (int i = 0; i < SELS; i++) {
+        ((int(*)(id, SEL))objc_msgSend)(obj, sels[i]);
+    }
+}
+
+static struct objc_cache_statistics statsFor(Class cls)
+{
+    unsigned int count;
+    struct objc_cache_statistics *all = objc_copyCacheStatistics(&count);
+    testassert(all);
+    testassert(count > 0);
+
+    struct objc_cache_statistics result = {};
+    bool found = false;
+    for (unsigned int i = 0; i < count; i++) {
+        if (i > 0) testassert(all[i-1].fills >= all[i].fills);
+        testassert(all[i].occupied <= all[i].capacity);
+        if (all[i].cls == cls) {
+            testassert(!found);
+            result = all[i];
+            found = true;
+        }
+    }
+    free(all);
+
+    testassert(found);
+    return result;
+}
+
+int main()
+{
+    for (int i = 0; i < SELS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "thrash%d", i);
+        sels[i] = sel_registerName(name);
+        testassert(class_addMethod([Thrash class], sels[i], (IMP)fn, "i@:"));
+    }
+
+    id thrash = [Thrash new];
+    sendAll(thrash);
+    struct objc_cache_statistics before = statsFor([Thrash class]);
+    testassert(before.fills >= SELS);
+    testassert(before.expansions > 0);
+    testassert(before.capacity >= SELS);
+
+    for (int r = 0; r < ROUNDS; r++) {
+        _objc_flush_caches([Thrash class]);
+        sendAll(thrash);
+    }
+
+    struct objc_cache_statistics after = statsFor([Thrash class]);
+    testprintf("Thrash: %zu fills, %zu expansions, %zu flushes, "
+               "%zu probes, max probe %u (%s)\n", 
+               after.fills, after.expansions, after.flushes, 
+               after.probes, after.maxProbe, 
+               sel_getName(after.maxProbeSelector));
+    testassert(after.fills - before.fills == SELS*ROUNDS);
+    testassert(after.flushes - before.flushes == ROUNDS);
+    testassert(after.probes >= before.probes);
+    testassert(after.maxProbe >= before.maxProbe);
+    testassert(after.maxProbeSelector);
+    testassert(after.mostFilledSelectorFills == ROUNDS + 1);
+    bool isThrashSel = false;
+    for (int i = 0; i < SELS; i++) {
+        if (after.mostFilledSelector == sels[i]) isThrashSel = true;
+    }
+    testassert(isThrashSel);
+
+    Quiet *quiet = [Quiet new];
+    testassert([quiet quiet] == 1);
+    struct objc_cache_statistics q = statsFor([Quiet class]);
+    testassert(q.flushes == 0);
+    testassert(q.fills < after.fills);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,113 @@
+// TEST_CONFIG
+
+// Read-only introspection runs concurrently with method addition.
+// Readers copy method, property, and protocol lists while writers
+// add methods to the same classes. Every copy must be consistent:
+// method counts never decrease, and every Method in a copied list
+// is one of the methods added so far.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if defined(__arm__)
+#define READERS 4
+#else
+#define READERS 8
+#endif
+#define CLASSES 4
+#define METHODS 256
+
+@protocol Proto
+@property int prop;
+@end
+
+@interface Sub : TestRoot <Proto> @end
+@implementation Sub
+@dynamic prop;
+@end
+
+static Class classes[CLASSES];
+static atomic_int added[CLASSES];
+static atomic_int done;
+
+static int fn(id self __unused, SEL _cmd __unused) { return 0; }
+
+static void *reader(void *arg __unused)
+{
+    unsigned lastCount[CLASSES] = {0};
+
+    while (!atomic_load(&done)) {
+        for (int c = 0; c < CLASSES; c++) {
+            unsigned count;
+            Method *list = class_copyMethodList(classes[c], &count);
+            testassert(count >= lastCount[c]);
+            lastCount[c] = count;
+            for (unsigned i = 0; i < count; i++) {
+                testassert(method_getImplementation(list[i]) == (IMP)fn);
+            }
+            free(list);
+
+            objc_property_t *props = class_copyPropertyList(classes[c], &count);
+            testassert(count == 0);
+            free(props);
+
+            testassert(!class_conformsToProtocol(classes[c], @protocol(Proto)));
+            testassert(class_conformsToProtocol([Sub class], @protocol(Proto)));
+            testassert(protocol_conformsToProtocol(@protocol(Proto), @protocol(Proto)));
+        }
+    }
+    return NULL;
+}
+
+static void *writer(void *arg)
+{
+    int c = (int)(intptr_t)arg;
+    for (int i = 0; i < METHODS; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "c%d_m%d", c, i);
+        testassert(class_addMethod(classes[c], sel_registerName(name),
+                                   (IMP)fn, "i@:"));
+        atomic_fetch_add(&added[c], 1);
+    }
+    return NULL;
+}
+
+int main()
+{
+    for (int c = 0; c < CLASSES; c++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Dynamic%d", c);
+        classes[c] = objc_allocateClassPair([Sub class], name, 0);
+        objc_registerClassPair(classes[c]);
+    }
+
+    pthread_t readers[READERS];
+    for (int t = 0; t < READERS; t++) {
+        pthread_create(&readers[t], NULL, &reader, NULL);
+    }
+
+    pthread_t writers[CLASSES];
+    for (int c = 0; c < CLASSES; c++) {
+        pthread_create(&writers[c], NULL, &writer, (void *)(intptr_t)c);
+    }
+    for (int c = 0; c < CLASSES; c++) {
+        pthread_join(writers[c], NULL);
+    }
+
+    atomic_store(&done, 1);
+    for (int t = 0; t < READERS; t++) {
+        pthread_join(readers[t], NULL);
+    }
+
+    for (int c = 0; c < CLASSES; c++) {
+        unsigned count;
+        free(class_copyMethodList(classes[c], &count));
+        testassert(count == METHODS);
+        testassert(atomic_load(&added[c]) == METHODS);
+    }
+
+    succeed(__FILE__);
+}
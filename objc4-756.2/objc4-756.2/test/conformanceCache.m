@@ -0,0 +1,99 @@
+// TEST_CONFIG
+
+// class_conformsToProtocol() answers stay correct when they are 
+// memoized: through incorporated protocols, after class_addProtocol(), 
+// after new protocols are registered, and while other threads ask.
+// Also prints the cost of a conformance check.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+@protocol Base @end
+@protocol Middle <Base> @end
+@protocol Top <Middle> @end
+@protocol Other @end
+@protocol Added @end
+
+@interface Adopter : TestRoot <Top> @end
+@implementation Adopter @end
+
+@interface Sub : Adopter @end
+@implementation Sub @end
+
+#define THREADS 4
+#define CHECKS 1000000
+
+static void checkAdopter(void)
+{
+    Class cls = [Adopter class];
+    testassert(class_conformsToProtocol(cls, @protocol(Top)));
+    testassert(class_conformsToProtocol(cls, @protocol(Middle)));
+    testassert(class_conformsToProtocol(cls, @protocol(Base)));
+    testassert(!class_conformsToProtocol(cls, @protocol(Other)));
+
+    // Only the class's own protocols count.
+    testassert(!class_conformsToProtocol([Sub class], @protocol(Top)));
+}
+
+static atomic_bool added;
+
+static void *reader(void *arg __unused)
+{
+    for (int i = 0; i < CHECKS / 10; i++) {
+        checkAdopter();
+        bool wasAdded = atomic_load(&added);
+        bool conforms = 
+            class_conformsToProtocol([Sub class], @protocol(Added));
+        testassert(!wasAdded  ||  conforms);
+    }
+    return NULL;
+}
+
+int main()
+{
+    for (int i = 0; i < 3; i++) checkAdopter();
+
+    // class_addProtocol invalidates the class's answers.
+    testassert(!class_conformsToProtocol([Adopter class], @protocol(Other)));
+    testassert(class_addProtocol([Adopter class], @protocol(Other)));
+    testassert(class_conformsToProtocol([Adopter class], @protocol(Other)));
+    testassert(!class_addProtocol([Adopter class], @protocol(Other)));
+
+    // A newly registered protocol is not adopted until it is added.
+    Protocol *dyn = objc_allocateProtocol("DynamicProto");
+    protocol_addProtocol(dyn, @protocol(Base));
+    objc_registerProtocol(dyn);
+    testassert(!class_conformsToProtocol([Adopter class], dyn));
+    testassert(class_addProtocol([Adopter class], dyn));
+    testassert(class_conformsToProtocol([Adopter class], dyn));
+    testassert(class_conformsToProtocol([Adopter class], @protocol(Base)));
+
+    // Answers change under concurrent readers.
+    pthread_t threads[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &reader, NULL);
+    }
+    usleep(1000);
+    testassert(class_addProtocol([Sub class], @protocol(Added)));
+    atomic_store(&added, true);
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    testassert(class_conformsToProtocol([Sub class], @protocol(Added)));
+
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < CHECKS; i++) {
+        class_conformsToProtocol([Adopter class], @protocol(Base));
+        class_conformsToProtocol([Adopter class], @protocol(Added));
+    }
+    uint64_t elapsed = mach_absolute_time() - start;
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    testprintf("%.1f ns per class_conformsToProtocol\n", 
+               (double)elapsed * tb.numer / tb.denom / (2.0 * CHECKS));
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,13 @@
+// Run test conformanceCache with the conformance cache disabled, 
+// which also times the uncached path for comparison.
+
+// TEST_CONFIG
+// TEST_ENV OBJC_DISABLE_CONFORMANCE_CACHE=YES
+
+/*
+TEST_RUN_OUTPUT
+OK: conformanceCache.m
+END
+*/
+
+#include "conformanceCache.m"
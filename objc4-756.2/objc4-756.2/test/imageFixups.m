@@ -0,0 +1,37 @@
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DISABLE_PREOPTIMIZATION=YES
+
+// Loading many unoptimized images at once fixes up their selector, 
+// class, and protocol references, possibly on several threads. 
+// Selectors must come out unique across images.
+
+#include "test.h"
+#include <objc/runtime.h>
+#include <objc/message.h>
+#include <dlfcn.h>
+
+int main()
+{
+    void *dl = dlopen("/System/Library/Frameworks/Foundation.framework/Foundation", RTLD_LAZY);
+    testassert(dl);
+
+    testassert(@selector(stringWithUTF8String:) == 
+               sel_registerName("stringWithUTF8String:"));
+    testassert(@selector(length) == sel_getUid("length"));
+
+    Class NSString = objc_getClass("NSString");
+    testassert(NSString);
+    testassert(class_respondsToSelector(object_getClass(NSString), 
+                                        @selector(stringWithUTF8String:)));
+    id str = ((id(*)(id, SEL, const char *))objc_msgSend)
+        (NSString, @selector(stringWithUTF8String:), "fixups");
+    testassert(str);
+    testassert(((NSUInteger(*)(id, SEL))objc_msgSend)
+               (str, @selector(length)) == 6);
+
+    Protocol *copying = objc_getProtocol("NSCopying");
+    testassert(copying);
+    testassert(class_conformsToProtocol(NSString, copying));
+
+    succeed(__FILE__);
+}
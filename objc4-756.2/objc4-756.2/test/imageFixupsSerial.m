@@ -0,0 +1,12 @@
+// Run test imageFixups with parallel fixups disabled.
+
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DISABLE_PREOPTIMIZATION=YES OBJC_DISABLE_PARALLEL_FIXUPS=YES
+
+/*
+TEST_RUN_OUTPUT
+OK: imageFixups.m
+END
+*/
+
+#include "imageFixups.m"
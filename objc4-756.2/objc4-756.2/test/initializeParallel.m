@@ -0,0 +1,112 @@
+// TEST_CONFIG
+
+// Many threads trigger +initialize of many classes at once.
+// Each class is initialized exactly once, every thread that waits for
+// a class sees it fully initialized, and subclasses wait for their
+// superclass. Waiters sleep on a per-class stripe, so the classes'
+// slow +initialize methods should overlap instead of running in turn.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <objc/message.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <mach/mach_time.h>
+
+#define CLASSES 16
+#define THREADS_PER_CLASS 4
+#define INITIALIZE_USEC 20000
+
+static atomic_int initCounts[CLASSES];
+static atomic_int subInitCounts[CLASSES];
+static atomic_bool initDone[CLASSES];
+static atomic_bool go;
+
+@interface TestRoot (Index)
++(int)index;
+@end
+
+#define INIT_CLASSES(n)                                                 \
+    @interface Init##n : TestRoot @end                                  \
+    @implementation Init##n                                             \
+    +(void)initialize {                                                 \
+        atomic_fetch_add(&initCounts[n], 1);                            \
+        usleep(INITIALIZE_USEC);                                        \
+        atomic_store(&initDone[n], true);                               \
+    }                                                                   \
+    +(int)index {                                                       \
+        testassert(atomic_load(&initDone[n]));                          \
+        return n;                                                       \
+    }                                                                   \
+    @end                                                                \
+    @interface Sub##n : Init##n @end                                    \
+    @implementation Sub##n                                              \
+    +(void)initialize {                                                 \
+        testassert(atomic_load(&initDone[n]));                          \
+        atomic_fetch_add(&subInitCounts[n], 1);                         \
+    }                                                                   \
+    @end
+
+INIT_CLASSES(0)
+INIT_CLASSES(1)
+INIT_CLASSES(2)
+INIT_CLASSES(3)
+INIT_CLASSES(4)
+INIT_CLASSES(5)
+INIT_CLASSES(6)
+INIT_CLASSES(7)
+INIT_CLASSES(8)
+INIT_CLASSES(9)
+INIT_CLASSES(10)
+INIT_CLASSES(11)
+INIT_CLASSES(12)
+INIT_CLASSES(13)
+INIT_CLASSES(14)
+INIT_CLASSES(15)
+
+static void *initializer(void *arg)
+{
+    int t = (int)(intptr_t)arg;
+    int n = t % CLASSES;
+    bool sub = (t / CLASSES) % 2;
+
+    char name[32];
+    snprintf(name, sizeof(name), "%s%d", sub ? "Sub" : "Init", n);
+    Class cls = objc_getClass(name);
+    testassert(cls);
+
+    while (!atomic_load(&go)) { }
+    testassert([cls index] == n);
+    return NULL;
+}
+
+int main()
+{
+    pthread_t threads[CLASSES * THREADS_PER_CLASS];
+    for (int t = 0; t < CLASSES * THREADS_PER_CLASS; t++) {
+        pthread_create(&threads[t], NULL, &initializer, (void *)(intptr_t)t);
+    }
+
+    uint64_t start = mach_absolute_time();
+    atomic_store(&go, true);
+    for (int t = 0; t < CLASSES * THREADS_PER_CLASS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    uint64_t elapsed = mach_absolute_time() - start;
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    testprintf("%d threads initialized %d classes in %llu us "
+               "(%d us if serialized)\n",
+               CLASSES * THREADS_PER_CLASS, CLASSES * 2,
+               (unsigned long long)(elapsed * tb.numer / tb.denom / 1000),
+               CLASSES * INITIALIZE_USEC);
+
+    for (int n = 0; n < CLASSES; n++) {
+        testassert(atomic_load(&initCounts[n]) == 1);
+        testassert(atomic_load(&subInitCounts[n]) == 1);
+    }
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,123 @@
+// TEST_CONFIG
+
+// Method cache miss storm.
+// Many threads send messages whose implementations live in a superclass
+// while another thread flushes caches continuously, so most sends take
+// the slow lookup path. Meanwhile overrides are added to the subclass;
+// once an override is visible to a thread, no stale implementation
+// may be returned to that thread again.
+// Run with OBJC_DISABLE_LOCKFREE_LOOKUP=YES to compare against
+// method lookup under runtimeLock.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <objc/message.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <mach/mach_time.h>
+
+#if defined(__arm__)
+#define THREADS 4
+#define COUNT 1024
+#else
+#define THREADS 16
+#define COUNT 1024*4
+#endif
+#define SELS 32
+#define OVERRIDE 1000
+
+@interface Base : TestRoot @end
+@implementation Base @end
+
+@interface Mid : Base @end
+@implementation Mid @end
+
+@interface Leaf : Mid @end
+@implementation Leaf @end
+
+static SEL sels[SELS];
+static atomic_int overridden[SELS];
+static atomic_int done;
+static id obj;
+
+static void *reader(void *arg __unused)
+{
+    for (int n = 0; n < COUNT; n++) {
+        for (int i = 0; i < SELS; i++) {
+            int isOverridden =
+                atomic_load_explicit(&overridden[i], memory_order_acquire);
+            long value = ((long(*)(id, SEL))objc_msgSend)(obj, sels[i]);
+            if (isOverridden) {
+                testassert(value == i + OVERRIDE);
+            } else {
+                testassert(value == i  ||  value == i + OVERRIDE);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void *flusher(void *arg __unused)
+{
+    while (!atomic_load(&done)) {
+        _objc_flush_caches([Leaf class]);
+    }
+    return NULL;
+}
+
+static IMP impReturning(long value)
+{
+    return imp_implementationWithBlock(^(id self __unused) { return value; });
+}
+
+int main()
+{
+    for (int i = 0; i < SELS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "m%d", i);
+        sels[i] = sel_registerName(name);
+        testassert(class_addMethod([Base class], sels[i], impReturning(i), "l@:"));
+    }
+
+    obj = [Leaf new];
+
+    pthread_t flush;
+    pthread_create(&flush, NULL, &flusher, NULL);
+
+    uint64_t start = mach_absolute_time();
+
+    pthread_t threads[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &reader, NULL);
+    }
+
+    // Add overrides while the readers are running.
+    for (int i = 0; i < SELS; i++) {
+        usleep(1000);
+        testassert(class_addMethod([Leaf class], sels[i],
+                                   impReturning(i + OVERRIDE), "l@:"));
+        atomic_store_explicit(&overridden[i], 1, memory_order_release);
+    }
+
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    uint64_t elapsed = mach_absolute_time() - start;
+
+    atomic_store(&done, 1);
+    pthread_join(flush, NULL);
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    testprintf("%d threads x %d sends: %llu us\n", THREADS, COUNT*SELS,
+               (unsigned long long)(elapsed * tb.numer / tb.denom / 1000));
+
+    for (int i = 0; i < SELS; i++) {
+        long value = ((long(*)(id, SEL))objc_msgSend)(obj, sels[i]);
+        testassert(value == i + OVERRIDE);
+    }
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,95 @@
+// TEST_CONFIG
+
+// Method lookups in classes whose only method list has from a few
+// to thousands of methods. Big lists are searched through a hash
+// table; every method must still be found, and misses must miss.
+// Test methodHashDisabled also uses this file, to compare lookup
+// times against binary search of the list.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <objc/message.h>
+#include <objc/objc-internal.h>
+#include <mach/mach_time.h>
+
+#define LOOKUPS 20000
+
+static const uint32_t sizes[] = { 8, 64, 127, 128, 512, 4096 };
+
+static uint64_t nanosSince(uint64_t start)
+{
+    uint64_t elapsed = mach_absolute_time() - start;
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    return elapsed * tb.numer / tb.denom;
+}
+
+static void testSize(uint32_t count)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "Methods%u", count);
+    Class cls = objc_allocateClassPair([TestRoot class], name, 0);
+
+    SEL *sels = (SEL *)malloc(count * sizeof(SEL));
+    IMP *imps = (IMP *)malloc(count * sizeof(IMP));
+    const char **types = (const char **)malloc(count * sizeof(char *));
+    for (uint32_t i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "method%u_%u", count, i);
+        sels[i] = sel_registerName(name);
+        long value = i;
+        imps[i] = imp_implementationWithBlock(^(id self __unused) {
+            return value;
+        });
+        types[i] = "l@:";
+    }
+    uint32_t failed = 1;
+    testassert(class_addMethodsBulk(cls, sels, imps, types, count, &failed) == nil);
+    testassert(failed == 0);
+    objc_registerClassPair(cls);
+
+    id obj = [cls new];
+    for (uint32_t i = 0; i < count; i++) {
+        Method m = class_getInstanceMethod(cls, sels[i]);
+        testassert(m);
+        testassert(method_getName(m) == sels[i]);
+        testassert(((long(*)(id, SEL))objc_msgSend)(obj, sels[i]) == (long)i);
+    }
+
+    SEL missing[16];
+    for (int i = 0; i < 16; i++) {
+        snprintf(name, sizeof(name), "missing%u_%d", count, i);
+        missing[i] = sel_registerName(name);
+        testassert(class_getInstanceMethod(cls, missing[i]) == nil);
+    }
+
+    // class_getInstanceMethod() does not use the method cache.
+    uint64_t start = mach_absolute_time();
+    for (uint32_t i = 0; i < LOOKUPS; i++) {
+        testassert(class_getInstanceMethod(cls, sels[i % count]));
+    }
+    uint64_t hits = nanosSince(start);
+
+    start = mach_absolute_time();
+    for (uint32_t i = 0; i < LOOKUPS; i++) {
+        testassert(!class_getInstanceMethod(cls, missing[i % 16]));
+    }
+    uint64_t misses = nanosSince(start);
+
+    testprintf("%5u methods: %llu ns per hit, %llu ns per miss\n", count,
+               (unsigned long long)(hits / LOOKUPS),
+               (unsigned long long)(misses / LOOKUPS));
+
+    free(sels);
+    free(imps);
+    free(types);
+}
+
+int main()
+{
+    for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        testSize(sizes[i]);
+    }
+
+    succeed(__FILE__);
+}
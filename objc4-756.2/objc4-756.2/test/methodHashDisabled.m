@@ -0,0 +1,12 @@
+// Run test methodHash with method list hash tables disabled.
+
+// TEST_CONFIG
+// TEST_ENV OBJC_DISABLE_METHOD_HASH=YES
+
+/*
+TEST_RUN_OUTPUT
+OK: methodHash.m
+END
+*/
+
+#include "methodHash.m"
@@ -0,0 +1,174 @@
+// TEST_CFLAGS -Wl,-no_objc_category_merging
+
+// A class with more categories than are attached in one batch.
+// Lookups through the merged method index must find the same
+// methods as a search of the method lists: the newest category's
+// override, and the very Method that method_setImplementation() changes.
+// Test methodIndexDisabled also uses this file, to compare lookup time
+// against searching every method list.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <objc/message.h>
+#include <mach/mach_time.h>
+
+#define CATEGORIES 70
+#define LOOKUPS 100000
+
+@interface Many : TestRoot @end
+@implementation Many
+-(int)who { fail("-who not overridden by category"); return -1; }
++(int)classWho { fail("+classWho not overridden by category"); return -1; }
+-(int)base { return -1; }
+@end
+
+#define CATEGORY(n)                                     \
+    @interface Many (Cat##n) @end                       \
+    @implementation Many (Cat##n)                       \
+    -(int)who { return n; }                             \
+    +(int)classWho { return n; }                        \
+    -(int)only##n { return n; }                         \
+    @end
+
+CATEGORY(0)
+CATEGORY(1)
+CATEGORY(2)
+CATEGORY(3)
+CATEGORY(4)
+CATEGORY(5)
+CATEGORY(6)
+CATEGORY(7)
+CATEGORY(8)
+CATEGORY(9)
+CATEGORY(10)
+CATEGORY(11)
+CATEGORY(12)
+CATEGORY(13)
+CATEGORY(14)
+CATEGORY(15)
+CATEGORY(16)
+CATEGORY(17)
+CATEGORY(18)
+CATEGORY(19)
+CATEGORY(20)
+CATEGORY(21)
+CATEGORY(22)
+CATEGORY(23)
+CATEGORY(24)
+CATEGORY(25)
+CATEGORY(26)
+CATEGORY(27)
+CATEGORY(28)
+CATEGORY(29)
+CATEGORY(30)
+CATEGORY(31)
+CATEGORY(32)
+CATEGORY(33)
+CATEGORY(34)
+CATEGORY(35)
+CATEGORY(36)
+CATEGORY(37)
+CATEGORY(38)
+CATEGORY(39)
+CATEGORY(40)
+CATEGORY(41)
+CATEGORY(42)
+CATEGORY(43)
+CATEGORY(44)
+CATEGORY(45)
+CATEGORY(46)
+CATEGORY(47)
+CATEGORY(48)
+CATEGORY(49)
+CATEGORY(50)
+CATEGORY(51)
+CATEGORY(52)
+CATEGORY(53)
+CATEGORY(54)
+CATEGORY(55)
+CATEGORY(56)
+CATEGORY(57)
+CATEGORY(58)
+CATEGORY(59)
+CATEGORY(60)
+CATEGORY(61)
+CATEGORY(62)
+CATEGORY(63)
+CATEGORY(64)
+CATEGORY(65)
+CATEGORY(66)
+CATEGORY(67)
+CATEGORY(68)
+CATEGORY(69)
+
+static int sendInt(id obj, SEL sel)
+{
+    return ((int(*)(id, SEL))objc_msgSend)(obj, sel);
+}
+
+// The first method named sel in the class's own method lists.
+static Method firstInList(Class cls, SEL sel)
+{
+    unsigned int count;
+    Method *methods = class_copyMethodList(cls, &count);
+    Method result = nil;
+    for (unsigned int i = 0; i < count; i++) {
+        if (method_getName(methods[i]) == sel) {
+            result = methods[i];
+            break;
+        }
+    }
+    free(methods);
+    return result;
+}
+
+static int fn(id self __unused, SEL _cmd __unused) { return 1000; }
+
+int main()
+{
+    Class cls = [Many class];
+    id obj = [Many new];
+
+    testassert(sendInt(obj, @selector(who)) == CATEGORIES-1);
+    testassert(sendInt(cls, @selector(classWho)) == CATEGORIES-1);
+    testassert(sendInt(obj, @selector(base)) == -1);
+    for (int i = 0; i < CATEGORIES; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "only%d", i);
+        SEL sel = sel_registerName(name);
+        testassert(class_getInstanceMethod(cls, sel) == firstInList(cls, sel));
+        testassert(sendInt(obj, sel) == i);
+    }
+
+    Method who = class_getInstanceMethod(cls, @selector(who));
+    testassert(who == firstInList(cls, @selector(who)));
+    testassert(class_getClassMethod(cls, @selector(classWho)) ==
+               firstInList(object_getClass(cls), @selector(classWho)));
+    testassert(class_getInstanceMethod(cls, sel_registerName("missing")) == nil);
+    testassert(!class_respondsToSelector(cls, sel_registerName("missing")));
+
+    // The Method found is the one in the method list.
+    method_setImplementation(who, (IMP)fn);
+    testassert(sendInt(obj, @selector(who)) == 1000);
+    testassert(!class_addMethod(cls, @selector(who), (IMP)fn, "i@:"));
+
+    // Methods added later are found.
+    testassert(class_addMethod(cls, sel_registerName("added"), (IMP)fn, "i@:"));
+    testassert(sendInt(obj, sel_registerName("added")) == 1000);
+    testassert(class_getInstanceMethod(cls, sel_registerName("added")) ==
+               firstInList(cls, sel_registerName("added")));
+    testassert(class_getInstanceMethod(cls, @selector(base)) ==
+               firstInList(cls, @selector(base)));
+    testassert(class_getInstanceMethod(cls, sel_registerName("missing")) == nil);
+
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < LOOKUPS; i++) {
+        testassert(class_getInstanceMethod(cls, @selector(base)));
+    }
+    uint64_t elapsed = mach_absolute_time() - start;
+    testprintf("%d lookups of the base class method: %llu ticks\n",
+               LOOKUPS, (unsigned long long)elapsed);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,12 @@
+// Run test methodIndex with the merged method index disabled.
+
+// TEST_CFLAGS -Wl,-no_objc_category_merging
+// TEST_ENV OBJC_DISABLE_METHOD_INDEX=YES
+
+/*
+TEST_RUN_OUTPUT
+OK: methodIndex.m
+END
+*/
+
+#include "methodIndex.m"
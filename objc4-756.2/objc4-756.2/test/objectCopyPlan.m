@@ -0,0 +1,90 @@
+/*
+TEST_CONFIG MEM=mrc
+TEST_BUILD
+    $C{COMPILE} -fobjc-weak $DIR/objectCopyPlan.m -o objectCopyPlan.exe
+END
+*/
+
+// object_copy() with weak ivars between plain ones, in the class and
+// its superclass, repeated so the cached copy plan is exercised.
+
+#include "test.h"
+#include <objc/NSObject.h>
+
+@interface Base : NSObject {
+  @public
+    long before;
+    __weak id baseWeak;
+    long after;
+}
+@end
+@implementation Base @end
+
+@interface Sub : Base {
+  @public
+    id plain;
+    __weak id subWeak1;
+    __weak id subWeak2;
+    char tail[3];
+}
+@end
+@implementation Sub @end
+
+int main()
+{
+    id target = [NSObject new];
+    id plainTarget = [NSObject new];
+
+    Sub *orig = [Sub new];
+    orig->before = 1;
+    orig->baseWeak = target;
+    orig->after = 2;
+    orig->plain = plainTarget;
+    orig->subWeak1 = target;
+    orig->subWeak2 = nil;
+    orig->tail[0] = 'a'; orig->tail[2] = 'c';
+
+    Sub *copies[10];
+    for (int i = 0; i < 10; i++) {
+        Sub *copy = object_copy(orig, i == 0 ? 0 : 16);
+        testassert(copy != orig);
+        testassert([copy class] == [Sub class]);
+        testassert(copy->before == 1);
+        testassert(copy->after == 2);
+        testassert(copy->plain == plainTarget);
+        testassert(copy->baseWeak == target);
+        testassert(copy->subWeak1 == target);
+        testassert(copy->subWeak2 == nil);
+        testassert(copy->tail[0] == 'a'  &&  copy->tail[2] == 'c');
+        testassert([copy retainCount] == 1);
+        copies[i] = copy;
+    }
+
+    // Plain ids are copied bytewise without a retain under MRC.
+    testassert([plainTarget retainCount] == 1);
+
+    // The copies' weak ivars are registered: they are cleared
+    // when the target is deallocated.
+    [target release];
+    for (int i = 0; i < 10; i++) {
+        testassert(copies[i]->baseWeak == nil);
+        testassert(copies[i]->subWeak1 == nil);
+        [copies[i] release];
+    }
+    testassert(orig->baseWeak == nil);
+
+    // Classes still under construction are copied without a cached plan.
+    Class dyn = objc_allocateClassPair([Sub class], "DynSub", 0);
+    testassert(class_addIvar(dyn, "extra", sizeof(long), 3, "q"));
+    Sub *dynObj = class_createInstance(dyn, 0);
+    dynObj->before = 5;
+    Sub *dynCopy = object_copy(dynObj, 0);
+    testassert(dynCopy->before == 5);
+    object_dispose(dynCopy);
+    object_dispose(dynObj);
+
+    [orig release];
+    [plainTarget release];
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,145 @@
+// TEST_CONFIG MEM=mrc
+
+// Autorelease pool pop releases objects last-in first-out, 
+// across page boundaries and nested pools. Runs of the same object 
+// must not deallocate it early, and objects autoreleased by -dealloc 
+// during a pop are released by the same pop.
+// Then measure pop throughput by pool size.
+// Test poolDrainOneByOne also uses this file, 
+// with OBJC_DISABLE_BATCHED_POOL_DRAIN set.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/objc-internal.h>
+#include <mach/mach_time.h>
+#include <sys/param.h>
+
+#define LOGMAX 1024*8
+
+static int deallocLog[LOGMAX];
+static int deallocCount;
+
+@interface Logged : TestRoot {
+  @public
+    int tag;
+    bool autoreleaseInDealloc;
+}
+@end
+@implementation Logged
+-(void)dealloc {
+    testassert(deallocCount < LOGMAX);
+    deallocLog[deallocCount++] = tag;
+    if (autoreleaseInDealloc) {
+        Logged *extra = [Logged new];
+        extra->tag = -tag;
+        [extra autorelease];
+    }
+    [super dealloc];
+}
+@end
+
+static Logged *logged(int tag)
+{
+    Logged *obj = [Logged new];
+    obj->tag = tag;
+    return obj;
+}
+
+int main()
+{
+    // Distinct objects are deallocated last-in first-out, 
+    // across page boundaries.
+    int count = LOGMAX / 2;
+    deallocCount = 0;
+    void *pool = objc_autoreleasePoolPush();
+    for (int i = 0; i < count; i++) {
+        [logged(i) autorelease];
+    }
+    objc_autoreleasePoolPop(pool);
+    testassert(deallocCount == count);
+    for (int i = 0; i < count; i++) {
+        testassert(deallocLog[i] == count - 1 - i);
+    }
+
+    // Runs of the same object are released together 
+    // without deallocating early.
+    deallocCount = 0;
+    Logged *survivor = logged(1);
+    Logged *victim = logged(2);
+    pool = objc_autoreleasePoolPush();
+    for (int i = 0; i < 100; i++) {
+        [[survivor retain] autorelease];
+    }
+    [victim autorelease];
+    for (int i = 0; i < 100; i++) {
+        [[victim retain] autorelease];
+    }
+    objc_autoreleasePoolPop(pool);
+    testassert(deallocCount == 1);
+    testassert(deallocLog[0] == 2);
+    testassert([survivor retainCount] == 1);
+    [survivor release];
+    testassert(deallocCount == 2);
+
+    // Nested pools inside one batch stop at the right boundary.
+    deallocCount = 0;
+    void *outer = objc_autoreleasePoolPush();
+    [logged(1) autorelease];
+    void *inner = objc_autoreleasePoolPush();
+    [logged(2) autorelease];
+    [logged(3) autorelease];
+    objc_autoreleasePoolPop(inner);
+    testassert(deallocCount == 2);
+    testassert(deallocLog[0] == 3  &&  deallocLog[1] == 2);
+    objc_autoreleasePoolPop(outer);
+    testassert(deallocCount == 3  &&  deallocLog[2] == 1);
+
+    // Objects autoreleased by -dealloc during the pop 
+    // are released by the same pop.
+    deallocCount = 0;
+    pool = objc_autoreleasePoolPush();
+    for (int i = 1; i <= 300; i++) {
+        Logged *obj = logged(i);
+        obj->autoreleaseInDealloc = (i % 3 == 0);
+        [obj autorelease];
+    }
+    objc_autoreleasePoolPop(pool);
+    testassert(deallocCount == 400);
+    bool seen[301] = {};
+    for (int i = 0; i < deallocCount; i++) {
+        int tag = deallocLog[i];
+        if (tag > 0) {
+            seen[tag] = true;
+        } else {
+            testassert(-tag % 3 == 0  &&  seen[-tag]);
+        }
+    }
+
+    // Pop throughput by pool size.
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    for (int size = 1; size <= 1024*64; size *= 4) {
+        int rounds = 1024*256 / size;
+        for (int duplicates = 1; duplicates <= 4; duplicates *= 4) {
+            uint64_t total = 0;
+            for (int r = 0; r < rounds; r++) {
+                pool = objc_autoreleasePoolPush();
+                for (int i = 0; i < size; i += duplicates) {
+                    int refs = MIN(duplicates, size - i);
+                    id obj = [TestRoot new];
+                    for (int d = 1; d < refs; d++) [obj retain];
+                    for (int d = 0; d < refs; d++) [obj autorelease];
+                }
+                uint64_t start = mach_absolute_time();
+                objc_autoreleasePoolPop(pool);
+                total += mach_absolute_time() - start;
+            }
+            testprintf("pool of %d objects, %d references each: %llu ns/object\n", 
+                       size, duplicates, 
+                       (unsigned long long)(total * tb.numer / tb.denom 
+                                            / ((uint64_t)rounds * size)));
+        }
+    }
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,12 @@
+// Run test poolDrain with the unbatched pool drain.
+
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DISABLE_BATCHED_POOL_DRAIN=YES
+
+/*
+TEST_RUN_OUTPUT
+OK: poolDrain.m
+END
+*/
+
+#include "poolDrain.m"
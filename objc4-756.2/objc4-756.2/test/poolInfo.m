@@ -0,0 +1,95 @@
+// TEST_CONFIG MEM=mrc
+
+// _objc_copyAutoreleasePoolInfo reports the calling thread's pools, 
+// pages, and pending objects counted by class.
+// Then measure the cost of a summary of a large pool.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/objc-internal.h>
+#include <mach/mach_time.h>
+#include <mach/vm_param.h>
+
+@interface Frequent : TestRoot @end
+@implementation Frequent @end
+
+@interface Rare : TestRoot @end
+@implementation Rare @end
+
+static struct objc_autorelease_pool_class_count *
+info(struct objc_autorelease_pool_info *summary, unsigned int *count)
+{
+    bzero(summary, sizeof(*summary));
+    return _objc_copyAutoreleasePoolInfo(summary, count);
+}
+
+int main()
+{
+    struct objc_autorelease_pool_info summary;
+    unsigned int count;
+
+    // No pools.
+    testassert(info(&summary, &count) == nil);
+    testassert(count == 0);
+    testassert(summary.pools == 0);
+    testassert(summary.entries == 0);
+
+    // An empty pool.
+    void *outer = objc_autoreleasePoolPush();
+    testassert(info(&summary, &count) == nil);
+    testassert(summary.pools == 1);
+    testassert(summary.entries == 0);
+
+    // Nested pools with pending objects.
+    for (int i = 0; i < 10; i++) [[Frequent new] autorelease];
+    for (int i = 0; i < 3; i++) [[Rare new] autorelease];
+    void *inner = objc_autoreleasePoolPush();
+    for (int i = 0; i < 5; i++) [[Rare new] autorelease];
+
+    struct objc_autorelease_pool_class_count *counts = info(&summary, &count);
+    testassert(summary.pools == 2);
+    testassert(summary.pages == 1);
+    testassert(summary.entries == 18);
+    testassert(summary.allThreadsPages >= 1);
+    testassert(count == 2);
+    testassert(counts[0].cls == [Frequent class]  &&  counts[0].count == 10);
+    testassert(counts[1].cls == [Rare class]  &&  counts[1].count == 8);
+    free(counts);
+
+    // Pools spanning pages, and kept pages after the pop.
+    size_t many = 3 * PAGE_MAX_SIZE / sizeof(id);
+    for (size_t i = 0; i < many; i++) [[Rare new] autorelease];
+    counts = info(&summary, &count);
+    testassert(summary.pages >= 3);
+    testassert(summary.entries == 18 + many);
+    testassert(count == 2);
+    testassert(counts[0].cls == [Rare class]  &&  counts[0].count == 8 + many);
+    free(counts);
+
+    // Summary cost.
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < 100; i++) {
+        free(info(&summary, &count));
+    }
+    uint64_t total = mach_absolute_time() - start;
+    testprintf("summary of %zu objects: %llu ns\n", summary.entries, 
+               (unsigned long long)(total * tb.numer / tb.denom / 100));
+
+    objc_autoreleasePoolPop(inner);
+    counts = info(&summary, &count);
+    testassert(summary.pools == 1);
+    testassert(summary.pages == 1);
+    testassert(summary.keptPages >= 1);
+    testassert(summary.entries == 13);
+    free(counts);
+
+    objc_autoreleasePoolPop(outer);
+    testassert(info(&summary, &count) == nil);
+    testassert(summary.entries == 0);
+    testassert(summary.pages == 0);
+    testassert(summary.keptPages >= 1);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,83 @@
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_RESERVE_POOL_PAGES=YES
+
+// _objc_copyAutoreleasePoolInfo's allThreadsPages counts pages in use
+// by threads, exactly, while pages move in and out of the page reserve.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/objc-internal.h>
+#include <pthread.h>
+#include <mach/vm_param.h>
+
+static size_t threadPages(struct objc_autorelease_pool_info *summary)
+{
+    bzero(summary, sizeof(*summary));
+    free(_objc_copyAutoreleasePoolInfo(summary, nil));
+    return summary->pages + summary->keptPages;
+}
+
+static size_t mainPages;
+
+static void *fill(void *arg __unused)
+{
+    struct objc_autorelease_pool_info summary;
+
+    void *pool = objc_autoreleasePoolPush();
+    size_t many = 3 * PAGE_MAX_SIZE / sizeof(id);
+    for (size_t i = 0; i < many; i++) [[TestRoot new] autorelease];
+
+    size_t pages = threadPages(&summary);
+    testassert(pages >= 3);
+    testassert(summary.allThreadsPages == mainPages + pages);
+
+    objc_autoreleasePoolPop(pool);
+    return (void *)pages;
+}
+
+static size_t runFill(void)
+{
+    pthread_t th;
+    void *pages;
+    pthread_create(&th, nil, &fill, nil);
+    pthread_join(th, &pages);
+    return (size_t)pages;
+}
+
+int main()
+{
+    struct objc_autorelease_pool_info summary;
+    struct objc_autorelease_pool_page_statistics before, after;
+
+    void *pool = objc_autoreleasePoolPush();
+    [[TestRoot new] autorelease];
+    mainPages = threadPages(&summary);
+    testassert(mainPages >= 1);
+    testassert(summary.allThreadsPages == mainPages);
+
+    // The first thread's pages go to the reserve when it exits.
+    _objc_getAutoreleasePoolPageStatistics(&before);
+    size_t pages = runFill();
+    _objc_getAutoreleasePoolPageStatistics(&after);
+    testassert(after.reserveCount >= pages);
+    testassert(after.freedPages == before.freedPages);
+    threadPages(&summary);
+    testassert(summary.allThreadsPages == mainPages);
+
+    // The second thread's pages all come from the reserve,
+    // and go back to it.
+    _objc_getAutoreleasePoolPageStatistics(&before);
+    testassert(runFill() == pages);
+    _objc_getAutoreleasePoolPageStatistics(&after);
+    testassert(after.freshPages == before.freshPages);
+    testassert(after.reservedPages == before.reservedPages + pages);
+    testassert(after.reserveCount == before.reserveCount);
+    threadPages(&summary);
+    testassert(summary.allThreadsPages == mainPages);
+
+    objc_autoreleasePoolPop(pool);
+    testassert(threadPages(&summary) == summary.keptPages);
+    testassert(summary.allThreadsPages == summary.keptPages);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,103 @@
+// TEST_CONFIG MEM=mrc
+
+// Autorelease pool pages emptied by pop are kept for the thread's 
+// next pools of the same depth instead of being freed and reallocated, 
+// and are freed once the thread's pools stay shallow.
+// With OBJC_RESERVE_POOL_PAGES set, pages freed by an exiting thread 
+// are reused by the next thread.
+// Then measure push/pop throughput of pools several pages deep.
+// Test poolPageReserve also uses this file, 
+// with OBJC_RESERVE_POOL_PAGES set.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/objc-internal.h>
+#include <mach/mach_time.h>
+#include <mach/vm_param.h>
+#include <pthread.h>
+
+// Deep pools span about four pages.
+#define DEEP (4 * PAGE_MAX_SIZE / sizeof(id))
+
+static struct objc_autorelease_pool_page_statistics stats()
+{
+    struct objc_autorelease_pool_page_statistics result;
+    _objc_getAutoreleasePoolPageStatistics(&result);
+    return result;
+}
+
+static void fill(int count)
+{
+    void *pool = objc_autoreleasePoolPush();
+    for (int i = 0; i < count; i++) {
+        [[TestRoot new] autorelease];
+    }
+    objc_autoreleasePoolPop(pool);
+}
+
+static void *deepPools(void *arg __unused)
+{
+    void *outer = objc_autoreleasePoolPush();
+    [[TestRoot new] autorelease];
+
+    // The first deep pool allocates its pages. 
+    // Later deep pools reuse them.
+    fill(DEEP);
+    struct objc_autorelease_pool_page_statistics before = stats();
+    for (int i = 0; i < 100; i++) {
+        fill(DEEP);
+    }
+    struct objc_autorelease_pool_page_statistics after = stats();
+    testprintf("deep pools: %zu fresh, %zu reused pages\n", 
+               after.freshPages - before.freshPages, 
+               after.reusedPages - before.reusedPages);
+    testassert(after.freshPages == before.freshPages);
+    testassert(after.reservedPages == before.reservedPages);
+    testassert(after.reusedPages - before.reusedPages >= 100 * 3);
+
+    // Draining the outermost pool while pools stay shallow 
+    // eventually releases the kept pages.
+    objc_autoreleasePoolPop(outer);
+    for (int i = 0; i < 8; i++) {
+        fill(1);
+    }
+    struct objc_autorelease_pool_page_statistics trimmed = stats();
+    testassert(trimmed.freedPages + trimmed.reserveCount > 
+               after.freedPages + after.reserveCount);
+
+    return NULL;
+}
+
+int main()
+{
+    pthread_t th;
+    pthread_create(&th, NULL, &deepPools, NULL);
+    pthread_join(th, NULL);
+
+    if (getenv("OBJC_RESERVE_POOL_PAGES")) {
+        // The first thread's pages went to the reserve at thread exit.
+        // A second thread takes pages from the reserve instead of malloc.
+        struct objc_autorelease_pool_page_statistics before = stats();
+        testassert(before.reserveCount > 0);
+        pthread_create(&th, NULL, &deepPools, NULL);
+        pthread_join(th, NULL);
+        struct objc_autorelease_pool_page_statistics after = stats();
+        testassert(after.reservedPages > before.reservedPages);
+        testassert(after.reserveCount <= 64);
+    }
+
+    // Push/pop throughput of deep pools.
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    void *outer = objc_autoreleasePoolPush();
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < 1000; i++) {
+        fill(DEEP);
+    }
+    uint64_t total = mach_absolute_time() - start;
+    objc_autoreleasePoolPop(outer);
+    testprintf("deep pools: %llu ns/pool\n", 
+               (unsigned long long)(total * tb.numer / tb.denom / 1000));
+
+    succeed(__FILE__);
+}
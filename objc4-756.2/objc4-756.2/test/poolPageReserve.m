@@ -0,0 +1,12 @@
+// Run test poolPageCache with the process-wide page reserve.
+
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_RESERVE_POOL_PAGES=YES
+
+/*
+TEST_RUN_OUTPUT
+OK: poolPageCache.m
+END
+*/
+
+#include "poolPageCache.m"
@@ -0,0 +1,173 @@
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DEBUG_RETURN_STATISTICS=YES
+
+// An autoreleased return value whose caller does not look optimized 
+// is parked and can still be claimed by objc_retainAutoreleasedReturnValue 
+// without an autorelease pool entry. Unclaimed values land in the pool 
+// that was hot when they were returned.
+// Then measure a getter-heavy loop's cost and pool growth.
+// Test returnClaimDisabled also uses this file, 
+// with OBJC_DISABLE_CLAIMABLE_RETURNS set.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/objc-internal.h>
+#include <mach/mach_time.h>
+
+// Classes with custom retain/release, such as TestRoot, 
+// always autorelease their unoptimized returns.
+@interface Plain : NSObject @end
+@implementation Plain @end
+
+static id value;
+static id other;
+static volatile int sideEffect;
+static bool claimable;
+
+// The caller's code between the call and the claim 
+// defeats the instruction-matching optimized return.
+static id __attribute__((noinline)) getter(void)
+{
+    return objc_autoreleaseReturnValue([value retain]);
+}
+
+static id __attribute__((noinline)) otherGetter(void)
+{
+    return objc_retainAutoreleaseReturnValue(other);
+}
+
+// Calls getter() from -dealloc without claiming the result.
+@interface Dropper : NSObject @end
+@implementation Dropper
+-(void)dealloc {
+    id result __unused = getter();
+    sideEffect++;
+    [super dealloc];
+}
+@end
+
+static size_t poolEntries(void)
+{
+    struct objc_autorelease_pool_info info;
+    free(_objc_copyAutoreleasePoolInfo(&info, nil));
+    return info.entries;
+}
+
+static unsigned int parkedReturns(void)
+{
+    struct objc_autorelease_pool_info info;
+    free(_objc_copyAutoreleasePoolInfo(&info, nil));
+    return info.parkedReturns;
+}
+
+static struct objc_return_value_statistics stats(void)
+{
+    struct objc_return_value_statistics result;
+    _objc_getReturnValueStatistics(&result);
+    return result;
+}
+
+int main()
+{
+    claimable = !getenv("OBJC_DISABLE_CLAIMABLE_RETURNS");
+    value = [Plain new];
+    other = [Plain new];
+
+    void *pool = objc_autoreleasePoolPush();
+
+    // A claimed return stays out of the pool.
+    struct objc_return_value_statistics before = stats();
+    size_t entries = poolEntries();
+    id result = getter();
+    sideEffect++;
+    // Looking at the pools leaves the parked value parked.
+    testassert(parkedReturns() == (claimable ? 1 : 0));
+    testassert(poolEntries() == entries + (claimable ? 0 : 1));
+    result = objc_retainAutoreleasedReturnValue(result);
+    testassert(result == value);
+    [result release];
+    struct objc_return_value_statistics after = stats();
+    if (claimable) {
+        testassert(poolEntries() == entries);
+        testassert(after.claimed == before.claimed + 1);
+        testassert([value retainCount] == 1);
+    } else {
+        testassert(poolEntries() == entries + 1);
+        testassert(after.claimed == before.claimed);
+        testassert(after.autoreleased == before.autoreleased + 1);
+    }
+
+    // Unclaimed returns go to the pool that was hot when they were 
+    // returned, even if the caller pushes a pool before using them.
+    objc_autoreleasePoolPop(pool);
+    testassert([value retainCount] == 1);
+    pool = objc_autoreleasePoolPush();
+    result = getter();
+    sideEffect++;
+    void *inner = objc_autoreleasePoolPush();
+    objc_autoreleasePoolPop(inner);
+    testassert([value retainCount] == 2);
+    objc_autoreleasePoolPop(pool);
+    testassert([value retainCount] == 1);
+
+    // A value returned while a nested pool drains is released 
+    // by that pop, not left for the outer pool.
+    pool = objc_autoreleasePoolPush();
+    entries = poolEntries();
+    inner = objc_autoreleasePoolPush();
+    [[Dropper new] autorelease];
+    objc_autoreleasePoolPop(inner);
+    testassert([value retainCount] == 1);
+    testassert(parkedReturns() == 0);
+    testassert(poolEntries() == entries);
+    objc_autoreleasePoolPop(pool);
+    testassert([value retainCount] == 1);
+
+    // A second return flushes the first, and a claim of 
+    // a different object does not take the parked one.
+    pool = objc_autoreleasePoolPush();
+    entries = poolEntries();
+    id first = getter();
+    sideEffect++;
+    id second = otherGetter();
+    sideEffect++;
+    testassert(objc_retainAutoreleasedReturnValue(first) == value);
+    testassert([value retainCount] == 3);
+    testassert(objc_unsafeClaimAutoreleasedReturnValue(second) == other);
+    [value release];
+    testassert(poolEntries() == entries + (claimable ? 1 : 2));
+    objc_autoreleasePoolPop(pool);
+    testassert([value retainCount] == 1);
+    testassert([other retainCount] == 1);
+
+    // Getter-heavy loop.
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    pool = objc_autoreleasePoolPush();
+    entries = poolEntries();
+    before = stats();
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < 100000; i++) {
+        result = getter();
+        sideEffect++;
+        [objc_retainAutoreleasedReturnValue(result) release];
+    }
+    uint64_t total = mach_absolute_time() - start;
+    after = stats();
+    testprintf("getter loop: %llu ns/call, %zu pool entries, "
+               "%zu optimized, %zu claimed, %zu autoreleased\n", 
+               (unsigned long long)(total * tb.numer / tb.denom / 100000), 
+               poolEntries() - entries, 
+               after.optimized - before.optimized, 
+               after.claimed - before.claimed, 
+               after.autoreleased - before.autoreleased);
+    if (claimable) {
+        testassert(poolEntries() == entries);
+    } else {
+        testassert(poolEntries() == entries + 100000);
+    }
+    objc_autoreleasePoolPop(pool);
+    testassert([value retainCount] == 1);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,12 @@
+// Run test returnClaim without claimable returns.
+
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DEBUG_RETURN_STATISTICS=YES OBJC_DISABLE_CLAIMABLE_RETURNS=YES
+
+/*
+TEST_RUN_OUTPUT
+OK: returnClaim.m
+END
+*/
+
+#include "returnClaim.m"
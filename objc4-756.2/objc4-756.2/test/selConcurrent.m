@@ -0,0 +1,86 @@
+// TEST_CONFIG
+
+// sel_registerName() from many threads at once. Every thread must get 
+// the same selector for the same name, including names registered for 
+// the first time while other threads race to register them.
+// Also prints a rough hit and miss throughput under contention.
+
+#include "test.h"
+#include <objc/runtime.h>
+#include <pthread.h>
+
+#define THREADS 8
+#define NAMES 20000
+#define HIT_ROUNDS 20
+
+static SEL results[THREADS][NAMES];
+
+static void *registerNames(void *arg)
+{
+    int t = (int)(intptr_t)arg;
+    char name[64];
+    for (int k = 0; k < NAMES; k++) {
+        // Each thread walks the names in a different order.
+        int i = (k * 7919 + t * 104729) % NAMES;
+        snprintf(name, sizeof(name), "selConcurrent_%d:with:", i);
+        SEL sel = sel_registerName(name);
+        testassert(0 == strcmp(sel_getName(sel), name));
+        results[t][i] = sel;
+    }
+    return NULL;
+}
+
+static void *lookUpNames(void *arg __unused)
+{
+    char name[64];
+    for (int r = 0; r < HIT_ROUNDS; r++) {
+        for (int i = 0; i < NAMES; i++) {
+            snprintf(name, sizeof(name), "selConcurrent_%d:with:", i);
+            testassert(sel_registerName(name) == results[0][i]);
+        }
+    }
+    return NULL;
+}
+
+static uint64_t runThreads(void *(*fn)(void *))
+{
+    pthread_t threads[THREADS];
+    uint64_t start = mach_absolute_time();
+    for (int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, fn, (void *)(intptr_t)t);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    return mach_absolute_time() - start;
+}
+
+int main()
+{
+    uint64_t missTime = runThreads(&registerNames);
+
+    for (int i = 0; i < NAMES; i++) {
+        for (int t = 1; t < THREADS; t++) {
+            testassert(results[t][i] == results[0][i]);
+        }
+        testassert(sel_isMapped(results[0][i]));
+    }
+
+    // A copy of a registered name is not itself a selector.
+    char *copy = strdup(sel_getName(results[0][0]));
+    testassert(!sel_isMapped((SEL)copy));
+    testassert(sel_getUid(copy) == results[0][0]);
+    free(copy);
+
+    uint64_t hitTime = runThreads(&lookUpNames);
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    testprintf("%d threads: %.1f ns per new selector, %.1f ns per lookup\n", 
+               THREADS, 
+               (double)missTime * tb.numer / tb.denom / NAMES, 
+               (double)hitTime * tb.numer / tb.denom / 
+               ((double)NAMES * HIT_ROUNDS));
+
+    succeed(__FILE__);
+}
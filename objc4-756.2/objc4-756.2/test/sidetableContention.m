@@ -0,0 +1,104 @@
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DISABLE_NONPOINTER_ISA=YES
+
+// Many threads retain and release one shared object whose retain count 
+// lives in a side table. Some threads also release references retained 
+// by other threads. The object must be deallocated exactly once, after 
+// its last release, or after the autorelease pool pop that follows it.
+// Test sidetableContentionDeferred also uses this file, 
+// with OBJC_DEFER_SIDETABLE_RELEASES set.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/objc-internal.h>
+#include <pthread.h>
+#include <mach/mach_time.h>
+
+#if defined(__arm__)
+#define THREADS 4
+#define COUNT 1024*16
+#else
+#define THREADS 16
+#define COUNT 1024*64
+#endif
+#define EXTRA 100
+#define HANDOFF 1000
+
+static id shared;
+static atomic_int handedOff;
+
+static void *worker(void *arg)
+{
+    int t = (int)(intptr_t)arg;
+
+    for (int i = 0; i < COUNT; i++) {
+        objc_retain(shared);
+        objc_release(shared);
+        if (i % 1024 == 0) {
+            void *pool = objc_autoreleasePoolPush();
+            objc_autorelease(objc_retain(shared));
+            objc_autoreleasePoolPop(pool);
+        }
+    }
+
+    // Even threads retain; odd threads release those retains.
+    if (t % 2 == 0) {
+        for (int i = 0; i < HANDOFF; i++) {
+            objc_retain(shared);
+            atomic_fetch_add(&handedOff, 1);
+        }
+    } else {
+        for (int i = 0; i < HANDOFF; i++) {
+            while (atomic_load(&handedOff) == 0) sched_yield();
+            atomic_fetch_sub(&handedOff, 1);
+            objc_release(shared);
+        }
+    }
+
+    return NULL;
+}
+
+int main()
+{
+    testassert(THREADS % 2 == 0);
+
+    shared = [TestRoot new];
+    for (int i = 0; i < EXTRA; i++) {
+        objc_retain(shared);
+    }
+    testassert([shared retainCount] == 1 + EXTRA);
+
+    uint64_t start = mach_absolute_time();
+
+    pthread_t threads[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &worker, (void *)(intptr_t)t);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    uint64_t elapsed = mach_absolute_time() - start;
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    testprintf("%d threads x %d retain/release pairs: %llu us\n", 
+               THREADS, COUNT, 
+               (unsigned long long)(elapsed * tb.numer / tb.denom / 1000));
+
+    // Exiting threads applied their deferred releases.
+    testassert(atomic_load(&handedOff) == 0);
+    testassert([shared retainCount] == 1 + EXTRA);
+
+    // A release may be deferred until an autorelease pool is popped.
+    TestRootDealloc = 0;
+    void *pool = objc_autoreleasePoolPush();
+    for (int i = 0; i < EXTRA; i++) {
+        objc_release(shared);
+        testassert(TestRootDealloc == 0);
+    }
+    objc_release(shared);
+    objc_autoreleasePoolPop(pool);
+    testassert(TestRootDealloc == 1);
+
+    succeed(__FILE__);
+}
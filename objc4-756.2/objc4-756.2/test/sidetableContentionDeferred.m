@@ -0,0 +1,12 @@
+// Run test sidetableContention with deferred side table releases.
+
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DISABLE_NONPOINTER_ISA=YES OBJC_DEFER_SIDETABLE_RELEASES=YES
+
+/*
+TEST_RUN_OUTPUT
+OK: sidetableContention.m
+END
+*/
+
+#include "sidetableContention.m"
@@ -0,0 +1,52 @@
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_RECORD_STARTUP_TRACE=YES
+
+// The startup trace records image loading phases and +load calls.
+// Recording it alone prints nothing, so the run output is only "OK".
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/objc-internal.h>
+
+@interface Loader : TestRoot @end
+@implementation Loader
++(void)load {
+    usleep(2000);
+}
+@end
+
+@interface Loader (Cat) @end
+@implementation Loader (Cat)
++(void)load { }
+@end
+
+int main()
+{
+    char *json = _objc_copyStartupTraceJSON();
+    testassert(json);
+    testprintf("%s", json);
+
+    testassert(json[0] == '{');
+    testassert(strstr(json, "\"trace\": {\"pid\": "));
+    testassert(strstr(json, "\"images\": ["));
+    testassert(strstr(json, ", \"index\": 0, "));
+
+    // Nothing that changes between launches, other than the pid once.
+    testassert(!strstr(json, "\"header\""));
+    const char *pid = strstr(json, "\"pid\"");
+    testassert(!strstr(pid + 1, "\"pid\""));
+    testassert(strstr(json, "\"map_image\": {\"ns\": "));
+    testassert(strstr(json, "\"discover_classes\": {\"ns\": "));
+    testassert(strstr(json, "\"load_methods_called\": 2"));
+    testassert(strstr(json, "{\"class\": \"Loader\", \"category\": null, "));
+    testassert(strstr(json, "{\"class\": \"Loader\", \"category\": \"Cat\", "));
+
+    // The class +load slept for 2 ms.
+    const char *load = strstr(json, "\"category\": null, ");
+    const char *ns = strstr(load, ", \"ns\": ");
+    testassert(ns);
+    testassert(strtoull(ns + 8, NULL, 10) >= 2000000);
+
+    free(json);
+    succeed(__FILE__);
+}
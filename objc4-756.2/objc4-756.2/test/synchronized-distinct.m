@@ -0,0 +1,101 @@
+// TEST_CONFIG
+
+#include "test.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <objc/runtime.h>
+#include <objc/objc-sync.h>
+#include <mach/mach_time.h>
+#include <Foundation/NSObject.h>
+
+// synchronized stress test
+// Thousands of distinct objects, one thread per core and then some.
+// Each thread repeatedly locks a run of shared objects in ascending 
+// order, several at a time, and increments their counters. 
+// It also synchronizes on short-lived objects of its own, 
+// so locks are constantly handed to objects never seen before.
+
+#if defined(__arm__)
+#define OBJECTS 1024
+#define COUNT 1024
+#else
+#define OBJECTS 1024*4
+#define COUNT 1024*4
+#endif
+#define NEST 4
+#define MAXTHREADS 256
+
+static id objects[OBJECTS];
+static int counts[OBJECTS];
+
+
+static void *threadfn(void *arg)
+{
+    unsigned seed = (unsigned)(uintptr_t)arg;
+
+    for (int n = 0; n < COUNT; n++) {
+        // Lock NEST shared objects in ascending order to prevent deadlock.
+        int first = rand_r(&seed) % (OBJECTS - NEST);
+        for (int i = 0; i < NEST; i++) {
+            int err = objc_sync_enter(objects[first + i]);
+            testassert(err == OBJC_SYNC_SUCCESS);
+        }
+        for (int i = 0; i < NEST; i++) {
+            counts[first + i]++;
+        }
+        for (int i = NEST - 1; i >= 0; i--) {
+            int err = objc_sync_exit(objects[first + i]);
+            testassert(err == OBJC_SYNC_SUCCESS);
+        }
+
+        // Lock a short-lived object nobody else can see.
+        id obj = [[NSObject alloc] init];
+        testassert(objc_sync_enter(obj) == OBJC_SYNC_SUCCESS);
+        testassert(objc_sync_exit(obj) == OBJC_SYNC_SUCCESS);
+        testassert(objc_sync_exit(obj) == OBJC_SYNC_NOT_OWNING_THREAD_ERROR);
+        RELEASE_VAR(obj);
+    }
+
+    return NULL;
+}
+
+int main()
+{
+    pthread_t threads[MAXTHREADS];
+    int threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN) * 2;
+    if (threadCount > MAXTHREADS) threadCount = MAXTHREADS;
+    if (threadCount < 4) threadCount = 4;
+
+    for (int i = 0; i < OBJECTS; i++) {
+        objects[i] = [[NSObject alloc] init];
+    }
+
+    uint64_t start = mach_absolute_time();
+    for (int t = 0; t < threadCount; t++) {
+        pthread_create(&threads[t], NULL, &threadfn, (void*)(intptr_t)t);
+    }
+    for (int t = 0; t < threadCount; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    testprintf("%d threads x %d iterations over %d objects: %llu us\n", 
+               threadCount, COUNT, OBJECTS, 
+               (unsigned long long)((mach_absolute_time() - start) 
+                                    * tb.numer / tb.denom / 1000));
+
+    // Verify locks: all should be available
+    // Verify counts: they should add up to every increment
+    long total = 0;
+    for (int i = 0; i < OBJECTS; i++) {
+        testassert(objc_sync_enter(objects[i]) == OBJC_SYNC_SUCCESS);
+        total += counts[i];
+        testassert(objc_sync_exit(objects[i]) == OBJC_SYNC_SUCCESS);
+    }
+    testassert(total == (long)threadCount * COUNT * NEST);
+
+    succeed(__FILE__);
+}
@@ -6,6 +6,7 @@
 #include <pthread.h>
 #include <objc/runtime.h>
 #include <objc/objc-sync.h>
+#include <mach/mach_time.h>
 #include <Foundation/NSObject.h>
 
 // synchronized stress test
@@ -89,6 +90,7 @@ int main()
     }
 
     // Start the threads
+    uint64_t start = mach_absolute_time();
     for (t = 0; t < THREADS; t++) {
         pthread_create(&threads[t], NULL, &threadfn, (void*)(intptr_t)t);
     }
@@ -97,6 +99,12 @@ int main()
     for (t = 0; t < THREADS; t++) {
         pthread_join(threads[t], NULL);
     }
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    testprintf("%d threads x %d iterations: %llu us\n", THREADS, COUNT, 
+               (unsigned long long)((mach_absolute_time() - start) 
+                                    * tb.numer / tb.denom / 1000));
     
     // Verify locks: all should be available
     // Verify counts: all should be THREADS*COUNT
@@ -0,0 +1,85 @@
+// TEST_CONFIG MEM=mrc
+
+// An object with many weak references is deallocated while another 
+// thread stores a different object into some of those weak variables. 
+// Each stored variable must end up holding the other object, 
+// and every other variable must end up nil.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/objc-internal.h>
+#include <pthread.h>
+#include <mach/mach_time.h>
+
+#define VARCOUNT 10000
+#define STRIDE 7
+#define CYCLES 50
+
+static semaphore_t go;
+static semaphore_t done;
+
+static id target;
+static id other;
+static id *vars;
+
+static void *storer(void *arg __unused)
+{
+    while (1) {
+        semaphore_wait(go);
+        for (int i = 0; i < VARCOUNT; i += STRIDE) {
+            objc_storeWeak(&vars[i], other);
+        }
+        semaphore_signal(done);
+    }
+}
+
+static void *deallocator(void *arg __unused)
+{
+    while (1) {
+        semaphore_wait(go);
+        [target release];
+        semaphore_signal(done);
+    }
+}
+
+int main()
+{
+    semaphore_create(mach_task_self(), &go, 0, 0);
+    semaphore_create(mach_task_self(), &done, 0, 0);
+
+    vars = (id *)calloc(VARCOUNT, sizeof(id));
+    other = [NSObject new];
+
+    pthread_t th;
+    pthread_create(&th, NULL, storer, NULL);
+    pthread_create(&th, NULL, deallocator, NULL);
+
+    uint64_t elapsed = 0;
+    for (int c = 0; c < CYCLES; c++) {
+        target = [NSObject new];
+        for (int i = 0; i < VARCOUNT; i++) {
+            objc_initWeak(&vars[i], target);
+        }
+
+        uint64_t start = mach_absolute_time();
+        semaphore_signal(go);
+        semaphore_signal(go);
+        semaphore_wait(done);
+        semaphore_wait(done);
+        elapsed += mach_absolute_time() - start;
+
+        for (int i = 0; i < VARCOUNT; i++) {
+            if (i % STRIDE == 0) testassert(vars[i] == other);
+            else testassert(vars[i] == nil);
+            objc_destroyWeak(&vars[i]);
+            vars[i] = nil;
+        }
+    }
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    testprintf("%d cycles of %d weak clears: %llu us\n", CYCLES, VARCOUNT, 
+               (unsigned long long)(elapsed * tb.numer / tb.denom / 1000));
+
+    succeed(__FILE__);
+}
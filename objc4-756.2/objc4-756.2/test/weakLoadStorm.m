@@ -0,0 +1,109 @@
+// TEST_CONFIG MEM=mrc
+
+// Many threads load one weak variable while another thread repeatedly 
+// stores a new object into it and deallocates the old one. Every load 
+// must return nil or a live object, never a deallocating or freed one.
+// Test weakLoadStormLocked also uses this file, 
+// with OBJC_DISABLE_LOCKFREE_WEAK_LOADS set.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/objc-internal.h>
+#include <pthread.h>
+#include <mach/mach_time.h>
+
+#if defined(__arm__)
+#define THREADS 4
+#define LOADS 1024*16
+#define STORES 1024
+#else
+#define THREADS 16
+#define LOADS 1024*64
+#define STORES 1024*4
+#endif
+
+#define ALIVE 0x600DF00D
+#define DEAD  0xDEADDEAD
+
+@interface Referent : TestRoot {
+  @public
+    uintptr_t state;
+}
+@end
+@implementation Referent
+-(void)dealloc {
+    testassert(state == ALIVE);
+    state = DEAD;
+    [super dealloc];
+}
+@end
+
+static id weakVar;
+static atomic_int done;
+static atomic_long nilLoads;
+
+static void *loader(void *arg __unused)
+{
+    for (int i = 0; i < LOADS; i++) {
+        Referent *obj = objc_loadWeakRetained(&weakVar);
+        if (obj) {
+            testassert(obj->state == ALIVE);
+            objc_release(obj);
+        } else {
+            atomic_fetch_add(&nilLoads, 1);
+        }
+    }
+    return NULL;
+}
+
+static void *storer(void *arg __unused)
+{
+    for (int i = 0; i < STORES  ||  !atomic_load(&done); i++) {
+        Referent *obj = [Referent new];
+        obj->state = ALIVE;
+        objc_storeWeak(&weakVar, obj);
+        if (i % 8 == 0) objc_storeWeak(&weakVar, nil);
+        [obj release];  // clears weakVar if it still points to obj
+    }
+    return NULL;
+}
+
+int main()
+{
+    Referent *first = [Referent new];
+    first->state = ALIVE;
+    objc_initWeak(&weakVar, first);
+
+    pthread_t store;
+    pthread_create(&store, NULL, &storer, NULL);
+
+    uint64_t start = mach_absolute_time();
+
+    pthread_t threads[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &loader, NULL);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    uint64_t elapsed = mach_absolute_time() - start;
+
+    atomic_store(&done, 1);
+    pthread_join(store, NULL);
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    testprintf("%d threads x %d weak loads: %llu us (%ld nil)\n", 
+               THREADS, LOADS, 
+               (unsigned long long)(elapsed * tb.numer / tb.denom / 1000), 
+               (long)atomic_load(&nilLoads));
+
+    TestRootDealloc = 0;
+    [first release];
+    testassert(TestRootDealloc == 1);
+    testassert(objc_loadWeakRetained(&weakVar) == nil);
+    objc_destroyWeak(&weakVar);
+
+    succeed(__FILE__);
+}
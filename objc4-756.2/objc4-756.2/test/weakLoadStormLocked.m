@@ -0,0 +1,12 @@
+// Run test weakLoadStorm with weak loads under the side table lock.
+
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DISABLE_LOCKFREE_WEAK_LOADS=YES
+
+/*
+TEST_RUN_OUTPUT
+OK: weakLoadStorm.m
+END
+*/
+
+#include "weakLoadStorm.m"